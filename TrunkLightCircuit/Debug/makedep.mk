@@ -12,3 +12,15 @@ main.c
 
 StatusLED.c
 
+blackbox.c
+
+log.c
+
+shell.c
+
+telemetry.c
+
+config.c
+
+sw_timers.c
+
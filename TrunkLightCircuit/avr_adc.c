@@ -8,6 +8,21 @@
 #include "avr_adc.h"
 #include <avr/io.h>
 #include "avr_uart.h"
+#include <util/atomic.h>
+
+static const sADCScanChannel* scan_table = 0;
+static uint8_t scan_num_channels = 0;
+static uint8_t scan_idx;                                  ///channel currently being converted
+static uint8_t scan_walk_idx;                             ///last channel picked by the normal walk
+static uint8_t scan_priority = ADC_SCAN_NO_PRIORITY;      ///converted after every other conversion
+static eADCReference scan_ref;                            ///reference currently selected
+static bool scan_discard;                                 ///next conversion is thrown away
+//oversampling is kept per channel so the priority channel can cut in between oversamples
+static uint16_t scan_accum[ADC_SCAN_MAX_CHANNELS];
+static uint8_t scan_accum_count[ADC_SCAN_MAX_CHANNELS];
+static uint8_t scan_countdown[ADC_SCAN_MAX_CHANNELS];     ///passes left till the channel is due
+static volatile uint16_t scan_ring[ADC_SCAN_MAX_CHANNELS][ADC_SCAN_RING_LEN];
+static volatile uint8_t scan_ring_idx[ADC_SCAN_MAX_CHANNELS];   ///next slot to write
 
 void adc_reset(void)
 {
@@ -91,25 +106,6 @@ void adc_right_shift_result(void)
     BIT_CLEAR(ADMUX, ADLAR);
 }
 
-void adc_select_ref(eADCReference value)
-{
-    if (value == AREF_default)
-    {
-        BIT_CLEAR(ADMUX, REFS1);
-        BIT_CLEAR(ADMUX, REFS0);
-    }
-    else if (value == AVcc)
-    {
-        BIT_CLEAR(ADMUX, REFS1);
-        BIT_SET(ADMUX  , REFS0);
-    }
-    else if (value == Internal_2p56V)
-    {
-        BIT_SET(ADMUX  , REFS1);
-        BIT_SET(ADMUX  , REFS0);
-    }
-}
-
 bool adc_start_conversion(bool block_till_complete)
 {
     //if the adc is not enabled return false
@@ -158,48 +154,222 @@ uint16_t adc_read10_value(void)
     return ret_val;
 }
 
-void adc_set_prescale(eADCPrescaleValues value)
+/** Private function, selects the input and reference of a scan table entry. 
+ *  If the reference changes, the next conversion is marked to be thrown away
+ */
+void _adc_scan_select(uint8_t idx)
+{
+    adc_select_input_channel(scan_table[idx].input);
+    
+    if (scan_table[idx].ref != scan_ref)
+    {
+        //from the datasheet the first reading after changing reference may be inaccurate
+        scan_ref = scan_table[idx].ref;
+        adc_select_ref(scan_ref);
+        scan_discard = true;
+    }
+    
+    scan_idx = idx;
+}
+
+/** Private function, picks the channel to convert after done_idx.
+ *  - the priority channel (if any) goes after every other conversion
+ *  - a channel that is part way through its oversamples continues
+ *  - otherwise the walk moves on to the next due channel, channels with a divider are
+ *    skipped until their countdown runs out
+ */
+uint8_t _adc_scan_next(uint8_t done_idx)
+{
+    uint8_t idx;
+    
+    if ((scan_priority != ADC_SCAN_NO_PRIORITY) && (done_idx != scan_priority))
+    {
+        return scan_priority;
+    }
+    
+    if (scan_accum_count[scan_walk_idx] != 0)
+    {
+        return scan_walk_idx;
+    }
+    
+    idx = scan_walk_idx;
+    while (1)
+    {
+        idx++;
+        if (idx >= scan_num_channels)
+        {
+            idx = 0;
+        }
+        
+        //the priority channel already gets every other conversion
+        if ((scan_table[idx].divider != 0) && (idx != scan_priority))
+        {
+            if (scan_countdown[idx] <= 1)
+            {
+                scan_countdown[idx] = scan_table[idx].divider;
+                scan_walk_idx = idx;
+                return idx;
+            }
+            
+            scan_countdown[idx]--;
+        }
+    }
+}
+
+void adc_scan_init(const sADCScanChannel* channels, uint8_t num_channels)
+{
+    uint8_t ii;
+    uint8_t jj;
+    
+    if (num_channels > ADC_SCAN_MAX_CHANNELS)
+    {
+        num_channels = ADC_SCAN_MAX_CHANNELS;
+    }
+    
+    scan_table = channels;
+    scan_num_channels = num_channels;
+    
+    for (ii = 0; ii < num_channels; ii++)
+    {
+        //the first pass counts too, so divider n channels are first read on pass n
+        scan_countdown[ii] = channels[ii].divider;
+        scan_ring_idx[ii] = 0;
+        scan_accum[ii] = 0;
+        scan_accum_count[ii] = 0;
+        
+        for (jj = 0; jj < ADC_SCAN_RING_LEN; jj++)
+        {
+            scan_ring[ii][jj] = 0;
+        }
+    }
+}
+
+void adc_scan_start(void)
 {
-    if (value == clk_over_2_default)
+    uint8_t ii;
+    
+    for (ii = 0; ii < scan_num_channels; ii++)
     {
-        BIT_CLEAR(ADCSRA, ADPS2);
-        BIT_CLEAR(ADCSRA, ADPS1); 
-        BIT_CLEAR(ADCSRA, ADPS0);
+        scan_accum[ii] = 0;
+        scan_accum_count[ii] = 0;
     }
-    else if (value == clk_over_4)
+    
+    //start on the entry before 0 so the first due channel is found the normal way
+    //(this also makes sure a divider 0 entry at the start is skipped)
+    scan_walk_idx = scan_num_channels - 1;
+    
+    //force the reference to be written and the first conversion to be dropped
+    scan_ref = (eADCReference)0xFF;
+    _adc_scan_select(_adc_scan_next(scan_walk_idx));
+    
+    adc_start_conversion(false);
+}
+
+void adc_scan_isr(void)
+{
+    uint16_t value;
+    uint8_t done_idx;
+    const sADCScanChannel* channel;
+    
+    value = adc_read10_value();
+    channel = &scan_table[scan_idx];
+    
+    if (scan_discard)
     {
-        BIT_CLEAR(ADCSRA, ADPS2);
-        BIT_SET(ADCSRA  , ADPS1);
-        BIT_CLEAR(ADCSRA, ADPS0);
+        //reading after a reference switch, convert the same channel again
+        scan_discard = false;
+        adc_start_conversion(false);
+        return;
     }
-    else if (value == clk_over_8)
+    
+    done_idx = scan_idx;
+    scan_accum[done_idx] += value;
+    scan_accum_count[done_idx]++;
+    
+    if (scan_accum_count[done_idx] < (1 << channel->oversample_shift))
     {
-        BIT_CLEAR(ADCSRA, ADPS2);
-        BIT_SET(ADCSRA  , ADPS1);
-        BIT_SET(ADCSRA  , ADPS0);
+        //not a full sample yet, the priority channel may still cut in before the next one
+        _adc_scan_select(_adc_scan_next(done_idx));
+        adc_start_conversion(false);
+        return;
     }
-    else if (value == clk_over_16)
+    
+    value = scan_accum[done_idx] >> channel->oversample_shift;
+    scan_accum[done_idx] = 0;
+    scan_accum_count[done_idx] = 0;
+    
+    scan_ring[done_idx][scan_ring_idx[done_idx]] = value;
+    scan_ring_idx[done_idx] = (scan_ring_idx[done_idx] + 1) & (ADC_SCAN_RING_LEN - 1);
+    
+    //switch the input and start the next conversion before the callback, so the callback
+    //runs while the adc is already working
+    _adc_scan_select(_adc_scan_next(done_idx));
+    adc_start_conversion(false);
+    
+    if (channel->callback != 0)
     {
-        BIT_SET(ADCSRA  , ADPS2);
-        BIT_CLEAR(ADCSRA, ADPS1);
-        BIT_CLEAR(ADCSRA, ADPS0);
+        channel->callback(done_idx, value);
     }
-    else if (value == clk_over_32)
+}
+
+bool adc_scan_set_priority(uint8_t idx)
+{
+    uint8_t ii;
+    bool other_channel = false;
+    
+    if (idx != ADC_SCAN_NO_PRIORITY)
     {
-        BIT_SET(ADCSRA  , ADPS2);
-        BIT_CLEAR(ADCSRA, ADPS1);
-        BIT_SET(ADCSRA  , ADPS0);
+        if (idx >= scan_num_channels)
+        {
+            return false;
+        }
+        
+        //the walk skips the priority channel, so something else has to be left to walk
+        for (ii = 0; ii < scan_num_channels; ii++)
+        {
+            if ((ii != idx) && (scan_table[ii].divider != 0))
+            {
+                other_channel = true;
+            }
+        }
+        
+        if (other_channel == false)
+        {
+            return false;
+        }
     }
-    else if (value == clk_over_64)
+    
+    //single byte write, picked up by the next conversion
+    scan_priority = idx;
+    return true;
+}
+
+uint16_t adc_scan_get_latest(uint8_t idx)
+{
+    uint16_t ret_val;
+    
+    //16 bit value written by the adc interrupt, so it must be read atomically
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        BIT_SET(ADCSRA  , ADPS2);
-        BIT_SET(ADCSRA  , ADPS1);
-        BIT_CLEAR(ADCSRA, ADPS0);
+        ret_val = scan_ring[idx][(scan_ring_idx[idx] - 1) & (ADC_SCAN_RING_LEN - 1)];
     }
-    else if (value == clk_over_128)
+    
+    return ret_val;
+}
+
+uint16_t adc_scan_get_average(uint8_t idx)
+{
+    uint16_t sum = 0;
+    uint8_t ii;
+    
+    //the samples are only 10 bits, so the sum of a few always fits in 16 bits
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        BIT_SET(ADCSRA  , ADPS2);
-        BIT_SET(ADCSRA  , ADPS1);
-        BIT_SET(ADCSRA  , ADPS0);
+        for (ii = 0; ii < ADC_SCAN_RING_LEN; ii++)
+        {
+            sum += scan_ring[idx][ii];
+        }
     }
-}
\ No newline at end of file
+    
+    return (sum >> ADC_SCAN_RING_SHIFT);
+}
@@ -101,12 +101,19 @@ void adc_left_shift_result(void);
     */
 void adc_right_shift_result(void);
 
+#define ADC_REF_MASK        ((1 << REFS1) | (1 << REFS0))
+#define ADC_PRESCALE_MASK   ((1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0))
+
 /** selects the adc reference voltage
  *  @PARAM value the ADC reference to be used
  *  @NOTE from datasheet: the first reading after changing reference may 
  *  be accurate
+ *  @NOTE the enum values are the REFS1:0 bits, so this is a single masked write
  */
-void adc_select_ref(eADCReference value);
+static inline void adc_select_ref(eADCReference value)
+{
+    ADMUX = (ADMUX & ~ADC_REF_MASK) | (value & ADC_REF_MASK);
+}
 
 /** 
  Starts a single adc conversion
@@ -147,7 +154,77 @@ uint16_t adc_read10_value(void);
  Sets the prescaler bits for the ADC  
  @PARAM value - the system clock prescaler to use for the ADC clock
  @RETURN n/a
+ @NOTE the enum values are the ADPS2:0 bits, so this is a single masked write. ADIF is
+ cleared by writing a 1 to it, so it is written as 0 to not lose a pending conversion
+ */
+static inline void adc_set_prescale(eADCPrescaleValues value)
+{
+    ADCSRA = (ADCSRA & ~(ADC_PRESCALE_MASK | (1 << ADIF))) | (value & ADC_PRESCALE_MASK);
+}
+
+/************************************************************************/
+/* SCAN ENGINE                                                          */
+/************************************************************************/
+/** The scan engine walks a table of channels from the ADC interrupt. Every channel has 
+ *  its own reference, oversampling and callback, finished samples are stored in a small
+ *  ring per channel so the main code can read averaged values without touching the ADC.
+ *  Adding a channel is adding a table entry.
+ */
+///maximum number of entries in a scan table
+#define ADC_SCAN_MAX_CHANNELS   5
+///finished samples kept per channel is 2^ADC_SCAN_RING_SHIFT, used by adc_scan_get_average
+#define ADC_SCAN_RING_SHIFT     2
+#define ADC_SCAN_RING_LEN       (1 << ADC_SCAN_RING_SHIFT)
+///adc_scan_set_priority value for no priority channel
+#define ADC_SCAN_NO_PRIORITY    0xFF
+
+/** called with every finished sample of a channel
+ *  @PARAM idx - index of the channel in the scan table
+ *  @PARAM value - the sample (average of the oversampled conversions)
+ *  @NOTE this is called from inside the ADC interrupt, keep it short
+ */
+typedef void (*adc_scan_callback)(uint8_t idx, uint16_t value);
+
+typedef struct _sADCScanChannel
+{
+    eADCInput         input;
+    eADCReference     ref;
+    uint8_t           oversample_shift; /// 2^n conversions are averaged into one sample, 0 = none
+    uint8_t           divider;          /// converted once every n passes over the table,
+                                        /// 1 = every pass, 0 = channel is skipped
+    adc_scan_callback callback;         /// optional, NULL for none
+}sADCScanChannel;
+
+/** sets the scan table. This does not start anything, see adc_scan_start
+ *  @PARAM channels - the scan table, it is used in place so it must stay valid
+ *  @PARAM num_channels - number of entries, at most ADC_SCAN_MAX_CHANNELS
+ *  @NOTE at least one channel must have a non zero divider
+ */
+void adc_scan_init(const sADCScanChannel* channels, uint8_t num_channels);
+
+/** selects the first channel of the table and starts converting. The ADC must already be
+ *  enabled with the conversion interrupt on, and ISR(ADC_vect) must call adc_scan_isr
+ */
+void adc_scan_start(void);
+
+/** runs the scan engine, call this from ISR(ADC_vect) */
+void adc_scan_isr(void);
+
+/** Gives one channel every other conversion (priority, walk, priority, walk...), e.g. the
+ *  feedback channel of an output that just switched on. Its samples are then never more
+ *  than one conversion apart, oversampling of the other channels included.
+ *  @PARAM idx - scan table index, or ADC_SCAN_NO_PRIORITY to go back to a plain walk
+ *  @RETURN false if idx is out of range or it is the only channel that can be converted
+ *  @NOTE the priority channel should not be oversampled, it skips its normal walk turn
+ */
+bool adc_scan_set_priority(uint8_t idx);
+
+/** @RETURN the most recent sample of a channel in the scan table */
+uint16_t adc_scan_get_latest(uint8_t idx);
+
+/** @RETURN the average of the last ADC_SCAN_RING_LEN samples of a channel in the scan table
+ *  @NOTE this never waits on the ADC, it only reads the stored samples
  */
-void adc_set_prescale(eADCPrescaleValues value);
+uint16_t adc_scan_get_average(uint8_t idx);
 
 #endif /* AVR_ADC_H_ */
\ No newline at end of file
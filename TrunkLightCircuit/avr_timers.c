@@ -1,7 +1,90 @@
 #include "global.h"
 #include "avr_timers.h"
+#include <avr/pgmspace.h>
 
-#define ONE_PERCENT_OF_8_BIT (255.0 / 100.0)
+//0-100 -> 0-255 without float, gives the same result as the old (255.0 / 100.0) * value
+//for every value 0-100. Needs 32 bit, 100 * 5223 doesn't fit 16
+#define PERCENT_TO_8_BIT(value) ((uint8_t)(((uint32_t)(value) * 5223UL) >> 11))
+
+//perceptual brightness -> pwm value. Brightness looks roughly like duty^(1/2.2), the
+//x^2.2 curve is approximated by 0.75x^2 + 0.25x^3 (x = 0-1) so the whole table is integer
+//math the compiler does. Non zero brightness always gets at least one pwm count
+#define _PWM_GAMMA_POLY(x)  ((3UL * 255UL * (x) * (x) + (uint32_t)(x) * (x) * (x) + 2UL * 255UL * 255UL) \
+                             / (4UL * 255UL * 255UL))
+#define _PWM_GAMMA(x)       ((uint8_t)(((x) == 0) ? 0 : ((_PWM_GAMMA_POLY(x) == 0) ? 1 : _PWM_GAMMA_POLY(x))))
+#define _PG_LUT_4(n)        _PWM_GAMMA(n), _PWM_GAMMA((n) + 1), _PWM_GAMMA((n) + 2), _PWM_GAMMA((n) + 3)
+#define _PG_LUT_16(n)       _PG_LUT_4(n),  _PG_LUT_4((n) + 4),  _PG_LUT_4((n) + 8),   _PG_LUT_4((n) + 12)
+#define _PG_LUT_64(n)       _PG_LUT_16(n), _PG_LUT_16((n) + 16), _PG_LUT_16((n) + 32), _PG_LUT_16((n) + 48)
+#define _PG_LUT_256(n)      _PG_LUT_64(n), _PG_LUT_64((n) + 64), _PG_LUT_64((n) + 128), _PG_LUT_64((n) + 192)
+
+/// one entry per brightness value, read with pgm_read_byte
+static const uint8_t arr_pwm_gamma[256] PROGMEM = { _PG_LUT_256(0) };
+
+//run time descriptors, built from the register description macros in avr_timers.h
+typedef struct _sTimerDescriptor
+{
+    volatile uint8_t* cs_reg;                               /// register with the CS bits
+    uint8_t toie_mask;                                      /// overflow interrupt bit in TIMSK
+    uint8_t cs_bits[TIMER_NUM_PRESCALE_VALUES];             /// TIMER_CS_BITS per prescale value
+}sTimerDescriptor;
+
+#define _TIMER_DESC(t, reg) { &(reg), TIMER_TOIE_BIT(t), \
+    { TIMER_CS_BITS(t, 0), TIMER_CS_BITS(t, 1), TIMER_CS_BITS(t, 2), TIMER_CS_BITS(t, 3), TIMER_CS_BITS(t, 4), \
+      TIMER_CS_BITS(t, 5), TIMER_CS_BITS(t, 6), TIMER_CS_BITS(t, 7), TIMER_CS_BITS(t, 8), TIMER_CS_BITS(t, 9) } }
+
+/// indexed by eTIMER
+static const sTimerDescriptor arr_timer_desc[3] PROGMEM =
+{
+    _TIMER_DESC(etimer_0, TCCR0),
+    _TIMER_DESC(etimer_1, TCCR1B),
+    _TIMER_DESC(etimer_2, TCCR2),
+};
+
+typedef struct _sPWMDescriptor
+{
+    volatile uint8_t* com_reg;  /// register with the COM bits
+    uint8_t com_mask;
+    uint8_t com_on;
+    uint8_t ddr_mask;           /// pin in DDRB
+    volatile void* ocr;         /// compare register
+    bool ocr_16_bit;
+}sPWMDescriptor;
+
+#define _PWM_DESC(o, com_reg, ocr, ocr_16_bit) { &(com_reg), PWM_COM_MASK(o), PWM_COM_ON(o), \
+    PWM_DDR_MASK(o), &(ocr), ocr_16_bit }
+
+/// indexed by ePWM_OUTPUT
+static const sPWMDescriptor arr_pwm_desc[3] PROGMEM =
+{
+    _PWM_DESC(epwm_1a, TCCR1A, OCR1A, true),
+    _PWM_DESC(epwm_1b, TCCR1A, OCR1B, true),
+    _PWM_DESC(epwm_2 , TCCR2 , OCR2 , false),
+};
+
+//prescalers setPWMCarrier tries, smallest first. The ones a timer can't do are skipped
+//using the clock select table above
+typedef struct _sPrescaleDivisor
+{
+    eTimerPrescaleValues prescale;
+    uint16_t divisor;
+}sPrescaleDivisor;
+
+static const sPrescaleDivisor arr_pwm_prescale[] PROGMEM =
+{
+    { tmr_prscl_clk_over_1,                1 },
+    { tmr_prscl_clk_over_8,                8 },
+    { tmr_prscl_clk_over_32_timer2_only,   32 },
+    { tmr_prscl_clk_over_64,               64 },
+    { tmr_prscl_clk_over_128_timer2_only,  128 },
+    { tmr_prscl_clk_over_256,              256 },
+    { tmr_prscl_clk_over_1024,             1024 },
+};
+
+#define PWM_NUM_PRESCALE    (sizeof(arr_pwm_prescale) / sizeof(arr_pwm_prescale[0]))
+
+uint16_t gu16_TIMER1_PWM_TOP = 0xFF;
+uint8_t gu8_TIMER1_PWM_SCALE_HI = 0x01;
+uint8_t gu8_TIMER1_PWM_SCALE_LO = 0x00;
 
 
 void timers_default(void)
@@ -44,6 +127,12 @@ void timer1_default(void)
     //compare value 16 bit registers
     OCR1A = 0x0000;
     OCR1B = 0x0000;
+    ICR1  = 0x0000;
+    
+    //back to the 8 bit TOP until setPWMCarrier picks a mode
+    gu16_TIMER1_PWM_TOP = 0xFF;
+    gu8_TIMER1_PWM_SCALE_HI = 0x01;
+    gu8_TIMER1_PWM_SCALE_LO = 0x00;
 }
 
 void timer2_default(void)
@@ -65,318 +154,249 @@ void timer2_default(void)
     OCR2 = 0x00;
 }
 
-bool SetTimerPrescale(eTIMER timer, eTimerPrescaleValues value)
+bool _SetTimerPrescale(eTIMER timer, eTimerPrescaleValues value)
 {
-    bool ret_value = true;
+    bool ret_value = false;
+    uint8_t cs_bits = TIMER_CS_INVALID;
+    volatile uint8_t* cs_reg;
 
-    if (timer == etimer_0)
+    if (timer <= etimer_2)
     {
-        //clear all bits/none to known state
-        BIT_CLEAR(TCCR0, CS12);
-        BIT_CLEAR(TCCR0, CS11);
-        BIT_CLEAR(TCCR0, CS10);
-
-        if (value == tmr_prscl_disabled_default)
-        {
-            //dont do anything all bits are clear already
-        }
-        else if (value == tmr_prscl_clk_over_1)
-        {
-            BIT_SET(TCCR0, CS10);
-        }
-        else if (value == tmr_prscl_clk_over_8)
-        {
-            BIT_SET(TCCR0, CS11);
-        }
-        else if (value == tmr_prscl_clk_over_64)
-        {
-            BIT_SET(TCCR0, CS11);
-            BIT_SET(TCCR0, CS10);
-        }
-        else if (value == tmr_prscl_clk_over_256)
-        {
-            BIT_SET(TCCR0, CS12);
-        }
-        else if (value == tmr_prscl_clk_over_1024)
-        {
-            BIT_SET(TCCR0, CS12);
-            BIT_SET(TCCR0, CS10);
-        }
-        else if (value == tmr_prscl_ext_tn_pin_falling_edge_timers_01_only)
+        cs_reg = pgm_read_ptr(&arr_timer_desc[timer].cs_reg);
+        
+        if (value < TIMER_NUM_PRESCALE_VALUES)
         {
-            //this is T0 pin for timer 0
-            BIT_SET(TCCR0, CS12);
-            BIT_SET(TCCR0, CS11);
+            cs_bits = pgm_read_byte(&arr_timer_desc[timer].cs_bits[value]);
         }
-        else if (value == tmr_prscl_ext_tn_pin_rising_edge_timers_01_only)
+        
+        if (cs_bits == TIMER_CS_INVALID)
         {
-            //this is T0 pin for timer 0
-            BIT_SET(TCCR0, CS12);
-            BIT_SET(TCCR0, CS11);
-            BIT_SET(TCCR0, CS10);
+            //timer is left stopped
+            *cs_reg &= ~TIMER_CS_MASK;
         }
         else
         {
-            ret_value = false;
+            *cs_reg = (*cs_reg & ~TIMER_CS_MASK) | cs_bits;
+            ret_value = true;
         }
     }
-    else if (timer == etimer_1)
-    {
-        //clear all bits/none to known state
-        BIT_CLEAR(TCCR1B, CS12);
-        BIT_CLEAR(TCCR1B, CS11);
-        BIT_CLEAR(TCCR1B, CS10);
 
-        if (value == tmr_prscl_disabled_default)
-        {
-            //dont do anything all bits are clear already
-        }
-        else if (value == tmr_prscl_clk_over_1)
-        {
-            BIT_SET(TCCR1B, CS10);
-        }
-        else if (value == tmr_prscl_clk_over_8)
-        {
-            BIT_SET(TCCR1B, CS11);
-        }
-        else if (value == tmr_prscl_clk_over_64)
-        {
-            BIT_SET(TCCR1B, CS11);
-            BIT_SET(TCCR1B, CS10);
-        }
-        else if (value == tmr_prscl_clk_over_256)
-        {
-            BIT_SET(TCCR1B, CS12);
-        }
-        else if (value == tmr_prscl_clk_over_1024)
-        {
-            BIT_SET(TCCR1B, CS12);
-            BIT_SET(TCCR1B, CS10);
-        }
-        else if (value == tmr_prscl_ext_tn_pin_falling_edge_timers_01_only)
+    return ret_value;
+}
+
+uint16_t setPWMCarrier(eTIMER timer, ePWM_MODE mode, uint16_t freq_hz)
+{
+    uint16_t ret_value = 0;
+    bool icr1 = (mode == epwm_mode_fast_icr1) || (mode == epwm_mode_phase_correct_icr1);
+    bool phase_correct = (mode == epwm_mode_phase_correct_8bit) || (mode == epwm_mode_phase_correct_icr1);
+    uint8_t cs_bits = TIMER_CS_INVALID;
+    uint8_t wgm1a, wgm1b;
+    uint16_t top = 0xFF;
+    uint32_t clocks;            /// cpu clocks per timer count, phase correct counts up and down
+    uint32_t counts;            /// timer counts per period: TOP + 1 fast, TOP phase correct
+    uint32_t freq;
+    uint32_t err;
+    uint32_t best_err = UINT32_MAX;
+    uint8_t i;
+    
+    //timer0 has no pwm, timer2 can't count to ICR1. Those stay at TIMER_CS_INVALID
+    bool valid = (freq_hz != 0) && (mode <= epwm_mode_phase_correct_icr1) &&
+                 ((timer == etimer_1) || ((timer == etimer_2) && !icr1));
+    
+    for (i = 0; valid && (i < PWM_NUM_PRESCALE); i++)
+    {
+        eTimerPrescaleValues prescale = pgm_read_byte(&arr_pwm_prescale[i].prescale);
+        uint8_t bits = pgm_read_byte(&arr_timer_desc[timer].cs_bits[prescale]);
+        
+        if (bits == TIMER_CS_INVALID)
         {
-            //this is T1 pin for timer 1
-            BIT_SET(TCCR1B, CS12);
-            BIT_SET(TCCR1B, CS11);
+            continue;
         }
-        else if (value == tmr_prscl_ext_tn_pin_rising_edge_timers_01_only)
+        
+        clocks = (uint32_t)pgm_read_word(&arr_pwm_prescale[i].divisor) << (phase_correct ? 1 : 0);
+        
+        if (icr1)
         {
-            //this is T1 pin for timer 1
-            BIT_SET(TCCR1B, CS12);
-            BIT_SET(TCCR1B, CS11);
-            BIT_SET(TCCR1B, CS10);
+            //TOP only gets smaller with bigger prescalers, the first one that fits has the
+            //most resolution. Below 255 setPWMVal would lose steps so that's a fail
+            counts = F_CPU / (clocks * freq_hz);
+            
+            if (counts < (phase_correct ? 0xFFUL : 0x100UL))
+            {
+                break;
+            }
+            
+            if (counts <= (phase_correct ? PWM_TIMER1_TOP_MAX : PWM_TIMER1_TOP_MAX + 1UL))
+            {
+                top = phase_correct ? counts : counts - 1;
+                cs_bits = bits;
+                ret_value = F_CPU / (clocks * counts);
+                break;
+            }
         }
         else
         {
-            ret_value = false;
+            //fixed TOP, closest frequency wins
+            counts = phase_correct ? 0xFFUL : 0x100UL;
+            freq = F_CPU / (clocks * counts);
+            err = (freq > freq_hz) ? (freq - freq_hz) : (freq_hz - freq);
+            
+            if (err < best_err)
+            {
+                best_err = err;
+                cs_bits = bits;
+                ret_value = freq;
+            }
         }
     }
-    else if (timer == etimer_2)
+    
+    if (cs_bits == TIMER_CS_INVALID)
     {
-        //clear all bits/none to known state
-        BIT_CLEAR(TCCR2, CS12);
-        BIT_CLEAR(TCCR2, CS11);
-        BIT_CLEAR(TCCR2, CS10);
-
-        if (value == tmr_prscl_disabled_default)
-        {
-            //dont do anything all bits are clear already
-        }
-        else if (value == tmr_prscl_clk_over_1)
-        {
-            BIT_SET(TCCR2, CS10);
-        }
-        else if (value == tmr_prscl_clk_over_8)
-        {
-            BIT_SET(TCCR2, CS11);
-        }
-        else if (value == tmr_prscl_clk_over_32_timer2_only)
-        {
-            BIT_SET(TCCR2, CS11);
-            BIT_SET(TCCR2, CS10);
-        }
-        else if (value == tmr_prscl_clk_over_64)
-        {
-            BIT_SET(TCCR2, CS12);
-        }
-        else if (value == tmr_prscl_clk_over_128_timer2_only)
-        {
-            BIT_SET(TCCR2, CS12);
-            BIT_SET(TCCR2, CS10);
-        }
-        else if (value == tmr_prscl_clk_over_256)
-        {
-            //this is T1 pin for timer 1
-            BIT_SET(TCCR2, CS12);
-            BIT_SET(TCCR2, CS11);
-        }
-        else if (value == tmr_prscl_clk_over_1024)
+        //timer is left stopped
+        _SetTimerPrescale(timer, tmr_prscl_disabled_default);
+        ret_value = 0;
+    }
+    else if (timer == etimer_1)
+    {
+        switch (mode)
         {
-            //this is T1 pin for timer 1
-            BIT_SET(TCCR2, CS12);
-            BIT_SET(TCCR2, CS11);
-            BIT_SET(TCCR2, CS10);
+            case epwm_mode_phase_correct_8bit:
+                wgm1a = (1 << WGM10);
+                wgm1b = 0;
+                break;
+            case epwm_mode_fast_icr1:
+                wgm1a = (1 << WGM11);
+                wgm1b = (1 << WGM13) | (1 << WGM12);
+                break;
+            case epwm_mode_phase_correct_icr1:
+                wgm1a = (1 << WGM11);
+                wgm1b = (1 << WGM13);
+                break;
+            case epwm_mode_fast_8bit_default:
+            default:
+                wgm1a = (1 << WGM10);
+                wgm1b = (1 << WGM12);
+                break;
         }
-        else
+        
+        //stop the counter while TOP moves so it can't be left above the new TOP
+        TCCR1B &= ~TIMER_CS_MASK;
+        TCNT1 = 0;
+        
+        if (icr1)
         {
-            ret_value = false;
+            ICR1 = top;
         }
+        
+        //TOP + 1 fits 16 bits, top is at most PWM_TIMER1_TOP_MAX
+        gu16_TIMER1_PWM_TOP = top;
+        gu8_TIMER1_PWM_SCALE_HI = (uint8_t)((top + 1) >> 8);
+        gu8_TIMER1_PWM_SCALE_LO = (uint8_t)(top + 1);
+        TCCR1A = (TCCR1A & ~PWM_WGM1A_MASK) | wgm1a;
+        TCCR1B = (TCCR1B & ~(PWM_WGM1B_MASK | TIMER_CS_MASK)) | wgm1b | cs_bits;
     }
-
+    else
+    {
+        TCCR2 = (TCCR2 & ~(PWM_WGM2_MASK | TIMER_CS_MASK))
+              | (phase_correct ? (1 << WGM20) : ((1 << WGM21) | (1 << WGM20))) | cs_bits;
+    }
+    
     return ret_value;
 }
 
+uint16_t getPWMTop(ePWM_OUTPUT output_pin)
+{
+    return (output_pin == epwm_2) ? 0xFF : gu16_TIMER1_PWM_TOP;
+}
+
 /// Values above 100 will be clipped to 100
-/// @NOTE right now this code only works for timer1 in 8 bit mode!!
 void setPWMDutyCycle(ePWM_OUTPUT output_pin, uint8_t value_0_to_100)
 {
     if (value_0_to_100 > 100)
         value_0_to_100 = 100;
 
-    if (output_pin == epwm_1a)
-    {
-        OCR1A = ONE_PERCENT_OF_8_BIT * value_0_to_100;
-    }
-    else if (output_pin == epwm_1b)
-    {
-        OCR1B = ONE_PERCENT_OF_8_BIT * value_0_to_100;
-    }
-    else if (output_pin == epwm_2)
-    {
-        OCR2 = ONE_PERCENT_OF_8_BIT * value_0_to_100;
-    }
+    setPWMVal(output_pin, PERCENT_TO_8_BIT(value_0_to_100));
 }
 
-/// @NOTE right now this code only works for timer1 in 8 bit mode!!
-void setPWMVal(ePWM_OUTPUT output_pin, uint8_t val)
+uint8_t getPWMBrightnessVal(uint8_t brightness)
 {
-    if (output_pin == epwm_1a)
-    {
-        OCR1A = val;
-    }
-    else if (output_pin == epwm_1b)
-    {
-        OCR1B = val;
-    }
-    else if (output_pin == epwm_2)
-    {
-        OCR2 = val;
-    }
+    return pgm_read_byte(&arr_pwm_gamma[brightness]);
+}
+
+void setPWMBrightness(ePWM_OUTPUT output_pin, uint8_t brightness)
+{
+    setPWMVal(output_pin, pgm_read_byte(&arr_pwm_gamma[brightness]));
 }
 
-/// @NOTE currently this only supports non-inverted mode. It will also set 16 bit
-/// timer into 8 bit mode. This function only enables the wave form generator and 
-/// output pins. It doesn't not alter the counter/compare-match values
-void enablePWMOutput(ePWM_OUTPUT output_pin)
+void _setPWMVal(ePWM_OUTPUT output_pin, uint8_t val)
 {
-    if (output_pin == epwm_1a)
+    setPWMCompare(output_pin, (output_pin == epwm_2) ? val : _scalePWMValTimer1(val));
+}
+
+void setPWMCompare(ePWM_OUTPUT output_pin, uint16_t compare)
+{
+    volatile void* ocr;
+    
+    if (output_pin <= epwm_2)
     {
-        //for the output driver to work, you must set the pin as output in Data Direction Register DDR
-        BIT_SET(DDRB, PINB1);
-        
-        //turn on PWM pin OC1A 8bit mode, note config spans 2 registers A/B
-        BIT_CLEAR(TCCR1B, WGM13);
-        BIT_SET(TCCR1B  , WGM12);
-        BIT_CLEAR(TCCR1A, WGM11);
-        BIT_SET(TCCR1A  , WGM10);
-        
-        //set as inverting (clear on compare match)
-        BIT_SET(TCCR1A  , COM1A1);  //enable pwm output pin
-        //BIT_SET(TCCR1A  , COM1A0);  //inverting
+        ocr = pgm_read_ptr(&arr_pwm_desc[output_pin].ocr);
         
-        //this would be non-inverting
-        BIT_CLEAR(TCCR1A, COM1A0);    
+        if (pgm_read_byte(&arr_pwm_desc[output_pin].ocr_16_bit))
+        {
+            //16 bit write, the compiler does the high byte first
+            *(volatile uint16_t*)ocr = compare;
+        }
+        else
+        {
+            //OCR2 is the only 8 bit compare register
+            *(volatile uint8_t*)ocr = (uint8_t)compare;
+            PROFILE_MARK(PROFILE_OCR2);
+        }
     }
-    else if (output_pin == epwm_1b)
+}
+
+/// @NOTE currently this only supports non-inverted mode. The waveform mode is left to
+/// setPWMCarrier. This function only connects the output pins to the wave form generator.
+/// It doesn't not alter the counter/compare-match values
+void _enablePWMOutput(ePWM_OUTPUT output_pin)
+{
+    sPWMDescriptor desc;
+    
+    if (output_pin <= epwm_2)
     {
-        //for the output driver to work, you must set the pin as output in Data Direction Register DDR
-        BIT_SET(DDRB, PINB2);
-        
-        //turn on PWM pin OC1A 8bit mode, note config spans 2 registers A/B
-        BIT_CLEAR(TCCR1B, WGM13);
-        BIT_SET(TCCR1B  , WGM12);
-        BIT_CLEAR(TCCR1A, WGM11);
-        BIT_SET(TCCR1A  , WGM10);
-        
-        //set as inverting (clear on compare match)
-        BIT_SET(TCCR1A  , COM1B1);  //enable pwm output pin
-        //BIT_SET(TCCR1A  , COM1B0);  //inverting
+        memcpy_P(&desc, &arr_pwm_desc[output_pin], sizeof(desc));
         
-        //this would be non-inverting mode
-        BIT_CLEAR(TCCR1A, COM1B0);
-    }
-    else if (output_pin == epwm_2)
-    {
         //for the output driver to work, you must set the pin as output in Data Direction Register DDR
-        BIT_SET(DDRB, PINB3);
-        
-        //turn on PWM pin OC2
-        BIT_SET(TCCR2  , WGM21);
-        BIT_SET(TCCR2  , WGM20);
+        DDRB |= desc.ddr_mask;
         
-        //set as non-inverting (toggle on compare match)
-        BIT_SET(TCCR2  , COM21); //enable pwm output pin
-        //BIT_SET(TCCR2  , COM20); //inverting
-        
-        //this would be non-inverting
-        BIT_CLEAR(TCCR2, COM20);
+        *desc.com_reg = (*desc.com_reg & ~desc.com_mask) | desc.com_on;
     }
 }
 
-///disconnects PWM pin (notice we only disconnected the pin, the PWM
-///timer is actually still running with all settings unchanged)
-void disablePWMOutput(ePWM_OUTPUT output_pin)
+void _disablePWMOutput(ePWM_OUTPUT output_pin)
 {
-    if (output_pin == epwm_1a)
-    {
-        //disconnect OC1A from Waveform Generation module
-        BIT_CLEAR(TCCR1A, COM1A1);
-        BIT_CLEAR(TCCR1A, COM1A0);
-    }
-    else if (output_pin == epwm_1b)
-    {
-        //disconnect OC1B from Waveform Generation module
-        BIT_CLEAR(TCCR1A, COM1B1);
-        BIT_CLEAR(TCCR1A, COM1B0);
-    }
-    else if (output_pin == epwm_2)
+    volatile uint8_t* com_reg;
+    
+    if (output_pin <= epwm_2)
     {
-        //disconnect OC2 from Waveform Generation module
-        BIT_CLEAR(TCCR2, COM21);
-        BIT_CLEAR(TCCR2, COM20);
+        //disconnect the pin from Waveform Generation module
+        com_reg = pgm_read_ptr(&arr_pwm_desc[output_pin].com_reg);
+        *com_reg &= ~pgm_read_byte(&arr_pwm_desc[output_pin].com_mask);
     }
 }
 
-void enableTimerOverflowInterrupt(eTIMER val)
+void _enableTimerOverflowInterrupt(eTIMER val)
 {
-    if (val == etimer_0)
+    if (val <= etimer_2)
     {
-        BIT_SET(TIMSK, TOIE0);
-    }
-    else if (val == etimer_1)
-    {
-        //There are 3 more types of interrupts compare match a/b, input capture
-        BIT_SET(TIMSK, TOIE1);
-    }
-    else if (val == etimer_2)
-    {
-        //there is also a compare match interrupt
-        BIT_SET(TIMSK, TOIE2);
+        TIMSK |= pgm_read_byte(&arr_timer_desc[val].toie_mask);
     }
 }
 
-void disableTimerOverflowInterrupt(eTIMER val)
+void _disableTimerOverflowInterrupt(eTIMER val)
 {
-    if (val == etimer_0)
-    {
-        BIT_CLEAR(TIMSK, TOIE0);
-    }
-    else if (val == etimer_1)
-    {
-        BIT_CLEAR(TIMSK, TOIE1);
-    }
-    else if (val == etimer_2)
+    if (val <= etimer_2)
     {
-        BIT_CLEAR(TIMSK, TOIE2);
+        TIMSK &= ~pgm_read_byte(&arr_timer_desc[val].toie_mask);
     }
 }
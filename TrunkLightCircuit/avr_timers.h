@@ -41,6 +41,81 @@ typedef enum _eTimerPrescaleValues
     tmr_prscl_clk_over_128_timer2_only,
 } eTimerPrescaleValues;
 
+#define TIMER_NUM_PRESCALE_VALUES   (tmr_prscl_clk_over_128_timer2_only + 1)
+
+/************************************************************************/
+/* REGISTER DESCRIPTIONS                                                */
+/************************************************************************/
+/** The register bits of every timer and pwm output are described once, by the macros
+ *  below. When a driver function is called with compile time constant arguments (the
+ *  usual case, e.g. arr_pwm_output[ARR_IDX_LEFT]) the static inline version folds them
+ *  and the call becomes one masked write per register. With run time arguments the same
+ *  values come from PROGMEM descriptor tables that avr_timers.c builds from these macros.
+ *  The run time versions have the same name with a leading _, only the inline versions
+ *  call them.
+ */
+#define TIMER_CS_MASK       0x07    /// clock select bits, bottom 3 of TCCR0/TCCR1B/TCCR2
+#define TIMER_CS_INVALID    0xFF    /// prescale value the timer can't do
+
+/// clock select bits of timer0 and timer1
+#define _TIMER01_CS(p)  ((p) == tmr_prscl_disabled_default                        ? 0 : \
+                         (p) == tmr_prscl_clk_over_1                              ? 1 : \
+                         (p) == tmr_prscl_clk_over_8                              ? 2 : \
+                         (p) == tmr_prscl_clk_over_64                             ? 3 : \
+                         (p) == tmr_prscl_clk_over_256                            ? 4 : \
+                         (p) == tmr_prscl_clk_over_1024                           ? 5 : \
+                         (p) == tmr_prscl_ext_tn_pin_falling_edge_timers_01_only  ? 6 : \
+                         (p) == tmr_prscl_ext_tn_pin_rising_edge_timers_01_only   ? 7 : TIMER_CS_INVALID)
+/// clock select bits of timer2, no external clock but two extra prescalers
+#define _TIMER2_CS(p)   ((p) == tmr_prscl_disabled_default                        ? 0 : \
+                         (p) == tmr_prscl_clk_over_1                              ? 1 : \
+                         (p) == tmr_prscl_clk_over_8                              ? 2 : \
+                         (p) == tmr_prscl_clk_over_32_timer2_only                 ? 3 : \
+                         (p) == tmr_prscl_clk_over_64                             ? 4 : \
+                         (p) == tmr_prscl_clk_over_128_timer2_only                ? 5 : \
+                         (p) == tmr_prscl_clk_over_256                            ? 6 : \
+                         (p) == tmr_prscl_clk_over_1024                           ? 7 : TIMER_CS_INVALID)
+#define TIMER_CS_BITS(t, p) ((t) == etimer_2 ? _TIMER2_CS(p) : _TIMER01_CS(p))
+#define TIMER_CS_REG(t)     (*((t) == etimer_0 ? &TCCR0 : (t) == etimer_1 ? &TCCR1B : &TCCR2))
+#define TIMER_TOIE_BIT(t)   ((t) == etimer_0 ? (1 << TOIE0) : (t) == etimer_1 ? (1 << TOIE1) : (1 << TOIE2))
+
+/// COMx1:0 bits of an output, non inverting mode is COMx1 only. In fast and phase correct
+/// pwm the same bits mean non inverting so they don't depend on the carrier mode
+#define PWM_COM_MASK(o)     ((o) == epwm_1a ? ((1 << COM1A1) | (1 << COM1A0)) : \
+                             (o) == epwm_1b ? ((1 << COM1B1) | (1 << COM1B0)) : ((1 << COM21) | (1 << COM20)))
+#define PWM_COM_ON(o)       ((o) == epwm_1a ? (1 << COM1A1) : (o) == epwm_1b ? (1 << COM1B1) : (1 << COM21))
+/// register holding the COM bits
+#define PWM_COM_REG(o)      (*((o) == epwm_2 ? &TCCR2 : &TCCR1A))
+/// waveform bits, written by setPWMCarrier only. Timer1 WGM13:10 is split over TCCR1A/B
+#define PWM_WGM1A_MASK      ((1 << WGM11) | (1 << WGM10))
+#define PWM_WGM1B_MASK      ((1 << WGM13) | (1 << WGM12))
+#define PWM_WGM2_MASK       ((1 << WGM21) | (1 << WGM20))
+/// output pin, must be an output for the driver to work
+#define PWM_DDR_MASK(o)     ((o) == epwm_1a ? (1 << PINB1) : (o) == epwm_1b ? (1 << PINB2) : (1 << PINB3))
+
+/** pwm carrier modes. Timer2 only has the 8 bit modes (TOP = 255), timer1 can also count to
+ *  ICR1 so the frequency can be picked freely and left/right get more than 8 bits. In the
+ *  ICR1 modes TOP is at least 1023 (10 bit) up to 15.6kHz fast / 7.8kHz phase correct
+ */
+typedef enum _ePWM_MODE
+{
+    epwm_mode_fast_8bit_default,    /// timer1 WGM 5, timer2 WGM 3. TOP = 255, F_CPU / (N * 256)
+    epwm_mode_phase_correct_8bit,   /// timer1 WGM 1, timer2 WGM 1. TOP = 255, F_CPU / (N * 510)
+    epwm_mode_fast_icr1,            /// timer1 only, WGM 14. F_CPU / (N * (ICR1 + 1))
+    epwm_mode_phase_correct_icr1,   /// timer1 only, WGM 10. F_CPU / (2 * N * ICR1)
+}ePWM_MODE;
+
+/// highest TOP setPWMCarrier picks for timer1, keeps TOP + 1 in 16 bits for the scaling in
+/// setPWMVal. 15 bits is already far more than the gamma table can use
+#define PWM_TIMER1_TOP_MAX  0x7FFF
+
+/// TOP of timer1 in the active carrier mode, written by setPWMCarrier. Read by setPWMVal
+extern uint16_t gu16_TIMER1_PWM_TOP;
+/// high and low byte of TOP + 1, the scale of setPWMVal on timer1. Written with
+/// gu16_TIMER1_PWM_TOP so the scaling is two 8x8 multiplies, no 16 or 32 bit math per call
+extern uint8_t gu8_TIMER1_PWM_SCALE_HI;
+extern uint8_t gu8_TIMER1_PWM_SCALE_LO;
+
 /** Resets all timers to default settings
 */
 void timers_default(void);
@@ -77,7 +152,58 @@ void timer2_default(void);
  *  @PARAM prescale - the selected prescale value (including external pin)
  *  @RETURN if setting was successfully applied
  */
-bool SetTimerPrescale(eTIMER timer, eTimerPrescaleValues prescale); 
+bool _SetTimerPrescale(eTIMER timer, eTimerPrescaleValues prescale);
+static inline bool SetTimerPrescale(eTIMER timer, eTimerPrescaleValues prescale)
+{
+    bool ret_value = true;
+    
+    if (__builtin_constant_p(timer) && __builtin_constant_p(prescale))
+    {
+        if (TIMER_CS_BITS(timer, prescale) == TIMER_CS_INVALID)
+        {
+            //same as the run time version, the timer is left stopped
+            TIMER_CS_REG(timer) &= ~TIMER_CS_MASK;
+            ret_value = false;
+        }
+        else
+        {
+            TIMER_CS_REG(timer) = (TIMER_CS_REG(timer) & ~TIMER_CS_MASK) | TIMER_CS_BITS(timer, prescale);
+        }
+    }
+    else
+    {
+        ret_value = _SetTimerPrescale(timer, prescale);
+    }
+    
+    return ret_value;
+}
+
+/** Picks the waveform mode and carrier frequency of a pwm timer. Sets the WGM and clock select
+ *  bits, the timer runs once this returns. For timer1 in the ICR1 modes the smallest prescaler
+ *  that fits TOP in PWM_TIMER1_TOP_MAX is used, that gives the most resolution. In the 8 bit
+ *  modes (and on timer2) the prescaler with the frequency closest to freq_hz is used
+ *  @PARAM timer - etimer_1 or etimer_2, timer0 has no pwm on this part
+ *  @PARAM mode - waveform mode, the ICR1 modes are timer1 only
+ *  @PARAM freq_hz - wanted carrier frequency
+ *  @RETURN the carrier frequency that was set (rounded down), 0 if it can't be done. The timer
+ *  is left stopped in that case
+ *  @NOTE compare values are not rescaled, write the duty cycles again after changing the
+ *  carrier of a running timer. Output enable/disable doesn't touch the mode
+ */
+uint16_t setPWMCarrier(eTIMER timer, ePWM_MODE mode, uint16_t freq_hz);
+
+/** returns the TOP of the timer behind an output, the compare value for 100% duty cycle
+ *  @PARAM output_pin - pwm output
+ *  @RETURN 255 for timer2 and timer1 in the 8 bit modes, ICR1 otherwise
+ */
+uint16_t getPWMTop(ePWM_OUTPUT output_pin);
+
+/** writes a raw compare value, for callers that want the full resolution of the ICR1 modes
+ *  (see getPWMTop). Values above TOP give 100% in fast mode
+ *  @PARAM output_pin - pwm output
+ *  @PARAM compare - 0 to TOP, only the low byte is used on timer2
+ */
+void setPWMCompare(ePWM_OUTPUT output_pin, uint16_t compare);
 
 /** Sets the pwm duty cycle for a timer waveform generation model
  *  This function can be called even if PWM output is disabled
@@ -86,10 +212,29 @@ bool SetTimerPrescale(eTIMER timer, eTimerPrescaleValues prescale);
  *  channels)
  *  @PARAM value_0_to_100 - Desired duty cycle 0-100%, values >100 will
  *  be clipped to 100
- *  @ NOTE - all PWM is generated with 8 bit counter
+ *  @ NOTE - goes through setPWMVal, so it is scaled to the active TOP
  */
 void setPWMDutyCycle(ePWM_OUTPUT output_pin, uint8_t value_0_to_100);
 
+/** scales a 0-255 pwm value to the active timer1 TOP: (val * (TOP + 1)) >> 8, 255 is TOP
+ *  so full stays 100%. With TOP = 255 this is val unchanged
+ *  @NOTE val * HI + ((val * LO) >> 8) is exactly that, the low product only adds its carry.
+ *  Each product is one MUL. A power of two TOP + 1 has LO = 0 and HI is the shift, the
+ *  multiply is cheaper than a variable shift here so it isn't special cased
+ */
+static inline uint16_t _scalePWMValTimer1(uint8_t val)
+{
+    uint16_t ret_value = gu16_TIMER1_PWM_TOP;
+    
+    if (val != 0xFF)
+    {
+        ret_value = (uint16_t)val * gu8_TIMER1_PWM_SCALE_HI
+                  + (((uint16_t)val * gu8_TIMER1_PWM_SCALE_LO) >> 8);
+    }
+    
+    return ret_value;
+}
+
 /** sets pwm duty cycle with more granular control range 0-255 (as opposed
  *  to setPWMDutyCycle which is 0-100)
  *  This function can be called even if PWM output is disabled
@@ -97,23 +242,102 @@ void setPWMDutyCycle(ePWM_OUTPUT output_pin, uint8_t value_0_to_100);
  *  (this is not the same as the timer since some timers have multiple output
  *  channels)
  *  @PARAM val- Desired duty cycle 0-255
- *  @ NOTE - all PWM is generated with 8 bit counter
+ *  @ NOTE - timer1 values are scaled to the active TOP, timer2 is always 8 bit
+ */
+void _setPWMVal(ePWM_OUTPUT output_pin, uint8_t val);
+static inline void setPWMVal(ePWM_OUTPUT output_pin, uint8_t val)
+{
+    if (__builtin_constant_p(output_pin))
+    {
+        if (output_pin == epwm_1a)
+        {
+            OCR1A = _scalePWMValTimer1(val);
+        }
+        else if (output_pin == epwm_1b)
+        {
+            OCR1B = _scalePWMValTimer1(val);
+        }
+        else
+        {
+            OCR2 = val;
+            PROFILE_MARK(PROFILE_OCR2);
+        }
+    }
+    else
+    {
+        _setPWMVal(output_pin, val);
+    }
+}
+
+/** sets the pwm output to a perceptual brightness. The value goes through a gamma
+ *  table in flash, so equal steps in brightness look like equal steps to the eye and
+ *  low levels keep their resolution. No math per call, it is a table read
+ *  This function can be called even if PWM output is disabled
+ *  @PARAM output_pin - waveform genearation pin to apply brightness to
+ *  @PARAM brightness - 0 (off) to 255 (100% duty cycle)
+ *  @ NOTE - goes through setPWMVal, so it is scaled to the active TOP
+ */
+void setPWMBrightness(ePWM_OUTPUT output_pin, uint8_t brightness);
+
+/** returns the pwm value (0-255) setPWMBrightness would write for a brightness
+ *  @PARAM brightness - 0 (off) to 255 (100% duty cycle)
+ *  @RETURN the gamma corrected pwm value
  */
-void setPWMVal(ePWM_OUTPUT output_pin, uint8_t val);
+uint8_t getPWMBrightnessVal(uint8_t brightness);
 
 /** enables PWM output of the specified pin
  *  @PARAM output_pin which output to enable
 *  (this is not the same as the timer since some timers have multiple output
 *  channels)
+*  @NOTE the waveform mode is whatever setPWMCarrier picked, it is not changed here
 */
-void enablePWMOutput(ePWM_OUTPUT output_pin);
+void _enablePWMOutput(ePWM_OUTPUT output_pin);
+static inline void enablePWMOutput(ePWM_OUTPUT output_pin)
+{
+    if (__builtin_constant_p(output_pin))
+    {
+        DDRB |= PWM_DDR_MASK(output_pin);
+        PWM_COM_REG(output_pin) = (PWM_COM_REG(output_pin) & ~PWM_COM_MASK(output_pin)) | PWM_COM_ON(output_pin);
+    }
+    else
+    {
+        _enablePWMOutput(output_pin);
+    }
+}
 
 /** disables PWM output of the specified pin
  *  @PARAM output_pin which output to disable
 *  (this is not the same as the timer since some timers have multiple output
 *  channels)
 */
-void disablePWMOutput(ePWM_OUTPUT output_pin);
+void _disablePWMOutput(ePWM_OUTPUT output_pin);
+static inline void disablePWMOutput(ePWM_OUTPUT output_pin)
+{
+    if (__builtin_constant_p(output_pin))
+    {
+        PWM_COM_REG(output_pin) &= ~PWM_COM_MASK(output_pin);
+    }
+    else
+    {
+        _disablePWMOutput(output_pin);
+    }
+}
+
+/** makes an OCR2 value written while the pwm runs show on the next timer clock instead of
+ *  the next BOTTOM. OCR2 is double buffered in the pwm modes, a new value can otherwise
+ *  wait a whole carrier period (~1.02ms at 976Hz)
+ *  @NOTE fast pwm only, it latches at BOTTOM and TOP is always 255 on timer2. The running
+ *  period is cut short once, that is only a problem for a value that must not glitch. In
+ *  phase correct mode the count direction can't be read back, nothing is done
+ */
+static inline void updatePWMCompareTimer2Now(void)
+{
+    if (BIT_GET(TCCR2, WGM21))
+    {
+        //TOP, the next timer clock wraps to BOTTOM and loads the buffer
+        TCNT2 = 0xFF;
+    }
+}
 
 /** enables overflow interrupt for select timer. The calling code MUST
  *  implement the actual ISR, This function is only a way to enable it
@@ -125,11 +349,33 @@ void disablePWMOutput(ePWM_OUTPUT output_pin);
  *   ISR(TIMER2_OVF_vect)
  * @PARAM the timer you wish to enable interrupts for
  */
-void enableTimerOverflowInterrupt(eTIMER val);
+void _enableTimerOverflowInterrupt(eTIMER val);
+static inline void enableTimerOverflowInterrupt(eTIMER val)
+{
+    if (__builtin_constant_p(val))
+    {
+        TIMSK |= TIMER_TOIE_BIT(val);
+    }
+    else
+    {
+        _enableTimerOverflowInterrupt(val);
+    }
+}
 
 /** Disables interrupt generation for the specified timer
  * @PARAM the timer you wish to enable interrupts for
  */
-void disableTimerOverflowInterrupt(eTIMER val);
+void _disableTimerOverflowInterrupt(eTIMER val);
+static inline void disableTimerOverflowInterrupt(eTIMER val)
+{
+    if (__builtin_constant_p(val))
+    {
+        TIMSK &= ~TIMER_TOIE_BIT(val);
+    }
+    else
+    {
+        _disableTimerOverflowInterrupt(val);
+    }
+}
 
 #endif /* AVR_TIMERS_H_ */
\ No newline at end of file
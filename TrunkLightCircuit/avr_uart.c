@@ -16,15 +16,46 @@
 #include "avr_uart.h"
 #include <util/atomic.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 #define ASCII_0         48
 #define UCSRC_CLEAR_VAL 0x80  /// This clears register UCSRC, all writes to the reg must have
                               /// URSEL bit (MSB 7) set since this register is shared with UBRRH'
                              
 static volatile char rcv_buff[_UART_RX_BUFF_MAX_LEN] = {0};
+#if CIRCULAR_BUFFER
+#define _UART_RX_BUFF_MASK (_UART_RX_BUFF_MAX_LEN - 1)
+
+#if (_UART_RX_BUFF_MAX_LEN & _UART_RX_BUFF_MASK) || (_UART_RX_BUFF_MAX_LEN > 256)
+#error "_UART_RX_BUFF_MAX_LEN must be a power of 2, at most 256"
+#endif
+
+//single producer/single consumer: head is only written by ISR(USART_RXC_vect), tail and
+//the scan position only by the reader, so no counter is shared and nothing needs locking.
+//One slot stays empty to tell full from empty, the ring holds _UART_RX_BUFF_MAX_LEN - 1
+static volatile uint8_t rx_buff_head_idx = 0;
+static volatile uint8_t rx_buff_tail_idx = 0;
+static uint8_t rx_scan_idx = 0;     /// UART_PeekLine searched up to here already
+static bool rx_skip_lf = false;     /// last line ended in '\r', drop a '\n' right after it
+static uint8_t rx_line_len = 0;     /// bytes UART_ReleaseLine frees, line ending included. 0 = none
+static uint8_t rx_line_text_len = 0;    /// same line without its ending, what the view shows
+#else
 static volatile uint16_t rcv_buff_len = 0;
-static volatile uint8_t rx_buff_start_idx = 0;
-static volatile uint8_t rx_buff_end_idx = 0;
+#endif
+
+#define _UART_TX_BUFF_MASK (_UART_TX_BUFF_MAX_LEN - 1)
+
+//head is only moved by the producers (UART_TxEnqueue), tail only by ISR(USART_UDRE_vect)
+//except for tx_full_overwrite which moves it with interrupts disabled
+static volatile char tx_buff[_UART_TX_BUFF_MAX_LEN];
+static volatile uint8_t tx_buff_head_idx = 0;
+static volatile uint8_t tx_buff_tail_idx = 0;
+static eUartTxFullPolicy tx_full_policy = tx_full_drop_default;
+//frame being written in place (UART_TxFrameStart): the slots from tx_hold_idx on are taken
+//and the UDRE interrupt stops there till UART_TxFrameEnd
+static volatile bool tx_holding = false;
+static volatile uint8_t tx_hold_idx = 0;
+static uint8_t tx_frame_idx = 0;    /// next slot UART_TxFramePut writes
 
 /************************************************************************/
 /* UART CONFIGURATION FUNCTIONS                                         */
@@ -253,6 +284,11 @@ void UART_disableRxInterrupt(void)
     BIT_CLEAR(UCSRB, RXCIE);
 }
 
+void UART_SetTxFullPolicy(eUartTxFullPolicy value)
+{
+    tx_full_policy = value;
+}
+
 /************************************************************************/
 /* UART USE FUNCTIONS                                                   */
 /************************************************************************/
@@ -276,7 +312,19 @@ void uart_enable(eUartBaudRate baud_rate,
     uart_SetStopBits(stop_bits);
     uart_SetParity(parity);
     
+    tx_buff_head_idx = 0;
+    tx_buff_tail_idx = 0;
+    
+#if CIRCULAR_BUFFER
+    rx_buff_head_idx = 0;
+    rx_buff_tail_idx = 0;
+    rx_scan_idx = 0;
+    rx_skip_lf = false;
+    rx_line_len = 0;
+    rx_line_text_len = 0;
+#else
     rcv_buff_len = 0;
+#endif
     for (ii=0; ii < _UART_RX_BUFF_MAX_LEN; ii++)
     {
         rcv_buff[ii] = 0;
@@ -285,6 +333,9 @@ void uart_enable(eUartBaudRate baud_rate,
 
 void uart_disable(void)
 {
+    //stop draining the tx queue
+    BIT_CLEAR(UCSRB, UDRIE);
+    
     //disable tx pin
     BIT_CLEAR(UCSRB, TXEN);
     
@@ -292,18 +343,133 @@ void uart_disable(void)
     BIT_CLEAR(UCSRB, RXEN);
 }
 
-bool _UART_TxIsBusy(void)
+/** Data register empty interrupt, this sends the queued Tx data one byte at a time.
+ *  It is only enabled while there is data in the queue
+ */
+ISR(USART_UDRE_vect)
 {
-    //if the UDR (Uart Data Register) is Empty then TX is NOT busy
-    //otherwise it is
-    if (BIT_GET(UCSRA,UDRE))
+    //bytes queued after a frame that is still being written wait for it
+    uint8_t end_idx = tx_holding ? tx_hold_idx : tx_buff_head_idx;
+    
+    if (tx_buff_tail_idx != end_idx)
     {
-        return false;
+        UDR = tx_buff[tx_buff_tail_idx];
+        tx_buff_tail_idx = (tx_buff_tail_idx + 1) & _UART_TX_BUFF_MASK;
     }
-    else
+    
+    if (tx_buff_tail_idx == end_idx)
     {
-        return true;
+        //nothing to send, otherwise this interrupt would keep firing. UART_TxFrameEnd
+        //turns it back on
+        BIT_CLEAR(UCSRB, UDRIE);
+    }
+}
+
+bool UART_TxEnqueue(char data)
+{
+    uint8_t next_idx;
+    bool queued = false;
+    bool can_block;
+    
+    //inside an ISR (or with interrupts off) the UDRE interrupt can't drain the queue
+    //so waiting would never end
+    can_block = ((tx_full_policy == tx_full_block) && BIT_GET(SREG, SREG_I));
+    
+    do
+    {
+        //producers can be in main and in ISRs, so claiming a slot has to be atomic
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            next_idx = (tx_buff_head_idx + 1) & _UART_TX_BUFF_MASK;
+            
+            if ((next_idx == tx_buff_tail_idx) && (tx_full_policy == tx_full_overwrite)
+                && !(tx_holding && (tx_buff_tail_idx == tx_hold_idx)))
+            {
+                //throw away the oldest byte to make room, unless it is part of the frame
+                //being written
+                tx_buff_tail_idx = (tx_buff_tail_idx + 1) & _UART_TX_BUFF_MASK;
+            }
+            
+            if (next_idx != tx_buff_tail_idx)
+            {
+                tx_buff[tx_buff_head_idx] = data;
+                tx_buff_head_idx = next_idx;
+                queued = true;
+                
+                //starts (or keeps) the UDRE interrupt draining the queue
+                BIT_SET(UCSRB, UDRIE);
+            }
+        }
+    } while ((queued == false) && can_block);
+    
+    return queued;
+}
+
+bool UART_TxFrameStart(uint8_t len)
+{
+    uint8_t free_len;
+    bool started = false;
+    
+    //the free check and taking the slots in one go, no ISR producer (the Rx echo, a log
+    //line) can take the room in between or end up inside the frame
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        free_len = (tx_buff_tail_idx - tx_buff_head_idx - 1) & _UART_TX_BUFF_MASK;
+        
+        if (tx_holding)
+        {
+            //one frame at a time
+            free_len = 0;
+        }
+        else if ((len > free_len) && (tx_full_policy == tx_full_overwrite) && (len < _UART_TX_BUFF_MAX_LEN))
+        {
+            //throw away the oldest bytes to make room
+            tx_buff_tail_idx = (tx_buff_tail_idx + (len - free_len)) & _UART_TX_BUFF_MASK;
+            free_len = len;
+        }
+        
+        if (len <= free_len)
+        {
+            tx_hold_idx = tx_buff_head_idx;
+            tx_frame_idx = tx_buff_head_idx;
+            tx_buff_head_idx = (tx_buff_head_idx + len) & _UART_TX_BUFF_MASK;
+            tx_holding = true;
+            started = true;
+        }
     }
+    
+    return started;
+}
+
+void UART_TxFramePut(char data)
+{
+    //the slot is the frame's, neither the producers nor the UDRE interrupt touch it
+    tx_buff[tx_frame_idx] = data;
+    tx_frame_idx = (tx_frame_idx + 1) & _UART_TX_BUFF_MASK;
+}
+
+void UART_TxFrameEnd(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        tx_holding = false;
+        
+        //starts (or keeps) the UDRE interrupt draining the queue
+        BIT_SET(UCSRB, UDRIE);
+    }
+}
+
+uint8_t UART_TxFree(void)
+{
+    uint8_t ret_value;
+    
+    //one slot always stays empty to tell a full queue from an empty one
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ret_value = (tx_buff_tail_idx - tx_buff_head_idx - 1) & _UART_TX_BUFF_MASK;
+    }
+    
+    return ret_value;
 }
 
 uint8_t UART_transmitString(char *str)
@@ -312,18 +478,32 @@ uint8_t UART_transmitString(char *str)
     
     while (*str != 0)
     {
-        //wait till previous write is done
-        while (_UART_TxIsBusy() == true)
+        if (UART_TxEnqueue(*str))
         {
-            ;
+            bytes_sent++;
         }
         
-        //puts data in transmit register
-        UDR  = *str;
-
-        //advance pointer, increase counter
+        //advance pointer
         str++;
-        bytes_sent++;
+    }
+    
+    return bytes_sent;
+}
+
+uint8_t UART_transmitString_P(const char *str_P)
+{
+    uint8_t bytes_sent = 0;
+    char data = pgm_read_byte(str_P);
+    
+    while (data != 0)
+    {
+        if (UART_TxEnqueue(data))
+        {
+            bytes_sent++;
+        }
+        
+        str_P++;
+        data = pgm_read_byte(str_P);
     }
     
     return bytes_sent;
@@ -335,19 +515,14 @@ uint8_t UART_transmitBytes(char *data, uint8_t len)
     
     while (len > 0)
     {
-        //wait till previous write is done
-        while (_UART_TxIsBusy() == true)
+        if (UART_TxEnqueue(*data))
         {
-            ;
+            bytes_sent++;
         }
         
-        //puts data in transmit register
-        UDR  = *data;
-
         //advance pointer, decrease counter
         data++;
         len--;
-        bytes_sent++;
     }
     
     return bytes_sent;
@@ -355,7 +530,7 @@ uint8_t UART_transmitBytes(char *data, uint8_t len)
 
 void UART_TransmitByte(char data)
 {
-    UART_transmitBytes(&data, 1);
+    UART_TxEnqueue(data);
 }
 
 void UART_transmitNewLine(void)
@@ -395,6 +570,29 @@ void UART_transmitInt16(int16_t val)
     UART_transmitBytes(str, STR_INT16_LEN);
 }
 
+void UART_transmitUint16Raw(uint16_t val)
+{
+    char str[STR_UINT16_RAW_LEN];
+    
+    UART_transmitBytes(str, convertUint16ToCharRaw(val, str));
+}
+
+void UART_transmitHex8(uint8_t val)
+{
+    char str[STR_HEX8_LEN];
+    
+    convertUint8ToHex(val, str);
+    UART_transmitBytes(str, STR_HEX8_LEN);
+}
+
+void UART_transmitHex16(uint16_t val)
+{
+    char str[STR_HEX16_LEN];
+    
+    convertUint16ToHex(val, str);
+    UART_transmitBytes(str, STR_HEX16_LEN);
+}
+
 /** This private support function will tell whether or not the USRT RX data Register (UDR)
  * has pending data or not. 
  * @NOTE this doesn't read the data, it just tells its presence
@@ -439,134 +637,204 @@ void UART_ReceiveByte(char* ret_data)
 
 ISR(USART_RXC_vect)
 {
-    //uint8_t rx_err_flags;
-    uint8_t rx_dump_register;
+    uint8_t next_idx;
+    char data;
   
-    if (rcv_buff_len >= _UART_RX_BUFF_MAX_LEN)
-    {
-        //we have to read the value to clear all flags and stop the
-        //interrupt from triggering, even if we are just dumping the
-        //value
-        rx_dump_register = UDR;
-        return;
-    }
+    PROFILE_START(PROFILE_UART_RX);
     
-    rcv_buff[rx_buff_end_idx] = UDR;
+    //reading UDR clears the interrupt, it has to be read even if the byte is dropped
+    data = UDR;
+    next_idx = (rx_buff_head_idx + 1) & _UART_RX_BUFF_MASK;
     
-    //echo
-#if ECHO_ON    
-    if ((rcv_buff[rx_buff_end_idx] == '\r') ||  (rcv_buff[rx_buff_end_idx] == '\n') )
-    {
-        UART_transmitNewLine();
-    }
-    else
+    if (next_idx != rx_buff_tail_idx)
     {
-        UART_TransmitByte(rcv_buff[rx_buff_end_idx]);
-    }
+        rcv_buff[rx_buff_head_idx] = data;
+        
+        //publish after the byte is stored, the reader never looks past head
+        rx_buff_head_idx = next_idx;
+    
+        //echo
+#if ECHO_ON    
+        if ((data == '\r') || (data == '\n'))
+        {
+            UART_transmitNewLine();
+        }
+        else
+        {
+            UART_TransmitByte(data);
+        }
 #endif //ECHO_ON
-    //takes care of circular indexing
-    rx_buff_end_idx = (rx_buff_end_idx+1) % _UART_RX_BUFF_MAX_LEN;
-    rcv_buff_len++;
+    }
+    
+    PROFILE_END(PROFILE_UART_RX);
 }
 
 void UART_ReadRxBuff(char* ret_data, uint8_t* ret_data_len)
 {
-    uint8_t bytes_read;
+    uint8_t bytes_read = 0;
+    uint8_t tail = rx_buff_tail_idx;
+    uint8_t head = rx_buff_head_idx;    //bytes that come in while copying wait for next time
     
-    bytes_read = 0;
-    while(rcv_buff_len > 0)
+    while (tail != head)
     {
-        //save value
-        ret_data[bytes_read] = rcv_buff[(rx_buff_start_idx + bytes_read) % _UART_RX_BUFF_MAX_LEN];
-        
-        //mark cell as unused now  //removed for speed, we don't need 0 for empty cells now that we use rcv_buff_len
-        //rcv_buff[(rx_buff_start_idx + bytes_read) % _UART_RX_BUFF_MAX_LEN] = 0;
-        
-        //increment counters
-        rcv_buff_len--;
-        bytes_read++;
-        rx_buff_start_idx = (rx_buff_start_idx + 1) % _UART_RX_BUFF_MAX_LEN;
+        ret_data[bytes_read++] = rcv_buff[tail];
+        tail = (tail + 1) & _UART_RX_BUFF_MASK;
     }
     
+    //frees the space for the ISR
+    rx_buff_tail_idx = tail;
+    rx_scan_idx = tail;
+    rx_skip_lf = false;
+    rx_line_len = 0;
+    rx_line_text_len = 0;
+    
     *ret_data_len = bytes_read;
-    //UART_enableRxInterrupt();
 }
 
-void UART_ReadLineRxBuff(char* ret_data, uint8_t* ret_data_len)
+bool UART_PeekLine(sUartLine* line)
 {
-    uint8_t bytes_read = 0;
-    bool done = false;
+    uint8_t tail = rx_buff_tail_idx;
+    uint8_t head = rx_buff_head_idx;
+    uint8_t scan = rx_scan_idx;
+    uint8_t text_len;
+    bool found = false;
+    char data = 0;
     
-    //dump everything if the buffer is full
-    if (rcv_buff_len == _UART_RX_BUFF_MAX_LEN)
+    if (rx_line_len == 0)
     {
-        //dump everything if the buffer is full
-    }
-    else
-    {
-        //check for newline character, if its not there... then just return nothing
-        while( (done == false) && (bytes_read < rcv_buff_len))
+        //the '\n' of a "\r\n" that came in after the line was released
+        if (rx_skip_lf && (tail != head))
         {
-            if (  (rcv_buff[(rx_buff_start_idx + bytes_read) % _UART_RX_BUFF_MAX_LEN] == '\r')
-            || (rcv_buff[(rx_buff_start_idx + bytes_read) % _UART_RX_BUFF_MAX_LEN] == '\n'))
+            if (rcv_buff[tail] == '\n')
             {
-                done = true;
+                tail = (tail + 1) & _UART_RX_BUFF_MASK;
+                rx_buff_tail_idx = tail;
+                scan = tail;
             }
-            bytes_read++;
+            rx_skip_lf = false;
+        }
+        
+        //only the bytes that came in since the last call are searched
+        while ((found == false) && (scan != head))
+        {
+            data = rcv_buff[scan];
+            found = ((data == '\r') || (data == '\n'));
+            scan = (scan + 1) & _UART_RX_BUFF_MASK;
         }
+        rx_scan_idx = scan;
         
-        //if its still not "done" it means theres no line ending char
-        if (done == false)
+        if (found)
         {
-            *ret_data_len = 0;
-            return;
+            rx_line_len = (scan - tail) & _UART_RX_BUFF_MASK;
+            rx_line_text_len = rx_line_len - 1;
         }
+        //no line ending yet. If the ring is full there never will be room for one, so
+        //everything in it is handed out as one line to make room for new messages
+        else if (((head - tail) & _UART_RX_BUFF_MASK) == _UART_RX_BUFF_MASK)
+        {
+            rx_line_len = _UART_RX_BUFF_MASK;
+            rx_line_text_len = _UART_RX_BUFF_MASK;
+        }
+    }
+    
+    text_len = rx_line_text_len;
+    
+    //the bytes between tail and head belong to the reader, the ISR doesn't touch them
+    //until the line is released, so they can be handed out without the volatile
+    line->part1 = (const char*)&rcv_buff[tail];
+    line->part2 = (const char*)&rcv_buff[0];
+    line->len1 = _UART_RX_BUFF_MAX_LEN - tail;
+    
+    if (line->len1 >= text_len)
+    {
+        line->len1 = text_len;
     }
+    line->len2 = text_len - line->len1;
+    
+    return (rx_line_len != 0);
+}
 
-    done = false;
-    bytes_read = 0;
-    while( (done == false) && (rcv_buff_len > 0))
+char UART_LineChar(const sUartLine* line, uint8_t idx)
+{
+    char ret_value = 0;
+    
+    if (idx < line->len1)
     {
-        //save value
-        ret_data[bytes_read] = rcv_buff[(rx_buff_start_idx) % _UART_RX_BUFF_MAX_LEN];
+        ret_value = line->part1[idx];
+    }
+    else if ((uint8_t)(idx - line->len1) < line->len2)
+    {
+        ret_value = line->part2[idx - line->len1];
+    }
+    
+    return ret_value;
+}
+
+void UART_ReleaseLine(void)
+{
+    uint8_t tail = rx_buff_tail_idx;
+    uint8_t head = rx_buff_head_idx;
+    uint8_t last_idx;
+    
+    if (rx_line_len != 0)
+    {
+        last_idx = (tail + rx_line_len - 1) & _UART_RX_BUFF_MASK;
+        tail = (tail + rx_line_len) & _UART_RX_BUFF_MASK;
         
-        //mark cell as unused now //removed for speed, we don't need 0 for empty cells now that we use rcv_buff_len
-        //rcv_buff[(rx_buff_start_idx) % _UART_RX_BUFF_MAX_LEN] = 0;
-                
-        //check for line ending char
-        if ((ret_data[bytes_read] == '\r') || (ret_data[bytes_read] == '\n'))
+        //"\r\n" is one line ending, the '\n' goes with the line if it is already here
+        if (rcv_buff[last_idx] == '\r')
         {
-            done = true;
-            
-            //since its windows we need to look for \r\n
-            //so if there is still more in the buffer
-            if (rcv_buff > 0)
+            if (tail == head)
             {
-                //and its a '\n'
-                if (rcv_buff[(rx_buff_start_idx + 1) % _UART_RX_BUFF_MAX_LEN] == '\n')
-                {
-                    //save value
-                    ret_data[bytes_read] = rcv_buff[(rx_buff_start_idx) % _UART_RX_BUFF_MAX_LEN];
-                    
-                    //mark cell as unused now  //removed for speed, we don't need 0 for empty cells now that we use rcv_buff_len
-                    //rcv_buff[(rx_buff_start_idx + bytes_read) % _UART_RX_BUFF_MAX_LEN] = 0;
-                    
-                    //increment counters
-                    rcv_buff_len--;
-                    bytes_read++;
-                    rx_buff_start_idx = (rx_buff_start_idx + 1) % _UART_RX_BUFF_MAX_LEN;
-                }
+                rx_skip_lf = true;
             }
+            else if (rcv_buff[tail] == '\n')
+            {
+                tail = (tail + 1) & _UART_RX_BUFF_MASK;
+            }
+        }
+        
+        rx_line_len = 0;
+        rx_line_text_len = 0;
+        
+        //the next search starts after the line. Not worked out from tail and head in
+        //UART_PeekLine: once the ring fills up again a scan position one behind tail
+        //looks the same as one at head
+        rx_scan_idx = tail;
+        
+        //frees the space for the ISR
+        rx_buff_tail_idx = tail;
+    }
+}
+
+void UART_ReadLineRxBuff(char* ret_data, uint8_t* ret_data_len)
+{
+    sUartLine line;
+    uint8_t bytes_read = 0;
+    uint8_t tail;
+    
+    if (UART_PeekLine(&line))
+    {
+        //read after the peek, it can skip the '\n' left over from the last line
+        tail = rx_buff_tail_idx;
+        
+        //copies the line ending too (the view leaves it out)
+        while (bytes_read < rx_line_len)
+        {
+            ret_data[bytes_read++] = rcv_buff[tail];
+            tail = (tail + 1) & _UART_RX_BUFF_MASK;
         }
         
-        //increment counters
-        rcv_buff_len--;
-        bytes_read++;
-        rx_buff_start_idx = (rx_buff_start_idx + 1) % _UART_RX_BUFF_MAX_LEN;
+        UART_ReleaseLine();
+        
+        //a "\r\n" the release merged comes back in one piece like it was received
+        if ((ret_data[bytes_read - 1] == '\r') && (tail != rx_buff_tail_idx))
+        {
+            ret_data[bytes_read++] = '\n';
+        }
     }
     
     *ret_data_len = bytes_read;
-    //UART_enableRxInterrupt();
 }
 #else //!CIRCULAR_BUFFER
 ISR(USART_RXC_vect)
@@ -622,250 +890,141 @@ void UART_ReadRxBuff(char* ret_data, uint8_t* ret_data_len)
     //UART_enableRxInterrupt();
 }
 #endif
-void convertUint8ToChar(uint8_t in_val, char* output_3_chars)
+//the decimal formatters take powers of ten off by repeated subtraction. The AVR has no
+//divide instruction, a 16 bit / or % is a libgcc loop of ~200 cycles and the old code did
+//eight of them per number (from ISRs with DEBUG on). Counting down is at most 6+9+9+9 = 33
+//subtract/compare steps for a 16 bit value and 2+9 for an 8 bit one
+
+/** Private function, takes as many powers as fit off the remainder
+ *  @RETURN the digit (how many were taken off)
+ */
+static inline uint8_t _takeDigit16(uint16_t* remainder, uint16_t power)
 {
-    uint8_t ones;
-    uint8_t tens;
-    uint8_t hundreds;
-    uint8_t remainder;
-    
-    remainder = in_val;
-    
-    //now we integer divide, to isolate our digit of interest   
-    hundreds = remainder / 100;
-    remainder -= (hundreds * 100);
-    
-    tens = remainder / 10;
-    ones = remainder - (tens * 10);
+    uint8_t digit = 0;
     
-    if (in_val >= 100)
+    while (*remainder >= power)
     {
-        output_3_chars[0] = (char)(ASCII_0 + hundreds);
-    }
-    else
-    {
-        output_3_chars[0] = ' ';
+        *remainder -= power;
+        digit++;
     }
     
-    if (in_val >= 10)
-    {
-        output_3_chars[1] = (char)(ASCII_0 + tens);
-    }
-    else
-    {
-        output_3_chars[1] = ' ';
-    }
-    
-    output_3_chars[2] = (char)(ASCII_0 + ones);
+    return digit;
 }
 
-void convertUint16ToChar(uint16_t in_val, char* output_6_chars)
+static inline uint8_t _takeDigit8(uint8_t* remainder, uint8_t power)
 {
-    uint8_t ones;
-    uint8_t tens;
-    uint8_t hundreds;
-    uint16_t thousands;
-    uint16_t ten_thousands;
-    uint16_t remainder;
-    
-    remainder = in_val;
-    
-    //now we integer divide, to isolate our digit of interest
-    ten_thousands = remainder / 10000;
-    remainder -= (ten_thousands * 10000);
-    
-    thousands = remainder / 1000;
-    remainder -= (thousands * 1000);
-    
-    hundreds = remainder / 100;
-    remainder -= (hundreds * 100);
+    uint8_t digit = 0;
     
-    tens = remainder / 10;
-    ones = remainder - (tens * 10);
-    
-    if (in_val >= 10000)
-    {
-        output_6_chars[0] = (char)(ASCII_0 + ten_thousands);
-    }
-    else
-    {
-        output_6_chars[0] = ' ';
-    }
-    
-    if (in_val >= 1000)
-    {
-        output_6_chars[1] = (char)(ASCII_0 + thousands);
-        output_6_chars[2] = ',';
-    }
-    else
+    while (*remainder >= power)
     {
-        output_6_chars[1] = ' ';
-        output_6_chars[2] = ' ';
+        *remainder -= power;
+        digit++;
     }
     
-    if (in_val >= 100)
-    {
-        output_6_chars[3] = (char)(ASCII_0 + hundreds);
-    }
-    else
+    return digit;
+}
+
+/** Private function, one digit of a right aligned number. Leading zeros are written as
+ *  *fill (a space), the first non zero digit switches *fill to '0' for all later digits
+ */
+static inline char _digitChar(uint8_t digit, char* fill)
+{
+    if (digit != 0)
     {
-        output_6_chars[3] = ' ';
+        *fill = ASCII_0;
     }
     
-    if (in_val >= 10)
-    {
-        output_6_chars[4] = (char)(ASCII_0 + tens);
-    }
-    else
-    {
-        output_6_chars[4] = ' ';
-    }
+    return (char)(*fill + digit);
+}
+
+/** Private function, the 6 char "xx,xxx" format of convertUint16ToChar */
+static void _formatUint16(uint16_t in_val, char* output_6_chars)
+{
+    uint16_t remainder = in_val;
+    char fill = ' ';
+    
+    output_6_chars[0] = _digitChar(_takeDigit16(&remainder, 10000), &fill);
+    output_6_chars[1] = _digitChar(_takeDigit16(&remainder, 1000), &fill);
+    //the comma only shows once there is a thousands digit
+    output_6_chars[2] = (fill == ASCII_0) ? ',' : ' ';
+    output_6_chars[3] = _digitChar(_takeDigit16(&remainder, 100), &fill);
+    output_6_chars[4] = _digitChar(_takeDigit16(&remainder, 10), &fill);
+    output_6_chars[5] = (char)(ASCII_0 + remainder);
+}
+
+/** Private function, the 3 char format of convertUint8ToChar */
+static void _formatUint8(uint8_t in_val, char* output_3_chars)
+{
+    uint8_t remainder = in_val;
+    char fill = ' ';
     
-    output_6_chars[5] = (char)(ASCII_0 + ones);
+    output_3_chars[0] = _digitChar(_takeDigit8(&remainder, 100), &fill);
+    output_3_chars[1] = _digitChar(_takeDigit8(&remainder, 10), &fill);
+    output_3_chars[2] = (char)(ASCII_0 + remainder);
+}
+
+void convertUint8ToChar(uint8_t in_val, char* output_3_chars)
+{
+    _formatUint8(in_val, output_3_chars);
+}
+
+void convertUint16ToChar(uint16_t in_val, char* output_6_chars)
+{
+    _formatUint16(in_val, output_6_chars);
 }
 
 void convertInt8ToChar(int8_t in_val, char* output_4_chars)
 {
-    uint8_t ones;
-    uint8_t tens;
-    uint8_t hundreds;
-    uint8_t remainder;
-    uint8_t is_neg;
-    
-    if (in_val < 0)
-    {
-        is_neg = 1;
-        in_val = -1 * in_val;
-    }
-    else
-    {
-        is_neg = 0;
-    }
-    
-    remainder = in_val;
-    
-    //now we integer divide, to isolate our digit of interest
-    hundreds = remainder / 100;
-    remainder -= (hundreds * 100);
-    
-    tens = remainder / 10;
-    ones = remainder - (tens * 10);
-    
-    //format
-    output_4_chars[3] = (char)(ASCII_0 + ones);
-    
-    if (in_val >= 10)
-    {
-        output_4_chars[2] = (char)(ASCII_0 + tens);
-    }
-    else
-    {
-        output_4_chars[2] = ' ';
-    }
-    
+    //magnitude in unsigned math so -128 doesn't overflow
+    uint8_t magnitude = (in_val < 0) ? (uint8_t)(0 - (uint8_t)in_val) : (uint8_t)in_val;
     
-    if (in_val >= 100)
-    {
-        output_4_chars[1] = (char)(ASCII_0 + hundreds);
-    }
-    else
-    {
-        output_4_chars[1] = ' ';
-    }
-    
-    if(is_neg)
-    {
-        output_4_chars[0] = '-';
-    }
-    else
-    {
-        output_4_chars[0] = ' ';
-    }
+    output_4_chars[0] = (in_val < 0) ? '-' : ' ';
+    _formatUint8(magnitude, &output_4_chars[1]);
 }
 
 void convertInt16ToChar(int16_t in_val, char* output_7_chars)
 {
-    uint8_t ones;
-    uint8_t tens;
-    uint8_t hundreds;
-    uint16_t thousands;
-    uint16_t ten_thousands;
-    uint16_t remainder;
-    uint8_t is_neg;
+    //magnitude in unsigned math so -32768 doesn't overflow
+    uint16_t magnitude = (in_val < 0) ? (uint16_t)(0 - (uint16_t)in_val) : (uint16_t)in_val;
     
-    if (in_val < 0)
-    {
-        is_neg = 1;
-        in_val = -1 * in_val;
-    }
-    else
-    {
-        is_neg = 0;
-    }
-    
-    remainder = in_val;
-    
-    //now we integer divide, to isolate our digit of interest
-    ten_thousands = remainder / 10000;
-    remainder -= (ten_thousands * 10000);
-    
-    thousands = remainder / 1000;
-    remainder -= (thousands * 1000);
-    
-    hundreds = remainder / 100;
-    remainder -= (hundreds * 100);
-    
-    tens = remainder / 10;
-    ones = remainder - (tens * 10);
-    
-    //format
-    output_7_chars[6] = (char)(ASCII_0 + ones);
-    
-    if (in_val >= 10)
-    {
-        output_7_chars[5] = (char)(ASCII_0 + tens);
-    }
-    else
-    {
-        output_7_chars[5] = ' ';
-    }
-    
-    if (in_val >= 100)
-    {
-        output_7_chars[4] = (char)(ASCII_0 + hundreds);
-    }
-    else
-    {
-        output_7_chars[4] = ' ';
-    }
+    output_7_chars[0] = (in_val < 0) ? '-' : ' ';
+    _formatUint16(magnitude, &output_7_chars[1]);
+}
+
+uint8_t convertUint16ToCharRaw(uint16_t in_val, char* output_5_chars)
+{
+    char padded[STR_UINT16_LEN];
+    uint8_t len = 0;
+    uint8_t ii;
     
-    if (in_val >= 1000)
-    {
-        output_7_chars[2] = (char)(ASCII_0 + thousands);
-        output_7_chars[3] = ',';
-    }
-    else
-    {
-        output_7_chars[2] = ' ';
-        output_7_chars[3] = ' ';
-    }
+    //same digits as the padded format, minus the padding and the comma
+    _formatUint16(in_val, padded);
     
-    if (in_val >= 10000)
-    {
-        output_7_chars[1] = (char)(ASCII_0 + ten_thousands);
-    }
-    else
+    for (ii = 0; ii < STR_UINT16_LEN; ii++)
     {
-        output_7_chars[1] = ' ';
+        if ((padded[ii] != ' ') && (padded[ii] != ','))
+        {
+            output_5_chars[len++] = padded[ii];
+        }
     }
     
-    if(is_neg)
-    {
-        output_7_chars[0] = '-';
-        is_neg = 0;
-    }
-    else
-    {
-        output_7_chars[0] = ' ';
-    }
-}
\ No newline at end of file
+    return len;
+}
+
+/** Private function, one hex digit 0-F */
+static inline char _hexChar(uint8_t nibble)
+{
+    return (char)((nibble < 10) ? (ASCII_0 + nibble) : ('A' - 10 + nibble));
+}
+
+void convertUint8ToHex(uint8_t in_val, char* output_2_chars)
+{
+    output_2_chars[0] = _hexChar(in_val >> 4);
+    output_2_chars[1] = _hexChar(in_val & 0x0F);
+}
+
+void convertUint16ToHex(uint16_t in_val, char* output_4_chars)
+{
+    convertUint8ToHex((uint8_t)(in_val >> 8), &output_4_chars[0]);
+    convertUint8ToHex((uint8_t)in_val, &output_4_chars[2]);
+}
@@ -11,12 +11,18 @@
 
 #include "global.h"
 ///This tells the maximum Rx buffer length for asyncronous Rx storage, Interrupts must be enabled to use this
-#define _UART_RX_BUFF_MAX_LEN 128
+///The shell reads its lines in place here, 63 chars is plenty for a command and the RAM is short
+#define _UART_RX_BUFF_MAX_LEN 64
+///This is the Tx queue length, it is drained by the data register empty interrupt. Must be a power of 2
+#define _UART_TX_BUFF_MAX_LEN 64
 
 #define STR_UINT8_LEN   3
 #define STR_UINT16_LEN  6
 #define STR_INT8_LEN    4
 #define STR_INT16_LEN   7
+#define STR_UINT16_RAW_LEN  5   /// longest, the raw format is only as long as the number
+#define STR_HEX8_LEN    2
+#define STR_HEX16_LEN   4
 
 #define CIRCULAR_BUFFER 1   //without circular buffer you save 100 bytes of progmem and 2 of datamem
 #define ECHO_ON 1
@@ -62,6 +68,15 @@ typedef enum _eUartBaudRate
     b1000000,  /// this speed is only valid above 8MHz
 }eUartBaudRate;
 
+/** What to do with a new Tx byte when the Tx queue is already full */
+typedef enum _eUartTxFullPolicy
+{
+    tx_full_drop_default,   /// the new byte is discarded
+    tx_full_overwrite,      /// the oldest queued byte is discarded to make room
+    tx_full_block,          /// wait for room. Only honored when interrupts are enabled (never
+                            /// inside an ISR), otherwise it behaves like tx_full_drop_default
+}eUartTxFullPolicy;
+
 //configuration
 void uart_default(void);
 void uart_SetCharWidth(eUARTCharSize value);
@@ -70,6 +85,7 @@ void uart_SetStopBits(eUARTStopBits value);
 bool uart_SetBaudRate(eUartBaudRate value);
 void UART_enableRxInterrupt(void);
 void UART_disableRxInterrupt(void);
+void UART_SetTxFullPolicy(eUartTxFullPolicy value);
 
 //use
 void uart_enable(eUartBaudRate baud_rate,
@@ -78,11 +94,46 @@ void uart_enable(eUartBaudRate baud_rate,
                  eUartParityMode parity);
 void uart_disable(void);
 
+/** Queues one byte for transmission. This never waits on the UART itself, the
+ *  byte is sent from ISR(USART_UDRE_vect) so it is safe to call from other ISRs.
+ *  @PARAM data - the byte to send
+ *  @RETURN true if the byte was queued, false if it was dropped (queue full)
+ *  @NOTE only the tx_full_block policy can wait, and only outside of ISRs
+ */
+bool UART_TxEnqueue(char data);
+
+/** Takes len slots of the Tx queue for a frame that is written straight into them, e.g. a
+ *  binary frame that must not be cut or have other output (the Rx echo, log lines) mixed
+ *  into it. The whole frame gets room or nothing does. Bytes queued after this go out after
+ *  the frame. Never waits, whatever the policy. tx_full_overwrite drops the oldest queued
+ *  bytes to make room
+ *  @PARAM len - number of bytes UART_TxFramePut will write, less than _UART_TX_BUFF_MAX_LEN
+ *  @RETURN true if the slots were taken, false if the frame didn't fit
+ *  @NOTE main loop only, one frame at a time. Exactly len UART_TxFramePut calls and then
+ *  UART_TxFrameEnd must follow, nothing is sent past the frame start till then
+ */
+bool UART_TxFrameStart(uint8_t len);
+
+/** writes the next byte of the frame started by UART_TxFrameStart */
+void UART_TxFramePut(char data);
+
+/** the frame is complete, it is sent with whatever was queued after it */
+void UART_TxFrameEnd(void);
+
+/** @RETURN number of bytes the Tx queue can take right now. Producers in ISRs can take
+ *  some of it before the caller gets to queue its data
+ */
+uint8_t UART_TxFree(void);
+
 /** This will transmit a C style (null-terminated) string. 
  * @PARAM str - the string to print to UART
- * @RETURN number of bytes written
+ * @RETURN number of bytes queued, less than the string length if the Tx queue filled up
  */
 uint8_t UART_transmitString(char *str);
+/** Same as UART_transmitString for a string in flash, e.g. PSTR("text"). Keeps constant
+ *  text out of the 1KB of RAM
+ */
+uint8_t UART_transmitString_P(const char *str_P);
 uint8_t UART_transmitBytes(char *data, uint8_t len);
 void UART_TransmitByte(char data);
 void UART_transmitNewLine(void);
@@ -90,6 +141,9 @@ void UART_transmitUint8(uint8_t val);
 void UART_transmitUint16(uint16_t val);
 void UART_transmitInt8(int8_t val);
 void UART_transmitInt16(int16_t val);
+void UART_transmitUint16Raw(uint16_t val);  /// no padding, no comma, e.g. "1234"
+void UART_transmitHex8(uint8_t val);        /// 2 uppercase hex digits, no 0x
+void UART_transmitHex16(uint16_t val);      /// 4 uppercase hex digits, no 0x
 
 /** reads multiple characters of Rx data. 
  * @NOTE This function will block till all "desired_len" data bytess are read
@@ -105,16 +159,48 @@ void UART_ReceievBytes(char* ret_data,  uint8_t desired_len);
 void UART_ReceiveByte(char* ret_data);
 
 #ifdef CIRCULAR_BUFFER
-/** This function will return one line of data form the receive buffer. Line endings
- *  can be \r\n or \n or \r
- *  If the buffer is completely full this command will dump ALL data (may contain
+/** A received line, read in place in the Rx ring. A line that wraps around the end of
+ *  the ring comes in two parts, part1 is always first. The line ending isn't included
+ */
+typedef struct _sUartLine
+{
+    const char* part1;
+    const char* part2;
+    uint8_t len1;
+    uint8_t len2;           /// 0 unless the line wraps
+}sUartLine;
+
+/** Looks for one line in the receive buffer without copying it. Line endings can be
+ *  \r\n or \n or \r. The line stays in the ring (and the view valid) until
+ *  UART_ReleaseLine, calling this again before that returns the same line.
+ *  If the buffer is completely full this will hand out ALL data as one line (may contain
  *  multiple lines) This will allow the buffer to save new messages
+ *  The search for the line ending picks up where the last call stopped, so calling this
+ *  every pass of the main loop only looks at each received byte once
+ *  @NOTE must only be called from one place (the ring has a single reader)
+ *  @PARAM line [out] where the line is, only valid if true is returned
+ *  @RETURN true if a complete line is waiting
+ */
+bool UART_PeekLine(sUartLine* line);
+
+/** @RETURN the char at idx of the line (across both parts), 0 past the end of the line */
+char UART_LineChar(const sUartLine* line, uint8_t idx);
+
+/** Frees the line UART_PeekLine returned, with its line ending, for new data. The view
+ *  must not be used after this. Does nothing if no line is waiting
+ */
+void UART_ReleaseLine(void);
+
+/** This function will return one line of data form the receive buffer, copied out.
+ *  Same as UART_PeekLine followed by UART_ReleaseLine, the line endings are returned
+ *  with the line
  * @PARAM ret_data[output] all data in the rcv buffer. This buffer should be pre-initialized
  *  to 0 and must be at least _UART_RX_BUFF_MAX_LEN bytes long
  * @PARAM ret_data_len [out] the number of bytes returned.
  */
 void UART_ReadLineRxBuff(char* ret_data, uint8_t* ret_data_len);
-#else
+#endif // CIRCULAR_BUFFER
+
 /** This function will retrieve all data from the uart rcv buffer. This will only have data
  * if interrupts are enabled AND data has been received. It will return the data and
  * length to the calling program. 
@@ -125,7 +211,6 @@ void UART_ReadLineRxBuff(char* ret_data, uint8_t* ret_data_len);
  * @PARAM ret_data_len [out] the number of bytes returned.
  */
 void UART_ReadRxBuff(char* ret_data, uint8_t* ret_data_len);
-#endif // CIRCULAR_BUFFER
 
 /**  This function will convert a uint8_t value into a 3 digit
  *  string. This string will always be 3 chars long.
@@ -161,6 +246,27 @@ void convertInt8ToChar(int8_t in_val, char* output_4_chars);
  */
 void convertInt16ToChar(int16_t in_val, char* output_6_chars);
 
+/**  This function will convert a uint16_t value into a string of 1-5 digits, no padding,
+ *  no comma. For logs/CSV where the fixed width format is in the way
+ @PARAM in_val [input] the value to convert
+ @PARAM output_5_chars [output] the digits, not null terminated
+ @RETURN number of chars written
+ @NOTE the calling code must declare at least STR_UINT16_RAW_LEN chars for the output
+ */
+uint8_t convertUint16ToCharRaw(uint16_t in_val, char* output_5_chars);
+
+/**  This function will convert a uint8_t value into 2 uppercase hex digits
+ @PARAM in_val [input] the value to convert
+ @PARAM output_2_chars [output] the value as 2 hex digits, no 0x
+ */
+void convertUint8ToHex(uint8_t in_val, char* output_2_chars);
+
+/**  This function will convert a uint16_t value into 4 uppercase hex digits
+ @PARAM in_val [input] the value to convert
+ @PARAM output_4_chars [output] the value as 4 hex digits, no 0x
+ */
+void convertUint16ToHex(uint16_t in_val, char* output_4_chars);
+
 //////////////////////////////////////////////////////////////////////////
 //this might be a separate strng library
 
@@ -0,0 +1,279 @@
+/*
+ * blackbox.c
+ *
+ */
+
+#include "blackbox.h"
+#include "sw_timers.h"
+#include "telemetry.h"
+#include "config.h"
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+#define _BB_EVENT_MASK  (BLACKBOX_NUM_EVENTS - 1)
+///record bytes per dump frame, after the frame id and the offset
+#define _BB_DUMP_CHUNK  (TELEMETRY_MAX_PAYLOAD - 2)
+
+//the save and the dump count record bytes in 8 bits
+#if (BLACKBOX_NUM_EVENTS & _BB_EVENT_MASK) || (BLACKBOX_NUM_EVENTS > 16)
+#error "BLACKBOX_NUM_EVENTS must be a power of 2, at most 16"
+#endif
+
+static sBlackBox ee_blackbox EEMEM;
+
+//not cleared by the C startup code, a watchdog reset leaves it as it was
+static sBlackBox bb_ram __attribute__((section(".noinit")));
+
+static volatile bool bb_saving = false;         /// the ring is frozen, EE_RDY is copying it
+static volatile uint8_t bb_save_idx = 0;        /// next byte EE_RDY writes
+static volatile uint8_t bb_pending = eBB_CAUSE_NONE;
+static uint8_t bb_trip_saves = 0;
+
+//peak of the running window and of the one before it, LEFT, BRAKE, RIGHT
+static volatile uint16_t bb_peak[3];
+static volatile uint16_t bb_peak_prev[3];
+static uint32_t bb_window_start = 0;
+
+static uint8_t bb_dump_offset = sizeof(sBlackBox);  /// next record byte to send, none left
+
+static uint16_t _blackbox_crc(const sBlackBox* record)
+{
+    const uint8_t* data = (const uint8_t*)record;
+    uint16_t crc = 0xFFFF;
+    uint8_t ii;
+
+    for (ii = 0; ii < offsetof(sBlackBox, crc); ii++)
+    {
+        crc = _crc16_update(crc, data[ii]);
+    }
+
+    return crc;
+}
+
+/** freezes the ring and starts copying it to the EEPROM
+ *  @NOTE main loop only, the EEPROM must not be in use
+ */
+static void _blackbox_save(uint8_t cause)
+{
+    uint8_t idx;
+    uint16_t peak;
+
+    //the peaks leading up to the save are the last events in it, an output that drew
+    //nothing (or a save straight after a reset) has none
+    for (idx = 0; idx < 3; idx++)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            peak = (bb_peak[idx] > bb_peak_prev[idx]) ? bb_peak[idx] : bb_peak_prev[idx];
+        }
+
+        if (peak != 0)
+        {
+            blackbox_event(eBB_EVENT_PEAK, idx, peak);
+        }
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        bb_saving = true;
+    }
+
+    bb_ram.cause = cause;
+    bb_ram.crc = _blackbox_crc(&bb_ram);
+    bb_save_idx = 0;
+
+    //a dump that was going on would mix the old and the new record, start it over
+    if (bb_dump_offset < sizeof(sBlackBox))
+    {
+        bb_dump_offset = 0;
+    }
+
+    //fires as soon as the EEPROM is ready, straight away unless a write is still going
+    BIT_SET(EECR, EERIE);
+}
+
+/** one byte of the save per interrupt, a byte that is already in the EEPROM isn't
+ *  written again. The adc interrupt has the higher priority, a trip never waits for this
+ */
+ISR(EE_RDY_vect)
+{
+    const uint8_t* data = (const uint8_t*)&bb_ram;
+
+    if (bb_save_idx < sizeof(sBlackBox))
+    {
+        EEAR = (uint16_t)((uint8_t*)&ee_blackbox + bb_save_idx);
+        BIT_SET(EECR, EERE);
+
+        if (EEDR != data[bb_save_idx])
+        {
+            EEDR = data[bb_save_idx];
+            //EEWE has to follow EEMWE within 4 cycles, interrupts are off in here
+            BIT_SET(EECR, EEMWE);
+            BIT_SET(EECR, EEWE);
+        }
+
+        bb_save_idx++;
+    }
+    else
+    {
+        //the crc went last, a save cut short by a power loss doesn't check out
+        BIT_CLEAR(EECR, EERIE);
+        bb_saving = false;
+    }
+}
+
+void blackbox_init(uint8_t reset_flags)
+{
+    uint8_t idx;
+
+    //power on and brown out leave RAM undefined, anything else keeps it
+    if ((reset_flags & (BIT(PORF) | BIT(BORF)))
+        || (bb_ram.magic != BLACKBOX_MAGIC)
+        || (bb_ram.version != BLACKBOX_VERSION)
+        || (bb_ram.head > _BB_EVENT_MASK)
+        || (bb_ram.count > BLACKBOX_NUM_EVENTS))
+    {
+        bb_ram.magic = BLACKBOX_MAGIC;
+        bb_ram.version = BLACKBOX_VERSION;
+        bb_ram.head = 0;
+        bb_ram.count = 0;
+    }
+
+    bb_ram.cause = eBB_CAUSE_NONE;
+
+    for (idx = 0; idx < 3; idx++)
+    {
+        bb_peak[idx] = 0;
+        bb_peak_prev[idx] = 0;
+    }
+
+    bb_window_start = sw_timers_uptime();
+
+    blackbox_event(eBB_EVENT_RESET, 0, reset_flags);
+
+    if (reset_flags & BIT(WDRF))
+    {
+        blackbox_trigger(eBB_CAUSE_WATCHDOG);
+    }
+}
+
+void blackbox_event(uint8_t type, uint8_t channel, uint16_t value)
+{
+    uint32_t time_ms = sw_timers_uptime();
+    sBlackBoxEvent* event;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (!bb_saving)
+        {
+            event = &bb_ram.events[bb_ram.head];
+            event->time_ms = time_ms;
+            event->type = type;
+            event->channel = channel;
+            event->value = value;
+
+            bb_ram.head = (bb_ram.head + 1) & _BB_EVENT_MASK;
+
+            if (bb_ram.count < BLACKBOX_NUM_EVENTS)
+            {
+                bb_ram.count++;
+            }
+        }
+    }
+}
+
+void blackbox_current(uint8_t idx, uint16_t value)
+{
+    if (value > bb_peak[idx])
+    {
+        bb_peak[idx] = value;
+    }
+}
+
+void blackbox_trigger(uint8_t cause)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if ((bb_pending == eBB_CAUSE_NONE) && !bb_saving)
+        {
+            bb_pending = cause;
+        }
+    }
+}
+
+void blackbox_dump(void)
+{
+    bb_dump_offset = 0;
+}
+
+bool blackbox_busy(void)
+{
+    return bb_saving;
+}
+
+void blackbox_poll(void)
+{
+    uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+    uint8_t len;
+    uint8_t cause;
+    uint8_t idx;
+    uint32_t now = sw_timers_uptime();
+
+    if ((now - bb_window_start) >= BLACKBOX_PEAK_WINDOW_MS)
+    {
+        bb_window_start = now;
+
+        for (idx = 0; idx < 3; idx++)
+        {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                bb_peak_prev[idx] = bb_peak[idx];
+                bb_peak[idx] = 0;
+            }
+        }
+    }
+
+    //the EEPROM can't be read while EE_RDY is writing it, and a config save has to finish
+    //first (a pending save waits for it)
+    if (!bb_saving && !config_busy())
+    {
+        cause = bb_pending;
+
+        if (cause != eBB_CAUSE_NONE)
+        {
+            bb_pending = eBB_CAUSE_NONE;
+
+            if (cause != eBB_CAUSE_TRIP)
+            {
+                _blackbox_save(cause);
+            }
+            else if (bb_trip_saves < BLACKBOX_MAX_TRIP_SAVES)
+            {
+                bb_trip_saves++;
+                _blackbox_save(cause);
+            }
+        }
+        else if (bb_dump_offset < sizeof(sBlackBox))
+        {
+            len = sizeof(sBlackBox) - bb_dump_offset;
+            if (len > _BB_DUMP_CHUNK)
+            {
+                len = _BB_DUMP_CHUNK;
+            }
+
+            payload[0] = BLACKBOX_FRAME_ID;
+            payload[1] = bb_dump_offset;
+            eeprom_read_block(&payload[2], (const uint8_t*)&ee_blackbox + bb_dump_offset, len);
+
+            //tried again on the next poll if the Tx queue is too full
+            if (telemetry_send(payload, len + 2))
+            {
+                bb_dump_offset += len;
+            }
+        }
+    }
+}
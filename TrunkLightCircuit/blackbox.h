@@ -0,0 +1,110 @@
+/*
+ * blackbox.h
+ * Black box event recorder. The last BLACKBOX_NUM_EVENTS timestamped events (input edges,
+ * overcurrent trips, resets) are kept in a RAM ring that is not cleared at reset
+ * (.noinit), so it still holds what happened before a watchdog reset.
+ * An overcurrent trip or a watchdog reset saves the ring to a reserved EEPROM record.
+ * The save is started from the main loop and written one byte per EEPROM ready interrupt,
+ * nothing waits on the EEPROM, least of all the overcurrent trip in the adc interrupt.
+ * The shell "bbox" command sends the saved record as telemetry frames whose first payload
+ * byte is BLACKBOX_FRAME_ID, tools/blackbox_decode.py puts them back together.
+ *
+ */
+
+
+#ifndef BLACKBOX_H_
+#define BLACKBOX_H_
+
+#include "global.h"
+
+///events kept, must be a power of 2. 8 bytes of RAM and EEPROM each
+#define BLACKBOX_NUM_EVENTS     16
+///layout of sBlackBox, bump it when the record changes
+#define BLACKBOX_VERSION        1
+///sBlackBox.magic while the RAM ring holds events of this firmware
+#define BLACKBOX_MAGIC          0xB10C
+///first payload byte of a dump frame, telemetry frames start with their version instead
+#define BLACKBOX_FRAME_ID       0xF1
+///current peaks are taken over windows this long, the last two windows go in a save
+#define BLACKBOX_PEAK_WINDOW_MS 1000
+///trip saves per power up. An output on a hard short trips on every retry, the EEPROM
+///would be worn out in days if every trip was saved
+#define BLACKBOX_MAX_TRIP_SAVES 1
+
+typedef enum _eBB_EVENT
+{
+    eBB_EVENT_NONE,
+    eBB_EVENT_RESET,        /// value = MCUCSR reset flags
+    eBB_EVENT_BRAKE,        /// value = 1 on, 0 off
+    eBB_EVENT_LEFT,
+    eBB_EVENT_RIGHT,
+    eBB_EVENT_TRIP,         /// channel = ARR_IDX_xxx, value = feedback reading
+    eBB_EVENT_PEAK,         /// channel = ARR_IDX_xxx, value = highest reading before the save
+    eBB_EVENT_LAMP_OUT,     /// channel = ARR_IDX_xxx, value = 1 out, 0 back
+}eBB_EVENT;
+
+typedef enum _eBB_CAUSE
+{
+    eBB_CAUSE_NONE,         /// nothing saved yet
+    eBB_CAUSE_TRIP,
+    eBB_CAUSE_WATCHDOG,
+}eBB_CAUSE;
+
+/** Little endian, packed (-fpack-struct), 8 bytes */
+typedef struct _sBlackBoxEvent
+{
+    uint32_t time_ms;       /// sw_timers_uptime, restarts at 0 after a reset
+    uint8_t  type;          /// eBB_EVENT
+    uint8_t  channel;       /// ARR_IDX_xxx, 0 for events without one
+    uint16_t value;
+}sBlackBoxEvent;
+
+/** The RAM ring and the EEPROM record are the same layout, a save is a straight copy */
+typedef struct _sBlackBox
+{
+    uint16_t magic;         /// BLACKBOX_MAGIC
+    uint8_t  version;       /// BLACKBOX_VERSION
+    uint8_t  cause;         /// eBB_CAUSE of the save
+    uint8_t  head;          /// next event to write, the oldest one once the ring is full
+    uint8_t  count;         /// events in the ring, at most BLACKBOX_NUM_EVENTS
+    sBlackBoxEvent events[BLACKBOX_NUM_EVENTS];
+    uint16_t crc;           /// crc16 of everything above, only filled in for a save
+}sBlackBox;
+
+/** keeps the events from before the reset if it was a watchdog or external reset, starts
+ *  an empty ring otherwise. Records the reset and, after a watchdog reset, saves the ring.
+ *  Call it once at boot, after sw_timers_init
+ *  @PARAM reset_flags - MCUCSR as it was at reset
+ */
+void blackbox_init(uint8_t reset_flags);
+
+/** adds an event, the oldest one goes once the ring is full. Safe from ISRs.
+ *  Events are dropped while a save is copying the ring
+ *  @PARAM type - eBB_EVENT
+ *  @PARAM channel - ARR_IDX_xxx, 0 if the event has none
+ */
+void blackbox_event(uint8_t type, uint8_t channel, uint16_t value);
+
+/** keeps the highest current reading of each output for the PEAK events of a save.
+ *  Called for every feedback conversion, from the adc interrupt
+ */
+void blackbox_current(uint8_t idx, uint16_t value);
+
+/** asks for a save, the main loop starts it on its next blackbox_poll. Safe from ISRs,
+ *  ignored while a save is pending or running
+ *  @PARAM cause - eBB_CAUSE
+ */
+void blackbox_trigger(uint8_t cause);
+
+/** starts sending the saved record, see BLACKBOX_FRAME_ID */
+void blackbox_dump(void);
+
+/** @RETURN true while a save is writing the EEPROM, nothing else may use it then */
+bool blackbox_busy(void);
+
+/** starts a pending save, rolls the peak windows and sends the next dump frame.
+ *  Call it from the main loop
+ */
+void blackbox_poll(void);
+
+#endif /* BLACKBOX_H_ */
@@ -0,0 +1,127 @@
+/*
+ * config.c
+ *
+ */ 
+
+#include "config.h"
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <util/atomic.h>
+
+static sConfig ee_config_slots[CONFIG_NUM_SLOTS] EEMEM;
+
+///slot the RAM copy came from (or was last saved to), the next save goes one further
+static uint8_t config_slot = CONFIG_NUM_SLOTS - 1;
+
+static sConfig config_save_copy;            /// what config_poll is writing
+static uint8_t config_save_idx = 0;         /// next byte config_poll writes
+static bool config_saving = false;
+
+static uint16_t _config_crc(const sConfig* config)
+{
+    const uint8_t* data = (const uint8_t*)config;
+    uint16_t crc = 0xFFFF;
+    uint8_t ii;
+
+    for (ii = 0; ii < offsetof(sConfig, crc); ii++)
+    {
+        crc = _crc16_update(crc, data[ii]);
+    }
+
+    return crc;
+}
+
+bool config_load(sConfig* config, const sConfig* defaults_P)
+{
+    sConfig slot;
+    bool found = false;
+    uint8_t ii;
+
+    for (ii = 0; ii < CONFIG_NUM_SLOTS; ii++)
+    {
+        eeprom_read_block(&slot, &ee_config_slots[ii], sizeof(slot));
+
+        if ((slot.version == CONFIG_VERSION) && (slot.crc == _config_crc(&slot)))
+        {
+            //the sequence wraps, newer is a positive difference. Slots never span more
+            //than CONFIG_NUM_SLOTS saves so this can't be fooled
+            if (!found || ((int8_t)(slot.sequence - config->sequence) > 0))
+            {
+                *config = slot;
+                config_slot = ii;
+                found = true;
+            }
+        }
+    }
+
+    if (!found)
+    {
+        memcpy_P(config, defaults_P, sizeof(*config));
+        config->version = CONFIG_VERSION;
+        config->sequence = 0;
+        config_slot = CONFIG_NUM_SLOTS - 1;
+    }
+
+    return found;
+}
+
+void config_save(sConfig* config)
+{
+    config_slot++;
+    if (config_slot >= CONFIG_NUM_SLOTS)
+    {
+        config_slot = 0;
+    }
+
+    config->version = CONFIG_VERSION;
+    config->sequence++;
+    config->crc = _config_crc(config);
+
+    config_save_copy = *config;
+    config_save_idx = 0;
+    config_saving = true;
+}
+
+bool config_busy(void)
+{
+    return config_saving;
+}
+
+bool config_poll(void)
+{
+    const uint8_t* data = (const uint8_t*)&config_save_copy;
+
+    //EEWE stays set till the byte before is in
+    if (!config_saving || BIT_GET(EECR, EEWE))
+    {
+        return false;
+    }
+
+    if (config_save_idx >= sizeof(sConfig))
+    {
+        //the crc went last, a save cut short by a power loss doesn't check out
+        config_saving = false;
+        return true;
+    }
+
+    EEAR = (uint16_t)((uint8_t*)&ee_config_slots[config_slot] + config_save_idx);
+    BIT_SET(EECR, EERE);
+
+    if (EEDR != data[config_save_idx])
+    {
+        EEDR = data[config_save_idx];
+        //EEWE has to follow EEMWE within 4 cycles
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            BIT_SET(EECR, EEMWE);
+            BIT_SET(EECR, EEWE);
+        }
+    }
+
+    config_save_idx++;
+
+    return false;
+}
@@ -0,0 +1,73 @@
+/*
+ * config.h
+ * Per vehicle settings kept in EEPROM. The block is versioned and CRC protected, it is
+ * read once at boot into a RAM copy and the firmware only ever uses the RAM copy.
+ * Saves are wear leveled: every save goes to the next of CONFIG_NUM_SLOTS slots with a
+ * sequence number one higher, at boot the valid slot with the newest sequence wins. The
+ * previous slot is left alone, so a save cut short by a power loss falls back to it.
+ *
+ */
+
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include "global.h"
+
+///layout version, records with another version are ignored (defaults are used)
+#define CONFIG_VERSION      2
+///number of slots the saves rotate over, multiplies the EEPROM life by this much
+#define CONFIG_NUM_SLOTS    8
+
+///flags
+#define CONFIG_FLAG_POT_LOCKOUT     0x01    /// flash speed and pattern come from the config, the
+                                            /// pots aren't converted at all
+
+typedef enum _eLIGHT_MODE
+{
+    eLIGHT_MODE_AUTO,           /// detect at boot from the brake light current
+    eLIGHT_MODE_SEPARATE,       /// separate brake light
+    eLIGHT_MODE_INTEGRATED,     /// left/right do brake duty
+}eLIGHT_MODE;
+
+typedef struct _sConfig
+{
+    uint8_t  version;           /// CONFIG_VERSION
+    uint8_t  sequence;          /// save counter, newest slot wins
+    uint16_t current_limit;     /// overcurrent trip, feedback adc counts
+    uint8_t  brightness_low;    /// running light brightness, perceptual 0-255
+    uint8_t  light_mode;        /// eLIGHT_MODE
+    uint8_t  flags;             /// CONFIG_FLAG_xxx
+    uint8_t  flash_step_ms;     /// brake pattern beat with the pots locked out
+    uint8_t  brake_pattern;     /// brake pattern with the pots locked out
+    uint8_t  telemetry_period_ms; /// binary telemetry frame every n ms, 0 = off
+    uint16_t crc;               /// crc16 of everything above
+}sConfig;
+
+/** loads the newest valid slot
+ *  @PARAM config - RAM copy to fill
+ *  @PARAM defaults_P - defaults in PROGMEM, used when no slot is valid
+ *  @RETURN true if the config came from EEPROM, false if the defaults were used
+ */
+bool config_load(sConfig* config, const sConfig* defaults_P);
+
+/** starts a save to the next slot, the sequence number, version and crc are filled in here.
+ *  Doesn't wait for the EEPROM, config_poll writes the bytes. Main loop only, the EEPROM
+ *  must not be in use
+ *  @PARAM config - RAM copy to save, its sequence and crc are updated. A copy is taken, it
+ *  can change while the save goes on
+ */
+void config_save(sConfig* config);
+
+/** @RETURN true while a save is being written, the EEPROM is in use
+ */
+bool config_busy(void);
+
+/** writes the next byte of the save once the EEPROM is done with the one before (8.5ms
+ *  per changed byte), a byte that is already in the EEPROM isn't written again
+ *  @RETURN true once, when the last byte of the save is written
+ *  @NOTE call every main loop pass
+ */
+bool config_poll(void);
+
+#endif /* CONFIG_H_ */
@@ -9,7 +9,11 @@
 #ifndef GLOBAL_H_
 #define GLOBAL_H_
 
+//can be overridden from the command line (-DF_CPU=...) e.g. for a build with a different
+//crystal or a native build against mock registers
+#ifndef F_CPU
 #define F_CPU  16000000UL
+#endif
 #include <util/delay.h>
 #include <avr/io.h> //this should work but for some reason its not 
 //  it should automatically see I chose atmega8A and use the iom8a.h 
@@ -22,10 +26,35 @@
 #define BIT_SET(p,x) ((p) |= ( 1 << x))
 #define BIT_CLEAR(p,x) ((p) &= ~(1 << x))
 #define BIT_FLIP(p,x) ((p) ^= (1 << x))
-#define BIT_WRITE(c,p,m) (c ? bit_set(p,m) : bit_clear(p,m))
+#define BIT_WRITE(c,p,m) ((c) ? BIT_SET(p,m) : BIT_CLEAR(p,m))
 #define BIT(x) (0x01 << (x))
 #define LONGBIT(x) ((unsigned long)0x00000001 << (x))
 
+//ISR profiling. Build with ISR_PROFILE defined and each profiled ISR drives a spare pin
+//high from entry to exit, a simulator pin trace (simavr VCD) or logic analyzer then gives
+//the ISR duration in cycles. The brake output marker toggles every time OCR2 is written
+//so INT1 edge (PD3) -> OCR2 update latency can be read off the same trace.
+//Without ISR_PROFILE the macros are empty and cost nothing.
+//                  port , pin
+#define PROFILE_ADC      PORTB, PINB0  /// ISR(ADC_vect)
+#define PROFILE_TIMER0   PORTB, PINB4  /// ISR(TIMER0_OVF_vect)
+#define PROFILE_UART_RX  PORTB, PINB5  /// ISR(USART_RXC_vect)
+#define PROFILE_OCR2     PORTC, PINC5  /// toggles on every brake output (OCR2) write
+
+#ifdef ISR_PROFILE
+//extra level so the port,pin pair is expanded into two arguments
+#define _PROFILE_SET(port,pin)      BIT_SET(port,pin)
+#define _PROFILE_CLEAR(port,pin)    BIT_CLEAR(port,pin)
+#define _PROFILE_FLIP(port,pin)     BIT_FLIP(port,pin)
+#define PROFILE_START(id)           _PROFILE_SET(id)
+#define PROFILE_END(id)             _PROFILE_CLEAR(id)
+#define PROFILE_MARK(id)            _PROFILE_FLIP(id)
+#else
+#define PROFILE_START(id)
+#define PROFILE_END(id)
+#define PROFILE_MARK(id)
+#endif // ISR_PROFILE
+
 //this will ensure  only one bit is set.
 #define CHECK_ONLY_SINGLE_BIT_SET(x) ((x != 0) && (!(x & (x-1))))
 
@@ -45,6 +74,7 @@ typedef enum
 /// 2. integrated 2 light outputs: left/brake, right/brake
 /// TRUE - we are in case 2 (integrated lights)
 /// FALSE= we are in case 1 
-bool gbINTEGRATED_TURN_AND_BRAKE;
+/// defined in main.c, this header is included by every file so it can only be declared here
+extern bool gbINTEGRATED_TURN_AND_BRAKE;
 
 #endif /* GLOBAL_H_ */
\ No newline at end of file
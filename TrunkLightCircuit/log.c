@@ -0,0 +1,161 @@
+/*
+ * log.c
+ *
+ */
+
+#include "log.h"
+#include "telemetry.h"
+#include <util/atomic.h>
+
+#define _LOG_BUFF_MASK (LOG_BUFF_LEN - 1)
+
+#if (LOG_BUFF_LEN & _LOG_BUFF_MASK) || (LOG_BUFF_LEN > 256)
+#error "LOG_BUFF_LEN must be a power of 2, at most 256"
+#endif
+
+#if (LOG_NUM_MESSAGES > LOG_MAX_MESSAGES)
+#error "too many log messages, the header only has 6 bits for the id"
+#endif
+
+//string table for tools/log_decode.py: a version string, the module names, an empty
+//string, then 5 strings per message in id order. The section has no "a" flag, so it is
+//kept in the ELF but never loaded into flash (and --gc-sections leaves it alone)
+#define _LOG_MODULE_STR(module)     "\t.asciz \"" #module "\"\n"
+#define _LOG_MESSAGE_STR(name, module, level, args, text)   \
+    "\t.asciz \"" #name "\", \"" #module "\", \"" #level "\", \"" #args "\", " #text "\n"
+
+__asm__(".pushsection .logstr, \"\", @progbits\n"
+        "\t.asciz \"logstr1\"\n"
+        LOG_MODULE_LIST(_LOG_MODULE_STR)
+        "\t.asciz \"\"\n"
+        LOG_MESSAGE_LIST(_LOG_MESSAGE_STR)
+        ".popsection\n");
+
+//bytes of arguments for each length code
+static const uint8_t arr_log_arg_len[4] = {0, 1, 2, 4};
+
+uint8_t gu8_LOG_LEVEL[LOG_NUM_MODULES];
+
+//any number of producers (main and ISRs) claim space with interrupts off, only
+//log_flush moves tail
+static uint8_t log_buff[LOG_BUFF_LEN];
+static volatile uint8_t log_head_idx = 0;
+static volatile uint8_t log_tail_idx = 0;
+static uint8_t log_dropped = 0;             /// records lost since the last LOG_ID_DROPPED
+static uint8_t log_frame_sequence = 0;      /// +1 per frame sent
+
+/** copies len bytes of the value into the ring, little endian
+ *  @NOTE interrupts must be off, the room must have been checked
+ */
+static void _log_put(uint16_t value, uint8_t len)
+{
+    while (len > 0)
+    {
+        log_buff[log_head_idx] = (uint8_t)value;
+        log_head_idx = (log_head_idx + 1) & _LOG_BUFF_MASK;
+        value >>= 8;
+        len--;
+    }
+}
+
+void log_init(void)
+{
+    uint8_t module;
+
+    for (module = 0; module < LOG_NUM_MODULES; module++)
+    {
+        gu8_LOG_LEVEL[module] = LOG_LVL_DEFAULT;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        log_head_idx = 0;
+        log_tail_idx = 0;
+        log_dropped = 0;
+    }
+}
+
+bool log_set_level(uint8_t module, uint8_t level)
+{
+    bool ret_value = false;
+
+    if ((module < LOG_NUM_MODULES) && (level <= LOG_LVL_DEBUG))
+    {
+        gu8_LOG_LEVEL[module] = level;
+        ret_value = true;
+    }
+
+    return ret_value;
+}
+
+void log_write(uint8_t header, uint16_t arg0, uint16_t arg1)
+{
+    uint8_t len = arr_log_arg_len[header >> 6];
+    uint8_t room;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        //one slot stays empty to tell a full ring from an empty one
+        room = (log_tail_idx - log_head_idx - 1) & _LOG_BUFF_MASK;
+
+        //a pending drop count goes in first, so the gap shows up where it happened
+        if ((log_dropped > 0) && (room >= 2))
+        {
+            _log_put(LOG_HDR_DROPPED, 1);
+            _log_put(log_dropped, 1);
+            log_dropped = 0;
+            room -= 2;
+        }
+
+        if ((log_dropped == 0) && (room > len))
+        {
+            _log_put(header, 1);
+            _log_put(arg0, (len > 2) ? 2 : len);
+            _log_put(arg1, (len > 2) ? 2 : 0);
+        }
+        else if (log_dropped < UINT8_MAX)
+        {
+            log_dropped++;
+        }
+    }
+}
+
+void log_flush(void)
+{
+    uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+    uint8_t payload_len = 2;
+    uint8_t tail = log_tail_idx;
+    uint8_t head = log_head_idx;    //records written while this runs go in the next frame
+    uint8_t record_len;
+    bool full = false;
+
+    payload[0] = LOG_FRAME_ID;
+    payload[1] = log_frame_sequence;
+
+    //whole records only, a frame can be lost on its own without breaking the others
+    while ((tail != head) && !full)
+    {
+        record_len = 1 + arr_log_arg_len[log_buff[tail] >> 6];
+
+        if (payload_len + record_len > TELEMETRY_MAX_PAYLOAD)
+        {
+            full = true;
+        }
+        else
+        {
+            while (record_len > 0)
+            {
+                payload[payload_len++] = log_buff[tail];
+                tail = (tail + 1) & _LOG_BUFF_MASK;
+                record_len--;
+            }
+        }
+    }
+
+    //the records stay in the ring if the Tx queue can't take the frame now
+    if ((payload_len > 2) && telemetry_send(payload, payload_len))
+    {
+        log_tail_idx = tail;
+        log_frame_sequence++;
+    }
+}
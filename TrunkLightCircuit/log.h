@@ -0,0 +1,102 @@
+/*
+ * log.h
+ * Binary event log. A log call only stores a 1 byte header (message id and argument
+ * length) and the raw arguments in a RAM ring, nothing is formatted on the target. The
+ * text of every message is in the .logstr section of the ELF (not loaded into flash),
+ * tools/log_decode.py formats the records with it.
+ * The ring is sent from the main loop as telemetry frames (telemetry.h) whose first
+ * payload byte is LOG_FRAME_ID, so it works from ISRs and costs the same in every build.
+ * A message is only recorded if its level is enabled for its module, that check is a
+ * load and a compare at the call site.
+ *
+ */
+
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include "global.h"
+#include "log_msgs.h"
+
+///RAM ring for the records, must be a power of 2
+#define LOG_BUFF_LEN        64
+///the header has 6 bits for the id
+#define LOG_MAX_MESSAGES    64
+///first payload byte of a log frame, telemetry frames start with their version instead
+#define LOG_FRAME_ID        0xF0
+
+///levels, a module set to a level records that level and everything more severe
+#define LOG_LVL_OFF         0
+#define LOG_LVL_ERROR       1
+#define LOG_LVL_WARN        2
+#define LOG_LVL_INFO        3
+#define LOG_LVL_DEBUG       4
+#define LOG_LVL_DEFAULT     LOG_LVL_INFO
+
+///argument bytes, coded in the top 2 bits of the header
+#define LOG_LEN_CODE_NONE   0   /// 0 bytes
+#define LOG_LEN_CODE_U8     1   /// 1 byte
+#define LOG_LEN_CODE_U16    2   /// 2 bytes
+#define LOG_LEN_CODE_I16    2
+#define LOG_LEN_CODE_U16X2  3   /// 4 bytes
+
+#define _LOG_MODULE_ENUM(module)    LOG_MOD_##module,
+typedef enum _eLOG_MODULE
+{
+    LOG_MODULE_LIST(_LOG_MODULE_ENUM)
+    LOG_NUM_MODULES
+}eLOG_MODULE;
+
+#define _LOG_ID_ENUM(name, module, level, args, text)       LOG_ID_##name,
+#define _LOG_HDR_ENUM(name, module, level, args, text)      \
+    LOG_HDR_##name = LOG_ID_##name | (LOG_LEN_CODE_##args << 6),
+#define _LOG_FILTER_ENUM(name, module, level, args, text)   \
+    LOG_FILTER_##name = (LOG_MOD_##module << 3) | LOG_LVL_##level,
+
+enum { LOG_MESSAGE_LIST(_LOG_ID_ENUM) LOG_NUM_MESSAGES };
+enum { LOG_MESSAGE_LIST(_LOG_HDR_ENUM) };
+enum { LOG_MESSAGE_LIST(_LOG_FILTER_ENUM) };
+
+///level of each module, LOG_LVL_xxx
+extern uint8_t gu8_LOG_LEVEL[LOG_NUM_MODULES];
+
+#define LOG_ENABLED(name) \
+    ((LOG_FILTER_##name & 0x07) <= gu8_LOG_LEVEL[LOG_FILTER_##name >> 3])
+
+/** records a message, name is its X() name in log_msgs.h, e.g. LOG1(BRAKE_TEST, value).
+ *  Arguments the message doesn't take are ignored
+ */
+#define LOG(name)           LOG2(name, 0, 0)
+#define LOG1(name, a)       LOG2(name, a, 0)
+#define LOG2(name, a, b)                                    \
+    do                                                      \
+    {                                                       \
+        if (LOG_ENABLED(name))                              \
+        {                                                   \
+            log_write(LOG_HDR_##name, (a), (b));            \
+        }                                                   \
+    } while (0)
+
+/** sets every module to LOG_LVL_DEFAULT and empties the ring */
+void log_init(void);
+
+/** @PARAM module - eLOG_MODULE
+ *  @PARAM level - LOG_LVL_xxx
+ *  @RETURN false if the module doesn't exist
+ */
+bool log_set_level(uint8_t module, uint8_t level);
+
+/** stores one record, use the LOG macros. Safe from ISRs. If the ring is full the record
+ *  is dropped and counted, the count is recorded (LOG_ID_DROPPED) once there is room
+ *  @PARAM header - LOG_HDR_xxx
+ *  @PARAM arg0 - first argument, only as many bytes as the header says are stored
+ *  @PARAM arg1 - second argument of U16X2 messages
+ */
+void log_write(uint8_t header, uint16_t arg0, uint16_t arg1);
+
+/** sends the records in the ring as one telemetry frame, as many whole records as fit.
+ *  Call it from the main loop, records stay in the ring while the Tx queue is too full
+ */
+void log_flush(void);
+
+#endif /* LOG_H_ */
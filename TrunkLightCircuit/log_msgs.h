@@ -0,0 +1,46 @@
+/*
+ * log_msgs.h
+ * Every message the firmware can log, used by log.h to build the ids and by log.c to
+ * build the string table. Ids are given in list order, add new messages at the end so
+ * older captures still decode (at most LOG_MAX_MESSAGES)
+ *
+ *  X(name, module, level, args, text)
+ *      module - LOG_MODULE_LIST entry, its level is set at runtime (log_set_level)
+ *      level  - ERROR, WARN, INFO or DEBUG
+ *      args   - NONE, U8, U16, I16 or U16X2, what LOG1/LOG2 record
+ *      text   - python str.format text for tools/log_decode.py, one {} per argument
+ *
+ */
+
+
+#ifndef LOG_MSGS_H_
+#define LOG_MSGS_H_
+
+#define LOG_MODULE_LIST(X)  \
+    X(LOG)                  \
+    X(MAIN)                 \
+    X(ADC)                  \
+    X(LIGHT)                \
+    X(INPUT)
+
+#define LOG_MESSAGE_LIST(X) \
+    X(DROPPED,          LOG,   WARN,  U8,    "{} log records dropped, the ring was full")   \
+    X(BOOT,             MAIN,  INFO,  NONE,  "firmware starting")                           \
+    X(LED_INIT_FAIL,    MAIN,  ERROR, NONE,  "status LED init failed")                      \
+    X(BRAKE_TEST,       MAIN,  INFO,  U16X2, "brake lamp window current {} pwm {}")         \
+    X(LIGHTS_SEPARATE,  MAIN,  INFO,  NONE,  "separate brake light")                        \
+    X(LIGHTS_INTEGRATED,MAIN,  INFO,  NONE,  "integrated brake/turn lights")                \
+    X(OVERCURRENT,      ADC,   ERROR, U16X2, "overcurrent on output {} reading {}")         \
+    X(FLASH_STEP,       ADC,   DEBUG, U8,    "flash step {} ms")                            \
+    X(BRAKE_PATTERN,    ADC,   DEBUG, U8,    "brake pattern {}")                            \
+    X(PATTERN_DONE,     LIGHT, DEBUG, NONE,  "brake pattern done, solid")                   \
+    X(TURN_TIMEOUT,     LIGHT, INFO,  NONE,  "turn signal over")                            \
+    X(BRAKE_ON,         INPUT, INFO,  NONE,  "brake on")                                    \
+    X(BRAKE_OFF,        INPUT, INFO,  NONE,  "brake off")                                   \
+    X(LEFT_ON,          INPUT, DEBUG, NONE,  "left on")                                     \
+    X(RIGHT_ON,         INPUT, DEBUG, NONE,  "right on")                                    \
+    X(LIGHTS_AUTO,      MAIN,  INFO,  NONE,  "detecting the lamps, conservative lights")     \
+    X(LAMP_OUT,         LIGHT, ERROR, U8,    "lamp out on output {}")                       \
+    X(LAMP_OK,          LIGHT, INFO,  U8,    "lamp on output {} draws current again")
+
+#endif /* LOG_MSGS_H_ */
@@ -7,6 +7,8 @@
 
 #include "main.h"
 
+bool gbINTEGRATED_TURN_AND_BRAKE;
+
 /************************************************************************/
 /*                                UART                                  */
 /************************************************************************/
@@ -46,6 +48,16 @@ void init_adc(bool enable_interrupts)
     adc_select_ref(FLASH_REF);
     adc_right_shift_result();
     adc_select_input_channel(arr_adc_input[ARR_IDX_LEFT]);
+    //with the pots locked out their values come from the config, don't spend
+    //conversions on them
+    if (gs_CONFIG.flags & CONFIG_FLAG_POT_LOCKOUT)
+    {
+        adc_scan_init(arr_adc_scan, ADC_SCAN_NUM_FEEDBACK);
+    }
+    else
+    {
+        adc_scan_init(arr_adc_scan, ADC_SCAN_NUM_CHANNELS);
+    }
     
     if (enable_interrupts)
     {
@@ -55,127 +67,124 @@ void init_adc(bool enable_interrupts)
     adc_enable();
 }
 
-ISR(ADC_vect)
-{    
-    if (ge_ADC_STATE == STATE_ADC_READ_FEEDBACK)
+/** scan engine callback for the three feedback (current) channels, every conversion is
+ *  checked so overcurrent is caught as soon as the channel comes around
+ */
+void adc_feedback_sample(uint8_t idx, uint16_t value)
+{
+    volatile sLampOut* lamp = &arr_lamp_out[idx];
+    
+    blackbox_current(idx, value);
+    
+    //lamp out window, lamp_out_tick empties it. Outputs without a lamp don't fill it
+    if (lamp->checked && (lamp->samples < LAMPOUT_WINDOW_SAMPLES))
     {
-        //curr_reading = adc_read10_value();
-        //reads old value
-        arr_adc_conv_val[gb_NUM_ADC_CONVERSIONS % 3] =  adc_read10_value();
-        
-       
-        //processes value, if the I (current reading) is too high turn off the output
-        // and set a flag
-        if (arr_adc_conv_val[gb_NUM_ADC_CONVERSIONS % 3] > gbCURRENT_LIMIT)
-        {
-            disablePWMOutput(arr_pwm_output[gb_NUM_ADC_CONVERSIONS % 3]);
-                
-            //this value can only be set. it is only cleared by a system reset
-            gb_OVERCURRENT_TRIPPED = true;
-                
-            #ifdef DEBUG
-            ge_ADC_STATE = STATE_ADC_HALT;     
-            UART_transmitString("Overcurrent!\r\n\0");                         
-            #endif // DEBUG
-        }
-        
-        #ifdef DEBUG
-        if ((gb_NUM_ADC_CONVERSIONS % 3) == 0)
-        {
-            UART_transmitUint16(arr_adc_conv_val[ARR_IDX_LEFT]);
-            UART_transmitUint16(arr_adc_conv_val[ARR_IDX_BRAKE]);
-            UART_transmitUint16(arr_adc_conv_val[ARR_IDX_RIGHT]);
-           
-            UART_transmitNewLine();
-        }
-        #endif
-        
-        //moves to new input
-        gb_NUM_ADC_CONVERSIONS++;        
-        
-        //with our ADC clock speed 125k/250k this should be ever 3-5 seconds
-        //moving the channel switch before other processing will ensure the input change is stable
-        if (gb_NUM_ADC_CONVERSIONS > FDBK_CYCLES)
-        {
-            //move to next state
-            adc_select_input_channel(arr_adc_input[ARR_IDX_FL_FREQ]);
-            ge_ADC_STATE = STATE_ADC_READ_FREQ_FLASHES;
-        }
-        else
-        {
-            adc_select_input_channel(arr_adc_input[(gb_NUM_ADC_CONVERSIONS) % 3]);
-        }
-                             
-        //start next conversion, but don't wait for completion
-        adc_start_conversion(false);
+        lamp->current_sum += value;
+        lamp->duty_sum += arr_light_ramp[idx].val;
+        lamp->samples++;
     }
-    else if (ge_ADC_STATE == STATE_ADC_SWITCH_TO_5V_REF)
+    
+    //lamp topology detection, task_topology empties the window
+    if ((idx == ARR_IDX_BRAKE) && (gu8_TOPO_SAMPLES < TOPO_WINDOW_SAMPLES))
     {
-        //dont read the value, its bad after switch reference sources
-        adc_read10_value();
-                
-        ge_ADC_STATE = STATE_ADC_READ_FREQ_FLASHES;        
-      
-        //start next conversion, but don't wait for completion
-        adc_start_conversion(false);
+        gu16_TOPO_CURRENT_SUM += value;
+        gu16_TOPO_DUTY_SUM += arr_light_ramp[ARR_IDX_BRAKE].val;
+        gu8_TOPO_SAMPLES++;
     }
-    else if (ge_ADC_STATE == STATE_ADC_READ_FREQ_FLASHES)
-    {
-        //timer0 will control the speed of the brake light flashes from 1-10Hz
-        //a flash is both ON and OFF, so really the range is effectively be 2-20Hz
-        // Timer0 will overflow at a rate of 61.03Hz (w/1024 prescale)
-        //                                  244.14Hz (w/256 prescale)   << we used this in the end
-        // so we will need an additional software prescaler to get to our desired
-        // frequency range
-        //
-        //           1024   |  256* we are using 256
-        // FREQ | PRESCALER | PRESCALER
-        //------+-----------+-----------
-        //  2   |  30       |   122.1
-        //  4   |  15       |   61.0
-        //  6   |  10       |   40.6
-        //  8   |  7.5      |   30.5    <--after testing 8Hz is lowest reasonable flash rate
-        // 10   |  6        |   24.4
-        // 12   |  5        |   20.5
-        // 14   |  4.29     |   17.5
-        // 16   |  3.75     |   15.3
-        // 18   |  3.33     |   13.6    <--these changes get small
-        // 20   |  3        |   12.2
-        //flash freq 2-20Hz; adc range 0-1024 so we convert
-        // Since we want to effectively double our frequency rather than doing 244Hz/val_1_to_10
-        // we will do (244/2) / val_1_to_10 which is the same as our table
-        //           ovf_freq/  ((    val is 0-9    ) now its 1-10)
-        gu16_FLASH_FREQ_PRESCALER = 30.0 / ((adc_read10_value() / 146.2) + 1);
-        
-        //move to next state
-        adc_select_input_channel(arr_adc_input[ARR_IDX_FL_NUM]);
-        ge_ADC_STATE = STATE_ADC_READ_NUM_FLASHES;
+    
+    //processes value, if the I (current reading) is too high turn off the output
+    // and set a flag
+    if (value > gs_CONFIG.current_limit)
+    {
+        //only the reading that trips the output is logged, not the ones after it
+        if (arr_channel_fault[idx].state != eFAULT_TRIPPED)
+        {
+            LOG2(OVERCURRENT, idx, value);
+            
+            //the save itself is started by the main loop
+            blackbox_event(eBB_EVENT_TRIP, idx, value);
+            blackbox_trigger(eBB_CAUSE_TRIP);
+        }
         
-        #ifdef DEBUG
-        UART_transmitString(" freq:\0");
-        UART_transmitUint16(gu16_FLASH_FREQ_PRESCALER);
-        #endif // DEBUG
-                
-        adc_start_conversion(false);
+        //scan table index == ARR_IDX_xxxx for the feedback channels
+        //the output is retried later by task_light_service, so the scan has to keep
+        //running to guard the retry
+        light_fault_trip(idx);
     }
-    else if (ge_ADC_STATE == STATE_ADC_READ_NUM_FLASHES)
+}
+
+/** ms per brake flash step for a flash speed pot reading, integer only
+ *  @PARAM value - 10 bit adc reading
+ *  @RETURN (prescaler + 1) * 4.096ms truncated, like FLASH_STEP_MS
+ *  @NOTE the prescaler is interpolated between the two knots of arr_flash_prescaler_x256 around
+ *  value and truncated like the float formula was. The knot difference is at most ~760 so the
+ *  product with the 4 bit fraction fits 16 bits
+ */
+uint8_t flash_step_ms_from_adc(uint16_t value)
+{
+    uint8_t knot = (uint8_t)(value >> FLASH_KNOT_SHIFT);
+    uint8_t frac = (uint8_t)(value & (FLASH_KNOT_STEP - 1));
+    uint16_t hi = pgm_read_word(&arr_flash_prescaler_x256[knot]);
+    uint16_t lo = pgm_read_word(&arr_flash_prescaler_x256[knot + 1]);
+    uint8_t overflows = (uint8_t)((hi - (((hi - lo) * frac) >> FLASH_KNOT_SHIFT)) >> 8) + 1;
+    
+    //* 4.096 as * 2097 >> 9, exact for 1-31 overflows and 31 * 2097 still fits 16 bits
+    return (uint8_t)(((uint16_t)overflows * 2097) >> 9);
+}
+
+/** scan engine callback for the flash frequency pot
+ */
+void adc_flash_freq_sample(uint8_t idx, uint16_t value)
+{
+    //timer0 will control the speed of the brake light flashes from 1-10Hz
+    //a flash is both ON and OFF, so really the range is effectively be 2-20Hz
+    // Timer0 will overflow at a rate of 61.03Hz (w/1024 prescale)
+    //                                  244.14Hz (w/256 prescale)   << we used this in the end
+    // so we will need an additional software prescaler to get to our desired
+    // frequency range
+    //
+    //           1024   |  256* we are using 256
+    // FREQ | PRESCALER | PRESCALER
+    //------+-----------+-----------
+    //  2   |  30       |   122.1
+    //  4   |  15       |   61.0
+    //  6   |  10       |   40.6
+    //  8   |  7.5      |   30.5    <--after testing 8Hz is lowest reasonable flash rate
+    // 10   |  6        |   24.4
+    // 12   |  5        |   20.5
+    // 14   |  4.29     |   17.5
+    // 16   |  3.75     |   15.3
+    // 18   |  3.33     |   13.6    <--these changes get small
+    // 20   |  3        |   12.2
+    //flash freq 2-20Hz; adc range 0-1024 so we convert
+    // Since we want to effectively double our frequency rather than doing 244Hz/val_1_to_10
+    // we will do (244/2) / val_1_to_10 which is the same as our table
+    //           ovf_freq/  ((    val is 0-9    ) now its 1-10)
+    // 30.0 / ((adc / 146.2) + 1) is precomputed every 16 adc counts in flash,
+    //flash_step_ms_from_adc interpolates it and converts to ms for the brake flash software timer
+    gu8_FLASH_STEP_MS = flash_step_ms_from_adc(value);
+    
+    LOG1(FLASH_STEP, gu8_FLASH_STEP_MS);
+}
+
+/** scan engine callback for the brake pattern pot (used to be the number of flashes)
+ */
+void adc_flash_pattern_sample(uint8_t idx, uint16_t value)
+{
+    //picked up the next time the brake goes on, a running pattern is finished as it is
+    gu8_BRAKE_PATTERN = BRAKE_PATTERN_FROM_ADC(value);
+    
+    LOG1(BRAKE_PATTERN, gu8_BRAKE_PATTERN);
+}
+
+ISR(ADC_vect)
+{    
+    PROFILE_START(PROFILE_ADC);
+    
+    if (ge_ADC_STATE == STATE_ADC_SCAN)
     {
-        //flashes range from 2-20 (even numbers only); adc range 0-1024 so we convert
-        //          the range from 1-10, then double it
-        gu8_MAX_NUM_FLASHES =  ((adc_read10_value()/ 103) + 1) * 2;
-        adc_select_input_channel(arr_adc_input[gb_NUM_ADC_CONVERSIONS % 3]);
-        
-        #ifdef DEBUG
-        UART_transmitString(" num:\0");
-        UART_transmitUint16(gu8_MAX_NUM_FLASHES);
-        UART_transmitNewLine();
-        #endif // DEBUG
-        
-        //move to next state
-        ge_ADC_STATE = STATE_ADC_READ_FEEDBACK;
-        
-        gb_NUM_ADC_CONVERSIONS = 0;       
-        adc_start_conversion(false);
+        //channel sequencing, sample storage and callbacks are all in the scan table
+        adc_scan_isr();
     }
     else if (ge_ADC_STATE == STATE_ADC_TEST)
     {
@@ -193,117 +202,684 @@ ISR(ADC_vect)
          UART_transmitString(".\0");
          statusLed_set_color(eLED_YELLOW);
     }
+    
+    PROFILE_END(PROFILE_ADC);
 }
 #pragma endregion adc
 
 /************************************************************************/
-/*                               TIMERS                                 */
+/*                            LIGHT OUTPUTS                             */
 /************************************************************************/
-#pragma region timers
+#pragma region light_outputs
+/** One ramp step of an output, does nothing once it reached its target
+ *  @NOTE interrupts must be off
+ */
+void _light_ramp_step(uint8_t idx)
+{
+    volatile sLightRamp* ramp = &arr_light_ramp[idx];
+    
+    if (ramp->val < ramp->target)
+    {
+        if ((uint8_t)(ramp->target - ramp->val) <= ramp->step)
+        {
+            ramp->val = ramp->target;
+        }
+        else
+        {
+            ramp->val += ramp->step;
+        }
+        
+        setPWMVal(arr_pwm_output[idx], ramp->val);
+    }
+}
 
-//this interrupt should occur at ~244Hz
-ISR(TIMER0_OVF_vect)
-{    
-    if (gb_BRAKE_ON)
+/** Moves an output toward a pwm value, see LIGHT_RAMP_PERIODS_LOG2
+ *  @PARAM idx - ARR_IDX_LEFT, ARR_IDX_BRAKE or ARR_IDX_RIGHT
+ *  @PARAM target - pwm value 0-255
+ *  @PARAM periods_log2 - an increase takes at most 2^periods_log2 ticks (1ms)
+ *  @NOTE interrupts must be off
+ */
+void _light_ramp_to(uint8_t idx, uint8_t target, uint8_t periods_log2)
+{
+    volatile sLightRamp* ramp = &arr_light_ramp[idx];
+    
+    ramp->target = target;
+    
+    if (target <= ramp->val)
+    {
+        ramp->val = target;
+        setPWMVal(arr_pwm_output[idx], target);
+    }
+    else
+    {
+        ramp->step = ((target - ramp->val) >> periods_log2) + 1;
+        
+        //first step now, the brake shouldn't wait a tick to start getting brighter
+        _light_ramp_step(idx);
+    }
+}
+
+/** Sets the brightness the light logic wants on an output. Increases are ramped, it is
+ *  only written to the hardware while the output is enabled and not tripped, otherwise
+ *  it is kept until then
+ *  @PARAM idx - ARR_IDX_LEFT, ARR_IDX_BRAKE or ARR_IDX_RIGHT
+ *  @PARAM brightness - perceptual brightness 0-255, same as setPWMBrightness
+ */
+void light_set_brightness(uint8_t idx, uint8_t brightness)
+{
+    //the ramp works on pwm values, inrush current follows the duty cycle
+    uint8_t target = getPWMBrightnessVal(brightness);
+    
+    //called from the main loop (light logic, shell, the brake pattern sw timer) and from
+    //ISR(INT1_vect). The ramp is stepped by task_light_service, a sw timer the main loop
+    //runs every 1ms, and a trip in the adc interrupt can move it any time
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        arr_light_brightness[idx] = brightness;
+        
+        //the same value can come twice (INT1 puts the brake on full, then the mode or the
+        //pattern does it again), that must not restart a ramp
+        if (arr_light_enabled[idx] 
+            && (arr_channel_fault[idx].state == eFAULT_NONE)
+            && (arr_light_ramp[idx].target != target))
+        {
+            _light_ramp_to(idx, target, LIGHT_RAMP_PERIODS_LOG2);
+        }
+    }
+}
+
+/** Turns an output on, ramping up from 0 to its brightness. A tripped output comes back on
+ *  by itself once its retry delay is over
+ *  @PARAM idx - ARR_IDX_LEFT, ARR_IDX_BRAKE or ARR_IDX_RIGHT
+ */
+void light_output_enable(uint8_t idx)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        //even this value is uint16 because it is read from the 10 bit ADC 
-        //and then we do some math on it to get it back into 8bit range
-        if (gu8_NUM_TIMER0_OVF >= gu16_FLASH_FREQ_PRESCALER)
-        {   
-            gu8_NUM_TIMER0_OVF = 0;
+        if (!arr_light_enabled[idx])
+        {
+            arr_light_enabled[idx] = true;
             
-            //if we have not done all our flashes
-            if (gu8_NUM_OCCURED_FLASHES < gu8_MAX_NUM_FLASHES)
+            if (arr_channel_fault[idx].state == eFAULT_NONE)
             {
-                gu8_NUM_OCCURED_FLASHES++;
-            
-                //if gu8_NUM_OCCURED_FLASHES is odd
-                if (gu8_NUM_OCCURED_FLASHES %2)
+                enablePWMOutput(arr_pwm_output[idx]);
+                _light_ramp_to(idx, getPWMBrightnessVal(arr_light_brightness[idx]), LIGHT_RAMP_PERIODS_LOG2);
+            }
+        }
+    }
+}
+
+/** Turns an output off. The filament cools down while it is off, so the next enable
+ *  ramps up from 0 again
+ *  @PARAM idx - ARR_IDX_LEFT, ARR_IDX_BRAKE or ARR_IDX_RIGHT
+ */
+void light_output_disable(uint8_t idx)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        arr_light_enabled[idx] = false;
+        disablePWMOutput(arr_pwm_output[idx]);
+        _light_ramp_to(idx, 0, LIGHT_RAMP_PERIODS_LOG2);
+    }
+}
+
+/** Steps every ramp that hasn't reached its target yet
+ *  @NOTE called from task_light_service, once per 1ms tick
+ */
+void light_ramp_tick(void)
+{
+    uint8_t idx;
+    
+    //a trip in the adc interrupt also moves the ramps
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (idx = 0; idx < 3; idx++)
+        {
+            _light_ramp_step(idx);
+        }
+    }
+}
+
+/** Called from the adc feedback callback when a channel is over the current limit.
+ *  Turns the output off and schedules the retry
+ *  @PARAM idx - ARR_IDX_LEFT, ARR_IDX_BRAKE or ARR_IDX_RIGHT
+ *  @NOTE interrupt context only
+ */
+void light_fault_trip(uint8_t idx)
+{
+    volatile sChannelFault* fault = &arr_channel_fault[idx];
+    
+    //a conversion that was already running when the output went off can still read high
+    if (fault->state != eFAULT_TRIPPED)
+    {
+        disablePWMOutput(arr_pwm_output[idx]);
+        _light_ramp_to(idx, 0, LIGHT_RAMP_PERIODS_LOG2);
+        
+        fault->state = eFAULT_TRIPPED;
+        fault->countdown = FAULT_RETRY_BASE_TICKS << fault->backoff;
+        
+        if (fault->backoff < FAULT_BACKOFF_MAX)
+        {
+            fault->backoff++;
+        }
+        
+        if (fault->fault_count < UINT16_MAX)
+        {
+            fault->fault_count++;
+        }
+        
+        gb_OVERCURRENT_TRIPPED = true;
+    }
+}
+
+/** Runs the retry countdowns and backoff resets of the three outputs. A retry turns the
+ *  output back on with the slow FAULT_SOFT_START_PERIODS_LOG2 ramp.
+ *  Clears gb_OVERCURRENT_TRIPPED once no output is tripped anymore
+ *  @NOTE called from task_light_service (1ms)
+ */
+void light_fault_tick(void)
+{
+    uint8_t idx;
+    bool any_fault = false;
+    volatile sChannelFault* fault;
+    
+    //the adc interrupt trips channels
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (idx = 0; idx < 3; idx++)
+        {
+            fault = &arr_channel_fault[idx];
+        
+            if (fault->state == eFAULT_TRIPPED)
+            {
+                if (--fault->countdown == 0)
                 {
-                    #ifdef DEBUG
-                    UART_transmitString("flashing\0");
-                    #endif // DEBUG
-                    setPWMDutyCycle(arr_pwm_output[ARR_IDX_BRAKE], DUTY_CYCLE_LOW_BRIGHTNESS);
+                    fault->state = eFAULT_NONE;
+                    fault->countdown = FAULT_BACKOFF_RESET_TICKS;
+                
+                    //if the light logic turned the output off in the meantime, the next
+                    //enable does the ramp
+                    if (arr_light_enabled[idx])
+                    {
+                        enablePWMOutput(arr_pwm_output[idx]);
+                        _light_ramp_to(idx, getPWMBrightnessVal(arr_light_brightness[idx]), FAULT_SOFT_START_PERIODS_LOG2);
+                    }
                 }
                 else
                 {
-                    setPWMDutyCycle(arr_pwm_output[ARR_IDX_BRAKE], DUTY_CYCLE_FULL_BRIGHTNESS);
+                    any_fault = true;
+                }
+            }
+            else if (fault->backoff > 0)
+            {
+                //ran long enough without tripping, the next trip gets the short delay again
+                if (--fault->countdown == 0)
+                {
+                    fault->backoff = 0;
                 }
             }
+        }
+    
+        if (gb_OVERCURRENT_TRIPPED && !any_fault)
+        {
+            gb_OVERCURRENT_TRIPPED = false;
+        
+            //back to the color that shows the light mode
+            light_mode_led();
+        }
+    }
+}
+
+/** Turns the lamp out check of an output on or off. An output the light mode has no lamp on
+ *  (the brake output with integrated lights, or until the lamps are detected) would always
+ *  read as out. Turning it off forgets a lamp out without logging it as fixed
+ *  @PARAM idx - ARR_IDX_LEFT, ARR_IDX_BRAKE or ARR_IDX_RIGHT
+ */
+void lamp_out_set_checked(uint8_t idx, bool checked)
+{
+    volatile sLampOut* lamp = &arr_lamp_out[idx];
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        lamp->checked = checked;
+        lamp->current_sum = 0;
+        lamp->duty_sum = 0;
+        lamp->samples = 0;
+        lamp->low_windows = 0;
+        
+        if (!checked)
+        {
+            lamp->out = false;
+            lamp->reported = false;
+        }
+    }
+}
+
+/** @RETURN a bit per output with its lamp out, bit ARR_IDX_xxx
+ */
+uint8_t lamp_out_mask(void)
+{
+    uint8_t ret_value = 0;
+    uint8_t idx;
+    
+    for (idx = 0; idx < 3; idx++)
+    {
+        if (arr_lamp_out[idx].out)
+        {
+            ret_value |= BIT(idx);
+        }
+    }
+    
+    return ret_value;
+}
+
+/** Judges the full lamp out windows, see LAMPOUT_WINDOWS. Logs lamps that went out or
+ *  came back since the last call, also to the black box
+ *  @NOTE called from task_light_service (1ms)
+ */
+void lamp_out_tick(void)
+{
+    volatile sLampOut* lamp;
+    uint16_t current_sum;
+    uint16_t duty_sum;
+    uint8_t idx;
+    bool out;
+    
+    for (idx = 0; idx < 3; idx++)
+    {
+        lamp = &arr_lamp_out[idx];
+        current_sum = 0;
+        duty_sum = 0;
+        
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (lamp->samples >= LAMPOUT_WINDOW_SAMPLES)
+            {
+                current_sum = lamp->current_sum;
+                duty_sum = lamp->duty_sum;
+                lamp->current_sum = 0;
+                lamp->duty_sum = 0;
+                lamp->samples = 0;
+            }
+        }
+        
+        //also covers a window that isn't full yet
+        if (duty_sum >= LAMPOUT_MIN_DUTY_SUM)
+        {
+            //current / (duty / 255) against the threshold, without the divide
+            if (((uint32_t)current_sum * 255) < ((uint32_t)LAMPOUT_CURRENT_FULL * duty_sum))
+            {
+                if (lamp->low_windows < LAMPOUT_WINDOWS)
+                {
+                    lamp->low_windows++;
+                }
+                lamp->out = (lamp->low_windows >= LAMPOUT_WINDOWS);
+            }
             else
             {
-                #ifdef DEBUG
-                UART_transmitString("solid\0");
-                #endif // DEBUG
-                
-                //if we already flashed, just stay solid
-                setPWMDutyCycle(arr_pwm_output[ARR_IDX_BRAKE], DUTY_CYCLE_FULL_BRIGHTNESS);
-            } 
+                lamp->low_windows = 0;
+                lamp->out = false;
+            }
         }
-        else
+        
+        out = lamp->out;
+        
+        if (out != lamp->reported)
         {
-            gu8_NUM_TIMER0_OVF++;
+            lamp->reported = out;
+            blackbox_event(eBB_EVENT_LAMP_OUT, idx, out);
+            
+            if (out)
+            {
+                LOG1(LAMP_OUT, idx);
+            }
+            else
+            {
+                LOG1(LAMP_OK, idx);
+            }
         }
-    }    
+    }
+}
+#pragma endregion light_outputs
+
+/************************************************************************/
+/*                             LIGHT MODE                               */
+/************************************************************************/
+#pragma region light_mode
+/** sets the status led to the color of the light mode: yellow while detecting, green for
+ *  separate and aqua for integrated lights
+ */
+void light_mode_led(void)
+{
+    if (ge_LIGHT_MODE == eLIGHT_MODE_SEPARATE)
+    {
+        statusLed_set_color(eLED_GREEN);
+    }
+    else if (ge_LIGHT_MODE == eLIGHT_MODE_INTEGRATED)
+    {
+        statusLed_set_color(eLED_AQUA);
+    }
     else
-    {        
-        setPWMDutyCycle(arr_pwm_output[ARR_IDX_BRAKE], DUTY_CYCLE_LOW_BRIGHTNESS);
+    {
+        statusLed_set_color(eLED_YELLOW);
+    }
+}
+
+/** Sets the outputs up for a light mode, the main loop applies the inputs on its next pass.
+ *  A running brake pattern or turn signal timeout is dropped, the lights follow the
+ *  inputs as they are now
+ *  @PARAM mode - eLIGHT_MODE_AUTO is the conservative mode used until the lamps are detected
+ *  @NOTE main loop only
+ */
+void light_mode_enter(eLIGHT_MODE mode)
+{
+    sw_timer_stop(SW_TIMER_BRAKE_FLASH);
+    sw_timer_stop(SW_TIMER_TURN_TIMEOUT);
+    gb_LEFT_TURN_SIGNAL_ON = false;
+    gb_RIGHT_TURN_SIGNAL_ON = false;
+    
+    ge_LIGHT_MODE = mode;
+    gbINTEGRATED_TURN_AND_BRAKE = (mode != eLIGHT_MODE_SEPARATE);
+    
+    //there is only a brake lamp to check once separate lights are detected
+    lamp_out_set_checked(ARR_IDX_BRAKE, (mode == eLIGHT_MODE_SEPARATE));
+    
+    if (mode == eLIGHT_MODE_SEPARATE)
+    {
+        // here we have a separate brake and turn signals. The turn signals only
+        // need to handle themselves based on current input values
+        
+        // the lights are flashed by enabling and disabling the PWM output
+        // this ensures no dim glow/leakage we would get if we left them on with 0% duty cycle
+        light_set_brightness(ARR_IDX_LEFT,  BRIGHTNESS_FULL);
+        light_set_brightness(ARR_IDX_RIGHT, BRIGHTNESS_FULL);
+        
+        light_output_disable(ARR_IDX_LEFT);
+        light_output_disable(ARR_IDX_RIGHT);
+        
+        LOG(LIGHTS_SEPARATE);
+    }
+    else
+    {
+        //here we have no explicit brake light (or don't know yet), only left and right
+        //lights, so they must operate as brake AND turn signal
+        
+        //sets lights as running lights
+        light_set_brightness(ARR_IDX_LEFT, BRIGHTNESS_LOW);
+        light_set_brightness(ARR_IDX_RIGHT, BRIGHTNESS_LOW);
+        light_output_enable(ARR_IDX_LEFT);
+        light_output_enable(ARR_IDX_RIGHT);
+    }
+    
+    if (mode == eLIGHT_MODE_INTEGRATED)
+    {
+        //when turn signals are on we want it to go from full/off for contrast
+        //if the signal doesn't go high for 1 second, we can resume brake duty
+        //(task_turn_timeout), the flasher isn't used in combined light mode
+        
+        //the brake output doesn't follow the pedal, it stays at running light level so
+        //task_topology sees a brake lamp that gets plugged in
+        light_set_brightness(ARR_IDX_BRAKE, BRIGHTNESS_LOW);
+        light_output_enable(ARR_IDX_BRAKE);
+        
+        //fast trip watches the light that is on all the time
+        adc_scan_set_priority(ARR_IDX_LEFT);
+        
+        LOG(LIGHTS_INTEGRATED);
+    }
+    else
+    {
+        //brake output as running light, full while the pedal is down. With integrated
+        //lights nothing is connected to it, that is harmless
+        light_set_brightness(ARR_IDX_BRAKE, gb_BRAKE_ON ? BRIGHTNESS_FULL : BRIGHTNESS_LOW);
+        light_output_enable(ARR_IDX_BRAKE);
+        
+        //the brake pattern (brake_pattern_start) is started by the main loop when the
+        //brake goes on, separate lights only
+        adc_scan_set_priority(ARR_IDX_BRAKE);
+    }
+    
+    if (mode == eLIGHT_MODE_AUTO)
+    {
+        LOG(LIGHTS_AUTO);
+    }
+    
+    light_mode_led();
+    gb_LIGHT_EVENT = true;
+}
+
+/** software timer, every TOPO_PERIOD_MS unless the config forces the light mode. Takes
+ *  the detection window once the adc interrupt has filled it and switches the light mode
+ *  once enough windows in a row disagree with it (TOPO_CONFIRM_WINDOWS while detecting,
+ *  TOPO_SWITCH_WINDOWS after that)
+ */
+void task_topology(void)
+{
+    uint16_t current_sum = 0;
+    uint16_t duty_sum = 0;
+    uint32_t current;
+    eLIGHT_MODE verdict = eLIGHT_MODE_AUTO;
+    uint8_t needed;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (gu8_TOPO_SAMPLES >= TOPO_WINDOW_SAMPLES)
+        {
+            current_sum = gu16_TOPO_CURRENT_SUM;
+            duty_sum = gu16_TOPO_DUTY_SUM;
+            gu16_TOPO_CURRENT_SUM = 0;
+            gu16_TOPO_DUTY_SUM = 0;
+            gu8_TOPO_SAMPLES = 0;
+        }
+    }
+    
+    //also covers a window that isn't full yet
+    if (duty_sum >= TOPO_MIN_DUTY_SUM)
+    {
+        //current / (duty / 255) against the thresholds, without the divide
+        current = (uint32_t)current_sum * 255;
+        
+        if (current >= ((uint32_t)TOPO_LAMP_CURRENT * duty_sum))
+        {
+            verdict = eLIGHT_MODE_SEPARATE;
+        }
+        else if (current < ((uint32_t)TOPO_NO_LAMP_CURRENT * duty_sum))
+        {
+            verdict = eLIGHT_MODE_INTEGRATED;
+        }
+        
+        //a window in the hysteresis band, or one that agrees with the mode, starts over
+        if ((verdict == eLIGHT_MODE_AUTO) || (verdict == ge_LIGHT_MODE))
+        {
+            gu8_TOPO_STREAK = 0;
+        }
+        else if ((verdict == ge_TOPO_VERDICT) && (gu8_TOPO_STREAK > 0))
+        {
+            gu8_TOPO_STREAK++;
+        }
+        else
+        {
+            ge_TOPO_VERDICT = verdict;
+            gu8_TOPO_STREAK = 1;
+        }
+        
+        needed = (ge_LIGHT_MODE == eLIGHT_MODE_AUTO) ? TOPO_CONFIRM_WINDOWS : TOPO_SWITCH_WINDOWS;
+        
+        if (gu8_TOPO_STREAK >= needed)
+        {
+            LOG2(BRAKE_TEST, current_sum, duty_sum);
+            
+            gu8_TOPO_STREAK = 0;
+            light_mode_enter(verdict);
+        }
     }
 }
+#pragma endregion light_mode
 
-/** this interrupt is used to flash the status led. As long as over current
- * wasn't detected. Over current will just light the LED solid red
+/************************************************************************/
+/*                               TIMERS                                 */
+/************************************************************************/
+#pragma region timers
+
+/** 1ms timebase. Only counts the uptime for the software timers (they run from the main
+ *  loop) and polls the right turn input, PD4 has no external interrupt so it is sampled
+ *  and debounced here
  */
-ISR(TIMER1_OVF_vect)
+ISR(TIMER0_OVF_vect)
+{    
+    bool right_in;
+    
+    PROFILE_START(PROFILE_TIMER0);
+    
+    //added instead of written, so the cycles it took to get here are not lost
+    TCNT0 += TIMER0_TICK_PRELOAD;
+    
+    sw_timers_tick();
+    
+    right_in = (BIT_GET(LIGHT_INPUT_PORT, RIGHT_IN) != 0);
+    
+    if (right_in == gb_RIGHT_IN)
+    {
+        gu8_RIGHT_IN_DEBOUNCE = 0;
+    }
+    else if (++gu8_RIGHT_IN_DEBOUNCE >= RIGHT_IN_DEBOUNCE_TICKS)
+    {
+        //input has been stable at the new level long enough
+        gu8_RIGHT_IN_DEBOUNCE = 0;
+        gb_RIGHT_IN = right_in;
+        gb_LIGHT_EVENT = true;
+    }
+    
+    PROFILE_END(PROFILE_TIMER0);
+}
+
+/** software timer, every 1ms. Steps the light ramps and the overcurrent retry
+ */
+void task_light_service(void)
+{
+    light_ramp_tick();
+    light_fault_tick();
+    lamp_out_tick();
+}
+
+/** software timer, flashes the status led. As long as over current wasn't detected.
+ *  Over current will just light the LED solid red until every output has recovered.
+ *  A lamp out flashes purple instead of the light mode color
+ */
+void task_status_led(void)
 {
     if (!gb_OVERCURRENT_TRIPPED)
     {
-        if (gu8_NUM_TIMER1_OVF < TIMER1_ADDTL_4Hz_PRESCALE)
+        if (lamp_out_mask() != 0)
         {
-            gu8_NUM_TIMER1_OVF++;
+            statusLed_set_color(eLED_PURPLE);
         }
         else
         {
-            //toggle led
-            statusLed_toggle(); 
-            gu8_NUM_TIMER1_OVF = 0;
+            light_mode_led();
         }
+        
+        statusLed_toggle(); 
     }
     else
     {
         statusLed_set_color(eLED_RED);
         statusLed_On();
     }        
-}    
+}
+
+/** starts the selected brake pattern. Called by the main loop when the brake goes on
+ *  (separate function lights only), INT1 has already put the brake on full
+ */
+void brake_pattern_start(void)
+{
+    gp_BRAKE_STEP = pgm_read_ptr(&arr_brake_patterns[gu8_BRAKE_PATTERN]);
+    
+    //first step one beat after the pedal, same as the old flasher
+    gu8_BRAKE_STEP_BEATS = 1;
+    sw_timer_start(SW_TIMER_BRAKE_FLASH, gu8_FLASH_STEP_MS, gu8_FLASH_STEP_MS, task_brake_flash);
+}
 
-/** This interrupt is used as a 1 second "watchdog" timer for turn signals In the 
- *  combined function lights. When a turn signal is on, it does not perform brake
- *  duties till 1 second after the signal has been disabled. 
- *  Once an entire second goes by without turn signal input, we say that turn signal
- *  function is over.
+/** software timer, one beat of the brake pattern. The same work every beat whatever the
+ *  pattern is: count the beat down, at 0 load the next step from flash. Stops itself at
+ *  the end of the pattern, the last brightness stays on
  */
-ISR(TIMER2_OVF_vect)
-{        
-    //if the turn signal isn't on, we don't have to do anything with this interrupt
-    if (gb_LEFT_TURN_SIGNAL_ON || gb_RIGHT_TURN_SIGNAL_ON)
+void task_brake_flash(void)
+{
+    sBrakeStep step;
+    
+    //the pot can change the flash speed while we are flashing
+    sw_timer_set_period(SW_TIMER_BRAKE_FLASH, gu8_FLASH_STEP_MS);
+    
+    if (--gu8_BRAKE_STEP_BEATS == 0)
     {
-        if (gu8_NUM_TIMER2_OVF >= TIMER2_ADDTL_1_SEC_PRESCALE)
+        memcpy_P(&step, gp_BRAKE_STEP++, sizeof(step));
+        light_set_brightness(ARR_IDX_BRAKE, step.brightness);
+        gu8_BRAKE_STEP_BEATS = step.beats;
+        
+        if (step.beats == 0)
         {
-            gu8_NUM_TIMER2_OVF = 0;
-            //one second has elapsed without another turn signal lighting
-            //up, we can set the turn signal flag low
-            gb_LEFT_TURN_SIGNAL_ON = false;
-            gb_RIGHT_TURN_SIGNAL_ON = false;
-            
-            #ifdef DEBUG
-            UART_transmitString("Turn sig off\r\n\0");
-            #endif // DEBUG
+            LOG(PATTERN_DONE);
+            sw_timer_stop(SW_TIMER_BRAKE_FLASH);
         }
-        else
+    }
+}
+
+/** software timer, one shot. In the combined function lights a turn signal keeps the
+ *  lights from doing brake duty till 1 second after the signal has been disabled.
+ *  The main loop starts this when both turn inputs go off and stops it when one comes
+ *  back on, so once it runs an entire second went by without turn signal input and we
+ *  say that turn signal function is over.
+ */
+void task_turn_timeout(void)
+{
+    gb_LEFT_TURN_SIGNAL_ON = false;
+    gb_RIGHT_TURN_SIGNAL_ON = false;
+    gb_LIGHT_EVENT = true;
+    
+    LOG(TURN_TIMEOUT);
+}
+
+/** software timer, every gs_CONFIG.telemetry_period_ms. Sends one binary telemetry frame,
+ *  if the Tx queue is too full the frame is dropped (the sequence number shows the gap)
+ */
+void task_telemetry(void)
+{
+    static uint8_t sequence = 0;
+    sTelemetryFrame frame;
+    uint8_t idx;
+    
+    frame.version = TELEMETRY_FRAME_VERSION;
+    frame.sequence = sequence;
+    frame.uptime_ms = sw_timers_uptime();
+    frame.flags = 0;
+    frame.lamp_out = lamp_out_mask();
+    
+    for (idx = 0; idx < 3; idx++)
+    {
+        frame.current[idx] = adc_scan_get_latest(idx);
+        
+        if (arr_channel_fault[idx].state == eFAULT_TRIPPED)
         {
-            gu8_NUM_TIMER2_OVF++;
+            //FAULT_LEFT, FAULT_BRAKE, FAULT_RIGHT are in ARR_IDX_xxxx order
+            frame.flags |= (TELEMETRY_FLAG_FAULT_LEFT << idx);
         }
     }
+    
+    frame.pot[0] = adc_scan_get_latest(ARR_IDX_FL_FREQ);
+    frame.pot[1] = adc_scan_get_latest(ARR_IDX_FL_NUM);
+    
+    frame.flags |= gb_BRAKE_ON                 ? TELEMETRY_FLAG_BRAKE      : 0;
+    frame.flags |= gb_LEFT_TURN_SIGNAL_ON      ? TELEMETRY_FLAG_LEFT       : 0;
+    frame.flags |= gb_RIGHT_TURN_SIGNAL_ON     ? TELEMETRY_FLAG_RIGHT      : 0;
+    frame.flags |= gbINTEGRATED_TURN_AND_BRAKE ? TELEMETRY_FLAG_INTEGRATED : 0;
+    frame.flags |= (gs_CONFIG.flags & CONFIG_FLAG_POT_LOCKOUT) ? TELEMETRY_FLAG_POT_LOCKOUT : 0;
+    
+    //the sequence only counts frames that went out
+    if (telemetry_send(&frame, sizeof(frame)))
+    {
+        sequence++;
+    }
 }
 
 //16bit reads -> read low -> read high
@@ -321,25 +897,22 @@ void init_timers(void)
     init_timer2();
 }
 
+/* Timer 0 is the 1ms timebase for the software timers (brake flasher, status LED, turn
+ * signal timeout, light ramps) in both light modes
+ */
 void init_timer0(void)
 {
-    //resets counter
-    TCNT0 = 0x00;
-    
     //reset registers to a known state
     timer0_default();
     
-    //timer0 can only generate overflow interrupts
+    //preload the counter, timer0 can only generate overflow interrupts
+    TCNT0 = TIMER0_TICK_PRELOAD;
     
-    //sets prescaler to 256 F_CPU = 16MHz
-    // 16MHz / (8_bit_max * prescaler) = 16MHz / (256 * 256) = 244.14Hz
-    SetTimerPrescale(etimer_0, tmr_prscl_clk_over_256);
+    //sets prescaler to 64 F_CPU = 16MHz
+    // 16MHz / (prescaler * (256 - preload)) = 16MHz / (64 * 250) = 1000Hz
+    SetTimerPrescale(etimer_0, tmr_prscl_clk_over_64);
     
-        
-    //the status LED will be controlled by the turn signal overflow interrupt
-    //this is because no matter if we are in separate function mode or not,
-    //this time is always running
-    enableTimerOverflowInterrupt(etimer_1);
+    enableTimerOverflowInterrupt(etimer_0);
 }
 
 /* Timer 1 has two channels A and B, these channels will be used for the two directional
@@ -355,70 +928,292 @@ void init_timer1(void)
     enablePWMOutput(arr_pwm_output[ARR_IDX_LEFT]);
     enablePWMOutput(arr_pwm_output[ARR_IDX_RIGHT]);
     
-    //sets prescaler to 64 F_CPU = 16MHz
-    //no real reason for this value, as long as its PWM we are fine
-    // 16MHz / (8_bit_max * prescaler) = 16MHz / (256 * 64) = 976.5625Hz
-    SetTimerPrescale(etimer_1, tmr_prscl_clk_over_64);
+    //waveform mode, TOP and prescaler, starts the timer
+    setPWMCarrier(etimer_1, PWM_TURN_CARRIER_MODE, PWM_TURN_CARRIER_HZ);
+}
+
+/* Timer 2 has one PWM output pin OC2 and will be used for the brake light function in
+ * a non-integrated lamp (separate output for left,brake,right). In an integrated system, 
+ * this timer and output will be disabled
+ */
+void init_timer2(void)
+{
+    //reset registers to a known state
+    timer2_default();
+    
+    //waveform mode and prescaler, at 976Hz that is 16MHz / (256 * 64) = 976.5625Hz
+    setPWMCarrier(etimer_2, PWM_BRAKE_CARRIER_MODE, PWM_BRAKE_CARRIER_HZ);
+    
+    //enable pwm
+    enablePWMOutput(arr_pwm_output[ARR_IDX_BRAKE]);
+}
+
+#pragma endregion timers
+
+/************************************************************************/
+/*                           RGB STATUS LED                             */
+/************************************************************************/
+#pragma region RGB_status_led
+void init_RGB_status_LED(void)
+{
+    if (!statusLed_init(&PORTD,
+                        LED_R_OUTPUT_PIN, 
+                        LED_G_OUTPUT_PIN, 
+                        LED_B_OUTPUT_PIN, 
+                        LED_ACTIVE_LOW))
+    {
+        LOG(LED_INIT_FAIL);
+    }
+                    
+    
+    statusLed_set_color(eLED_GREEN);
+}
+#pragma endregion RGB_status_led
+
+/************************************************************************/
+/*                                SHELL                                 */
+/************************************************************************/
+#pragma region shell
+/** prints " " and a number, the replies are space separated numbers so they are easy to
+ *  pick apart on the other end
+ */
+void _shell_print_value(uint16_t value)
+{
+    UART_TransmitByte(' ');
+    UART_transmitUint16Raw(value);
+}
+
+void _shell_print_bad_argument(void)
+{
+    UART_transmitString_P(PSTR("bad argument\r\n"));
+}
+
+/** @RETURN the value of config field idx, see arr_shell_cfg_fields */
+uint16_t _shell_cfg_get(uint8_t idx)
+{
+    sShellCfgField field;
+    const uint8_t* data = (const uint8_t*)&gs_CONFIG;
+    uint16_t ret_value;
+    
+    memcpy_P(&field, &arr_shell_cfg_fields[idx], sizeof(field));
+    
+    //little endian
+    ret_value = data[field.offset];
+    if (field.size == 2)
+    {
+        ret_value |= (uint16_t)data[field.offset + 1] << 8;
+    }
+    
+    return ret_value;
+}
+
+/** shell "stat": uptime in ms (hex), light mode, brake on, brake pattern, flash step ms
+ */
+void shell_cmd_stat(const sShellArgs* args)
+{
+    uint32_t uptime = sw_timers_uptime();
+    uint8_t id;
+    
+    UART_transmitString_P(PSTR("stat "));
+    UART_transmitHex16((uint16_t)(uptime >> 16));
+    UART_transmitHex16((uint16_t)uptime);
+    _shell_print_value(ge_LIGHT_MODE);
+    _shell_print_value(gb_BRAKE_ON);
+    _shell_print_value(gu8_BRAKE_PATTERN);
+    _shell_print_value(gu8_FLASH_STEP_MS);
+    
+    //deadlines the sw timers missed because the main loop was late, by timer id
+    for (id = 0; id < SW_TIMER_MAX_TIMERS; id++)
+    {
+        _shell_print_value(sw_timer_missed(id));
+    }
+    UART_transmitNewLine();
+}
+
+/** shell "cur": latest feedback readings then the trips since power up, LEFT BRAKE RIGHT
+ */
+void shell_cmd_cur(const sShellArgs* args)
+{
+    uint16_t fault_count[3];
+    uint8_t idx;
+    
+    //trips are counted in the adc interrupt
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (idx = 0; idx < 3; idx++)
+        {
+            fault_count[idx] = arr_channel_fault[idx].fault_count;
+        }
+    }
+    
+    UART_transmitString_P(PSTR("cur"));
+    for (idx = 0; idx < 3; idx++)
+    {
+        _shell_print_value(adc_scan_get_latest(idx));
+    }
+    for (idx = 0; idx < 3; idx++)
+    {
+        _shell_print_value(fault_count[idx]);
+    }
+    UART_transmitNewLine();
+}
+
+/** shell "adc <channel>": latest reading of one scan channel, the scan isn't disturbed
+ */
+void shell_cmd_adc(const sShellArgs* args)
+{
+    uint16_t channel;
+    
+    if (shell_arg_uint16(args, 1, &channel) && (channel < ADC_SCAN_NUM_CHANNELS))
+    {
+        UART_transmitString_P(PSTR("adc"));
+        _shell_print_value(adc_scan_get_latest(channel));
+        UART_transmitNewLine();
+    }
+    else
+    {
+        _shell_print_bad_argument();
+    }
+}
+
+/** shell "out <output> <brightness>": lamp test, 0 turns the output off. Goes through the
+ *  ramp and fault handling like the light logic, which takes the output back on its next
+ *  change
+ */
+void shell_cmd_out(const sShellArgs* args)
+{
+    uint16_t output;
+    uint16_t brightness;
+    
+    if (shell_arg_uint16(args, 1, &output) && (output < 3)
+        && shell_arg_uint16(args, 2, &brightness) && (brightness <= BRIGHTNESS_FULL))
+    {
+        if (brightness == BRIGHTNESS_OFF)
+        {
+            light_output_disable(output);
+        }
+        else
+        {
+            light_set_brightness(output, brightness);
+            light_output_enable(output);
+        }
+        UART_transmitString_P(PSTR("ok\r\n"));
+    }
+    else
+    {
+        _shell_print_bad_argument();
+    }
+}
+
+/** shell "cfg": the RAM config, arr_shell_cfg_fields order
+ */
+void shell_cmd_cfg(const sShellArgs* args)
+{
+    uint8_t idx;
     
-    //for heartbeat LED
-    enableTimerOverflowInterrupt(etimer_1);
+    UART_transmitString_P(PSTR("cfg"));
+    for (idx = 0; idx < SHELL_CFG_NUM_FIELDS; idx++)
+    {
+        _shell_print_value(_shell_cfg_get(idx));
+    }
+    UART_transmitNewLine();
 }
 
-/* Timer 2 has one PWM output pin OC2 and will be used for the brake light function in
- * a non-integrated lamp (separate output for left,brake,right). In an integrated system, 
- * this timer and output will be disabled
+/** shell "set <field> <value>": changes the RAM config, "save" keeps it
  */
-void init_timer2(void)
+void shell_cmd_set(const sShellArgs* args)
 {
-    //reset registers to a known state
-    timer2_default();
+    sShellCfgField field;
+    uint8_t* data = (uint8_t*)&gs_CONFIG;
+    uint16_t idx;
+    uint16_t value = 0;
     
-    //sets prescaler to 64 F_CPU = 16MHz
-    //no real reason for this value, as long as its PWM we are fine
-    // 16MHz / (8_bit_max * prescaler) = 16MHz / (256 * 64) = 976.5625Hz
-    SetTimerPrescale(etimer_2, tmr_prscl_clk_over_64);
+    if (shell_arg_uint16(args, 1, &idx) && (idx < SHELL_CFG_NUM_FIELDS)
+        && shell_arg_uint16(args, 2, &value))
+    {
+        memcpy_P(&field, &arr_shell_cfg_fields[idx], sizeof(field));
+    }
+    else
+    {
+        //no field can take this
+        field.min = 1;
+        field.max = 0;
+    }
     
-    //enable pwm
-    enablePWMOutput(arr_pwm_output[ARR_IDX_BRAKE]);
+    if ((value >= field.min) && (value <= field.max))
+    {
+        //current_limit is read by the adc interrupt
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            data[field.offset] = (uint8_t)value;
+            if (field.size == 2)
+            {
+                data[field.offset + 1] = (uint8_t)(value >> 8);
+            }
+        }
+        UART_transmitString_P(PSTR("ok\r\n"));
+    }
+    else
+    {
+        _shell_print_bad_argument();
+    }
 }
 
-void init_timer2AsOneSecondTimer(void)
+/** shell "log [<module> <level>]": sets the log level of a module (eLOG_MODULE,
+ *  LOG_LVL_xxx), then prints the levels of all modules in eLOG_MODULE order
+ */
+void shell_cmd_log(const sShellArgs* args)
 {
-    //reset registers to a known state
-    timer2_default();
+    uint16_t module;
+    uint16_t level;
+    bool valid = true;
     
-    //sets prescaler to 1024 F_CPU = 16MHz
-    //no real reason for this value, as long as its PWM we are fine
-    // 16MHz / (8_bit_max * prescaler) = 16MHz / (256 * 1024) = 61.03Hz
-    SetTimerPrescale(etimer_2, tmr_prscl_clk_over_1024);
+    if (args->argc > 1)
+    {
+        valid = shell_arg_uint16(args, 1, &module) && shell_arg_uint16(args, 2, &level)
+                && log_set_level(module, level);
+    }
     
-    enableTimerOverflowInterrupt(etimer_2);
+    if (valid)
+    {
+        UART_transmitString_P(PSTR("log"));
+        for (module = 0; module < LOG_NUM_MODULES; module++)
+        {
+            _shell_print_value(gu8_LOG_LEVEL[module]);
+        }
+        UART_transmitNewLine();
+    }
+    else
+    {
+        _shell_print_bad_argument();
+    }
 }
-#pragma endregion timers
 
-/************************************************************************/
-/*                           RGB STATUS LED                             */
-/************************************************************************/
-#pragma region RGB_status_led
-void init_RGB_status_LED(void)
+/** shell "save": RAM config to EEPROM. Only starts it, the main loop writes a byte per pass
+ *  (config_poll) and answers "saved" when the last one is in. Refused while the black box
+ *  or an earlier save is writing, the EEPROM is theirs till they are done
+ */
+void shell_cmd_save(const sShellArgs* args)
 {
-    if( statusLed_init(&PORTD,
-                   LED_R_OUTPUT_PIN, 
-                   LED_G_OUTPUT_PIN, 
-                   LED_B_OUTPUT_PIN, 
-                   LED_ACTIVE_LOW))
+    if (blackbox_busy() || config_busy())
     {
-        UART_transmitString("LED init success\n\0");
+        UART_transmitString_P(PSTR("busy\r\n"));
     }
     else
     {
-        UART_transmitString("LED init fail\n\0");
+        config_save(&gs_CONFIG);
     }
-                    
-    
-    statusLed_set_color(eLED_GREEN);
 }
-#pragma endregion RGB_status_led
+
+/** shell "bbox": sends the black box record saved in EEPROM as binary frames, see
+ *  blackbox.h and tools/blackbox_decode.py
+ */
+void shell_cmd_bbox(const sShellArgs* args)
+{
+    blackbox_dump();
+    UART_transmitString_P(PSTR("bbox\r\n"));
+}
+#pragma endregion shell
 /************************************************************************/
 /*                               MAIN                                   */
 /************************************************************************/
@@ -431,44 +1226,66 @@ ISR(INT1_vect)
     {
         gb_BRAKE_ON = true;
         
-        //this is for the software pre-scaler in ISR(TIMER0_OVF_VECT), which is only
-        //used when gb_SEPERATE_FUNCTION_LIGHTS == true
-        gu8_NUM_TIMER0_OVF = 0;
-        
-        //gb_SEPERATE_FUNCTION_LIGHTS == true we will flash the brake lights a certain
-        //number of times every time the brake is pressed, so we reset it. its used in
-        //ISR(TIMER0_OVF_VECT)
-        gu8_NUM_OCCURED_FLASHES = 0;
+        //the brake pattern is started by the main loop, the first step of the brake ramp is
+        //applied here so the light reacts to the pedal within a tick
+        if (ge_LIGHT_MODE != eLIGHT_MODE_INTEGRATED)
+        {
+            light_set_brightness(ARR_IDX_BRAKE, BRIGHTNESS_FULL);
+            
+            //the new OCR2 would only be loaded at the next BOTTOM, up to a carrier period away
+            updatePWMCompareTimer2Now();
+        }
         
-        #ifdef DEBUG
-        UART_transmitString("Brake on\r\n\0");
-        #endif // DEBUG
+        LOG(BRAKE_ON);
     }
     else
     {
         gb_BRAKE_ON = false;
         
-        #ifdef DEBUG
-        UART_transmitString("Brake off\r\n\0");
-        #endif // DEBUG
+        LOG(BRAKE_OFF);
     }
+    
+    //integrated lights use the brake state in the main loop
+    gb_LIGHT_EVENT = true;
+}
+
+/** Left turn input, any edge. The main loop reads the pin itself, this only wakes it up
+ */
+ISR(INT0_vect)
+{
+    gb_LIGHT_EVENT = true;
 }
 
 void init_external_interupts(void)
 {
     //any logical change on int1 generates an interrupt request
     //set Interrupt Sense Control Bit
-    BIT_CLEAR(MCUCR,ISC10);
+    BIT_CLEAR(MCUCR,ISC11);
     BIT_SET(MCUCR,ISC10);
     
-    //turns on ext interrupt 1
+    //same for int0 (left turn input)
+    BIT_CLEAR(MCUCR,ISC01);
+    BIT_SET(MCUCR,ISC00);
+    
+    //turns on ext interrupt 0 and 1
+    BIT_SET(GICR,INT0);
     BIT_SET(GICR,INT1);
 }
 
 void init_globals(void)
 {
-    gb_NUM_ADC_CONVERSIONS = 0;
-    ge_ADC_STATE = STATE_ADC_READ_FEEDBACK;  //init
+    uint8_t idx;
+    
+    ge_ADC_STATE = STATE_ADC_SCAN;  //init
+    ge_LIGHT_MODE = eLIGHT_MODE_AUTO;
+    gu16_TOPO_CURRENT_SUM = 0;
+    gu16_TOPO_DUTY_SUM = 0;
+    gu8_TOPO_SAMPLES = 0;
+    ge_TOPO_VERDICT = eLIGHT_MODE_AUTO;
+    gu8_TOPO_STREAK = 0;
+    
+    //first, everything after this may log
+    log_init();
     
     //the temptation might be to set these flags in a bit field in a single 8 bit register
     //but since they are set by multiple interrupts, we lessen the probability of data
@@ -477,13 +1294,56 @@ void init_globals(void)
     gb_LEFT_TURN_SIGNAL_ON = false;
     gb_RIGHT_TURN_SIGNAL_ON = false;
     gb_OVERCURRENT_TRIPPED = false;
+    gb_LIGHT_EVENT = false;
+    gb_RIGHT_IN = (BIT_GET(LIGHT_INPUT_PORT, RIGHT_IN) != 0);
+    gu8_RIGHT_IN_DEBOUNCE = 0;
 
-    gu8_MAX_NUM_FLASHES =  10;
-    gu16_FLASH_FREQ_PRESCALER = 12;    
+    //everything below may depend on the config
+    config_load(&gs_CONFIG, &gs_CONFIG_DEFAULTS);
+    
+    //a config from another tool/firmware could have values this build can't use
+    if (gs_CONFIG.brake_pattern >= BRAKE_NUM_PATTERNS)
+    {
+        gs_CONFIG.brake_pattern = BRAKE_PATTERN_DEFAULT;
+    }
+    if (gs_CONFIG.flash_step_ms == 0)
+    {
+        gs_CONFIG.flash_step_ms = 1;    //0 would make the brake flash timer a one shot
+    }
+    if (gs_CONFIG.light_mode > eLIGHT_MODE_INTEGRATED)
+    {
+        gs_CONFIG.light_mode = eLIGHT_MODE_AUTO;
+    }
+    if ((gs_CONFIG.current_limit < CURRENT_LIMIT_MIN) || (gs_CONFIG.current_limit > CURRENT_LIMIT_MAX))
+    {
+        gs_CONFIG.current_limit = CURRENT_LIMIT_DEFAULT;
+    }
+    
+    //the pots overwrite these once they are read, unless they are locked out
+    gu8_BRAKE_PATTERN = gs_CONFIG.brake_pattern;
+    gu8_FLASH_STEP_MS = gs_CONFIG.flash_step_ms;
+    
+    sw_timers_init();
     
-    gu8_NUM_TIMER0_OVF = 0;
-    gu8_NUM_TIMER1_OVF = 0;
-    gu8_NUM_TIMER2_OVF = 0;
+    for (idx = 0; idx < 3; idx++)
+    {
+        arr_channel_fault[idx].state = eFAULT_NONE;
+        arr_channel_fault[idx].backoff = 0;
+        arr_channel_fault[idx].countdown = 0;
+        arr_channel_fault[idx].fault_count = 0;
+        arr_light_ramp[idx].val = 0;
+        arr_light_ramp[idx].target = 0;
+        arr_light_ramp[idx].step = 0;
+        arr_light_brightness[idx] = BRIGHTNESS_OFF;
+        arr_light_enabled[idx] = false;
+        arr_lamp_out[idx].current_sum = 0;
+        arr_lamp_out[idx].duty_sum = 0;
+        arr_lamp_out[idx].samples = 0;
+        arr_lamp_out[idx].low_windows = 0;
+        arr_lamp_out[idx].out = false;
+        arr_lamp_out[idx].checked = (idx != ARR_IDX_BRAKE);
+        arr_lamp_out[idx].reported = false;
+    }
 }
 
 void init_IO(void)
@@ -500,7 +1360,7 @@ void init_IO(void)
     //  PB6 - OSC XTAL osc1
     //  PB7 - OSC XTAL osc2
     //  PC0 - ADC input flash freq
-    //  PC1 - ADC input flash num
+    //  PC1 - ADC input brake pattern
     //  PC2 - ADC input left  feedback/current measuring
     //  PC3 - ADC input brake feedback/current measuring
     //  PC4 - ADC input rigth feedback/current measuring
@@ -523,6 +1383,14 @@ void init_IO(void)
     DDRD |= (1 << LED_R_OUTPUT_PIN)
          |  (1 << LED_G_OUTPUT_PIN)
          |  (1 << LED_B_OUTPUT_PIN);
+    
+    #ifdef ISR_PROFILE
+    //  PB0, PB4, PB5, PC5 - ISR profiling markers (see global.h)
+    DDRB |= (1 << PINB0)
+         |  (1 << PINB4)
+         |  (1 << PINB5);
+    DDRC |= (1 << PINC5);
+    #endif // ISR_PROFILE
          
     //LED is active low 
     BIT_CLEAR(LED_OUTPUT_PORT, LED_R_OUTPUT_PIN);
@@ -641,449 +1509,184 @@ int main_adc(void)
  */
 int main(void)
 {
-    //in the future you may use these
-    char ret_data[_UART_RX_BUFF_MAX_LEN] = {0};
-    uint8_t num;
-    uint8_t ret_len;
-    uint16_t brake_light_test_reading;
-    bool separate_function_lights;
-    bool debug_mode_enabled = false;
-    eDEBUG_MODES curr_debug_mode;
+    bool left_in;
+    bool right_in;
+    bool brake_in;
+    bool left_in_prev = false;
+    bool right_in_prev = false;
+    bool brake_in_prev = false;
+    uint8_t left_brightness;
+    uint8_t right_brightness;
+    //last value written to the outputs: on/off in separate mode, brightness in
+    //integrated mode. 0xFFFF is never valid so the first event always writes
+    uint16_t left_applied = 0xFFFF;
+    uint16_t right_applied = 0xFFFF;
+    //mode the applied values above belong to
+    eLIGHT_MODE mode_applied;
+    //what caused this reset, read before anything can change it
+    uint8_t reset_flags = MCUCSR;
+    
+    MCUCSR = 0;
     
     //initialization order
     //1. uart
     //2. adc (must be done before timers)
     //3. timers    
     
-#ifdef DEBUG
-    init_uart_debug();
-    
-    UART_transmitString("Trunk Light FW starting v 1.0.0 2019/04/14\r\n\0");
-#endif // DEBUG
-
     //order of initialization is important
     init_IO();
     init_globals();
+    blackbox_init(reset_flags);
+    
+    LOG(BOOT);
+    
+    //the command shell, telemetry and the log all go out on the uart
+    init_uart_debug();
+    shell_init(arr_shell_commands, SHELL_NUM_COMMANDS);
     init_external_interupts();
-    //no interrupts until AFTER we take brake current reading.
-    init_adc(false);
+    init_adc(true);
     init_timers();
     init_RGB_status_LED();
-       
-        
-    //enable global interrupts
-    sei();
-
-    /*    
-    now set pwm of brake very low,
-    monitor voltage levels, is there current flowing?
-    if yes
-    separate_function_lights = true
-        we have 3 light system
-        we have a brake light circuit separate from the turn signals
-        this will use flashing for brakes 100% guaranteed
-    else
-        we have two light system
-        separate_function_lights = false
-        a) disable brake output
-        in a two light system we have only left and right lights. so they must
-        do both turn signal and brake.... i think for clarity this also disables
-        all flashing functionality???? I havent decided yet
-   
-    now that we've determined system type we can go to work with regular program
-    */
-    
-    statusLed_set_color(eLED_YELLOW);
     statusLed_On();
-    setPWMDutyCycle(arr_pwm_output[ARR_IDX_BRAKE], DUTY_CYCLE_FULL_BRIGHTNESS);
-    adc_select_ref(FDBK_REF);
-    //adc_select_input_channel(arr_adc_input[ARR_IDX_FL_FREQ]);
-    adc_select_input_channel(arr_adc_input[ARR_IDX_BRAKE]);    
-    _delay_ms(10);
-    //adc start conversion and wait for result, normally the first one is inaccurate
-    //so we wont even check it
-    adc_start_conversion(true);
-    _delay_ms(3000);
-    
-    adc_start_conversion(true);
-    brake_light_test_reading = adc_read10_value();
-    
-    #ifdef DEBUG
-    UART_transmitString("Brake value:\0");
-    UART_transmitUint16(brake_light_test_reading);
-    UART_transmitNewLine();
-    #endif // DEBUG
     
-    //init adc for program use, with interrupts
-    init_adc(false);
+    //the scan (and with it the overcurrent trip) runs before any output is turned on
+    adc_scan_start();
     
-    //if we have at least 100mA flowing, we know we have a brake light connected
-    if (brake_light_test_reading >= FEEDBACK_50_mAMP)
+    //the lights work straight away. Without a mode in the config they start in the
+    //conservative mode that suits both topologies, task_topology switches to the right
+    //one once it has seen enough of the brake output current and keeps watching for a
+    //trailer swap
+    light_mode_enter(gs_CONFIG.light_mode);
+    mode_applied = ge_LIGHT_MODE;
+    
+    if (ge_LIGHT_MODE == eLIGHT_MODE_AUTO)
     {
-        separate_function_lights = true;
-        statusLed_set_color(eLED_GREEN);
-        #ifdef DEBUG
-        UART_transmitString("Detected Separate fn\r\n\0");
-        #endif // DEBUG
+        sw_timer_start(SW_TIMER_TOPOLOGY, TOPO_PERIOD_MS, TOPO_PERIOD_MS, task_topology);
     }
-    else
+    
+    //periodic work, the rest of the software timers are started by the light logic
+    sw_timer_start(SW_TIMER_LIGHT_SERVICE, LIGHT_SERVICE_MS, LIGHT_SERVICE_MS, task_light_service);
+    sw_timer_start(SW_TIMER_STATUS_LED, STATUS_LED_BLINK_MS, STATUS_LED_BLINK_MS, task_status_led);
+    if (gs_CONFIG.telemetry_period_ms != 0)
     {
-        separate_function_lights = false;
-        statusLed_set_color(eLED_AQUA);
-        #ifdef DEBUG
-        UART_transmitString("Detected Integrated fn\r\n\0");
-        #endif // DEBUG
-    }    
+        sw_timer_start(SW_TIMER_TELEMETRY, gs_CONFIG.telemetry_period_ms, gs_CONFIG.telemetry_period_ms, task_telemetry);
+    }
+
+    //idle mode keeps the timers, adc and uart running, only the cpu stops
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    
+    //enable global interrupts
+    sei();
+    
+    //forces the first pass through the loop to apply the current inputs
+    gb_LIGHT_EVENT = true;
     
-    if (separate_function_lights)
+    //the loop comes around every 1ms tick
+    wdt_enable(WDTO_500MS);
+
+    while (1)
     {
-        // here we have a separate brake and turn signals. The turn signals only
-        // need to handle themselves based on current input values
+        //sleep until something that changes the lights happens (input edge, right input
+        //debounce) or the next 1ms tick. Checking and going to sleep has to be atomic,
+        //otherwise an event arriving in between would wait for an unrelated interrupt
+        cli();
+        if ((gb_LIGHT_EVENT == false) && !sw_timers_pending())
+        {
+            sleep_enable();
+            sei();          //the instruction after sei always executes, so no wake up is lost
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
         
-        // the lights are flashed by enabling and disabling the PWM output
-        // this ensures no dim glow/leakage we would get if we left them on with 0% duty cycle
-        setPWMDutyCycle(arr_pwm_output[ARR_IDX_LEFT],  DUTY_CYCLE_FULL_BRIGHTNESS);
-        setPWMDutyCycle(arr_pwm_output[ARR_IDX_RIGHT], DUTY_CYCLE_FULL_BRIGHTNESS);
+        wdt_reset();
         
-        disablePWMOutput(arr_pwm_output[ARR_IDX_LEFT]);
-        disablePWMOutput(arr_pwm_output[ARR_IDX_RIGHT]);
+        //periodic tasks, the turn signal timeout sets gb_LIGHT_EVENT
+        sw_timers_run();
         
-        //sets brake as running light
-        setPWMDutyCycle(arr_pwm_output[ARR_IDX_BRAKE], DUTY_CYCLE_LOW_BRIGHTNESS);
+        //at most one command line per pass, the lights keep running while it is used
+        shell_poll();
         
-        //timer0 is used for the flasher function
-        enableTimerOverflowInterrupt(etimer_0);
-    }
-    else
-    {
-        //here we have no explicit brake light, only left and right lights, so they
-        //must operate as brake AND turn signal
+        //log records that came in since the last pass, one frame at most
+        log_flush();
         
-        //this will disable pwm on the brake light 
-        //now timer2 will be re-purposed as a 1 second timer
-        //when turn signals are on we want it to go from full/off for contrast
-        //if the signal doesn't go high for 1 second, we can resume brake duty
-        init_timer2AsOneSecondTimer();
+        //config save started by the shell, one EEPROM byte per pass
+        if (config_poll())
+        {
+            UART_transmitString_P(PSTR("saved\r\n"));
+        }
         
-        //timer0 is used as flasher function, we wont have this for combined light mode
-        //so we disable it completely
-        timer0_default();
+        //black box save or dump
+        blackbox_poll();
         
-        //sets lights as running lights
-        setPWMDutyCycle(arr_pwm_output[ARR_IDX_LEFT], DUTY_CYCLE_LOW_BRIGHTNESS);
-        setPWMDutyCycle(arr_pwm_output[ARR_IDX_RIGHT], DUTY_CYCLE_LOW_BRIGHTNESS);
-    }        
-
-#ifndef DEBUG_DIAG    
-    //start adc state machine
-    init_adc(true);
-    adc_start_conversion(false);
-#endif
-
-    while (1)
-    {
+        if (gb_LIGHT_EVENT == false)
+        {
+            //woken up by an interrupt that doesn't concern the lights (adc, uart, tick)
+            continue;
+        }
+        gb_LIGHT_EVENT = false;
+        
+        left_in  = (BIT_GET(LIGHT_INPUT_PORT, LEFT_IN) != 0);
+        right_in = gb_RIGHT_IN;
+        brake_in = gb_BRAKE_ON;
+        
+        //light_mode_enter set the outputs up for the new mode, everything gets applied again
+        if (ge_LIGHT_MODE != mode_applied)
+        {
+            mode_applied = ge_LIGHT_MODE;
+            left_applied = 0xFFFF;
+            right_applied = 0xFFFF;
+        }
         
-#ifdef DEBUG_DIAG      
-        //originally I planned to enable al debug modes, but unfortunately
-        //they took up too much memory (only 8kb avaliable)
-        // so I had to enable them one at a time using block comments
-        UART_ReadLineRxBuff(ret_data, &ret_len);
+        //fast overcurrent trip follows the output that switched on last, that is where
+        //a cold bulb inrush or a freshly connected short shows up
+        if (left_in && !left_in_prev)
+        {
+            adc_scan_set_priority(ARR_IDX_LEFT);
+        }
+        else if (right_in && !right_in_prev)
+        {
+            adc_scan_set_priority(ARR_IDX_RIGHT);
+        }
+        else if (brake_in && !brake_in_prev && (mode_applied != eLIGHT_MODE_INTEGRATED))
+        {
+            adc_scan_set_priority(ARR_IDX_BRAKE);
+        }
         
-        if (ret_len > 0)
+        //the brake output is a brake light in every mode but integrated, the pattern
+        //only runs once we know a brake lamp is connected
+        if ((mode_applied != eLIGHT_MODE_INTEGRATED) && (brake_in != brake_in_prev))
         {
-            if (ret_data[0] == 'd')
+            if (brake_in && (mode_applied == eLIGHT_MODE_SEPARATE))
             {
-                UART_transmitString("Entering debug mode\r\n\0");
-                debug_mode_enabled = true;
-                curr_debug_mode = DebugDisabled;
+                //INT1 already put the brake on full, the pattern starts one beat later
+                brake_pattern_start();
             }
-            
-            if (debug_mode_enabled)
+            else if (!brake_in)
             {
-                if (curr_debug_mode == DebugDisabled)
-                {
-                    if (ret_data[0] == 'Q')
-                    {
-                        UART_transmitString("Leaving debug mode, reset device for normal operation\r\n\0");
-                        debug_mode_enabled = false;
-                    }
-                    else if (ret_data[0] == 'a' && ret_data[1] == 'd' && ret_data[2] == 'c')
-                    {
-                        curr_debug_mode = DebugADC;
-                        UART_transmitString("Starting ADC debug mode");
-                    
-                        adc_disable_interrupt_on_conversion();
-                        ge_ADC_STATE = STATE_ADC_TEST;
-                        adc_select_ref(AVcc);
-                        adc_select_input_channel(ADC4);
-                        adc_enable_interrupt_on_conversion();                    
-                    
-                        adc_start_conversion(false);
-                    }
-                    else if (ret_data[0] == 'u')
-                    {
-                        curr_debug_mode = DebugUART;
-                        UART_transmitString("Starting uart debug mode");
-                    }
-                    else if ((ret_data[0] == 'p') && (ret_data[1] == 'w') && (ret_data[2] == 'm'))
-                    {
-                        curr_debug_mode = DebugPWM;
-                        UART_transmitString("Starting PWM debug mode");
-                        //ensures PWM is running
-                        init_timers();
-                    }
-                    else if (ret_data[0] == 'l')
-                    {
-                        curr_debug_mode = DebugLED;
-                        init_RGB_status_LED();
-                        UART_transmitString("Starting RGB LED debug mode");
-                    }                        
-                }//if (curr_debug_mode == DebugDisabled)
-               /* else if (curr_debug_mode == DebugADC)
-                {
-                    if (ret_data[0] == 'Q')
-                    {
-                        UART_transmitString("Leaving adc debug mode\r\n\0");
-                        curr_debug_mode = DebugDisabled;
-                        
-                        adc_disable_interrupt_on_conversion();
-                    }
-                    else if (ret_data[0] == 'g')
-                    {
-                        UART_transmitString("Displaying ground\r\n\0");
-                        adc_select_input_channel(GND_0V_mega8);
-                    }
-                    else if (ret_data[0] == 't')
-                    {
-                        UART_transmitString("Displaying 1.30V reference\r\n\0");
-                        adc_select_input_channel(REF_1P30v_mega8);
-                    }
-                    else if (ret_data[0] == 'r')
-                    {
-                        if (ret_data[1] == '5')
-                        {
-                            UART_transmitString("Setting Reference to 5V Vcc\r\n\0");
-                            adc_select_ref(AVcc);
-                        }
-                        if (ret_data[1] == '2')
-                        {
-                            UART_transmitString("Setting reference to 2.56V\r\n\0");
-                            adc_select_ref(Internal_2p56V);
-                        }
-                    }
-                    else if (ret_data[0] == '0')
-                    {
-                        UART_transmitString("Displaying Channel 0\r\n\0");
-                        adc_select_input_channel(ADC0);
-                        adc_start_conversion(true);
-                        brake_light_test_reading = adc_read10_value();
-                        UART_transmitUint16(brake_light_test_reading);
-                        UART_transmitNewLine();
-                        
-                    }
-                    else if (ret_data[0] == '1')
-                    {
-                        UART_transmitString("Displaying Channel 1\r\n\0");
-                        adc_select_input_channel(ADC1);
-                        adc_start_conversion(true);
-                        brake_light_test_reading = adc_read10_value();
-                        UART_transmitUint16(brake_light_test_reading);
-                        UART_transmitNewLine();
-                    }
-                    else if (ret_data[0] == '2')
-                    {
-                        UART_transmitString("Displaying Channel 2\r\n\0");
-                        adc_select_input_channel(ADC2);
-                        adc_start_conversion(true);
-                        brake_light_test_reading = adc_read10_value();
-                        UART_transmitUint16(brake_light_test_reading);
-                        UART_transmitNewLine();
-                    }
-                    else if (ret_data[0] == '3')
-                    {
-                        UART_transmitString("Displaying Channel 3\r\n\0");
-                        adc_select_input_channel(ADC3);
-                        adc_start_conversion(false);
-                        _delay_ms(100);
-                        brake_light_test_reading = adc_read10_value();
-                        UART_transmitUint16(brake_light_test_reading);
-                        UART_transmitNewLine();
-                    }
-                    else if (ret_data[0] == '4')
-                    {
-                        UART_transmitString("Displaying Channel 4\r\n\0");
-                        adc_select_input_channel(ADC4);
-                        adc_start_conversion(false);
-                        _delay_ms(100);
-                        brake_light_test_reading = adc_read10_value();
-                        UART_transmitUint16(brake_light_test_reading);
-                        UART_transmitNewLine();
-                    }
-                }//else if (curr_debug_mode == DebugADC)
-                else if (curr_debug_mode == DebugPWM)
-                {
-                    if (ret_data[0] == 'Q')
-                    {
-                        UART_transmitString("Leaving PWM debug mode\r\n\0");
-                        curr_debug_mode = DebugDisabled;
-                        init_timers();
-                    }
-                    else if (ret_data[0] == 's')
-                    {
-                        num = ret_data[4] - 48;
-                        num *= 10;
-                        
-                        UART_transmitString("PWM:");
-                        UART_transmitUint8(num);
-                        UART_transmitNewLine();
-                        if ((ret_data[1] == '1') || (ret_data[2] == 'a'))
-                        {
-                            setPWMDutyCycle(epwm_1a,num);
-                        } 
-                        else if ((ret_data[1] == '1') || (ret_data[2] == 'b'))
-                        {
-                            setPWMDutyCycle(epwm_1b,num);
-                        }
-                        else if (ret_data[1] == '2')
-                        {
-                            setPWMDutyCycle(epwm_2,num);
-                        }
-                    }//else if (ret_data[0] == 's')
-                    else if (ret_data[0] == 'd')
-                    {
-                        if ((ret_data[1] == '1') || (ret_data[2] == 'a'))
-                        {
-                            disablePWMOutput(epwm_1a);
-                        }
-                        else if ((ret_data[1] == '1') || (ret_data[2] == 'b'))
-                        {
-                            disablePWMOutput(epwm_1b);
-                        }
-                        else if (ret_data[1] == '2')
-                        {
-                            disablePWMOutput(epwm_2);
-                        }
-                    }//else if (ret_data[0] == 'd')
-                    else if (ret_data[0] == 'e')
-                    {
-                        if ((ret_data[1] == '1') || (ret_data[2] == 'a'))
-                        {
-                            enablePWMOutput(epwm_1a);
-                        }
-                        else if ((ret_data[1] == '1') || (ret_data[2] == 'b'))
-                        {
-                            enablePWMOutput(epwm_1b);
-                        }
-                        else if (ret_data[1] == '2')
-                        {
-                            enablePWMOutput(epwm_2);
-                        }
-                    }//else if (ret_data[0] == 'e') 
-                }// else if (curr_debug_mode == DebugPWM) 
-                */
-               
-                else if (curr_debug_mode == DebugLED)
-                {
-                    switch  (ret_data[0])
-                    {
-                        case '1':
-                        case 'r':
-                        {
-                            statusLed_On();
-                            statusLed_set_color(eLED_RED);         
-                            UART_transmitString("RED\n\0");
-                            break;
-                        }   
-                        case '2':
-                        case 'y':
-                        {
-                            statusLed_On();
-                            statusLed_set_color(eLED_YELLOW);
-                            UART_transmitString("YELLOW\n\0");
-                            break;
-                        }
-                        case '3':
-                        case 'g':
-                        {
-                            statusLed_On();
-                            statusLed_set_color(eLED_GREEN);
-                            UART_transmitString("GREEN\n\0");
-                            break;
-                        }
-                        case '4':
-                        case 'a':
-                        {
-                            statusLed_On();
-                            statusLed_set_color(eLED_AQUA);
-                            UART_transmitString("AQUA\n\0");
-                            break;
-                        }
-                        case '5':
-                        case 'b':
-                        {
-                            statusLed_On();
-                            statusLed_set_color(LED_BLUE);
-                            UART_transmitString("BLUE\n\0");
-                            break;
-                        }
-                        case '6':
-                        case 'p':
-                        {
-                            statusLed_On();
-                            statusLed_set_color(eLED_PURPLE);
-                            UART_transmitString("PURPLE\n\0");
-                            break;
-                        }
-                        case '7':
-                        case 'w':
-                        {
-                            statusLed_On();
-                            statusLed_set_color(eLED_WHITE);
-                            UART_transmitString("WHITE\n\0");
-                            break;
-                        }
-                        case 't':
-                        {
-                            statusLed_toggle();
-                            UART_transmitString("toggle\n\0");
-                            break;
-                        }
-                        default:
-                        {
-                            statuseLED_OFF();
-                            statusLed_set_color(eLED_OFF);
-                            UART_transmitString("OFF\n\0");
-                            break;
-                        }
-                    } //end switch                                          
-                } // else if (curr_debug_mode == DebugLED)               
-            }//if (debug_mode_enabled)
-            
-//             
-//             adc_select_input_channel(arr_adc_input[ARR_IDX_FL_FREQ]);
-//             UART_transmitString("sc\r\n\0");
-//             if (!adc_start_conversion(true))
-//             UART_transmitString("ADC ERROR not enabled\0");
-//                             
-//             adc_val = adc_read10_value();
-//                             
-//             UART_transmitString("FREQ:\0");
-//             UART_transmitUint16(adc_val);
-//                             
-//             adc_select_input_channel(arr_adc_input[ARR_IDX_FL_NUM]);
-//             adc_start_conversion(true);
-//             adc_val = adc_read10_value();
-//                             
-//             UART_transmitString("     NUM:\0");
-//             UART_transmitUint16(adc_val);
-                            
-            UART_transmitNewLine();
-            
-        }//end ret_len > 0
-#else // !DEBUG_DIAG
-
+                sw_timer_stop(SW_TIMER_BRAKE_FLASH);
+                light_set_brightness(ARR_IDX_BRAKE, BRIGHTNESS_LOW);
+            }
+        }
+        
+        if (left_in != left_in_prev)
+        {
+            blackbox_event(eBB_EVENT_LEFT, ARR_IDX_LEFT, left_in);
+        }
+        if (right_in != right_in_prev)
+        {
+            blackbox_event(eBB_EVENT_RIGHT, ARR_IDX_RIGHT, right_in);
+        }
+        if (brake_in != brake_in_prev)
+        {
+            blackbox_event(eBB_EVENT_BRAKE, ARR_IDX_BRAKE, brake_in);
+        }
+        
+        left_in_prev  = left_in;
+        right_in_prev = right_in;
+        brake_in_prev = brake_in;
                 
-        if (separate_function_lights)
+        if (mode_applied == eLIGHT_MODE_SEPARATE)
         {
             // here we have a separate brake and turn signals. The turn signals only
             // need to handle themselves based on current input values,
@@ -1093,38 +1696,45 @@ int main(void)
             // the leakage/dim-glow if we simply set the PWM value to 0% duty cycle
             
             // LEFT TURN
-            if (BIT_GET(LIGHT_INPUT_PORT, LEFT_IN))
-            {
-                enablePWMOutput(arr_pwm_output[ARR_IDX_LEFT]);
-                #ifdef DEBUG
-                UART_transmitString("LEFT ON\r\n\0");
-                #endif // DEBUG
-            }
-            else
+            if (left_in != left_applied)
             {
-                disablePWMOutput(arr_pwm_output[ARR_IDX_LEFT]);
+                left_applied = left_in;
+                
+                if (left_in)
+                {
+                    light_output_enable(ARR_IDX_LEFT);
+                    LOG(LEFT_ON);
+                }
+                else
+                {
+                    light_output_disable(ARR_IDX_LEFT);
+                }
             }
             
             //RIGHT TURN
-            if (BIT_GET(LIGHT_INPUT_PORT, RIGHT_IN))
-            {
-                enablePWMOutput(arr_pwm_output[ARR_IDX_RIGHT]);
-                #ifdef DEBUG
-                UART_transmitString("RIGHT ON\r\n\0");
-                #endif // DEBUG
-            }
-            else
+            if (right_in != right_applied)
             {
-                disablePWMOutput(arr_pwm_output[ARR_IDX_RIGHT]);
+                right_applied = right_in;
+                
+                if (right_in)
+                {
+                    light_output_enable(ARR_IDX_RIGHT);
+                    LOG(RIGHT_ON);
+                }
+                else
+                {
+                    light_output_disable(ARR_IDX_RIGHT);
+                }
             }
             
-            //BRAKE handled by interrupts (ext1 and timer0 overflow)
+            //BRAKE handled by ext1 interrupt and task_brake_flash
             
-        }//if (separate_function_lights)
-        else //if (!separate_function_lights)
+        }//if (mode_applied == eLIGHT_MODE_SEPARATE)
+        else //integrated, or not detected yet
         {
             // this is where we only have a left light and a right light, the must handle both
-            // brakes and turn signals.
+            // brakes and turn signals. Until the lamps are detected the turn lamps of
+            // separate function lights are run this way as well, so a brake shows either way
             // We cannot simply set output based on input since we have to keep in mind what
             // the brake should be doing
             
@@ -1136,71 +1746,74 @@ int main(void)
             // after like 1 second of turn signal being off, we can resume regular brake duty
             
             // LEFT TURN
-            if (BIT_GET(LIGHT_INPUT_PORT, LEFT_IN))
+            if (left_in)
             {
-                setPWMDutyCycle(arr_pwm_output[ARR_IDX_LEFT], DUTY_CYCLE_FULL_BRIGHTNESS);
-                //you need the watchdog timer
-                gu8_NUM_TIMER2_OVF = 0;
+                left_brightness = BRIGHTNESS_FULL;
                 gb_LEFT_TURN_SIGNAL_ON = true;
                 
-                #ifdef DEBUG
-                UART_transmitString("left on\r\n\0");
-                #endif // DEBUG
+                LOG(LEFT_ON);
+            }
+            else if (gb_LEFT_TURN_SIGNAL_ON)
+            {
+                left_brightness = BRIGHTNESS_OFF;
+            }
+            else if (gb_BRAKE_ON)
+            {
+                left_brightness = BRIGHTNESS_FULL;
             }
             else
             {
-                if (gb_LEFT_TURN_SIGNAL_ON)
-                {
-                    setPWMDutyCycle(arr_pwm_output[ARR_IDX_LEFT], DUTY_CYCLE_OFF_BRIGHTNESS);
-                }
-                else
-                {
-                    if (gb_BRAKE_ON)
-                    {
-                        setPWMDutyCycle(arr_pwm_output[ARR_IDX_LEFT], DUTY_CYCLE_FULL_BRIGHTNESS);
-                    }
-                    else
-                    {
-                        setPWMDutyCycle(arr_pwm_output[ARR_IDX_LEFT], DUTY_CYCLE_LOW_BRIGHTNESS);
-                    }
-                }
+                left_brightness = BRIGHTNESS_LOW;
             }
             
             // RIGHT TURN
-            if (BIT_GET(LIGHT_INPUT_PORT, RIGHT_IN))
+            if (right_in)
             {
-                setPWMDutyCycle(arr_pwm_output[ARR_IDX_RIGHT], DUTY_CYCLE_FULL_BRIGHTNESS);
-                //you need the watchdog timer
-                gu8_NUM_TIMER2_OVF = 0;
+                right_brightness = BRIGHTNESS_FULL;
                 gb_RIGHT_TURN_SIGNAL_ON = true;
                 
-                #ifdef DEBUG
-                UART_transmitString("right on\r\n\0");
-                #endif // DEBUG
+                LOG(RIGHT_ON);
+            }
+            else if (gb_RIGHT_TURN_SIGNAL_ON)
+            {
+                right_brightness = BRIGHTNESS_OFF;
+            }
+            else if (gb_BRAKE_ON)
+            {
+                right_brightness = BRIGHTNESS_FULL;
             }
             else
             {
-                if (gb_RIGHT_TURN_SIGNAL_ON)
-                {
-                    setPWMDutyCycle(arr_pwm_output[ARR_IDX_RIGHT], DUTY_CYCLE_OFF_BRIGHTNESS);
-                }
-                else
-                {
-                    if (gb_BRAKE_ON)
-                    {
-                        setPWMDutyCycle(arr_pwm_output[ARR_IDX_RIGHT], DUTY_CYCLE_FULL_BRIGHTNESS);
-                    }
-                    else
-                    {
-                        setPWMDutyCycle(arr_pwm_output[ARR_IDX_RIGHT], DUTY_CYCLE_LOW_BRIGHTNESS);
-                    }
-                }
+                right_brightness = BRIGHTNESS_LOW;
+            }
+            
+            //only touch the compare registers when the value really changes
+            if (left_brightness != left_applied)
+            {
+                light_set_brightness(ARR_IDX_LEFT, left_brightness);
+                left_applied = left_brightness;
+            }
+            
+            if (right_brightness != right_applied)
+            {
+                light_set_brightness(ARR_IDX_RIGHT, right_brightness);
+                right_applied = right_brightness;
+            }
+            
+            //the 1 second turn signal "watchdog" only counts while both turn inputs are off
+            if (left_in || right_in)
+            {
+                sw_timer_stop(SW_TIMER_TURN_TIMEOUT);
+            }
+            else if ((gb_LEFT_TURN_SIGNAL_ON || gb_RIGHT_TURN_SIGNAL_ON)
+                     && !sw_timer_running(SW_TIMER_TURN_TIMEOUT))
+            {
+                sw_timer_start(SW_TIMER_TURN_TIMEOUT, TURN_SIGNAL_TIMEOUT_MS, 0, task_turn_timeout);
             }
             
             //brake input and gb_BRAKE_ON is handled by external interrupt 1
             
         }//end else (!seperate_function_lights)
-#endif // DEBUG
     }//end while(1)
 }//main
 
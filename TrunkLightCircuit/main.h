@@ -12,11 +12,22 @@
 #ifndef MAIN_H_
 #define MAIN_H_
 
+#include <stddef.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
 #include "global.h"
 #include "avr_uart.h"
 #include "avr_adc.h"
 #include "avr_timers.h"
+#include "sw_timers.h"
+#include "config.h"
+#include "telemetry.h"
+#include "shell.h"
+#include "log.h"
+#include "blackbox.h"
 #include "StatusLED.h"
 
 /************************************************************************/
@@ -29,7 +40,8 @@ void init_uart_debug(void);
 /************************************************************************/
 #define FLASH_FREQ_INPUT_IDX 3
 #define FLASH_NUM_INPUT_IDX  4
-#define FDBK_CYCLES         59      ///this is an additional modulus on adc conversions, the flash
+#define FLASH_POT_DIVIDER   20      ///the pots are read once every 20 passes over the feedback
+                                    ///channels (60 feedback conversions)
 //this is the order
 //notice we preserve ARR_IDX_xxxx ordering
 //FEEDBACK_LEFT, FEEDBACK_BRAKE, FEEDBACK_RIGHT, FREQ_FLASH, NUM_FLASH
@@ -37,16 +49,14 @@ void init_uart_debug(void);
 #define ARR_IDX_FL_NUM  4
 const eADCInput arr_adc_input[5] = {ADC4, ADC3, ADC2, ADC0, ADC1};
 
-const eADCReference FLASH_REF = AVcc;
-const eADCReference FDBK_REF  = AVcc;   //used to have a 2.56 ref, but newest code has opamp
+//these are defines (not const variables) so they can be used in the scan table initializer
+#define FLASH_REF   AVcc
+#define FDBK_REF    AVcc    //used to have a 2.56 ref, but newest code has opamp
     //so we can keep the 5V reference
 
 typedef enum
 {
-    STATE_ADC_SWITCH_TO_5V_REF,
-    STATE_ADC_READ_FEEDBACK,    
-    STATE_ADC_READ_FREQ_FLASHES,
-    STATE_ADC_READ_NUM_FLASHES,
+    STATE_ADC_SCAN,             /// normal operation, the scan engine runs arr_adc_scan
     STATE_ADC_TEST,
     STATE_ADC_HALT,
 }ADC_STATE_MACHINE;
@@ -61,11 +71,92 @@ volatile ADC_STATE_MACHINE ge_ADC_STATE;
 #define FEEDBACK_1p12_AMP   1024    //max value
 #define FEEDBACK_50_mAMP    46 //45.6
 
-//adc input
-const uint16_t gbCURRENT_LIMIT = FEEDBACK_1_AMP;
+//overcurrent trip level is gs_CONFIG.current_limit, this is its default
+#define CURRENT_LIMIT_DEFAULT   FEEDBACK_1_AMP
+//range "set" and init_globals accept. A lamp draws FEEDBACK_50_mAMP or more so a lower
+//limit trips every good lamp, the adc reads at most 1023 so a higher one never trips
+#define CURRENT_LIMIT_MIN       FEEDBACK_50_mAMP
+#define CURRENT_LIMIT_MAX       1023
 
-static volatile uint16_t arr_adc_conv_val[3] = {0};
-static volatile uint8_t gb_NUM_ADC_CONVERSIONS = 0;
+//fast overcurrent trip. The feedback channel of the output that switched on last is the scan
+//priority channel (adc_scan_set_priority), it gets every other conversion so its check never
+//waits for the round robin or the pots. Worst case from a fault starting to the output being
+//turned off is 3 conversions: the rest of the one in progress, one other channel, then the
+//priority conversion itself. Each conversion is started from the ADC interrupt, so two
+//restarts and the trip path of the last interrupt come on top (tests/test_overcurrent.c)
+#define OVERCURRENT_TRIP_MAX_US     200     /// allowed worst case, checked below
+#if (F_CPU == 8000000UL)
+#define ADC_CLK_DIV                 128     /// must match adc_set_prescale in init_adc
+#else
+#define ADC_CLK_DIV                 64
+#endif
+#define ADC_CONVERSION_US           ((13UL * ADC_CLK_DIV * 1000000UL) / F_CPU)
+//ADC ISR paths, estimates until the first simavr run: tests/profile/isr_profile checks them
+//as the adc_restart and adc_trip budgets and fails the build when the firmware takes longer.
+//Raise them to what it measured then, the #error below says if the ADC clock has to go up
+#define ADC_ISR_RESTART_CYCLES      160     /// vector to the next conversion start in adc_scan_isr
+#define ADC_ISR_TRIP_CYCLES         320     /// vector to disablePWMOutput in light_fault_trip
+#define OVERCURRENT_TRIP_WORST_US   (3 * ADC_CONVERSION_US \
+                                    + ((2UL * ADC_ISR_RESTART_CYCLES + ADC_ISR_TRIP_CYCLES) * 1000000UL) / F_CPU)
+#if (OVERCURRENT_TRIP_WORST_US > OVERCURRENT_TRIP_MAX_US)
+#error "Overcurrent trip latency is over OVERCURRENT_TRIP_MAX_US, use a faster ADC clock"
+#endif
+
+//pot reading -> ms per flash step. The flasher used to count ~244Hz timer0 overflows
+//(4.096ms each) and stepped every prescaler + 1 overflows, the prescaler being the original
+//float formula 30.0 / ((adc / 146.2) + 1)   (see adc_flash_freq_sample)
+//the float formula is only ever evaluated by the compiler, FLASH_STEP_MS for the config
+//default and FLASH_FREQ_PRESCALER_X256 for the knots of arr_flash_prescaler_x256, so no
+//soft-float code ends up in the ADC interrupt
+#define FLASH_FREQ_PRESCALER(adc)   ((uint8_t)(30.0 / (((adc) / 146.2) + 1)))
+#define FLASH_STEP_MS(adc)          ((uint8_t)(((FLASH_FREQ_PRESCALER(adc) + 1) * 4096UL) / 1000))
+#define FLASH_FREQ_PRESCALER_X256(adc)  ((uint16_t)((256.0 * 30.0 / (((adc) / 146.2) + 1)) + 0.5))
+
+//the prescaler curve every FLASH_KNOT_STEP adc counts, adc_flash_freq_sample interpolates
+//linearly in between. 130 bytes of flash instead of a 1024 entry table. The curve is convex so
+//the chord sits up to ~0.1 prescaler above it, and just before adc 592 and 960 the curve is
+//close enough under the next whole prescaler for the chord to cross it: FLASH_KNOT_TRIM lowers
+//those two knots so the truncated prescaler is the float one for all 1024 inputs
+//(tests/test_pot_map.c checks every one)
+#define FLASH_KNOT_SHIFT            4
+#define FLASH_KNOT_STEP             (1 << FLASH_KNOT_SHIFT)
+#define FLASH_KNOT_TRIM(n)          (((n) == 37) ? 2 : ((n) == 60) ? 1 : 0)
+#define _FFP_KNOT(n)        (FLASH_FREQ_PRESCALER_X256((n) * FLASH_KNOT_STEP) - FLASH_KNOT_TRIM(n))
+#define _FFP_KNOTS_4(n)     _FFP_KNOT(n), _FFP_KNOT((n) + 1), _FFP_KNOT((n) + 2), _FFP_KNOT((n) + 3)
+#define _FFP_KNOTS_16(n)    _FFP_KNOTS_4(n),  _FFP_KNOTS_4((n) + 4),  _FFP_KNOTS_4((n) + 8),  _FFP_KNOTS_4((n) + 12)
+#define _FFP_KNOTS_64(n)    _FFP_KNOTS_16(n), _FFP_KNOTS_16((n) + 16),_FFP_KNOTS_16((n) + 32),_FFP_KNOTS_16((n) + 48)
+
+/// prescaler * 256 at adc 0, 16, 32 ... 1024, read with pgm_read_word. The last knot is past
+/// the adc range so adc 1008-1023 has one to interpolate towards
+const uint16_t arr_flash_prescaler_x256[((MASK_10_BIT + 1) >> FLASH_KNOT_SHIFT) + 1] PROGMEM =
+{
+    _FFP_KNOTS_64(0), FLASH_FREQ_PRESCALER_X256(MASK_10_BIT + 1)
+};
+
+uint8_t flash_step_ms_from_adc(uint16_t value);
+
+//pot reading -> brake pattern, the pot range is split in BRAKE_NUM_PATTERNS equal parts
+//(adc * n) >> 10 instead of a divide, 1023 * n still fits 16 bits
+#define BRAKE_PATTERN_FROM_ADC(adc) ((uint8_t)(((uint16_t)(adc) * BRAKE_NUM_PATTERNS) >> 10))
+
+void adc_feedback_sample(uint8_t idx, uint16_t value);
+void adc_flash_freq_sample(uint8_t idx, uint16_t value);
+void adc_flash_pattern_sample(uint8_t idx, uint16_t value);
+
+//scan table, the order is the same as arr_adc_input so ARR_IDX_xxxx index both
+//FEEDBACK_LEFT, FEEDBACK_BRAKE, FEEDBACK_RIGHT, FREQ_FLASH, NUM_FLASH
+//the pots are last so with CONFIG_FLAG_POT_LOCKOUT the table is just cut short
+#define ADC_SCAN_NUM_CHANNELS 5
+#define ADC_SCAN_NUM_FEEDBACK 3
+const sADCScanChannel arr_adc_scan[ADC_SCAN_NUM_CHANNELS] =
+{
+    //input, reference, oversample, divider          , callback
+    { ADC4 , FDBK_REF , 0         , 1                , adc_feedback_sample   },
+    { ADC3 , FDBK_REF , 0         , 1                , adc_feedback_sample   },
+    { ADC2 , FDBK_REF , 0         , 1                , adc_feedback_sample   },
+    { ADC0 , FLASH_REF, 2         , FLASH_POT_DIVIDER, adc_flash_freq_sample },
+    { ADC1 , FLASH_REF, 2         , FLASH_POT_DIVIDER, adc_flash_pattern_sample },
+};
 
 void init_adc(bool enable_interrupts);
 ISR(ADC_vect);
@@ -73,31 +164,136 @@ ISR(ADC_vect);
 /************************************************************************/
 /*                               TIMERS                                 */
 /************************************************************************/
-#define TIMER0_ADDTL_PRESCALE 3
-// 16MHz / (8_bit_max * prescaler) = 16MHz / (256 * 64) = 976.5625Hz
-// 976 / 4 Hz = ~122
-#define TIMER1_ADDTL_4Hz_PRESCALE 244
-// 16MHz / (8_bit_max * prescaler) = 16MHz / (256 * 1024) = 61.03Hz
-//  to get down to 1 second we need to wait 61 ovf before it starts
-#define TIMER2_ADDTL_1_SEC_PRESCALE 61
+//timer0 is the 1ms timebase. It has no compare match on the mega8, so the counter is
+//preloaded to overflow after F_CPU / 64 / 1000 counts (250 at 16MHz)
+#define TIMER0_TICK_PRELOAD (256 - (F_CPU / 64UL / 1000UL))
+
+//software timers, all run from the main loop
+#define SW_TIMER_LIGHT_SERVICE  0   /// 1ms, light ramps and overcurrent retry
+#define SW_TIMER_STATUS_LED     1   /// 250ms, status led blink
+#define SW_TIMER_BRAKE_FLASH    2   /// flash steps while braking (separate function lights)
+#define SW_TIMER_TURN_TIMEOUT   3   /// one shot, turn signal over (integrated lights)
+#define SW_TIMER_TELEMETRY      4   /// binary telemetry frames, gs_CONFIG.telemetry_period_ms
+#define SW_TIMER_TOPOLOGY       5   /// lamp topology detection, TOPO_PERIOD_MS
+
+#define LIGHT_SERVICE_MS        1
+#define STATUS_LED_BLINK_MS     250
+#define TURN_SIGNAL_TIMEOUT_MS  1000
 
-volatile uint8_t gu8_NUM_TIMER0_OVF;
-volatile uint8_t gu8_NUM_TIMER1_OVF;
-volatile uint8_t gu8_NUM_TIMER2_OVF;
+//pwm carriers. 976Hz is what the lamps have always run at, LED lamps at that rate beat
+//with dash/backup cameras and show up as flicker, raise the frequency for those trailers.
+//Left/right count to ICR1 so they keep fine steps at any frequency (TOP 16392 at 976Hz),
+//the brake output is on timer2 which only has 8 bit modes
+#define PWM_TURN_CARRIER_MODE   epwm_mode_fast_icr1
+#define PWM_TURN_CARRIER_HZ     976
+#define PWM_BRAKE_CARRIER_MODE  epwm_mode_fast_8bit_default
+#define PWM_BRAKE_CARRIER_HZ    976
 
 //LEFT, BRAKE, RIGHT
 const ePWM_OUTPUT arr_pwm_output[3] = {epwm_1a, epwm_2, epwm_1b};
     
-ISR(TIMER0_OVF_vect);   /** for LED flashing */
-ISR(TIMER1_OVF_vect);   /** for status LED */
-ISR(TIMER2_OVF_vect);   /** for Turn signal flag*/
+ISR(TIMER0_OVF_vect);   /** 1ms timebase */
+
+void task_light_service(void);
+void task_status_led(void);
+void task_brake_flash(void);
+void task_turn_timeout(void);
+void task_telemetry(void);
+void task_topology(void);
 
 void init_timers(void);
 void init_timer0(void);
 void init_timer1(void);
 void init_timer2(void);
 
-void init_timer2AsOneSecondTimer(void);
+/************************************************************************/
+/*                            LIGHT OUTPUTS                             */
+/************************************************************************/
+//every increase in duty is ramped so a cold filament doesn't pull a current spike that the
+//feedback channels would see as overcurrent. A ramp takes at most 2^periods_log2 ticks (1ms),
+//the step is worked out once when the target is set: ((target - val) >> periods_log2) + 1.
+//The first step is written straight away so the light reacts without waiting for a tick,
+//decreases are written straight away as well (no inrush going down)
+//the ramps are stepped by the 1ms light service timer, not by the pwm carrier, so a ramp
+//takes the same time whatever PWM_TURN/BRAKE_CARRIER_HZ is
+#define LIGHT_RAMP_PERIODS_LOG2     2       /// regular changes, low->full in ~4ms
+#define FAULT_SOFT_START_PERIODS_LOG2 6     /// restart after an overcurrent trip, ~64ms
+
+typedef struct
+{
+    uint8_t val;            /// pwm value (0-255) on the output now
+    uint8_t target;         /// pwm value the ramp is heading for
+    uint8_t step;           /// added every tick until val reaches target
+}sLightRamp;
+
+//an output that trips overcurrent is retried after FAULT_RETRY_BASE_TICKS << backoff. Every
+//trip adds one to backoff (up to FAULT_BACKOFF_MAX), it goes back to 0 once the output has
+//run for FAULT_BACKOFF_RESET_TICKS without tripping. Ticks are light service runs (1ms)
+#define FAULT_RETRY_BASE_TICKS      100     /// 100ms
+#define FAULT_BACKOFF_MAX           6       /// 6.4s between retries
+#define FAULT_BACKOFF_RESET_TICKS   10000   /// 10s
+
+typedef enum
+{
+    eFAULT_NONE,            /// output follows the light logic
+    eFAULT_TRIPPED,         /// output is off waiting for the retry
+}eFAULT_STATE;
+
+typedef struct
+{
+    eFAULT_STATE state;
+    uint8_t backoff;            /// next retry waits FAULT_RETRY_BASE_TICKS << backoff
+    uint16_t countdown;         /// ticks to the retry (tripped) or to the backoff reset
+    uint16_t fault_count;       /// trips since power up, saturates
+}sChannelFault;
+
+//lamp out (open circuit): judged on windows like the topology detection, not on single
+//readings. One reading in the off phase of the pwm is 0 with a good lamp too, and the
+//readings of a channel aren't independent of the pwm phase, so no number of low readings
+//in a row proves anything. The adc interrupt adds up LAMPOUT_WINDOW_SAMPLES feedback
+//readings of a checked output and its pwm value at each of them, lamp_out_tick scales the
+//current to full duty. Under LAMPOUT_CURRENT_FULL the window is low, LAMPOUT_WINDOWS low
+//windows in a row are a lamp out, one window that isn't low clears it. The threshold is
+//half of what a lamp draws, the estimate of one window is off by a few counts (chopped
+//readings and adc noise scaled by 255/duty). Windows under LAMPOUT_MIN_DUTY_SUM (output
+//off or dimmer than LAMPOUT_MIN_PWM most of the window) don't count either way
+#define LAMPOUT_CURRENT_FULL            (FEEDBACK_50_mAMP / 2)  /// at full duty
+#define LAMPOUT_MIN_PWM                 32                      /// average pwm value
+#define LAMPOUT_WINDOW_SAMPLES_LOG2     5
+#define LAMPOUT_WINDOW_SAMPLES          (1 << LAMPOUT_WINDOW_SAMPLES_LOG2)  /// 1023 * 32 fits 16 bits
+#define LAMPOUT_MIN_DUTY_SUM            (LAMPOUT_WINDOW_SAMPLES * LAMPOUT_MIN_PWM)
+#define LAMPOUT_WINDOWS                 16
+
+typedef struct
+{
+    uint16_t current_sum;       /// feedback readings of the window
+    uint16_t duty_sum;          /// pwm value at each of them
+    uint8_t samples;            /// readings in the window, lamp_out_tick empties it once full
+    uint8_t low_windows;        /// low windows in a row
+    bool out;                   /// lamp out, set and cleared by lamp_out_tick
+    bool checked;               /// the light mode has a lamp on this output
+    bool reported;              /// out as last logged by lamp_out_tick
+}sLampOut;
+
+//LEFT, BRAKE, RIGHT
+volatile sLightRamp arr_light_ramp[3];
+volatile sChannelFault arr_channel_fault[3];
+volatile sLampOut arr_lamp_out[3];
+
+//what the light logic wants on each output. The hardware only follows it while the
+//channel has no fault, the fault handling uses it to restore the output afterwards
+volatile uint8_t arr_light_brightness[3];
+volatile bool arr_light_enabled[3];
+
+void light_set_brightness(uint8_t idx, uint8_t brightness);
+void light_output_enable(uint8_t idx);
+void light_output_disable(uint8_t idx);
+void light_ramp_tick(void);
+void light_fault_trip(uint8_t idx);
+void light_fault_tick(void);
+void lamp_out_set_checked(uint8_t idx, bool checked);
+uint8_t lamp_out_mask(void);
+void lamp_out_tick(void);
 
 /************************************************************************/
 /*                           RGB STATUS LED                             */
@@ -113,15 +309,6 @@ void init_RGB_status_LED(void);
 /*                               MAIN                                   */
 /************************************************************************/
 
-typedef enum
-{
-    DebugDisabled,
-    DebugADC,
-    DebugUART,
-    DebugPWM,
-    DebugLED,
-}eDEBUG_MODES;
-
 #define ARR_IDX_LEFT    0
 #define ARR_IDX_BRAKE   1
 #define ARR_IDX_RIGHT   2
@@ -138,10 +325,13 @@ typedef enum
 #define LED_G_OUTPUT_PIN    PIND6
 #define LED_R_OUTPUT_PIN    PIND7
 
-//pwm values for light levels
-#define DUTY_CYCLE_FULL_BRIGHTNESS 100 /// used for braking or turn signal
-#define DUTY_CYCLE_LOW_BRIGHTNESS   15 /// used for running lights
-#define DUTY_CYCLE_OFF_BRIGHTNESS    0 /// turns lights off used for turn signal and/or brake flashing
+//light levels, perceptual brightness 0-255 (gamma corrected by setPWMBrightness)
+#define BRIGHTNESS_FULL 255 /// used for braking or turn signal
+#define BRIGHTNESS_DIP  107 /// low step of the brake patterns, pwm 38 same as the old 15% duty cycle
+#define BRIGHTNESS_OFF    0 /// turns lights off used for turn signal and/or brake flashing
+//running lights are gs_CONFIG.brightness_low
+#define BRIGHTNESS_LOW  (gs_CONFIG.brightness_low)
+#define BRIGHTNESS_LOW_DEFAULT  BRIGHTNESS_DIP
 
 /**This flag is used to indicate the brake light should be on, it is set/cleared by external
  * interrupt1 handler and read by timer2 overflow handler
@@ -151,16 +341,215 @@ volatile bool gb_LEFT_TURN_SIGNAL_ON;
 volatile bool gb_RIGHT_TURN_SIGNAL_ON;
 volatile bool gb_OVERCURRENT_TRIPPED;
 
-volatile uint16_t gu8_MAX_NUM_FLASHES;
-volatile uint16_t gu16_FLASH_FREQ_PRESCALER;
-volatile uint8_t gu8_NUM_OCCURED_FLASHES;
+/** Set by everything that changes something the light outputs depend on (INT0/INT1 edges,
+ *  right input debounce, turn signal timeout)
+ */
+volatile bool gb_LIGHT_EVENT;
+
+/** Debounced state of the right turn input, PD4 has no external interrupt so it is polled
+ *  from ISR(TIMER0_OVF_vect)
+ */
+#define RIGHT_IN_DEBOUNCE_TICKS  4  /// 4ms of the 1ms tick
+volatile bool gb_RIGHT_IN;
+volatile uint8_t gu8_RIGHT_IN_DEBOUNCE;
+
+volatile uint8_t gu8_FLASH_STEP_MS;
 volatile uint16_t gu16_adc_test_val;
 
 // for brake input
 ISR(INT1_vect);
+// for left turn input
+ISR(INT0_vect);
 
 void init_external_interupts(void);
 void init_globals(void);
 void init_IO(void);
 void init(void);
+
+/************************************************************************/
+/*                             LIGHT MODE                               */
+/************************************************************************/
+//the outputs come up straight away in eLIGHT_MODE_AUTO, a conservative mode that works
+//with both lamp topologies: left/right do brake duty like integrated lights and the brake
+//output is a steady brake light (no pattern), it has nothing on it with integrated lights.
+//task_topology works out in the background whether a brake lamp is connected and
+//switches to the separate or integrated mode. It keeps watching after that, so a trailer
+//swapped without a power cycle is picked up: the brake output stays on at running light
+//level in integrated mode too, that way a brake lamp plugged in later draws current.
+//gs_CONFIG.light_mode can force a mode, then nothing is detected
+//
+//detection: the adc interrupt adds up TOPO_WINDOW_SAMPLES brake feedback readings and the
+//brake pwm value at each of them. Dividing one by the other gives the current the lamp
+//would draw at full duty, whatever the brake output is doing (running light, braking,
+//ramping). Below TOPO_MIN_DUTY_SUM the output was off most of the window, no verdict
+//(with brightness_low set to 0 that means detection waits for the pedal)
+#define TOPO_WINDOW_SAMPLES_LOG2    5
+#define TOPO_WINDOW_SAMPLES         (1 << TOPO_WINDOW_SAMPLES_LOG2)   /// 1023 * 32 fits 16 bits
+#define TOPO_MIN_DUTY_SUM           (TOPO_WINDOW_SAMPLES * 8)   /// average pwm value 8
+//verdicts have hysteresis, at or over TOPO_LAMP_CURRENT there is a brake lamp, under
+//TOPO_NO_LAMP_CURRENT there is none, in between is no verdict. A verdict that disagrees
+//with the mode has to come up TOPO_CONFIRM_WINDOWS times in a row to leave the
+//conservative mode at boot, TOPO_SWITCH_WINDOWS times (1-2s) to switch a detected mode.
+//A brake lamp that burns out ends up as integrated lights, left/right then show the brake
+#define TOPO_LAMP_CURRENT           FEEDBACK_50_mAMP        /// at full duty
+#define TOPO_NO_LAMP_CURRENT        (FEEDBACK_50_mAMP / 2)  /// at full duty
+#define TOPO_CONFIRM_WINDOWS        4
+#define TOPO_SWITCH_WINDOWS         200
+#define TOPO_PERIOD_MS              5       /// a window takes 3-7ms of brake conversions
+
+volatile eLIGHT_MODE ge_LIGHT_MODE;         /// mode the outputs run in, AUTO = not detected yet
+
+//detection window, filled by adc_feedback_sample and emptied by task_topology
+volatile uint16_t gu16_TOPO_CURRENT_SUM;
+volatile uint16_t gu16_TOPO_DUTY_SUM;
+volatile uint8_t gu8_TOPO_SAMPLES;
+eLIGHT_MODE ge_TOPO_VERDICT;                /// last verdict that disagreed with the mode
+uint8_t gu8_TOPO_STREAK;                    /// windows in a row with that verdict
+
+void light_mode_led(void);
+void light_mode_enter(eLIGHT_MODE mode);
+
+/************************************************************************/
+/*                            BRAKE PATTERNS                            */
+/************************************************************************/
+//what the brake does after the pedal goes down (separate function lights only). INT1 puts
+//the brake on full straight away, then the steps of the selected pattern run one after the
+//other. A step holds its brightness for a number of beats, a beat is gu8_FLASH_STEP_MS (the
+//speed pot). A step with 0 beats ends the pattern and its brightness is held till the pedal
+//is released. New patterns are only new table entries, the sequencer doesn't change
+typedef struct
+{
+    uint8_t brightness;     /// perceptual brightness, see BRIGHTNESS_xxx
+    uint8_t beats;          /// how long to hold it, 0 = end of the pattern
+}sBrakeStep;
+
+#define _BS_DIP         { BRIGHTNESS_DIP, 1 }, { BRIGHTNESS_FULL, 1 }
+#define _BS_DIP_2       _BS_DIP, _BS_DIP
+#define _BS_DIP_5       _BS_DIP_2, _BS_DIP_2, _BS_DIP
+#define _BS_DOUBLE      { BRIGHTNESS_DIP, 1 }, { BRIGHTNESS_FULL, 1 }, { BRIGHTNESS_DIP, 1 }, { BRIGHTNESS_FULL, 3 }
+#define _BS_RAMP        { BRIGHTNESS_DIP, 1 }, { 160, 1 }, { 210, 1 }, { BRIGHTNESS_FULL, 2 }
+#define _BS_END         { BRIGHTNESS_FULL, 0 }
+
+//the first four are the old flasher with 2, 6, 10 and 20 flash steps
+const sBrakeStep arr_bp_flash_2[]  PROGMEM = { _BS_DIP, _BS_END };
+const sBrakeStep arr_bp_flash_6[]  PROGMEM = { _BS_DIP_2, _BS_DIP, _BS_END };
+const sBrakeStep arr_bp_flash_10[] PROGMEM = { _BS_DIP_5, _BS_END };
+const sBrakeStep arr_bp_flash_20[] PROGMEM = { _BS_DIP_5, _BS_DIP_5, _BS_END };
+const sBrakeStep arr_bp_double[]   PROGMEM = { _BS_DOUBLE, _BS_DOUBLE, _BS_DOUBLE, _BS_END };
+const sBrakeStep arr_bp_ramp[]     PROGMEM = { _BS_RAMP, _BS_RAMP, _BS_RAMP, _BS_END };
+
+/// selected with the pattern pot (BRAKE_PATTERN_FROM_ADC), read with pgm_read_ptr
+#define BRAKE_NUM_PATTERNS      6
+#define BRAKE_PATTERN_DEFAULT   2   /// 10 flashes, what the flasher did before the pots are read
+const sBrakeStep* const arr_brake_patterns[BRAKE_NUM_PATTERNS] PROGMEM =
+{
+    arr_bp_flash_2,
+    arr_bp_flash_6,
+    arr_bp_flash_10,
+    arr_bp_flash_20,
+    arr_bp_double,
+    arr_bp_ramp,
+};
+
+volatile uint8_t gu8_BRAKE_PATTERN;         /// set by the pattern pot
+const sBrakeStep* gp_BRAKE_STEP;            /// next step of the running pattern
+uint8_t gu8_BRAKE_STEP_BEATS;               /// beats left of the current step
+
+void brake_pattern_start(void);
+
+/************************************************************************/
+/*                               CONFIG                                 */
+/************************************************************************/
+//binary telemetry is off unless the config turns it on, 1 gives 1kHz frames (~22 bytes
+//each, about a fifth of the 1Mbaud link)
+#define TELEMETRY_PERIOD_MS_DEFAULT 0
+
+//used when the EEPROM has no valid config, the behaviour is the same as before there
+//was a config: pots in use and the light type detected at boot
+const sConfig gs_CONFIG_DEFAULTS PROGMEM =
+{
+    CONFIG_VERSION,
+    0,
+    CURRENT_LIMIT_DEFAULT,
+    BRIGHTNESS_LOW_DEFAULT,
+    eLIGHT_MODE_AUTO,
+    0,
+    FLASH_STEP_MS(512),
+    BRAKE_PATTERN_DEFAULT,
+    TELEMETRY_PERIOD_MS_DEFAULT,
+    0,
+};
+
+/** RAM copy of the config, loaded once by init_globals. Everything reads this, nothing
+ *  reads the EEPROM after boot
+ */
+sConfig gs_CONFIG;
+
+/************************************************************************/
+/*                                SHELL                                 */
+/************************************************************************/
+//commands on the debug UART, they run in the main loop next to the light logic (shell.h)
+//  help                    lists the commands
+//  stat                    uptime (ms, hex), light mode (0 = detecting, 1 = separate,
+//                          2 = integrated), brake, pattern, flash step, then the missed
+//                          deadlines of each sw timer (SW_TIMER_xxx order)
+//  cur                     latest current readings and trips since power up, L B R
+//  adc <channel>           latest scan reading, channels in arr_adc_scan order 0-4
+//  out <output> <bright>   brightness of an output (0-2 = L B R), 0 turns it off. The
+//                          light logic takes the output back on its next change
+//  cfg                     prints the RAM config, fields in arr_shell_cfg_fields order
+//  set <field> <value>     changes a field of the RAM config, see arr_shell_cfg_fields
+//  log [<module> <level>]  prints the log level of every module, sets one first if given
+//  save                    writes the RAM config to EEPROM. Blocks for up to ~50ms, the
+//                          interrupts (overcurrent trip, brake input) keep running
+//  bbox                    sends the black box record from EEPROM as binary frames
+//config fields "cfg" prints and "set" changes, by index. current_limit is used straight
+//away, brightness_low from the next light change, the rest only after a save and reset.
+//Values init_globals wouldn't accept at boot are refused
+typedef struct
+{
+    uint8_t  offset;        /// offsetof(sConfig, xxx)
+    uint8_t  size;          /// 1 or 2 bytes
+    uint16_t min;
+    uint16_t max;
+}sShellCfgField;
+
+#define SHELL_CFG_NUM_FIELDS    7
+const sShellCfgField arr_shell_cfg_fields[SHELL_CFG_NUM_FIELDS] PROGMEM =
+{
+    //offset                                , size, min              , max
+    { offsetof(sConfig, current_limit)      , 2   , CURRENT_LIMIT_MIN, CURRENT_LIMIT_MAX      },
+    { offsetof(sConfig, brightness_low)     , 1   , 0                , BRIGHTNESS_FULL        },
+    { offsetof(sConfig, light_mode)         , 1   , 0                , eLIGHT_MODE_INTEGRATED },
+    { offsetof(sConfig, flags)              , 1   , 0                , 0xFF                   },
+    { offsetof(sConfig, flash_step_ms)      , 1   , 1                , 0xFF                   },
+    { offsetof(sConfig, brake_pattern)      , 1   , 0                , BRAKE_NUM_PATTERNS - 1 },
+    { offsetof(sConfig, telemetry_period_ms), 1   , 0                , 0xFF                   },
+};
+
+void shell_cmd_stat(const sShellArgs* args);
+void shell_cmd_cur(const sShellArgs* args);
+void shell_cmd_adc(const sShellArgs* args);
+void shell_cmd_out(const sShellArgs* args);
+void shell_cmd_cfg(const sShellArgs* args);
+void shell_cmd_set(const sShellArgs* args);
+void shell_cmd_log(const sShellArgs* args);
+void shell_cmd_save(const sShellArgs* args);
+void shell_cmd_bbox(const sShellArgs* args);
+
+#define SHELL_NUM_COMMANDS  10
+const sShellCommand arr_shell_commands[SHELL_NUM_COMMANDS] PROGMEM =
+{
+    //name , args, handler
+    { "help", 0  , shell_cmd_help },
+    { "stat", 0  , shell_cmd_stat },
+    { "cur" , 0  , shell_cmd_cur  },
+    { "adc" , 1  , shell_cmd_adc  },
+    { "out" , 2  , shell_cmd_out  },
+    { "cfg" , 0  , shell_cmd_cfg  },
+    { "set" , 2  , shell_cmd_set  },
+    { "log" , 0  , shell_cmd_log  },
+    { "save", 0  , shell_cmd_save },
+    { "bbox", 0  , shell_cmd_bbox },
+};
 #endif /* MAIN_H_ */
\ No newline at end of file
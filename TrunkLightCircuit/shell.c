@@ -0,0 +1,204 @@
+/*
+ * shell.c
+ *
+ */
+
+#include "shell.h"
+#include <avr/pgmspace.h>
+
+static const sShellCommand* shell_table_P = 0;
+static uint8_t shell_num_commands = 0;
+
+/** splits the line into tokens at spaces and tabs, tokens past SHELL_MAX_ARGS are ignored
+ */
+static void _shell_tokenize(sShellArgs* args)
+{
+    uint8_t len = args->line->len1 + args->line->len2;
+    uint8_t ii;
+    bool in_token = false;
+    char data;
+
+    args->argc = 0;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        data = UART_LineChar(args->line, ii);
+
+        if ((data == ' ') || (data == '\t'))
+        {
+            in_token = false;
+        }
+        else if (in_token)
+        {
+            args->argv[args->argc - 1].len++;
+        }
+        else if (args->argc <= SHELL_MAX_ARGS)
+        {
+            args->argv[args->argc].start = ii;
+            args->argv[args->argc].len = 1;
+            args->argc++;
+            in_token = true;
+        }
+    }
+}
+
+/** @RETURN the table entry named argv[0], 0 if there is none
+ */
+static const sShellCommand* _shell_find(const sShellArgs* args)
+{
+    const sShellCommand* ret_value = 0;
+    const sShellCommand* cmd = shell_table_P;
+    const sShellToken* name = &args->argv[0];
+    uint8_t num_left = shell_num_commands;
+    uint8_t ii;
+    bool match;
+
+    while ((ret_value == 0) && (num_left > 0))
+    {
+        match = (name->len < SHELL_NAME_LEN);
+
+        for (ii = 0; match && (ii < name->len); ii++)
+        {
+            match = (pgm_read_byte(&cmd->name[ii]) == UART_LineChar(args->line, name->start + ii));
+        }
+
+        //the table name mustn't be longer than the token
+        if (match && (pgm_read_byte(&cmd->name[name->len]) == 0))
+        {
+            ret_value = cmd;
+        }
+
+        cmd++;
+        num_left--;
+    }
+
+    return ret_value;
+}
+
+void shell_init(const sShellCommand* table_P, uint8_t num_commands)
+{
+    shell_table_P = table_P;
+    shell_num_commands = num_commands;
+}
+
+void shell_poll(void)
+{
+    sUartLine line;
+    sShellArgs args;
+    const sShellCommand* cmd;
+    shell_handler handler;
+
+    //the reply has to fit in the Tx queue, otherwise the line waits for a later poll.
+    //Handlers never wait on the UART that way
+    if ((UART_TxFree() >= SHELL_REPLY_MAX) && UART_PeekLine(&line))
+    {
+        args.line = &line;
+        _shell_tokenize(&args);
+
+        //empty lines are ignored
+        if (args.argc > 0)
+        {
+            cmd = _shell_find(&args);
+
+            if (cmd == 0)
+            {
+                UART_transmitString_P(PSTR("unknown command, try help\r\n"));
+            }
+            else if ((args.argc - 1) < pgm_read_byte(&cmd->min_args))
+            {
+                UART_transmitString_P(PSTR("missing argument\r\n"));
+            }
+            else
+            {
+                handler = (shell_handler)pgm_read_ptr(&cmd->handler);
+                handler(&args);
+            }
+        }
+
+        //the arguments point into the Rx ring, so the line is only freed now
+        UART_ReleaseLine();
+    }
+}
+
+bool shell_arg_uint16(const sShellArgs* args, uint8_t idx, uint16_t* value)
+{
+    uint16_t result = 0;
+    uint16_t max_before = 6553;     /// largest value that can still take another digit
+    uint8_t max_last = 5;           /// largest digit max_before can take
+    uint8_t base = 10;
+    uint8_t ii;
+    uint8_t end;
+    uint8_t digit;
+    char data;
+    bool ret_value = false;
+
+    if (idx < args->argc)
+    {
+        ii = args->argv[idx].start;
+        end = ii + args->argv[idx].len;
+
+        if ((args->argv[idx].len > 2) && (UART_LineChar(args->line, ii) == '0')
+            && ((UART_LineChar(args->line, ii + 1) | 0x20) == 'x'))
+        {
+            base = 16;
+            max_before = 0x0FFF;
+            max_last = 0x0F;
+            ii += 2;
+        }
+
+        ret_value = true;
+
+        while (ret_value && (ii < end))
+        {
+            data = UART_LineChar(args->line, ii);
+
+            if ((data >= '0') && (data <= '9'))
+            {
+                digit = data - '0';
+            }
+            else if ((base == 16) && ((data | 0x20) >= 'a') && ((data | 0x20) <= 'f'))
+            {
+                digit = (data | 0x20) - 'a' + 10;
+            }
+            else
+            {
+                digit = 0xFF;
+            }
+
+            //no division, the limits above keep the value in 16 bits
+            if ((digit >= base) || (result > max_before) || ((result == max_before) && (digit > max_last)))
+            {
+                ret_value = false;
+            }
+            else
+            {
+                result = (result * base) + digit;
+            }
+
+            ii++;
+        }
+    }
+
+    if (ret_value)
+    {
+        *value = result;
+    }
+
+    return ret_value;
+}
+
+void shell_cmd_help(const sShellArgs* args)
+{
+    const sShellCommand* cmd = shell_table_P;
+    uint8_t num_left = shell_num_commands;
+
+    while (num_left > 0)
+    {
+        UART_transmitString_P(cmd->name);
+        UART_TransmitByte(' ');
+        cmd++;
+        num_left--;
+    }
+
+    UART_transmitNewLine();
+}
@@ -0,0 +1,69 @@
+/*
+ * shell.h
+ * Command shell on the debug UART that runs next to the light logic. Commands are
+ * looked up in a PROGMEM table, the line is tokenized in place in the UART Rx ring
+ * (UART_PeekLine), nothing is copied.
+ * shell_poll does a bounded amount of work: at most one line, and only once the Tx queue
+ * has room for a whole reply, so a handler never waits on the UART. Handlers must keep
+ * their reply under SHELL_REPLY_MAX bytes and must not block.
+ *
+ */
+
+
+#ifndef SHELL_H_
+#define SHELL_H_
+
+#include "global.h"
+#include "avr_uart.h"
+
+#define SHELL_MAX_ARGS      4   /// arguments after the command name, more are ignored
+#define SHELL_NAME_LEN      6   /// command names are at most 5 chars
+#define SHELL_REPLY_MAX     56  /// Tx queue room a line waits for before it is run
+
+typedef struct _sShellToken
+{
+    uint8_t start;      /// index in the line, see UART_LineChar
+    uint8_t len;
+}sShellToken;
+
+typedef struct _sShellArgs
+{
+    const sUartLine* line;
+    uint8_t argc;                           /// tokens, the command name included
+    sShellToken argv[SHELL_MAX_ARGS + 1];   /// argv[0] is the command name
+}sShellArgs;
+
+/** runs a command, the arguments are only valid during the call
+ *  @NOTE called from the main loop
+ */
+typedef void (*shell_handler)(const sShellArgs* args);
+
+/** one command table entry, the table lives in PROGMEM */
+typedef struct _sShellCommand
+{
+    char          name[SHELL_NAME_LEN];
+    uint8_t       min_args;     /// arguments after the name, with fewer the handler isn't called
+    shell_handler handler;
+}sShellCommand;
+
+/** @PARAM table_P - command table in PROGMEM
+ *  @PARAM num_commands - entries in the table
+ */
+void shell_init(const sShellCommand* table_P, uint8_t num_commands);
+
+/** runs the next complete command line, if there is one and the Tx queue has room
+ *  for its reply. Call it regularly from the main loop
+ */
+void shell_poll(void);
+
+/** reads a number argument, decimal or hex with a 0x prefix
+ *  @PARAM idx - argv index, 1 is the first argument after the command name
+ *  @PARAM value [out] only written if true is returned
+ *  @RETURN false if the argument is missing, isn't a number or doesn't fit 16 bits
+ */
+bool shell_arg_uint16(const sShellArgs* args, uint8_t idx, uint16_t* value);
+
+/** command handler that lists the names in the table, put it in the table as "help" */
+void shell_cmd_help(const sShellArgs* args);
+
+#endif /* SHELL_H_ */
@@ -0,0 +1,141 @@
+/*
+ * sw_timers.c
+ *
+ */ 
+
+#include "sw_timers.h"
+#include <util/atomic.h>
+
+static volatile uint32_t sw_uptime_ms = 0;
+static uint32_t sw_last_run_ms = 0;               ///uptime seen by the last sw_timers_run
+static sSwTimer sw_timers[SW_TIMER_MAX_TIMERS];
+
+void sw_timers_init(void)
+{
+    uint8_t id;
+    
+    for (id = 0; id < SW_TIMER_MAX_TIMERS; id++)
+    {
+        sw_timers[id].active = false;
+        sw_timers[id].missed = 0;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        sw_uptime_ms = 0;
+    }
+    sw_last_run_ms = 0;
+}
+
+void sw_timers_tick(void)
+{
+    sw_uptime_ms++;
+}
+
+uint32_t sw_timers_uptime(void)
+{
+    uint32_t now;
+    
+    //32 bit read is 4 instructions, the tick could land in between
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = sw_uptime_ms;
+    }
+    
+    return now;
+}
+
+bool sw_timers_pending(void)
+{
+    return (sw_uptime_ms != sw_last_run_ms);
+}
+
+void sw_timers_run(void)
+{
+    uint8_t id;
+    uint32_t now = sw_timers_uptime();
+    sSwTimer* timer;
+    
+    sw_last_run_ms = now;
+    
+    for (id = 0; id < SW_TIMER_MAX_TIMERS; id++)
+    {
+        timer = &sw_timers[id];
+        
+        //signed difference so the uptime wrapping around doesn't matter
+        if (timer->active && ((int32_t)(now - timer->deadline) >= 0))
+        {
+            if (timer->period == 0)
+            {
+                timer->active = false;
+            }
+            else
+            {
+                timer->deadline += timer->period;
+                
+                //a full period late, drop the runs that were missed instead of bunching them up
+                while ((int32_t)(now - timer->deadline) >= 0)
+                {
+                    timer->deadline += timer->period;
+                    
+                    if (timer->missed < UINT16_MAX)
+                    {
+                        timer->missed++;
+                    }
+                }
+            }
+            
+            //last, the callback may restart or stop the timer
+            timer->callback();
+        }
+    }
+}
+
+bool sw_timer_start(uint8_t id, uint16_t delay_ms, uint16_t period_ms, sw_timer_callback callback)
+{
+    bool ret_value = false;
+    
+    if (id < SW_TIMER_MAX_TIMERS)
+    {
+        sw_timers[id].deadline = sw_timers_uptime() + delay_ms;
+        sw_timers[id].period = period_ms;
+        sw_timers[id].callback = callback;
+        sw_timers[id].active = true;
+        ret_value = true;
+    }
+    
+    return ret_value;
+}
+
+void sw_timer_stop(uint8_t id)
+{
+    if (id < SW_TIMER_MAX_TIMERS)
+    {
+        sw_timers[id].active = false;
+    }
+}
+
+void sw_timer_set_period(uint8_t id, uint16_t period_ms)
+{
+    if (id < SW_TIMER_MAX_TIMERS)
+    {
+        sw_timers[id].period = period_ms;
+    }
+}
+
+bool sw_timer_running(uint8_t id)
+{
+    return (id < SW_TIMER_MAX_TIMERS) && sw_timers[id].active;
+}
+
+uint16_t sw_timer_missed(uint8_t id)
+{
+    uint16_t ret_value = 0;
+    
+    if (id < SW_TIMER_MAX_TIMERS)
+    {
+        ret_value = sw_timers[id].missed;
+    }
+    
+    return ret_value;
+}
@@ -0,0 +1,82 @@
+/*
+ * sw_timers.h
+ * Software timers on top of a 1ms hardware tick. The tick interrupt only counts, the
+ * timers themselves are run from the main loop (cooperative), so their callbacks can take
+ * their time without holding off other interrupts.
+ *
+ */ 
+
+
+#ifndef SW_TIMERS_H_
+#define SW_TIMERS_H_
+
+#include "global.h"
+
+///maximum number of software timers, ids are 0 to SW_TIMER_MAX_TIMERS - 1
+#define SW_TIMER_MAX_TIMERS     6
+
+/** called from sw_timers_run (main loop) when a timer is due
+ *  @NOTE it can restart or stop its own timer
+ */
+typedef void (*sw_timer_callback)(void);
+
+typedef struct _sSwTimer
+{
+    uint32_t          deadline;     /// uptime in ms the timer is due
+    uint16_t          period;       /// ms between runs, 0 = one shot
+    uint16_t          missed;       /// periods that went by without the timer running, saturates
+    sw_timer_callback callback;
+    bool              active;
+}sSwTimer;
+
+/** stops all timers and resets the uptime
+ */
+void sw_timers_init(void);
+
+/** advances the uptime by 1ms, call this from the 1ms timebase interrupt
+ */
+void sw_timers_tick(void);
+
+/** @RETURN ms since sw_timers_init, wraps after ~49 days
+ */
+uint32_t sw_timers_uptime(void);
+
+/** @RETURN true if the uptime moved since the last sw_timers_run, so the main loop knows
+ *  whether it can sleep
+ *  @NOTE call with interrupts off, between the check and going to sleep
+ */
+bool sw_timers_pending(void);
+
+/** runs the callback of every timer that is due. Call it from the main loop, at least
+ *  once per ms or the periodic timers start counting missed deadlines
+ */
+void sw_timers_run(void);
+
+/** starts (or restarts) a timer
+ *  @PARAM id - 0 to SW_TIMER_MAX_TIMERS - 1
+ *  @PARAM delay_ms - ms to the first run
+ *  @PARAM period_ms - ms between the following runs, 0 for a one shot timer
+ *  @PARAM callback - function to run
+ *  @RETURN false if id is out of range
+ */
+bool sw_timer_start(uint8_t id, uint16_t delay_ms, uint16_t period_ms, sw_timer_callback callback);
+
+/** stops a timer, its missed count is kept
+ */
+void sw_timer_stop(uint8_t id);
+
+/** changes the period of a running timer, takes effect after its next run
+ */
+void sw_timer_set_period(uint8_t id, uint16_t period_ms);
+
+/** @RETURN true if the timer is started and hasn't finished (one shot) or been stopped
+ */
+bool sw_timer_running(uint8_t id);
+
+/** @RETURN number of deadlines the timer missed. A periodic timer that runs a full period
+ *  or more late skips the runs it missed (it never runs twice to catch up), each skipped
+ *  run is counted here
+ */
+uint16_t sw_timer_missed(uint8_t id);
+
+#endif /* SW_TIMERS_H_ */
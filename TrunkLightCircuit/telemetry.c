@@ -0,0 +1,74 @@
+/*
+ * telemetry.c
+ *
+ */
+
+#include "telemetry.h"
+#include "avr_uart.h"
+#include <util/crc16.h>
+
+#if (TELEMETRY_MAX_PAYLOAD + 2 > 253)
+#error "COBS encoding here doesn't split blocks, payload + crc must stay under 254"
+#endif
+
+/** byte idx of the frame before COBS: the payload, then its crc little endian */
+static inline uint8_t _frame_byte(const uint8_t* payload, uint8_t len, uint16_t crc, uint8_t idx)
+{
+    uint8_t ret_value = (uint8_t)(crc >> 8);
+    
+    if (idx < len)
+    {
+        ret_value = payload[idx];
+    }
+    else if (idx == len)
+    {
+        ret_value = (uint8_t)crc;
+    }
+    
+    return ret_value;
+}
+
+bool telemetry_send(const void* payload, uint8_t len)
+{
+    const uint8_t* data = (const uint8_t*)payload;
+    uint16_t crc = 0xFFFF;
+    uint8_t block;          /// first byte of the current COBS block
+    uint8_t next;           /// the zero (or the end) that closes it
+    uint8_t ii;
+    bool ret_value = false;
+
+    //all or nothing, a frame cut short or with the Rx echo inside fails its CRC. The frame
+    //is encoded straight into the Tx queue, no copy of it on the stack
+    if ((len <= TELEMETRY_MAX_PAYLOAD) && UART_TxFrameStart(TELEMETRY_WIRE_LEN(len)))
+    {
+        for (ii = 0; ii < len; ii++)
+        {
+            crc = _crc16_update(crc, data[ii]);
+        }
+
+        //leading delimiter closes off anything that came before (e.g. ASCII debug text)
+        UART_TxFramePut(0);
+
+        //COBS: every block is a code byte, one more than the number of non zero bytes up
+        //to the next zero, then those bytes. The zero itself isn't sent. A block closed by
+        //the end of the frame has no zero, under 254 bytes that needs no extra code byte
+        for (block = 0; block <= len + 2; block = next + 1)
+        {
+            for (next = block; (next < len + 2) && (_frame_byte(data, len, crc, next) != 0); next++)
+            {
+            }
+
+            UART_TxFramePut((char)(next - block + 1));
+            for (ii = block; ii < next; ii++)
+            {
+                UART_TxFramePut((char)_frame_byte(data, len, crc, ii));
+            }
+        }
+
+        UART_TxFramePut(0);
+        UART_TxFrameEnd();
+        ret_value = true;
+    }
+
+    return ret_value;
+}
@@ -0,0 +1,55 @@
+/*
+ * telemetry.h
+ * Binary telemetry over the debug UART. Every frame is the payload followed by its CRC16
+ * (little endian), COBS encoded so the only 0x00 bytes on the wire are the delimiters
+ * before and after the frame. A receiver that starts mid stream, or sees ASCII debug
+ * output in between, just drops whatever doesn't decode with a good CRC.
+ * tools/telemetry_to_csv.py decodes the stream.
+ *
+ */
+
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "global.h"
+
+///largest payload telemetry_send takes. COBS needs no extra code bytes below 254
+#define TELEMETRY_MAX_PAYLOAD   32
+///bytes on the wire for a payload: delimiter, COBS code, payload, crc, delimiter
+#define TELEMETRY_WIRE_LEN(len) ((len) + 5)
+
+///layout of sTelemetryFrame, bump it when the frame changes
+#define TELEMETRY_FRAME_VERSION 2
+
+///sTelemetryFrame.flags
+#define TELEMETRY_FLAG_BRAKE        0x01
+#define TELEMETRY_FLAG_LEFT         0x02
+#define TELEMETRY_FLAG_RIGHT        0x04
+#define TELEMETRY_FLAG_INTEGRATED   0x08    /// left/right do brake duty
+#define TELEMETRY_FLAG_FAULT_LEFT   0x10    /// output is off after an overcurrent trip
+#define TELEMETRY_FLAG_FAULT_BRAKE  0x20
+#define TELEMETRY_FLAG_FAULT_RIGHT  0x40
+#define TELEMETRY_FLAG_POT_LOCKOUT  0x80    /// pots aren't read, pot values are stale
+
+/** the fixed frame the main loop sends. Little endian, packed (-fpack-struct), 18 bytes */
+typedef struct _sTelemetryFrame
+{
+    uint8_t  version;           /// TELEMETRY_FRAME_VERSION
+    uint8_t  sequence;          /// +1 per frame sent, a gap means frames were dropped
+    uint32_t uptime_ms;
+    uint16_t current[3];        /// feedback adc counts, LEFT, BRAKE, RIGHT
+    uint16_t pot[2];            /// flash speed pot, brake pattern pot
+    uint8_t  flags;             /// TELEMETRY_FLAG_xxx
+    uint8_t  lamp_out;          /// bit ARR_IDX_xxx set while that output has a lamp out
+}sTelemetryFrame;
+
+/** frames and queues one payload on the UART Tx queue. The frame is queued whole or not
+ *  at all, so a slow link drops frames instead of cutting them
+ *  @PARAM payload - bytes to send
+ *  @PARAM len - at most TELEMETRY_MAX_PAYLOAD
+ *  @RETURN true if the frame was queued
+ */
+bool telemetry_send(const void* payload, uint8_t len);
+
+#endif /* TELEMETRY_H_ */
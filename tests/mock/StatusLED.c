@@ -0,0 +1,48 @@
+/*
+ * StatusLED.c (host stub)
+ *
+ */
+
+#include "StatusLED.h"
+#include "sim.h"
+
+static eLED_COLOR led_color = eLED_OFF;
+static bool led_on = false;
+
+bool statusLed_init(volatile uint8_t* port, uint8_t red_pin, uint8_t green_pin, uint8_t blue_pin, bool active_low)
+{
+    led_color = eLED_OFF;
+    led_on = false;
+    
+    return true;
+}
+
+void statusLed_set_color(eLED_COLOR color)
+{
+    led_color = color;
+}
+
+void statusLed_On(void)
+{
+    led_on = true;
+}
+
+void statusLed_Off(void)
+{
+    led_on = false;
+}
+
+void statusLed_toggle(void)
+{
+    led_on = !led_on;
+}
+
+uint8_t sim_led_color(void)
+{
+    return led_color;
+}
+
+uint8_t sim_led_on(void)
+{
+    return led_on;
+}
@@ -0,0 +1,32 @@
+/*
+ * StatusLED.h (host stub)
+ * The RGB status led driver isn't part of this tree, this stub has the interface the
+ * firmware uses and only remembers what it was told, see sim_led_color/sim_led_on.
+ *
+ */
+
+
+#ifndef STATUSLED_H_
+#define STATUSLED_H_
+
+#include "global.h"
+
+typedef enum
+{
+    eLED_OFF,
+    eLED_RED,
+    eLED_YELLOW,
+    eLED_GREEN,
+    eLED_AQUA,
+    eLED_BLUE,
+    eLED_PURPLE,
+    eLED_WHITE,
+}eLED_COLOR;
+
+bool statusLed_init(volatile uint8_t* port, uint8_t red_pin, uint8_t green_pin, uint8_t blue_pin, bool active_low);
+void statusLed_set_color(eLED_COLOR color);
+void statusLed_On(void);
+void statusLed_Off(void);
+void statusLed_toggle(void);
+
+#endif /* STATUSLED_H_ */
@@ -0,0 +1,28 @@
+/*
+ * avr/eeprom.h (host mock)
+ * EEMEM variables are ordinary host variables in their own section, the section is the
+ * EEPROM (mock/eeprom.c). The simulator blanks it to 0xFF at boot.
+ *
+ */
+
+
+#ifndef MOCK_AVR_EEPROM_H_
+#define MOCK_AVR_EEPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEMEM   __attribute__((section("sim_eeprom")))
+
+#define eeprom_is_ready()   1
+#define eeprom_busy_wait()  ((void)0)
+
+uint8_t eeprom_read_byte(const uint8_t* addr);
+uint16_t eeprom_read_word(const uint16_t* addr);
+void eeprom_read_block(void* dst, const void* src, size_t len);
+void eeprom_write_byte(uint8_t* addr, uint8_t value);
+void eeprom_update_byte(uint8_t* addr, uint8_t value);
+void eeprom_write_block(const void* src, void* dst, size_t len);
+void eeprom_update_block(const void* src, void* dst, size_t len);
+
+#endif /* MOCK_AVR_EEPROM_H_ */
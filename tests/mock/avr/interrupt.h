@@ -0,0 +1,20 @@
+/*
+ * avr/interrupt.h (host mock)
+ * Interrupt vectors are plain functions the simulator calls, sei/cli only move the I bit
+ * of the mock SREG. The simulator doesn't dispatch an interrupt while it is clear.
+ *
+ */
+
+
+#ifndef MOCK_AVR_INTERRUPT_H_
+#define MOCK_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)    void vector(void); void vector(void)
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define sei()               (SREG |= (1 << SREG_I))
+#define cli()               (SREG &= (uint8_t)~(1 << SREG_I))
+
+#endif /* MOCK_AVR_INTERRUPT_H_ */
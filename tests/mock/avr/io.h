@@ -0,0 +1,238 @@
+/*
+ * avr/io.h (host mock)
+ * ATmega8A register file for the host build. Every I/O register is a plain variable
+ * (mock/avr_regs.c), the simulator in sim/sim.c reads and writes them around the firmware
+ * code the way the hardware would. Bit names and numbers are the ATmega8A ones.
+ *
+ */
+
+
+#ifndef MOCK_AVR_IO_H_
+#define MOCK_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _MOCK_REG8(name)    extern volatile uint8_t name;
+#define _MOCK_REG16(name)   extern volatile uint16_t name;
+
+//ADC, the 16 bit ADC is the one the firmware reads (adc_read10_value)
+_MOCK_REG8(ADMUX) _MOCK_REG8(ADCSRA) _MOCK_REG8(ADCH) _MOCK_REG8(ADCL) _MOCK_REG16(ADC)
+//timers
+_MOCK_REG8(TCCR0) _MOCK_REG8(TCNT0)
+_MOCK_REG8(TCCR1A) _MOCK_REG8(TCCR1B) _MOCK_REG16(TCNT1) _MOCK_REG16(OCR1A) _MOCK_REG16(OCR1B) _MOCK_REG16(ICR1)
+_MOCK_REG8(TCCR2) _MOCK_REG8(TCNT2) _MOCK_REG8(OCR2) _MOCK_REG8(ASSR)
+_MOCK_REG8(TIMSK) _MOCK_REG8(TIFR)
+//UART. UDR is 16 bits here so the simulator can tell a written byte from no write (it
+//parks 0x100 in it before the data register empty interrupt)
+_MOCK_REG8(UCSRA) _MOCK_REG8(UCSRB) _MOCK_REG8(UCSRC) _MOCK_REG8(UBRRL) _MOCK_REG8(UBRRH)
+_MOCK_REG16(UDR)
+//ports
+_MOCK_REG8(DDRB) _MOCK_REG8(DDRC) _MOCK_REG8(DDRD)
+_MOCK_REG8(PORTB) _MOCK_REG8(PORTC) _MOCK_REG8(PORTD)
+_MOCK_REG8(PINB) _MOCK_REG8(PINC) _MOCK_REG8(PIND)
+//system
+_MOCK_REG8(SREG) _MOCK_REG8(MCUCR) _MOCK_REG8(MCUCSR) _MOCK_REG8(GICR) _MOCK_REG8(GIFR)
+_MOCK_REG8(ACSR) _MOCK_REG8(SFIOR) _MOCK_REG8(WDTCR)
+//EEPROM, EEAR holds the low 16 bits of the host address of the EEMEM variable. EEDR goes
+//through the simulator so a read strobe (EERE) is done before the firmware looks at it
+_MOCK_REG8(EECR) _MOCK_REG16(EEAR)
+volatile uint8_t* _mock_eedr(void);
+#define EEDR    (*_mock_eedr())
+
+/* ADMUX */
+#define REFS1   7
+#define REFS0   6
+#define ADLAR   5
+#define MUX3    3
+#define MUX2    2
+#define MUX1    1
+#define MUX0    0
+
+/* ADCSRA */
+#define ADEN    7
+#define ADSC    6
+#define ADFR    5
+#define ADIF    4
+#define ADIE    3
+#define ADPS2   2
+#define ADPS1   1
+#define ADPS0   0
+
+/* TCCR0 */
+#define CS02    2
+#define CS01    1
+#define CS00    0
+
+/* TCCR1A */
+#define COM1A1  7
+#define COM1A0  6
+#define COM1B1  5
+#define COM1B0  4
+#define FOC1A   3
+#define FOC1B   2
+#define WGM11   1
+#define WGM10   0
+
+/* TCCR1B */
+#define ICNC1   7
+#define ICES1   6
+#define WGM13   4
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+
+/* TCCR2 */
+#define FOC2    7
+#define WGM20   6
+#define COM21   5
+#define COM20   4
+#define WGM21   3
+#define CS22    2
+#define CS21    1
+#define CS20    0
+
+/* TIMSK */
+#define OCIE2   7
+#define TOIE2   6
+#define TICIE1  5
+#define OCIE1A  4
+#define OCIE1B  3
+#define TOIE1   2
+#define TOIE0   0
+
+/* TIFR */
+#define OCF2    7
+#define TOV2    6
+#define ICF1    5
+#define OCF1A   4
+#define OCF1B   3
+#define TOV1    2
+#define TOV0    0
+
+/* UCSRA */
+#define RXC     7
+#define TXC     6
+#define UDRE    5
+#define FE      4
+#define DOR     3
+#define PE      2
+#define U2X     1
+#define MPCM    0
+
+/* UCSRB */
+#define RXCIE   7
+#define TXCIE   6
+#define UDRIE   5
+#define RXEN    4
+#define TXEN    3
+#define UCSZ2   2
+#define RXB8    1
+#define TXB8    0
+
+/* UCSRC */
+#define URSEL   7
+#define UMSEL   6
+#define UPM1    5
+#define UPM0    4
+#define USBS    3
+#define UCSZ1   2
+#define UCSZ0   1
+#define UCPOL   0
+
+/* SREG */
+#define SREG_I  7
+
+/* MCUCR */
+#define SE      7
+#define SM2     6
+#define SM1     5
+#define SM0     4
+#define ISC11   3
+#define ISC10   2
+#define ISC01   1
+#define ISC00   0
+
+/* MCUCSR */
+#define WDRF    3
+#define BORF    2
+#define EXTRF   1
+#define PORF    0
+
+/* GICR / GIFR */
+#define INT1    7
+#define INT0    6
+#define INTF1   7
+#define INTF0   6
+
+/* ACSR */
+#define ACD     7
+#define ACBG    6
+#define ACO     5
+#define ACI     4
+#define ACIE    3
+#define ACIC    2
+#define ACIS1   1
+#define ACIS0   0
+
+/* SFIOR */
+#define ACME    3
+
+/* EECR */
+#define EERIE   3
+#define EEMWE   2
+#define EEWE    1
+#define EERE    0
+
+/* port pins */
+#define PINB0   0
+#define PINB1   1
+#define PINB2   2
+#define PINB3   3
+#define PINB4   4
+#define PINB5   5
+#define PINB6   6
+#define PINB7   7
+#define PINC0   0
+#define PINC1   1
+#define PINC2   2
+#define PINC3   3
+#define PINC4   4
+#define PINC5   5
+#define PINC6   6
+#define PIND0   0
+#define PIND1   1
+#define PIND2   2
+#define PIND3   3
+#define PIND4   4
+#define PIND5   5
+#define PIND6   6
+#define PIND7   7
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+#define PB6     6
+#define PB7     7
+#define PC0     0
+#define PC1     1
+#define PC2     2
+#define PC3     3
+#define PC4     4
+#define PC5     5
+#define PC6     6
+#define PD0     0
+#define PD1     1
+#define PD2     2
+#define PD3     3
+#define PD4     4
+#define PD5     5
+#define PD6     6
+#define PD7     7
+
+#define RAMEND  0x45F
+#define E2END   0x1FF
+
+#endif /* MOCK_AVR_IO_H_ */
@@ -0,0 +1,26 @@
+/*
+ * avr/pgmspace.h (host mock)
+ * Flash and RAM are the same address space on the host.
+ *
+ */
+
+
+#ifndef MOCK_AVR_PGMSPACE_H_
+#define MOCK_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char*
+#define PSTR(s)             (s)
+#define pgm_read_byte(a)    (*(const uint8_t*)(a))
+#define pgm_read_word(a)    (*(const uint16_t*)(a))
+#define pgm_read_dword(a)   (*(const uint32_t*)(a))
+#define pgm_read_ptr(a)     (*(void* const*)(a))
+#define memcpy_P            memcpy
+#define strlen_P            strlen
+#define strcmp_P            strcmp
+#define strncmp_P           strncmp
+
+#endif /* MOCK_AVR_PGMSPACE_H_ */
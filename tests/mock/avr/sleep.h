@@ -0,0 +1,22 @@
+/*
+ * avr/sleep.h (host mock)
+ * sleep_cpu hands over to the simulator, it runs the hardware until an interrupt wakes
+ * the cpu up again.
+ *
+ */
+
+
+#ifndef MOCK_AVR_SLEEP_H_
+#define MOCK_AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE     0
+
+void sim_sleep(void);
+
+#define set_sleep_mode(mode)    ((void)(mode))
+#define sleep_enable()          ((void)0)
+#define sleep_disable()         ((void)0)
+#define sleep_cpu()             sim_sleep()
+#define sleep_mode()            sim_sleep()
+
+#endif /* MOCK_AVR_SLEEP_H_ */
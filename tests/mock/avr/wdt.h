@@ -0,0 +1,28 @@
+/*
+ * avr/wdt.h (host mock)
+ * The main loop resets the watchdog once per pass, the simulator uses that as the cost of
+ * a pass and checks the timeout.
+ *
+ */
+
+
+#ifndef MOCK_AVR_WDT_H_
+#define MOCK_AVR_WDT_H_
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+
+void sim_wdt_enable(unsigned char timeout);
+void sim_wdt_reset(void);
+
+#define wdt_enable(timeout) sim_wdt_enable(timeout)
+#define wdt_disable()       ((void)0)
+#define wdt_reset()         sim_wdt_reset()
+
+#endif /* MOCK_AVR_WDT_H_ */
@@ -0,0 +1,24 @@
+/*
+ * avr_regs.c (host mock)
+ * The I/O registers of mock/avr/io.h.
+ *
+ */
+
+#include <avr/io.h>
+
+#define _MOCK_DEF8(name)    volatile uint8_t name;
+#define _MOCK_DEF16(name)   volatile uint16_t name;
+
+_MOCK_DEF8(ADMUX) _MOCK_DEF8(ADCSRA) _MOCK_DEF8(ADCH) _MOCK_DEF8(ADCL) _MOCK_DEF16(ADC)
+_MOCK_DEF8(TCCR0) _MOCK_DEF8(TCNT0)
+_MOCK_DEF8(TCCR1A) _MOCK_DEF8(TCCR1B) _MOCK_DEF16(TCNT1) _MOCK_DEF16(OCR1A) _MOCK_DEF16(OCR1B) _MOCK_DEF16(ICR1)
+_MOCK_DEF8(TCCR2) _MOCK_DEF8(TCNT2) _MOCK_DEF8(OCR2) _MOCK_DEF8(ASSR)
+_MOCK_DEF8(TIMSK) _MOCK_DEF8(TIFR)
+_MOCK_DEF8(UCSRA) _MOCK_DEF8(UCSRB) _MOCK_DEF8(UCSRC) _MOCK_DEF8(UBRRL) _MOCK_DEF8(UBRRH)
+_MOCK_DEF16(UDR)
+_MOCK_DEF8(DDRB) _MOCK_DEF8(DDRC) _MOCK_DEF8(DDRD)
+_MOCK_DEF8(PORTB) _MOCK_DEF8(PORTC) _MOCK_DEF8(PORTD)
+_MOCK_DEF8(PINB) _MOCK_DEF8(PINC) _MOCK_DEF8(PIND)
+_MOCK_DEF8(SREG) _MOCK_DEF8(MCUCR) _MOCK_DEF8(MCUCSR) _MOCK_DEF8(GICR) _MOCK_DEF8(GIFR)
+_MOCK_DEF8(ACSR) _MOCK_DEF8(SFIOR) _MOCK_DEF8(WDTCR)
+_MOCK_DEF8(EECR) _MOCK_DEF16(EEAR)
@@ -0,0 +1,63 @@
+/*
+ * eeprom.c (host mock)
+ * avr-libc EEPROM functions on the sim_eeprom section. A write costs the time of a real
+ * one (the cpu waits for it), reads are free.
+ *
+ */
+
+#include <string.h>
+#include <avr/eeprom.h>
+#include "sim.h"
+
+uint8_t eeprom_read_byte(const uint8_t* addr)
+{
+    return *addr;
+}
+
+uint16_t eeprom_read_word(const uint16_t* addr)
+{
+    uint16_t ret_value;
+    
+    memcpy(&ret_value, addr, sizeof(ret_value));
+    
+    return ret_value;
+}
+
+void eeprom_read_block(void* dst, const void* src, size_t len)
+{
+    memcpy(dst, src, len);
+}
+
+void eeprom_write_byte(uint8_t* addr, uint8_t value)
+{
+    sim_delay_us(SIM_EEPROM_WRITE_US);
+    *addr = value;
+}
+
+void eeprom_update_byte(uint8_t* addr, uint8_t value)
+{
+    if (*addr != value)
+    {
+        eeprom_write_byte(addr, value);
+    }
+}
+
+void eeprom_write_block(const void* src, void* dst, size_t len)
+{
+    size_t ii;
+    
+    for (ii = 0; ii < len; ii++)
+    {
+        eeprom_write_byte((uint8_t*)dst + ii, ((const uint8_t*)src)[ii]);
+    }
+}
+
+void eeprom_update_block(const void* src, void* dst, size_t len)
+{
+    size_t ii;
+    
+    for (ii = 0; ii < len; ii++)
+    {
+        eeprom_update_byte((uint8_t*)dst + ii, ((const uint8_t*)src)[ii]);
+    }
+}
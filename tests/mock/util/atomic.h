@@ -0,0 +1,45 @@
+/*
+ * util/atomic.h (host mock)
+ * Same structure as avr-libc: the I bit of the mock SREG is cleared for the block and put
+ * back (or forced on) however the block is left.
+ *
+ */
+
+
+#ifndef MOCK_UTIL_ATOMIC_H_
+#define MOCK_UTIL_ATOMIC_H_
+
+#include <avr/io.h>
+
+static __inline__ uint8_t __mock_cli(void)
+{
+    SREG &= (uint8_t)~(1 << SREG_I);
+    return 1;
+}
+
+static __inline__ void __mock_restore(const uint8_t* sreg)
+{
+    SREG = *sreg;
+}
+
+static __inline__ void __mock_force_on(const uint8_t* unused)
+{
+    (void)unused;
+    SREG |= (1 << SREG_I);
+}
+
+static __inline__ void __mock_force_off(const uint8_t* unused)
+{
+    (void)unused;
+    SREG &= (uint8_t)~(1 << SREG_I);
+}
+
+#define ATOMIC_BLOCK(type)      for (type, __ToDo = __mock_cli(); __ToDo; __ToDo = 0)
+#define NONATOMIC_BLOCK(type)   for (type, __ToDo = (SREG |= (1 << SREG_I), 1); __ToDo; __ToDo = 0)
+
+#define ATOMIC_RESTORESTATE     uint8_t sreg_save __attribute__((__cleanup__(__mock_restore))) = SREG
+#define ATOMIC_FORCEON          uint8_t sreg_save __attribute__((__cleanup__(__mock_force_on))) = 0
+#define NONATOMIC_RESTORESTATE  uint8_t sreg_save __attribute__((__cleanup__(__mock_restore))) = SREG
+#define NONATOMIC_FORCEOFF      uint8_t sreg_save __attribute__((__cleanup__(__mock_force_off))) = 0
+
+#endif /* MOCK_UTIL_ATOMIC_H_ */
@@ -0,0 +1,48 @@
+/*
+ * util/crc16.h (host mock)
+ * C versions of the avr-libc CRC helpers, same results.
+ *
+ */
+
+
+#ifndef MOCK_UTIL_CRC16_H_
+#define MOCK_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+/** CRC-16/MODBUS step, polynomial 0xA001 reflected */
+static __inline__ uint16_t _crc16_update(uint16_t crc, uint8_t data)
+{
+    uint8_t ii;
+
+    crc ^= data;
+    for (ii = 0; ii < 8; ii++)
+    {
+        crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+    }
+
+    return crc;
+}
+
+static __inline__ uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= (uint8_t)(crc & 0xFF);
+    data ^= (uint8_t)(data << 4);
+
+    return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+static __inline__ uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+    uint8_t ii;
+
+    crc ^= data;
+    for (ii = 0; ii < 8; ii++)
+    {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+
+    return crc;
+}
+
+#endif /* MOCK_UTIL_CRC16_H_ */
@@ -0,0 +1,16 @@
+/*
+ * util/delay.h (host mock)
+ * Busy waits take simulated time, interrupts keep running meanwhile.
+ *
+ */
+
+
+#ifndef MOCK_UTIL_DELAY_H_
+#define MOCK_UTIL_DELAY_H_
+
+void sim_delay_us(unsigned long us);
+
+#define _delay_us(us)   sim_delay_us((unsigned long)(us))
+#define _delay_ms(ms)   sim_delay_us((unsigned long)((ms) * 1000UL))
+
+#endif /* MOCK_UTIL_DELAY_H_ */
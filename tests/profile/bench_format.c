@@ -0,0 +1,148 @@
+/*
+ * bench_format.c
+ * AVR program, the cycles of the avr_uart.c number formatters against the divide versions
+ * they replaced (uart_format_div.h), over every input. Timer1 counts cpu cycles around each
+ * call, the results go out on the UART and the program ends with sleep and interrupts off,
+ * which stops simavr:
+ *
+ *   run_avr -m atmega8 -f 16000000 bench_format.elf
+ *
+ * The last line is "bench_format: ok" when the new formatters have the lower worst case.
+ *
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_uart.h"
+#include "uart_format_div.h"
+
+#define BENCH_UBRR      8       /// 115200 baud at 16MHz, simavr doesn't mind the error
+
+typedef struct
+{
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+} sCycles;
+
+static uint16_t gu16_overhead;
+
+static void _put(char data)
+{
+    while (!(UCSRA & (1 << UDRE)))
+    {
+    }
+    UDR = data;
+}
+
+static void _puts(const char* str)
+{
+    while (*str)
+    {
+        _put(*str++);
+    }
+}
+
+static void _putu(uint16_t val)
+{
+    char str[STR_UINT16_RAW_LEN];
+    uint8_t len = convertUint16ToCharRaw(val, str);
+    
+    for (uint8_t ii = 0; ii < len; ii++)
+    {
+        _put(str[ii]);
+    }
+}
+
+static void _record(sCycles* stats, uint16_t cycles)
+{
+    cycles -= gu16_overhead;
+    stats->min = (cycles < stats->min) ? cycles : stats->min;
+    stats->max = (cycles > stats->max) ? cycles : stats->max;
+    stats->sum += cycles;
+}
+
+//timer1 runs at the cpu clock, TCNT1 is reset right before the call and read right after
+#define TIME_CALL(stats, call)      \
+    do                              \
+    {                               \
+        TCNT1 = 0;                  \
+        call;                       \
+        _record(stats, TCNT1);      \
+    } while (0)
+
+/** one result line, avg is the sum over 2^shift inputs */
+static void _report(const char* what, const sCycles* stats, uint8_t shift)
+{
+    _puts(what);
+    _puts(" min ");
+    _putu(stats->min);
+    _puts(" avg ");
+    _putu((uint16_t)(stats->sum >> shift));
+    _puts(" max ");
+    _putu(stats->max);
+    _puts("\r\n");
+}
+
+int main(void)
+{
+    sCycles div16 = { 0xFFFF, 0, 0 };
+    sCycles sub16 = { 0xFFFF, 0, 0 };
+    sCycles divs16 = { 0xFFFF, 0, 0 };
+    sCycles subs16 = { 0xFFFF, 0, 0 };
+    sCycles div8 = { 0xFFFF, 0, 0 };
+    sCycles sub8 = { 0xFFFF, 0, 0 };
+    char out[STR_INT16_LEN];
+    uint16_t val = 0;
+    
+    UBRRH = 0;
+    UBRRL = BENCH_UBRR;
+    UCSRB = (1 << TXEN);
+    TCCR1A = 0;
+    TCCR1B = (1 << CS10);
+    
+    //what the timing itself costs, taken off every sample
+    TCNT1 = 0;
+    gu16_overhead = TCNT1;
+    
+    do
+    {
+        TIME_CALL(&div16, div_convertUint16ToChar(val, out));
+        TIME_CALL(&sub16, convertUint16ToChar(val, out));
+        TIME_CALL(&divs16, div_convertInt16ToChar((int16_t)val, out));
+        TIME_CALL(&subs16, convertInt16ToChar((int16_t)val, out));
+        
+        if (val <= UINT8_MAX)
+        {
+            TIME_CALL(&div8, div_convertUint8ToChar((uint8_t)val, out));
+            TIME_CALL(&sub8, convertUint8ToChar((uint8_t)val, out));
+        }
+    } while (++val != 0);
+    
+    _puts("cycles per call, all inputs\r\n");
+    _report("convertUint16ToChar divide  ", &div16, 16);
+    _report("convertUint16ToChar subtract", &sub16, 16);
+    _report("convertInt16ToChar  divide  ", &divs16, 16);
+    _report("convertInt16ToChar  subtract", &subs16, 16);
+    _report("convertUint8ToChar  divide  ", &div8, 8);
+    _report("convertUint8ToChar  subtract", &sub8, 8);
+    
+    if ((sub16.max < div16.max) && (subs16.max < divs16.max) && (sub8.max < div8.max))
+    {
+        _puts("bench_format: ok\r\n");
+    }
+    else
+    {
+        _puts("bench_format: subtract-and-count is not faster\r\n");
+    }
+    
+    //sleep with interrupts off never wakes up, simavr ends the run
+    cli();
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sleep_cpu();
+    
+    return 0;
+}
@@ -0,0 +1,407 @@
+/*
+ * isr_profile.c
+ * Runs the firmware ELF built with ISR_PROFILE in simavr and times the ISRs from their
+ * marker pins (global.h PROFILE_xxx): a pin goes high at the top of the ISR body and low at
+ * the bottom, the cycle counts of the two edges give the duration. PC5 toggles on every OCR2
+ * write, the INT1 -> OCR2 latency is from the PD3 edge the runner drives to that toggle.
+ *
+ * The markers sit inside the ISR body, the vector jump and the register push/pop of the
+ * prologue and epilogue (~20-50 cycles) are not in the numbers.
+ *
+ * Two more are taken without pins, from the ADC vector starting (simavr's interrupt irq) to
+ * register writes: adc_restart to the ADCSRA write that starts the next conversion and
+ * adc_trip to the TCCR1A/TCCR2 write of disablePWMOutput that turns a shorted output off.
+ * They are what main.h bounds the overcurrent trip latency with (ADC_ISR_RESTART_CYCLES,
+ * ADC_ISR_TRIP_CYCLES). The runner shorts the brake lamp for SHORT_MS every SHORT_PERIOD_MS
+ * to get trips.
+ *
+ *   isr_profile <firmware.elf> <budget file>... [-t seconds]
+ *
+ * Prints min/avg/max/p99 in cycles for each marker and exits 1 if a max is over its line in
+ * the budget files, so a build step running it fails on a regression.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_adc.h"
+#include "avr_uart.h"
+#include "sim_interrupts.h"
+
+#define F_CPU_HZ            16000000UL
+#define CYCLES_PER_MS       (F_CPU_HZ / 1000)
+#define RUN_SECONDS         10
+#define AVCC_MV             5000
+
+#define LAMP_COUNTS         400     /// feedback reading of a good lamp, like the host tests
+#define POT_COUNTS          512
+
+//input stimulus periods, not multiples of each other or of the 1ms tick so the edges walk
+//across the tick and the ADC scan
+#define BRAKE_TOGGLE_MS     37
+#define LEFT_TOGGLE_MS      251
+#define RIGHT_TOGGLE_MS     263
+#define SHELL_CMD_MS        97
+#define SHORT_PERIOD_MS     1709
+#define SHORT_MS            5
+#define SHORT_COUNTS        1023    /// feedback reading of the shorted brake lamp
+
+//ATmega8 vector number and data space addresses of the registers watched
+#define ADC_VECTOR          14
+#define ADCSRA_ADDR         0x26
+#define ADCSRA_ADSC         0x40
+#define TCCR2_ADDR          0x45
+#define TCCR2_COM21         0x20
+#define TCCR1A_ADDR         0x4F
+#define TCCR1A_COM1X1       0xA0    /// COM1A1 | COM1B1
+
+typedef enum
+{
+    MARK_ADC,
+    MARK_TIMER0,
+    MARK_UART_RX,
+    MARK_INT1_OCR2,
+    MARK_ADC_RESTART,
+    MARK_ADC_TRIP,
+    NUM_MARKS
+} eMark;
+
+typedef struct
+{
+    const char* name;       /// name in the report and the budget file
+    char port;              /// 0 - not a pin, taken from register writes
+    uint8_t pin;
+    avr_cycle_count_t start;
+    uint32_t* samples;
+    size_t count;
+    size_t size;
+    uint32_t budget;        /// 0 - no budget line
+} sMark;
+
+static sMark arr_marks[NUM_MARKS] =
+{
+    { "adc"         , 'B', 0 },
+    { "timer0"      , 'B', 4 },
+    { "uart_rx"     , 'B', 5 },
+    { "int1_to_ocr2", 'C', 5 },
+    { "adc_restart" , 0  , 0 },
+    { "adc_trip"    , 0  , 0 },
+};
+
+static avr_t* avr;
+static uint8_t brake_level;
+static uint8_t brake_shorted;
+static avr_cycle_count_t brake_edge;    /// 0 - no brake edge waiting for its OCR2 write
+static avr_cycle_count_t adc_vector;    /// 0 - not in the ADC ISR
+static uint8_t adc_restarted;           /// the conversion restart of this ADC ISR was taken
+static uint8_t tccr1a;                  /// what the firmware last wrote, the COM bits
+static uint8_t tccr2;
+
+static void mark_add(sMark* mark, uint32_t cycles)
+{
+    if (mark->count == mark->size)
+    {
+        mark->size = mark->size ? mark->size * 2 : 4096;
+        mark->samples = realloc(mark->samples, mark->size * sizeof(uint32_t));
+        if (!mark->samples)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+
+    mark->samples[mark->count++] = cycles;
+}
+
+/** ISR marker pins, high for the ISR body */
+static void isr_pin_changed(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    sMark* mark = param;
+
+    if (value)
+    {
+        mark->start = avr->cycle;
+    }
+    else if (mark->start)
+    {
+        mark_add(mark, (uint32_t)(avr->cycle - mark->start));
+        mark->start = 0;
+    }
+}
+
+/** PC5 toggles on every OCR2 write, the first one after a brake edge ends the latency */
+static void ocr2_pin_changed(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    if (brake_edge)
+    {
+        mark_add(&arr_marks[MARK_INT1_OCR2], (uint32_t)(avr->cycle - brake_edge));
+        brake_edge = 0;
+    }
+}
+
+/** the ADC vector starts (1) and returns (0) */
+static void adc_vector_changed(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    adc_vector = value ? avr->cycle : 0;
+    adc_restarted = 0;
+}
+
+/** ADSC written inside the ADC ISR, the first time is the restart of the scan */
+static void adcsra_written(struct avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param)
+{
+    if (adc_vector && !adc_restarted && (value & ADCSRA_ADSC))
+    {
+        mark_add(&arr_marks[MARK_ADC_RESTART], (uint32_t)(avr->cycle - adc_vector));
+        adc_restarted = 1;
+    }
+}
+
+/** COM bits cleared inside the ADC ISR, only light_fault_trip does that */
+static void tccr_written(struct avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param)
+{
+    uint8_t* shadow = (addr == TCCR2_ADDR) ? &tccr2 : &tccr1a;
+    uint8_t com = (addr == TCCR2_ADDR) ? TCCR2_COM21 : TCCR1A_COM1X1;
+
+    if (adc_vector && (*shadow & com & ~value))
+    {
+        mark_add(&arr_marks[MARK_ADC_TRIP], (uint32_t)(avr->cycle - adc_vector));
+    }
+    *shadow = value;
+}
+
+static avr_cycle_count_t brake_toggle(struct avr_t* avr, avr_cycle_count_t when, void* param)
+{
+    brake_level = !brake_level;
+    //only the press writes OCR2 from INT1, the release is left to the main loop
+    brake_edge = brake_level ? avr->cycle : 0;
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 3), brake_level);
+
+    return when + BRAKE_TOGGLE_MS * CYCLES_PER_MS;
+}
+
+static avr_cycle_count_t input_toggle(struct avr_t* avr, avr_cycle_count_t when, void* param)
+{
+    uint8_t pin = (uint8_t)(uintptr_t)param;
+    avr_irq_t* irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), pin);
+
+    avr_raise_irq(irq, !irq->value);
+
+    return when + ((pin == 2) ? LEFT_TOGGLE_MS : RIGHT_TOGGLE_MS) * CYCLES_PER_MS;
+}
+
+/** a shell command every SHELL_CMD_MS keeps the Rx ISR and its echo busy */
+static avr_cycle_count_t shell_cmd(struct avr_t* avr, avr_cycle_count_t when, void* param)
+{
+    const char* cmd = "stat\r";
+    avr_irq_t* rx = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+
+    //the uart model queues the bytes and hands them over at the baud rate
+    for (const char* c = cmd; *c; c++)
+    {
+        avr_raise_irq(rx, (uint8_t)*c);
+    }
+
+    return when + SHELL_CMD_MS * CYCLES_PER_MS;
+}
+
+static void set_adc_counts(uint8_t channel, uint16_t counts)
+{
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + channel),
+                  ((uint32_t)counts * AVCC_MV) / 1024);
+}
+
+/** shorts the brake lamp (ADC3) for SHORT_MS, the trip and the retry backoff take it from
+ *  there. A short while the output waits for its retry doesn't trip
+ */
+static avr_cycle_count_t brake_short(struct avr_t* avr, avr_cycle_count_t when, void* param)
+{
+    brake_shorted = !brake_shorted;
+    set_adc_counts(3, brake_shorted ? SHORT_COUNTS : LAMP_COUNTS);
+
+    return when + (brake_shorted ? SHORT_MS : SHORT_PERIOD_MS - SHORT_MS) * CYCLES_PER_MS;
+}
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/** budget file: "<name> <max cycles>" per line, # starts a comment */
+static int read_budget(const char* path)
+{
+    char line[128];
+    FILE* f = fopen(path, "r");
+
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char name[32];
+        unsigned long cycles;
+
+        if (line[0] == '#' || sscanf(line, "%31s %lu", name, &cycles) != 2)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < NUM_MARKS; i++)
+        {
+            if (strcmp(name, arr_marks[i].name) == 0)
+            {
+                arr_marks[i].budget = (uint32_t)cycles;
+            }
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+/** @RETURN number of markers over budget or without samples */
+static int report(void)
+{
+    int failed = 0;
+
+    printf("%-14s %8s %8s %8s %8s %8s %8s\n", "cycles", "n", "min", "avg", "max", "p99", "budget");
+    for (int i = 0; i < NUM_MARKS; i++)
+    {
+        sMark* mark = &arr_marks[i];
+        unsigned long long sum = 0;
+
+        if (mark->count == 0)
+        {
+            printf("%-14s no samples, is the ELF built with ISR_PROFILE?\n", mark->name);
+            failed++;
+            continue;
+        }
+
+        qsort(mark->samples, mark->count, sizeof(uint32_t), cmp_u32);
+        for (size_t n = 0; n < mark->count; n++)
+        {
+            sum += mark->samples[n];
+        }
+
+        uint32_t max = mark->samples[mark->count - 1];
+        uint32_t p99 = mark->samples[((mark->count - 1) * 99) / 100];
+        int over = mark->budget && (max > mark->budget);
+
+        printf("%-14s %8zu %8u %8llu %8u %8u %8u%s\n", mark->name, mark->count, mark->samples[0],
+               sum / mark->count, max, p99, mark->budget, over ? "  OVER BUDGET" : "");
+        failed += over;
+    }
+
+    return failed;
+}
+
+int main(int argc, char* argv[])
+{
+    elf_firmware_t fw;
+    int seconds = RUN_SECONDS;
+    int state = cpu_Running;
+    int budgets = 0;
+    uint32_t uart_flags;
+
+    for (int arg = 2; arg < argc; arg++)
+    {
+        if ((strcmp(argv[arg], "-t") == 0) && (arg + 1 < argc))
+        {
+            seconds = atoi(argv[++arg]);
+        }
+        else if (read_budget(argv[arg]) < 0)
+        {
+            return 2;
+        }
+        else
+        {
+            budgets++;
+        }
+    }
+    if ((argc < 2) || (budgets == 0))
+    {
+        fprintf(stderr, "usage: %s <firmware.elf> <budget file>... [-t seconds]\n", argv[0]);
+        return 2;
+    }
+
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(argv[1], &fw) != 0)
+    {
+        fprintf(stderr, "%s: can't read the ELF\n", argv[1]);
+        return 2;
+    }
+    strcpy(fw.mmcu, "atmega8");
+    fw.frequency = F_CPU_HZ;
+
+    avr = avr_make_mcu_by_name(fw.mmcu);
+    if (!avr)
+    {
+        fprintf(stderr, "simavr has no %s\n", fw.mmcu);
+        return 2;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &fw);
+    avr->vcc = avr->avcc = avr->aref = AVCC_MV;
+
+    //the shell output is not wanted on stdout
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uart_flags);
+    uart_flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uart_flags);
+
+    for (int i = 0; i < NUM_MARKS; i++)
+    {
+        if (arr_marks[i].port)
+        {
+            avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(arr_marks[i].port), arr_marks[i].pin),
+                                    (i == MARK_INT1_OCR2) ? ocr2_pin_changed : isr_pin_changed, &arr_marks[i]);
+        }
+    }
+
+    //the ADC vector and the registers its trip and restart paths write. simavr chains
+    //these after its own write handlers
+    avr_irq_register_notify(avr_get_interrupt_irq(avr, ADC_VECTOR) + AVR_INT_IRQ_RUNNING, adc_vector_changed, NULL);
+    avr_register_io_write(avr, ADCSRA_ADDR, adcsra_written, NULL);
+    avr_register_io_write(avr, TCCR1A_ADDR, tccr_written, NULL);
+    avr_register_io_write(avr, TCCR2_ADDR, tccr_written, NULL);
+
+    //lamps on all three outputs (ADC4 left, ADC3 brake, ADC2 right), pots in the middle
+    set_adc_counts(4, LAMP_COUNTS);
+    set_adc_counts(3, LAMP_COUNTS);
+    set_adc_counts(2, LAMP_COUNTS);
+    set_adc_counts(0, POT_COUNTS);
+    set_adc_counts(1, POT_COUNTS);
+
+    //inputs idle low, the stimulus starts once the topology detection is done
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2), 0);
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 3), 0);
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 4), 0);
+    avr_cycle_timer_register(avr, 100 * CYCLES_PER_MS, brake_toggle, NULL);
+    avr_cycle_timer_register(avr, 100 * CYCLES_PER_MS, input_toggle, (void*)(uintptr_t)2);
+    avr_cycle_timer_register(avr, 100 * CYCLES_PER_MS, input_toggle, (void*)(uintptr_t)4);
+    avr_cycle_timer_register(avr, 100 * CYCLES_PER_MS, shell_cmd, NULL);
+    avr_cycle_timer_register(avr, 500 * CYCLES_PER_MS, brake_short, NULL);
+
+    while ((avr->cycle < (avr_cycle_count_t)seconds * F_CPU_HZ) && (state != cpu_Done) && (state != cpu_Crashed))
+    {
+        state = avr_run(avr);
+    }
+
+    if (state == cpu_Crashed)
+    {
+        fprintf(stderr, "firmware crashed at cycle %llu\n", (unsigned long long)avr->cycle);
+        return 1;
+    }
+
+    printf("%d s of firmware time in simavr, %lu Hz\n", seconds, F_CPU_HZ);
+    return report() ? 1 : 0;
+}
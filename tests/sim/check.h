@@ -0,0 +1,44 @@
+/*
+ * check.h
+ * Assertions for the host tests. A failed check prints where and why and the test goes
+ * on, check_done() gives the exit code for ctest.
+ *
+ */
+
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdio.h>
+
+static int check_failures = 0;
+
+#define CHECK(cond, ...)                                                    \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            check_failures++;                                               \
+            printf("%s:%d: check failed: %s\n    ", __FILE__, __LINE__, #cond); \
+            printf(__VA_ARGS__);                                            \
+            printf("\n");                                                   \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                          \
+    CHECK((long long)(actual) == (long long)(expected), "%s = %lld, expected %lld", \
+          #actual, (long long)(actual), (long long)(expected))
+
+static inline int check_done(const char* name)
+{
+    if (check_failures == 0)
+    {
+        printf("%s: ok\n", name);
+        return 0;
+    }
+    
+    printf("%s: %d check(s) failed\n", name, check_failures);
+    return 1;
+}
+
+#endif /* CHECK_H_ */
@@ -0,0 +1,48 @@
+/*
+ * fw.h
+ * What the tests use of main.c. main.h defines its tables and globals, it can only be
+ * included once, so the tests get the declarations from here.
+ *
+ */
+
+
+#ifndef FW_H_
+#define FW_H_
+
+#include "global.h"
+#include "sw_timers.h"
+#include "config.h"
+#include "StatusLED.h"
+
+#define ARR_IDX_LEFT    0
+#define ARR_IDX_BRAKE   1
+#define ARR_IDX_RIGHT   2
+
+//main.h SW_TIMER_xxx
+#define SW_TIMER_LIGHT_SERVICE  0
+
+extern volatile bool gb_BRAKE_ON;
+extern volatile bool gb_LEFT_TURN_SIGNAL_ON;
+extern volatile bool gb_RIGHT_TURN_SIGNAL_ON;
+extern volatile bool gb_OVERCURRENT_TRIPPED;
+extern volatile uint8_t gu8_FLASH_STEP_MS;
+extern volatile uint8_t gu8_BRAKE_PATTERN;
+extern volatile uint8_t arr_light_brightness[3];
+extern volatile eLIGHT_MODE ge_LIGHT_MODE;
+extern sConfig gs_CONFIG;
+extern const sConfig gs_CONFIG_DEFAULTS;
+
+//main.h CURRENT_LIMIT_xxx, overcurrent trip level range in feedback adc counts
+#define CURRENT_LIMIT_DEFAULT   912
+#define CURRENT_LIMIT_MIN       46
+#define CURRENT_LIMIT_MAX       1023
+
+//main.h BRIGHTNESS_xxx, perceptual brightness
+#define BRIGHTNESS_FULL             255
+#define BRIGHTNESS_LOW_DEFAULT_VAL  107
+#define BRIGHTNESS_OFF              0
+
+uint8_t lamp_out_mask(void);
+uint8_t getPWMBrightnessVal(uint8_t brightness);
+
+#endif /* FW_H_ */
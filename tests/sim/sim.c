@@ -0,0 +1,1204 @@
+/*
+ * sim.c
+ * See sim.h. The firmware runs on its own stack (ucontext), the test and the firmware hand
+ * over to each other: sim_run_xxx switches to the firmware until the time is up, the
+ * firmware switches back from whatever step of the hardware it was in.
+ *
+ * The peripherals aren't stepped cycle by cycle. Every register write the firmware makes is
+ * picked up when its code returns to the simulator (an ISR or a main loop pass ends), the
+ * counters are worked out from when they were last written, and time jumps from one
+ * hardware event (overflow, ADC sample/done, UART byte, EEPROM write) to the next.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <avr/io.h>
+#include "sim.h"
+
+#define SIM_NEVER               UINT64_MAX
+#define SIM_FW_STACK_SIZE       (1024 * 1024)
+#define SIM_UART_RX_QUEUE       4096
+#define SIM_UART_TX_CAPTURE     (1024 * 1024)
+
+int fw_main(void);
+
+void INT0_vect(void);
+void INT1_vect(void);
+void TIMER0_OVF_vect(void);
+void USART_RXC_vect(void);
+void USART_UDRE_vect(void);
+void ADC_vect(void);
+void EE_RDY_vect(void);
+
+static void (* const sim_vectors[SIM_NUM_VECTORS])(void) =
+{
+    INT0_vect,
+    INT1_vect,
+    TIMER0_OVF_vect,
+    USART_RXC_vect,
+    USART_UDRE_vect,
+    ADC_vect,
+    EE_RDY_vect,
+};
+
+//defaults are rough cycle counts of the -Os build
+static uint16_t sim_isr_cycles[SIM_NUM_VECTORS] = { 60, 400, 150, 120, 60, 300, 100 };
+static uint16_t sim_isr_io_cycles[SIM_NUM_VECTORS] = { 30, 40, 30, 30, 30, 80, 40 };
+static uint16_t sim_main_pass_cycles = 400;
+
+static uint64_t sim_now = 0;
+static uint64_t sim_deadline = 0;
+static ucontext_t sim_test_ctx;
+static ucontext_t sim_fw_ctx;
+
+static uint32_t sim_isr_counts[SIM_NUM_VECTORS];
+static uint64_t sim_isr_last[SIM_NUM_VECTORS];
+
+/************************************************************************/
+/*                               TIMERS                                 */
+/************************************************************************/
+#define TM_NORMAL   0
+#define TM_FAST     1
+#define TM_PHASE    2
+
+typedef struct
+{
+    uint64_t base_cycle;        /// count was base_count at this cycle
+    uint32_t base_count;
+    uint32_t written;           /// TCNT value put in the register before the firmware ran
+    uint32_t prescale;          /// cpu cycles per count, 0 = stopped
+    uint32_t top;
+    uint8_t  mode;
+    uint16_t cfg;               /// control register bits the config came from (+ ICR1)
+    uint8_t  num_ocr;
+    uint16_t ocr_seen[2];       /// register value as of the last check
+    uint16_t ocr_latched[2];    /// value the compare unit runs with
+    uint16_t ocr_pending[2];
+    uint8_t  pending[2];
+    uint64_t latch_cycle[2];    /// pending becomes latched here
+    uint64_t changed_at[2];
+}sSimTimer;
+
+static sSimTimer sim_timer[3];
+static uint64_t sim_t0_next_ovf = SIM_NEVER;
+
+//INT1 -> OCR2 latency
+static int8_t sim_vector_running = -1;
+static uint64_t sim_int1_cycle = 0;
+static uint8_t sim_int1_ocr2_pending = 0;
+static uint64_t sim_int1_ocr2_latency = 0;
+
+static volatile uint16_t* _timer_tcnt16(uint8_t tmr)
+{
+    return (tmr == 1) ? &TCNT1 : NULL;
+}
+
+static volatile uint8_t* _timer_tcnt8(uint8_t tmr)
+{
+    return (tmr == 0) ? &TCNT0 : (tmr == 2) ? &TCNT2 : NULL;
+}
+
+static uint32_t _timer_read_tcnt(uint8_t tmr)
+{
+    return (tmr == 1) ? *_timer_tcnt16(tmr) : *_timer_tcnt8(tmr);
+}
+
+static uint16_t _timer_read_ocr(uint8_t tmr, uint8_t ch)
+{
+    if (tmr == 1)
+    {
+        return (ch == 0) ? OCR1A : OCR1B;
+    }
+
+    return OCR2;
+}
+
+static uint32_t _timer_period(const sSimTimer* t)
+{
+    return (t->mode == TM_PHASE) ? (2 * t->top) : (t->top + 1);
+}
+
+static uint64_t _timer_ticks(const sSimTimer* t, uint64_t cycle)
+{
+    if ((t->prescale == 0) || (cycle < t->base_cycle))
+    {
+        return 0;
+    }
+
+    return (cycle - t->base_cycle) / t->prescale;
+}
+
+/** position in the up (and down) count, 0 to period - 1 */
+static uint32_t _timer_pos(const sSimTimer* t, uint64_t cycle)
+{
+    return (uint32_t)((t->base_count + _timer_ticks(t, cycle)) % _timer_period(t));
+}
+
+static uint32_t _timer_count(const sSimTimer* t, uint64_t cycle)
+{
+    uint32_t pos = _timer_pos(t, cycle);
+
+    if ((t->mode == TM_PHASE) && (pos > t->top))
+    {
+        pos = 2 * t->top - pos;
+    }
+
+    return pos;
+}
+
+/** @RETURN cycle of the next BOTTOM (TOP in phase correct), where the compare registers
+ *  are updated. Counting from pos 0 that is the next one, not this one
+ */
+static uint64_t _timer_next_update(const sSimTimer* t, uint64_t cycle)
+{
+    uint64_t ticks;
+    uint32_t pos;
+    uint32_t to_go;
+
+    if (t->prescale == 0)
+    {
+        return SIM_NEVER;
+    }
+
+    ticks = _timer_ticks(t, cycle);
+    pos = (uint32_t)((t->base_count + ticks) % _timer_period(t));
+
+    if (t->mode == TM_PHASE)
+    {
+        to_go = (pos < t->top) ? (t->top - pos) : (3 * t->top - pos);
+    }
+    else
+    {
+        to_go = _timer_period(t) - pos;
+    }
+
+    return t->base_cycle + (ticks + to_go) * t->prescale;
+}
+
+/** applies compare values whose update came around by cycle */
+static void _timer_sync(uint8_t tmr, uint64_t cycle)
+{
+    sSimTimer* t = &sim_timer[tmr];
+    uint8_t ch;
+
+    for (ch = 0; ch < t->num_ocr; ch++)
+    {
+        if (t->pending[ch] && (cycle >= t->latch_cycle[ch]))
+        {
+            t->pending[ch] = 0;
+
+            if (t->ocr_latched[ch] != t->ocr_pending[ch])
+            {
+                t->ocr_latched[ch] = t->ocr_pending[ch];
+                t->changed_at[ch] = t->latch_cycle[ch];
+
+                if ((tmr == 2) && sim_int1_ocr2_pending)
+                {
+                    sim_int1_ocr2_pending = 0;
+                    sim_int1_ocr2_latency = t->latch_cycle[ch] - sim_int1_cycle;
+                }
+            }
+        }
+    }
+}
+
+static void _timer_rebase(uint8_t tmr, uint64_t cycle, uint32_t count)
+{
+    sSimTimer* t = &sim_timer[tmr];
+
+    //the prescaler runs on, the first count comes at its next edge
+    t->base_cycle = (t->prescale != 0) ? (cycle - (cycle % t->prescale)) : cycle;
+    t->base_count = (t->mode == TM_PHASE) ? count : (count % _timer_period(t));
+}
+
+/** decodes the waveform mode, TOP and clock of a timer from its registers */
+static void _timer_decode(uint8_t tmr, uint32_t* prescale, uint32_t* top, uint8_t* mode, uint16_t* cfg)
+{
+    static const uint16_t prescale01[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    static const uint16_t prescale2[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+    uint8_t wgm;
+
+    *mode = TM_NORMAL;
+
+    if (tmr == 0)
+    {
+        *prescale = prescale01[TCCR0 & 0x07];
+        *top = 0xFF;
+        *cfg = TCCR0 & 0x07;
+    }
+    else if (tmr == 1)
+    {
+        *prescale = prescale01[TCCR1B & 0x07];
+        wgm = (TCCR1A & 0x03) | ((TCCR1B >> 1) & 0x0C);
+        *top = 0xFFFF;
+
+        if (wgm == 5)
+        {
+            *mode = TM_FAST;
+            *top = 0xFF;
+        }
+        else if (wgm == 14)
+        {
+            *mode = TM_FAST;
+            *top = ICR1;
+        }
+        else if (wgm == 1)
+        {
+            *mode = TM_PHASE;
+            *top = 0xFF;
+        }
+        else if (wgm == 10)
+        {
+            *mode = TM_PHASE;
+            *top = ICR1;
+        }
+
+        *cfg = (uint16_t)(((TCCR1B & 0x1F) << 2) | (TCCR1A & 0x03)) ^ (uint16_t)(ICR1 << 7);
+    }
+    else
+    {
+        *prescale = prescale2[TCCR2 & 0x07];
+        wgm = ((TCCR2 >> WGM20) & 0x01) | ((TCCR2 >> (WGM21 - 1)) & 0x02);
+        *top = 0xFF;
+
+        if (wgm == 3)
+        {
+            *mode = TM_FAST;
+        }
+        else if (wgm == 1)
+        {
+            *mode = TM_PHASE;
+        }
+
+        *cfg = TCCR2 & ((1 << WGM20) | (1 << WGM21) | 0x07);
+    }
+
+    if (*top == 0)
+    {
+        *top = 1;
+    }
+}
+
+/** picks up what the firmware did to a timer, at cycle */
+static void _timer_leave(uint8_t tmr, uint64_t cycle)
+{
+    sSimTimer* t = &sim_timer[tmr];
+    uint32_t prescale;
+    uint32_t top;
+    uint8_t mode;
+    uint16_t cfg;
+    uint32_t tcnt;
+    uint16_t ocr;
+    uint8_t ch;
+
+    _timer_sync(tmr, cycle);
+
+    _timer_decode(tmr, &prescale, &top, &mode, &cfg);
+    if ((cfg != t->cfg) || (prescale != t->prescale) || (top != t->top) || (mode != t->mode))
+    {
+        uint32_t count = _timer_count(t, cycle);
+
+        t->prescale = prescale;
+        t->top = top;
+        t->mode = mode;
+        t->cfg = cfg;
+        _timer_rebase(tmr, cycle, count);
+    }
+
+    tcnt = _timer_read_tcnt(tmr);
+    if (tcnt != t->written)
+    {
+        _timer_rebase(tmr, cycle, tcnt);
+        t->written = tcnt;
+    }
+
+    for (ch = 0; ch < t->num_ocr; ch++)
+    {
+        ocr = _timer_read_ocr(tmr, ch);
+
+        if (ocr != t->ocr_seen[ch])
+        {
+            t->ocr_seen[ch] = ocr;
+            t->ocr_pending[ch] = ocr;
+            t->pending[ch] = 1;
+
+            if ((tmr == 2) && (sim_vector_running == SIM_VEC_INT1))
+            {
+                sim_int1_ocr2_pending = 1;
+            }
+
+            //double buffered in the pwm modes only
+            t->latch_cycle[ch] = (t->mode == TM_NORMAL) ? cycle : _timer_next_update(t, cycle);
+        }
+        else if (t->pending[ch])
+        {
+            //the counter may have been moved since the write
+            t->latch_cycle[ch] = (t->mode == TM_NORMAL) ? cycle : _timer_next_update(t, cycle);
+        }
+    }
+
+    _timer_sync(tmr, cycle);
+}
+
+static void _timer_enter(uint8_t tmr, uint64_t cycle)
+{
+    sSimTimer* t = &sim_timer[tmr];
+
+    t->written = _timer_count(t, cycle);
+
+    if (tmr == 1)
+    {
+        *_timer_tcnt16(tmr) = (uint16_t)t->written;
+    }
+    else
+    {
+        *_timer_tcnt8(tmr) = (uint8_t)t->written;
+    }
+}
+
+static void _timer0_schedule(void)
+{
+    //timer0 runs in normal mode, the overflow is its BOTTOM
+    sim_t0_next_ovf = _timer_next_update(&sim_timer[0], sim_now);
+}
+
+/************************************************************************/
+/*                             PWM OUTPUTS                              */
+/************************************************************************/
+static uint8_t _out_timer(uint8_t output)
+{
+    return (output == SIM_OUT_BRAKE) ? 2 : 1;
+}
+
+static uint8_t _out_channel(uint8_t output)
+{
+    return (output == SIM_OUT_RIGHT) ? 1 : 0;
+}
+
+static uint8_t _out_connected(uint8_t output)
+{
+    if (output == SIM_OUT_LEFT)
+    {
+        return (TCCR1A >> COM1A0) & 0x03;
+    }
+    else if (output == SIM_OUT_RIGHT)
+    {
+        return (TCCR1A >> COM1B0) & 0x03;
+    }
+
+    return (TCCR2 >> COM20) & 0x03;
+}
+
+static uint8_t _out_pin_at(uint8_t output, uint64_t cycle)
+{
+    uint8_t tmr = _out_timer(output);
+    sSimTimer* t = &sim_timer[tmr];
+    uint32_t ocr;
+    uint32_t count;
+
+    if (!_out_connected(output))
+    {
+        //back to the port, the outputs are driven low
+        return 0;
+    }
+
+    _timer_sync(tmr, cycle);
+    ocr = t->ocr_latched[_out_channel(output)];
+    count = _timer_count(t, cycle);
+
+    if (t->mode == TM_PHASE)
+    {
+        return (ocr >= t->top) || (count < ocr);
+    }
+
+    return (count <= ocr);
+}
+
+/** duty cycle in 1/65536 */
+static uint32_t _out_duty(uint8_t output)
+{
+    uint8_t tmr = _out_timer(output);
+    sSimTimer* t = &sim_timer[tmr];
+    uint32_t ocr;
+
+    if (!_out_connected(output))
+    {
+        return 0;
+    }
+
+    _timer_sync(tmr, sim_now);
+    ocr = t->ocr_latched[_out_channel(output)];
+
+    if (ocr >= t->top)
+    {
+        return 65536;
+    }
+
+    if (t->mode == TM_PHASE)
+    {
+        return (uint32_t)(((uint64_t)ocr << 16) / t->top);
+    }
+
+    return (uint32_t)(((uint64_t)(ocr + 1) << 16) / (t->top + 1));
+}
+
+/************************************************************************/
+/*                                 ADC                                  */
+/************************************************************************/
+static uint8_t sim_adc_busy = 0;
+static uint8_t sim_adc_sampled = 0;
+static uint8_t sim_adc_enabled = 0;
+static uint8_t sim_adc_first = 0;
+static uint8_t sim_adc_mux = 0;
+static uint16_t sim_adc_value = 0;
+static uint64_t sim_adc_sample_cycle = SIM_NEVER;
+static uint64_t sim_adc_done_cycle = SIM_NEVER;
+
+static uint16_t sim_lamp[3] = { 0, 0, 0 };
+static uint8_t sim_short[3] = { 0, 0, 0 };
+static uint16_t sim_pot[2] = { 512, 512 };
+static uint8_t sim_feedback_mode = SIM_FEEDBACK_CHOPPED;
+static uint8_t sim_noise_max = 2;
+static uint32_t sim_noise_state = 1;
+
+static uint8_t _noise(void)
+{
+    //xorshift, the tests want the same run every time
+    sim_noise_state ^= sim_noise_state << 13;
+    sim_noise_state ^= sim_noise_state >> 17;
+    sim_noise_state ^= sim_noise_state << 5;
+
+    return (uint8_t)(sim_noise_state % ((uint32_t)sim_noise_max + 1));
+}
+
+static uint16_t _adc_input(uint8_t mux, uint64_t cycle)
+{
+    //ADC4 left, ADC3 brake, ADC2 right feedback, ADC0/ADC1 the pots
+    static const int8_t feedback_output[8] = { -1, -1, SIM_OUT_RIGHT, SIM_OUT_BRAKE, SIM_OUT_LEFT, -1, -1, -1 };
+    uint32_t value = 0;
+    int8_t output;
+
+    if (mux < 2)
+    {
+        return sim_pot[mux];
+    }
+
+    output = (mux < 8) ? feedback_output[mux] : -1;
+    if (output < 0)
+    {
+        return 0;
+    }
+
+    if (sim_short[output])
+    {
+        value = 1023;
+    }
+    else if (sim_feedback_mode == SIM_FEEDBACK_AVERAGE)
+    {
+        value = (uint32_t)(((uint64_t)sim_lamp[output] * _out_duty(output)) >> 16);
+    }
+    else if (_out_pin_at(output, cycle))
+    {
+        value = sim_lamp[output];
+    }
+
+    value += _noise();
+
+    return (value > 1023) ? 1023 : (uint16_t)value;
+}
+
+static void _adc_leave(uint64_t cycle)
+{
+    static const uint8_t adc_div[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+    uint32_t div = adc_div[ADCSRA & 0x07];
+    uint64_t start;
+
+    if (!(ADCSRA & (1 << ADEN)))
+    {
+        sim_adc_enabled = 0;
+        sim_adc_busy = 0;
+        return;
+    }
+
+    if (!sim_adc_enabled)
+    {
+        //the first conversion after enabling takes 25 clocks
+        sim_adc_enabled = 1;
+        sim_adc_first = 1;
+    }
+
+    if ((ADCSRA & (1 << ADSC)) && !sim_adc_busy)
+    {
+        //starts on the next ADC clock edge
+        start = ((cycle + div - 1) / div) * div;
+
+        sim_adc_busy = 1;
+        sim_adc_sampled = 0;
+        sim_adc_mux = ADMUX & 0x0F;
+        sim_adc_sample_cycle = start + (sim_adc_first ? (27 * div) / 2 : (3 * div) / 2);
+        sim_adc_done_cycle = start + (sim_adc_first ? 25 : 13) * div;
+        sim_adc_first = 0;
+    }
+}
+
+/************************************************************************/
+/*                                UART                                  */
+/************************************************************************/
+static uint64_t sim_tx_ready = 0;
+static char* sim_tx_capture = NULL;
+static size_t sim_tx_len = 0;
+static size_t sim_tx_read = 0;
+
+static char sim_rx_queue[SIM_UART_RX_QUEUE];
+static size_t sim_rx_head = 0;
+static size_t sim_rx_tail = 0;
+static uint64_t sim_rx_next = SIM_NEVER;
+static uint8_t sim_rx_full = 0;
+static uint8_t sim_rx_data = 0;
+static uint32_t sim_rx_overruns = 0;
+
+/** cpu cycles of one 10 bit frame at the programmed baud rate */
+static uint32_t _uart_frame_cycles(void)
+{
+    uint32_t ubrr = ((uint32_t)(UBRRH & 0x0F) << 8) | UBRRL;
+    uint32_t ret_value = 10 * 16 * (ubrr + 1);
+
+    if (UCSRA & (1 << U2X))
+    {
+        ret_value /= 2;
+    }
+
+    return ret_value;
+}
+
+/************************************************************************/
+/*                               EEPROM                                 */
+/************************************************************************/
+extern uint8_t __start_sim_eeprom[];
+extern uint8_t __stop_sim_eeprom[];
+
+static uint64_t sim_ee_busy_until = 0;
+static uint8_t sim_ee_busy = 0;
+static volatile uint8_t sim_eedr = 0;
+
+/** EEAR only holds the low 16 bits of the host address of the EEMEM variable */
+static uint8_t* _ee_addr(void)
+{
+    uintptr_t base = (uintptr_t)__start_sim_eeprom;
+    uintptr_t addr = (base & ~(uintptr_t)0xFFFF) | EEAR;
+
+    if (addr < base)
+    {
+        addr += 0x10000;
+    }
+
+    if (addr >= (uintptr_t)__stop_sim_eeprom)
+    {
+        fprintf(stderr, "sim: EEAR 0x%04X is outside the EEPROM\n", EEAR);
+        abort();
+    }
+
+    return (uint8_t*)addr;
+}
+
+volatile uint8_t* _mock_eedr(void)
+{
+    if (EECR & (1 << EERE))
+    {
+        EECR &= (uint8_t)~(1 << EERE);
+        sim_eedr = *_ee_addr();
+    }
+
+    return &sim_eedr;
+}
+
+static void _ee_leave(uint64_t cycle)
+{
+    if ((EECR & (1 << EEWE)) && !sim_ee_busy)
+    {
+        *_ee_addr() = sim_eedr;
+        sim_ee_busy = 1;
+        sim_ee_busy_until = cycle + (uint64_t)SIM_EEPROM_WRITE_US * SIM_CYCLES_PER_US;
+    }
+}
+
+/************************************************************************/
+/*                              WATCHDOG                                */
+/************************************************************************/
+static uint64_t sim_wdt_period = 0;
+static uint64_t sim_wdt_last = 0;
+static uint8_t sim_wdt_fired = 0;
+
+/************************************************************************/
+/*                            ENTER / LEAVE                             */
+/************************************************************************/
+/** registers as the firmware would read them now. The timer counts are the ones of io_cycle,
+ *  where the writes of the code about to run land (_fw_leave), so a counter written back with
+ *  the value it had there is no change even if it ticked on in between
+ */
+static void _fw_enter(uint64_t io_cycle)
+{
+    uint8_t tmr;
+
+    for (tmr = 0; tmr < 3; tmr++)
+    {
+        _timer_enter(tmr, io_cycle);
+    }
+
+    if (sim_adc_busy)
+    {
+        ADCSRA |= (1 << ADSC);
+    }
+
+    if (sim_now >= sim_tx_ready)
+    {
+        UCSRA |= (1 << UDRE);
+    }
+    else
+    {
+        UCSRA &= (uint8_t)~(1 << UDRE);
+    }
+}
+
+/** picks up the register writes the firmware made, as if at cycle */
+static void _fw_leave(uint64_t cycle)
+{
+    uint8_t tmr;
+
+    for (tmr = 0; tmr < 3; tmr++)
+    {
+        _timer_leave(tmr, cycle);
+    }
+
+    _timer0_schedule();
+    _adc_leave(cycle);
+    _ee_leave(cycle);
+}
+
+/************************************************************************/
+/*                            EVENT LOOP                                */
+/************************************************************************/
+static int8_t _pending_vector(void)
+{
+    //INT0/INT1 with ISCx1:0 = 0 are level triggered on a low pin
+    if ((GICR & (1 << INT0)) && ((GIFR & (1 << INTF0)) || (!(MCUCR & 0x03) && !(PIND & (1 << PD2)))))
+    {
+        return SIM_VEC_INT0;
+    }
+    if ((GICR & (1 << INT1)) && ((GIFR & (1 << INTF1)) || (!(MCUCR & 0x0C) && !(PIND & (1 << PD3)))))
+    {
+        return SIM_VEC_INT1;
+    }
+    if ((TIMSK & (1 << TOIE0)) && (TIFR & (1 << TOV0)))
+    {
+        return SIM_VEC_TIMER0_OVF;
+    }
+    if ((UCSRB & (1 << RXCIE)) && sim_rx_full)
+    {
+        return SIM_VEC_USART_RXC;
+    }
+    if ((UCSRB & (1 << UDRIE)) && (sim_now >= sim_tx_ready))
+    {
+        return SIM_VEC_USART_UDRE;
+    }
+    if ((ADCSRA & (1 << ADIE)) && (ADCSRA & (1 << ADIF)))
+    {
+        return SIM_VEC_ADC;
+    }
+    if ((EECR & (1 << EERIE)) && !sim_ee_busy)
+    {
+        return SIM_VEC_EE_RDY;
+    }
+
+    return -1;
+}
+
+static uint64_t _next_event(void)
+{
+    uint64_t next = sim_t0_next_ovf;
+
+    if (sim_adc_busy)
+    {
+        uint64_t adc = sim_adc_sampled ? sim_adc_done_cycle : sim_adc_sample_cycle;
+        next = (adc < next) ? adc : next;
+    }
+    if (sim_rx_next < next)
+    {
+        next = sim_rx_next;
+    }
+    if ((UCSRB & (1 << UDRIE)) && (sim_tx_ready > sim_now) && (sim_tx_ready < next))
+    {
+        next = sim_tx_ready;
+    }
+    if (sim_ee_busy && (sim_ee_busy_until < next))
+    {
+        next = sim_ee_busy_until;
+    }
+
+    return next;
+}
+
+static void _process_events(void)
+{
+    if (sim_now >= sim_t0_next_ovf)
+    {
+        TIFR |= (1 << TOV0);
+        _timer0_schedule();
+    }
+
+    if (sim_adc_busy && !sim_adc_sampled && (sim_now >= sim_adc_sample_cycle))
+    {
+        sim_adc_value = _adc_input(sim_adc_mux, sim_adc_sample_cycle);
+        sim_adc_sampled = 1;
+    }
+    if (sim_adc_busy && sim_adc_sampled && (sim_now >= sim_adc_done_cycle))
+    {
+        sim_adc_busy = 0;
+        ADC = sim_adc_value;
+        ADCL = (uint8_t)sim_adc_value;
+        ADCH = (uint8_t)(sim_adc_value >> 8);
+        ADCSRA = (ADCSRA & (uint8_t)~(1 << ADSC)) | (1 << ADIF);
+    }
+
+    while (sim_now >= sim_rx_next)
+    {
+        if (sim_rx_full)
+        {
+            sim_rx_overruns++;
+        }
+        else
+        {
+            sim_rx_data = (uint8_t)sim_rx_queue[sim_rx_tail];
+            sim_rx_full = 1;
+            UCSRA |= (1 << RXC);
+        }
+
+        sim_rx_tail = (sim_rx_tail + 1) % SIM_UART_RX_QUEUE;
+        sim_rx_next = (sim_rx_tail == sim_rx_head) ? SIM_NEVER : (sim_rx_next + _uart_frame_cycles());
+    }
+
+    if (sim_ee_busy && (sim_now >= sim_ee_busy_until))
+    {
+        sim_ee_busy = 0;
+        EECR &= (uint8_t)~((1 << EEWE) | (1 << EEMWE));
+    }
+
+    if (sim_wdt_period && ((sim_now - sim_wdt_last) > sim_wdt_period))
+    {
+        sim_wdt_fired = 1;
+    }
+}
+
+static void _dispatch(uint8_t vector);
+
+/** runs the hardware for cycles, or with until_wake till an interrupt has been taken.
+ *  Hands over to the test whenever its time is up
+ */
+static void _advance(uint64_t cycles, uint8_t until_wake)
+{
+    uint64_t end = sim_now + cycles;
+    uint8_t woke = 0;
+    uint64_t next;
+    int8_t vector;
+
+    while (1)
+    {
+        if (SREG & (1 << SREG_I))
+        {
+            vector = _pending_vector();
+            if (vector >= 0)
+            {
+                _dispatch((uint8_t)vector);
+                woke = 1;
+                continue;
+            }
+        }
+
+        if (until_wake ? woke : (sim_now >= end))
+        {
+            return;
+        }
+
+        if (sim_now >= sim_deadline)
+        {
+            swapcontext(&sim_fw_ctx, &sim_test_ctx);
+            continue;
+        }
+
+        next = _next_event();
+        if (!until_wake && (end < next))
+        {
+            next = end;
+        }
+        if (sim_deadline < next)
+        {
+            next = sim_deadline;
+        }
+        if (next > sim_now)
+        {
+            sim_now = next;
+        }
+
+        _process_events();
+    }
+}
+
+static void _dispatch(uint8_t vector)
+{
+    //the hardware clears the flag of the vector it takes
+    if (vector == SIM_VEC_INT0)
+    {
+        GIFR &= (uint8_t)~(1 << INTF0);
+    }
+    else if (vector == SIM_VEC_INT1)
+    {
+        GIFR &= (uint8_t)~(1 << INTF1);
+        sim_int1_cycle = sim_now;
+    }
+    else if (vector == SIM_VEC_TIMER0_OVF)
+    {
+        TIFR &= (uint8_t)~(1 << TOV0);
+    }
+    else if (vector == SIM_VEC_ADC)
+    {
+        ADCSRA &= (uint8_t)~(1 << ADIF);
+    }
+
+    SREG &= (uint8_t)~(1 << SREG_I);
+    sim_isr_counts[vector]++;
+    sim_isr_last[vector] = sim_now;
+
+    _fw_enter(sim_now + sim_isr_io_cycles[vector]);
+    if (vector == SIM_VEC_USART_RXC)
+    {
+        UDR = sim_rx_data;
+    }
+    else if (vector == SIM_VEC_USART_UDRE)
+    {
+        //not a byte, shows whether the ISR wrote one
+        UDR = 0x100;
+    }
+
+    sim_vectors[vector]();
+
+    sim_vector_running = (int8_t)vector;
+    _fw_leave(sim_now + sim_isr_io_cycles[vector]);
+    sim_vector_running = -1;
+
+    if (vector == SIM_VEC_USART_RXC)
+    {
+        sim_rx_full = 0;
+        UCSRA &= (uint8_t)~(1 << RXC);
+    }
+    else if ((vector == SIM_VEC_USART_UDRE) && (UDR != 0x100))
+    {
+        if (sim_tx_len < SIM_UART_TX_CAPTURE)
+        {
+            sim_tx_capture[sim_tx_len++] = (char)UDR;
+        }
+        sim_tx_ready = ((sim_tx_ready > sim_now) ? sim_tx_ready : sim_now) + _uart_frame_cycles();
+    }
+
+    //the rest of the ISR, nothing else is taken meanwhile
+    _advance(sim_isr_cycles[vector], 0);
+
+    //reti
+    SREG |= (1 << SREG_I);
+}
+
+/************************************************************************/
+/*                          FIRMWARE HOOKS                              */
+/************************************************************************/
+void sim_sleep(void)
+{
+    _fw_leave(sim_now);
+    _advance(0, 1);
+    _fw_enter(sim_now);
+}
+
+void sim_wdt_enable(unsigned char timeout)
+{
+    sim_wdt_period = (uint64_t)(15UL << timeout) * 1000UL * SIM_CYCLES_PER_US;
+    sim_wdt_last = sim_now;
+}
+
+void sim_wdt_reset(void)
+{
+    //once per main loop pass, the pass takes its time here
+    _fw_leave(sim_now);
+    sim_wdt_last = sim_now;
+    _advance(sim_main_pass_cycles, 0);
+    _fw_enter(sim_now);
+}
+
+void sim_delay_us(unsigned long us)
+{
+    _fw_leave(sim_now);
+    _advance((uint64_t)us * SIM_CYCLES_PER_US, 0);
+    _fw_enter(sim_now);
+}
+
+static void _fw_entry(void)
+{
+    _fw_enter(sim_now);
+    fw_main();
+
+    fprintf(stderr, "sim: fw_main returned\n");
+    abort();
+}
+
+/************************************************************************/
+/*                              TEST API                                */
+/************************************************************************/
+void sim_boot(void)
+{
+    static char* stack = NULL;
+
+    if (stack != NULL)
+    {
+        fprintf(stderr, "sim: sim_boot can only be called once\n");
+        abort();
+    }
+
+    stack = malloc(SIM_FW_STACK_SIZE);
+    sim_tx_capture = malloc(SIM_UART_TX_CAPTURE);
+    if ((stack == NULL) || (sim_tx_capture == NULL))
+    {
+        abort();
+    }
+
+    //erased EEPROM, power on reset
+    memset(__start_sim_eeprom, 0xFF, (size_t)(__stop_sim_eeprom - __start_sim_eeprom));
+    MCUCSR = (1 << PORF);
+    PIND = 0;
+
+    sim_timer[1].num_ocr = 2;
+    sim_timer[2].num_ocr = 1;
+
+    getcontext(&sim_fw_ctx);
+    sim_fw_ctx.uc_stack.ss_sp = stack;
+    sim_fw_ctx.uc_stack.ss_size = SIM_FW_STACK_SIZE;
+    sim_fw_ctx.uc_link = NULL;
+    makecontext(&sim_fw_ctx, _fw_entry, 0);
+
+    //init runs in no time, this stops at the first main loop pass
+    sim_run_cycles(1);
+}
+
+void sim_run_cycles(uint64_t cycles)
+{
+    sim_deadline = sim_now + cycles;
+    swapcontext(&sim_test_ctx, &sim_fw_ctx);
+}
+
+void sim_run_us(uint32_t us)
+{
+    sim_run_cycles((uint64_t)us * SIM_CYCLES_PER_US);
+}
+
+uint64_t sim_now_cycles(void)
+{
+    return sim_now;
+}
+
+uint32_t sim_now_us(void)
+{
+    return (uint32_t)(sim_now / SIM_CYCLES_PER_US);
+}
+
+void sim_set_input(uint8_t input, uint8_t level)
+{
+    uint8_t old_level = (PIND >> input) & 0x01;
+    uint8_t isc;
+    uint8_t flag;
+
+    level = level ? 1 : 0;
+    if (level == old_level)
+    {
+        return;
+    }
+
+    if (level)
+    {
+        PIND |= (1 << input);
+    }
+    else
+    {
+        PIND &= (uint8_t)~(1 << input);
+    }
+
+    if ((input != SIM_IN_LEFT) && (input != SIM_IN_BRAKE))
+    {
+        return;
+    }
+
+    //ISCx1:0, 01 any change, 10 falling, 11 rising. The flag is set even if INTx is off
+    isc = (input == SIM_IN_LEFT) ? (MCUCR & 0x03) : ((MCUCR >> 2) & 0x03);
+    flag = (input == SIM_IN_LEFT) ? (1 << INTF0) : (1 << INTF1);
+
+    if ((isc == 1) || ((isc == 2) && !level) || ((isc == 3) && level))
+    {
+        GIFR |= flag;
+    }
+}
+
+void sim_set_lamp(uint8_t output, uint16_t counts)
+{
+    sim_lamp[output] = counts;
+}
+
+void sim_set_short(uint8_t output, uint8_t shorted)
+{
+    sim_short[output] = shorted;
+}
+
+void sim_set_pot(uint8_t pot, uint16_t value)
+{
+    sim_pot[pot] = value;
+}
+
+void sim_set_feedback_mode(uint8_t mode)
+{
+    sim_feedback_mode = mode;
+}
+
+void sim_set_noise(uint8_t max, uint32_t seed)
+{
+    sim_noise_max = max;
+    sim_noise_state = seed ? seed : 1;
+}
+
+void sim_set_isr_cycles(uint8_t vector, uint16_t cycles, uint16_t io_cycles)
+{
+    sim_isr_cycles[vector] = cycles;
+    sim_isr_io_cycles[vector] = io_cycles;
+}
+
+void sim_set_main_pass_cycles(uint16_t cycles)
+{
+    sim_main_pass_cycles = cycles;
+}
+
+int32_t sim_pwm_compare(uint8_t output)
+{
+    uint8_t tmr = _out_timer(output);
+
+    if (!_out_connected(output))
+    {
+        return -1;
+    }
+
+    _timer_sync(tmr, sim_now);
+
+    return sim_timer[tmr].ocr_latched[_out_channel(output)];
+}
+
+uint16_t sim_pwm_top(uint8_t output)
+{
+    return (uint16_t)sim_timer[_out_timer(output)].top;
+}
+
+uint8_t sim_pwm_val(uint8_t output)
+{
+    int32_t ocr = sim_pwm_compare(output);
+    uint32_t top = sim_pwm_top(output);
+
+    if (ocr < 0)
+    {
+        return 0;
+    }
+    if ((uint32_t)ocr >= top)
+    {
+        return 0xFF;
+    }
+
+    //inverse of _scalePWMValTimer1, rounded up so it gives back the value it came from
+    return (uint8_t)((((uint32_t)ocr << 8) + top) / (top + 1));
+}
+
+uint64_t sim_pwm_changed_at(uint8_t output)
+{
+    uint8_t tmr = _out_timer(output);
+
+    _timer_sync(tmr, sim_now);
+
+    return sim_timer[tmr].changed_at[_out_channel(output)];
+}
+
+uint8_t sim_pin(uint8_t output)
+{
+    return _out_pin_at(output, sim_now);
+}
+
+uint32_t sim_isr_count(uint8_t vector)
+{
+    return sim_isr_counts[vector];
+}
+
+uint64_t sim_isr_last_cycle(uint8_t vector)
+{
+    return sim_isr_last[vector];
+}
+
+uint64_t sim_int1_to_ocr2_cycles(void)
+{
+    _timer_sync(2, sim_now);
+
+    return sim_int1_ocr2_latency;
+}
+
+void sim_uart_rx(const char* data, size_t len)
+{
+    size_t ii;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        if (sim_rx_tail == sim_rx_head)
+        {
+            sim_rx_next = sim_now + _uart_frame_cycles();
+        }
+
+        sim_rx_queue[sim_rx_head] = data[ii];
+        sim_rx_head = (sim_rx_head + 1) % SIM_UART_RX_QUEUE;
+    }
+}
+
+void sim_uart_rx_str(const char* str)
+{
+    sim_uart_rx(str, strlen(str));
+}
+
+uint32_t sim_uart_rx_overruns(void)
+{
+    return sim_rx_overruns;
+}
+
+size_t sim_uart_tx(char* buf, size_t max)
+{
+    size_t len = sim_tx_len - sim_tx_read;
+
+    if (len > max)
+    {
+        len = max;
+    }
+
+    memcpy(buf, &sim_tx_capture[sim_tx_read], len);
+    sim_tx_read += len;
+
+    if (sim_tx_read == sim_tx_len)
+    {
+        sim_tx_read = 0;
+        sim_tx_len = 0;
+    }
+
+    return len;
+}
+
+uint8_t sim_wdt_expired(void)
+{
+    return sim_wdt_fired;
+}
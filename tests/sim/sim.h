@@ -0,0 +1,148 @@
+/*
+ * sim.h
+ * Host simulator for the firmware. The firmware (main renamed to fw_main) runs on the mock
+ * registers of mock/avr/io.h, sim.c plays the hardware around it: timer0 tick, the pwm
+ * timers with their double buffered compare registers, the ADC with its conversion timing
+ * and feedback currents that follow the pwm outputs, the light inputs on INT0/INT1/PD4,
+ * the UART and the EEPROM. Everything is clocked in cpu cycles at F_CPU.
+ *
+ * Firmware code itself takes no time, time passes in the ISRs (sim_set_isr_cycles), once
+ * per main loop pass (the wdt_reset, sim_set_main_pass_cycles), in busy waits and while
+ * the cpu sleeps. Interrupts are taken between those steps in vector priority order,
+ * only while the I bit of SREG is set.
+ *
+ * A test boots the firmware once with sim_boot, then runs it for a while with sim_run_us,
+ * changes inputs or loads and looks at the outputs in between.
+ *
+ */
+
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIM_F_CPU               16000000UL
+#define SIM_CYCLES_PER_US       (SIM_F_CPU / 1000000UL)
+
+#define SIM_EEPROM_WRITE_US     8500    /// one EEPROM byte, datasheet typical
+
+//light inputs, the pins on PIND
+#define SIM_IN_LEFT             2       /// PD2, INT0
+#define SIM_IN_BRAKE            3       /// PD3, INT1
+#define SIM_IN_RIGHT            4       /// PD4, polled by the tick
+
+//pwm outputs, same order as ARR_IDX_LEFT, ARR_IDX_BRAKE, ARR_IDX_RIGHT
+#define SIM_OUT_LEFT            0       /// OC1A
+#define SIM_OUT_BRAKE           1       /// OC2
+#define SIM_OUT_RIGHT           2       /// OC1B
+
+//interrupt vectors the firmware uses, in priority order
+#define SIM_VEC_INT0            0
+#define SIM_VEC_INT1            1
+#define SIM_VEC_TIMER0_OVF      2
+#define SIM_VEC_USART_RXC       3
+#define SIM_VEC_USART_UDRE      4
+#define SIM_VEC_ADC             5
+#define SIM_VEC_EE_RDY          6
+#define SIM_NUM_VECTORS         7
+
+//what the feedback (current sense) channels read
+#define SIM_FEEDBACK_CHOPPED    0   /// the lamp current while the output pin is high, else 0
+#define SIM_FEEDBACK_AVERAGE    1   /// the lamp current times the duty, a filtered sense line
+
+/** clears the registers and the EEPROM (0xFF) and starts fw_main. It runs up to its first
+ *  main loop pass, call once per process
+ */
+void sim_boot(void);
+
+/** lets the firmware run for a while */
+void sim_run_us(uint32_t us);
+void sim_run_cycles(uint64_t cycles);
+
+/** @RETURN time since sim_boot */
+uint64_t sim_now_cycles(void);
+uint32_t sim_now_us(void);
+
+/** sets a light input pin, an edge sets the INT0/INT1 flag the way MCUCR asks for
+ *  @PARAM input - SIM_IN_xxx
+ *  @PARAM level - 0 or 1
+ */
+void sim_set_input(uint8_t input, uint8_t level);
+
+/** the feedback reading of a lamp on an output while it is on, in adc counts */
+void sim_set_lamp(uint8_t output, uint16_t counts);
+
+/** a shorted output reads 1023 whatever the pwm does */
+void sim_set_short(uint8_t output, uint8_t shorted);
+
+/** @PARAM pot - 0 flash speed (ADC0), 1 brake pattern (ADC1) */
+void sim_set_pot(uint8_t pot, uint16_t value);
+
+/** @PARAM mode - SIM_FEEDBACK_CHOPPED (default) or SIM_FEEDBACK_AVERAGE */
+void sim_set_feedback_mode(uint8_t mode);
+
+/** random noise of 0 to max counts is added to every feedback reading (default 2) */
+void sim_set_noise(uint8_t max, uint32_t seed);
+
+/** cycles an ISR takes from the vector to reti, the io_cycles into it are when its register
+ *  writes (timer reload, ADC start) land
+ */
+void sim_set_isr_cycles(uint8_t vector, uint16_t cycles, uint16_t io_cycles);
+
+/** cycles one main loop pass takes */
+void sim_set_main_pass_cycles(uint16_t cycles);
+
+/** @RETURN the compare value the output is running with (the double buffer latched it),
+ *  -1 while the output is disconnected from the pin
+ */
+int32_t sim_pwm_compare(uint8_t output);
+
+/** @RETURN TOP of the timer behind the output */
+uint16_t sim_pwm_top(uint8_t output);
+
+/** @RETURN the running compare value scaled to 0-255 like setPWMVal, 0 when disconnected */
+uint8_t sim_pwm_val(uint8_t output);
+
+/** @RETURN cycle the running compare value last changed */
+uint64_t sim_pwm_changed_at(uint8_t output);
+
+/** @RETURN the output pin level now */
+uint8_t sim_pin(uint8_t output);
+
+/** @RETURN how often a vector ran, and the cycle it ran last */
+uint32_t sim_isr_count(uint8_t vector);
+uint64_t sim_isr_last_cycle(uint8_t vector);
+
+/** @RETURN cycles from the INT1 vector to the OCR2 value it wrote reaching the pin, for the
+ *  last INT1 that changed OCR2. 0 if there was none
+ */
+uint64_t sim_int1_to_ocr2_cycles(void);
+
+/** queues bytes on the UART Rx line, they arrive one frame time apart */
+void sim_uart_rx(const char* data, size_t len);
+void sim_uart_rx_str(const char* str);
+
+/** @RETURN Rx bytes lost because the last one wasn't read in time */
+uint32_t sim_uart_rx_overruns(void);
+
+/** takes what the firmware sent since the last call
+ *  @RETURN number of bytes copied, the rest stays queued
+ */
+size_t sim_uart_tx(char* buf, size_t max);
+
+/** status led stub, eLED_COLOR and on/off */
+uint8_t sim_led_color(void);
+uint8_t sim_led_on(void);
+
+/** @RETURN 1 if the watchdog would have reset the part */
+uint8_t sim_wdt_expired(void);
+
+/** hooks of the mock avr headers */
+void sim_sleep(void);
+void sim_wdt_enable(unsigned char timeout);
+void sim_wdt_reset(void);
+void sim_delay_us(unsigned long us);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,123 @@
+/*
+ * test_inputs.c
+ * Light inputs -> outputs in the three light modes. The mode is left to the topology
+ * detection: the test boots without a brake lamp (conservative mode, then integrated
+ * lights) and plugs one in later (separate lights).
+ *
+ */
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+
+#define LAMP_COUNTS     400
+#define DISCONNECTED    -1
+
+/** @RETURN pwm value of an output, DISCONNECTED while its pin is off */
+static int output_val(uint8_t output)
+{
+    return (sim_pwm_compare(output) < 0) ? DISCONNECTED : sim_pwm_val(output);
+}
+
+static void check_outputs(const char* what, int left, int brake, int right)
+{
+    CHECK(output_val(SIM_OUT_LEFT) == left, "%s: left is %d, expected %d", what, output_val(SIM_OUT_LEFT), left);
+    CHECK(output_val(SIM_OUT_BRAKE) == brake, "%s: brake is %d, expected %d", what, output_val(SIM_OUT_BRAKE), brake);
+    CHECK(output_val(SIM_OUT_RIGHT) == right, "%s: right is %d, expected %d", what, output_val(SIM_OUT_RIGHT), right);
+}
+
+int main(void)
+{
+    int low = getPWMBrightnessVal(BRIGHTNESS_LOW_DEFAULT_VAL);
+    
+    sim_set_lamp(SIM_OUT_LEFT, LAMP_COUNTS);
+    sim_set_lamp(SIM_OUT_RIGHT, LAMP_COUNTS);
+    sim_boot();
+    
+    //conservative mode: left/right do brake duty, the brake output is a plain brake light
+    sim_run_us(6000);
+    CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_AUTO);
+    check_outputs("auto, no input", low, low, low);
+    CHECK_EQ(sim_led_color(), eLED_YELLOW);
+    
+    sim_set_input(SIM_IN_BRAKE, 1);
+    sim_run_us(6000);
+    CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_AUTO);
+    check_outputs("auto, brake", 255, 255, 255);
+    
+    sim_set_input(SIM_IN_BRAKE, 0);
+    sim_run_us(2000);
+    check_outputs("auto, brake released", low, low, low);
+    
+    //no current on the brake output, integrated lights
+    sim_run_us(50000);
+    CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_INTEGRATED);
+    CHECK_EQ(sim_led_color(), eLED_AQUA);
+    //the brake output stays at running light level so a lamp plugged in later shows up
+    check_outputs("integrated, no input", low, low, low);
+    
+    sim_set_input(SIM_IN_BRAKE, 1);
+    sim_run_us(6000);
+    check_outputs("integrated, brake", 255, low, 255);
+    
+    //turn signal overrides the brake, full/off for contrast
+    sim_set_input(SIM_IN_LEFT, 1);
+    sim_run_us(2000);
+    check_outputs("integrated, brake + left on", 255, low, 255);
+    sim_set_input(SIM_IN_LEFT, 0);
+    sim_run_us(2000);
+    check_outputs("integrated, brake + left off phase", 0, low, 255);
+    
+    //a second without turn input and the left light does brake duty again
+    sim_run_us(900000);
+    check_outputs("integrated, brake + left within timeout", 0, low, 255);
+    sim_run_us(106000);
+    check_outputs("integrated, brake + left timed out", 255, low, 255);
+    
+    sim_set_input(SIM_IN_BRAKE, 0);
+    sim_run_us(2000);
+    check_outputs("integrated, released", low, low, low);
+    
+    //right turn without brake, the right input is debounced by the tick
+    sim_set_input(SIM_IN_RIGHT, 1);
+    sim_run_us(10000);
+    check_outputs("integrated, right on", low, low, 255);
+    sim_set_input(SIM_IN_RIGHT, 0);
+    sim_run_us(10000);
+    check_outputs("integrated, right off phase", low, low, 0);
+    sim_run_us(1010000);
+    check_outputs("integrated, right timed out", low, low, low);
+    
+    //trailer swapped for one with a brake lamp, picked up without a reset (TOPO_SWITCH_WINDOWS
+    //full windows, the brake output only gets every fourth conversion in integrated mode)
+    sim_set_lamp(SIM_OUT_BRAKE, LAMP_COUNTS);
+    sim_run_us(2500000);
+    CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_SEPARATE);
+    CHECK_EQ(sim_led_color(), eLED_GREEN);
+    check_outputs("separate, no input", DISCONNECTED, low, DISCONNECTED);
+    
+    //every input has its own output
+    sim_set_input(SIM_IN_LEFT, 1);
+    sim_run_us(6000);
+    check_outputs("separate, left", 255, low, DISCONNECTED);
+    
+    sim_set_input(SIM_IN_BRAKE, 1);
+    sim_run_us(4000);
+    check_outputs("separate, left + brake", 255, 255, DISCONNECTED);
+    
+    sim_set_input(SIM_IN_LEFT, 0);
+    sim_set_input(SIM_IN_RIGHT, 1);
+    sim_run_us(10000);
+    CHECK_EQ(output_val(SIM_OUT_LEFT), DISCONNECTED);
+    CHECK_EQ(output_val(SIM_OUT_RIGHT), 255);
+    
+    sim_set_input(SIM_IN_BRAKE, 0);
+    sim_set_input(SIM_IN_RIGHT, 0);
+    sim_run_us(10000);
+    check_outputs("separate, released", DISCONNECTED, low, DISCONNECTED);
+    
+    CHECK_EQ(lamp_out_mask(), 0);
+    CHECK_EQ(sim_wdt_expired(), 0);
+    
+    return check_done("test_inputs");
+}
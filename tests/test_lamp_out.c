@@ -0,0 +1,215 @@
+/*
+ * test_lamp_out.c
+ * Lamp out detection on the chopped feedback: a reading only sees the lamp current in the
+ * on phase of the pwm, so which readings see it depends on where the conversions fall in
+ * the pwm period. The ADC ISR time moves the conversions (the next one starts from the
+ * ISR), the good lamp cases run at several of them, at running light levels down to the
+ * dimmest checked duty and with lamps just over the least current a lamp draws. Each case
+ * boots the firmware in a child process of its own (sim_boot is once per process).
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+
+#define LAMP_COUNTS         400
+#define WEAK_LAMP_COUNTS    48      /// FEEDBACK_50_mAMP is 46 at full duty
+#define ADC_ISR_CYCLES      220     /// after the io cycles (conversion restart)
+#define SETTLE_US           200000  /// topology detected, ramps done
+#define DWELL_US            1000000 /// per running light level
+#define POLL_US             1000
+#define DETECT_MAX_MS       500
+#define CLEAR_MAX_MS        50
+#define SWITCH_MAX_MS       3000    /// TOPO_SWITCH_WINDOWS
+
+//running light levels, perceptual. The dimmest ones are under LAMPOUT_MIN_PWM and not
+//checked, the rest down to it have the longest off phases
+static const uint8_t arr_brightness[] = { 30, 45, 60, 80, 107, 150, 200, 255 };
+
+//ADC io cycles (default 80), moves the conversions against the pwm period
+static const uint16_t arr_adc_io_cycles[] = { 80, 170, 333, 610 };
+
+typedef struct
+{
+    uint16_t lamp_counts;       /// left and right lamps
+    uint16_t brake_counts;      /// brake lamp, 0 - none (integrated lights)
+    uint16_t adc_io_cycles;
+    uint8_t feedback_mode;      /// SIM_FEEDBACK_xxx
+} sCase;
+
+static void boot(const sCase* test)
+{
+    sim_set_lamp(SIM_OUT_LEFT, test->lamp_counts);
+    sim_set_lamp(SIM_OUT_RIGHT, test->lamp_counts);
+    sim_set_lamp(SIM_OUT_BRAKE, test->brake_counts);
+    sim_set_feedback_mode(test->feedback_mode);
+    sim_set_isr_cycles(SIM_VEC_ADC, test->adc_io_cycles + ADC_ISR_CYCLES, test->adc_io_cycles);
+    sim_boot();
+    sim_run_us(SETTLE_US);
+
+    CHECK_EQ(ge_LIGHT_MODE, test->brake_counts ? eLIGHT_MODE_SEPARATE : eLIGHT_MODE_INTEGRATED);
+}
+
+/** runs for a while and counts the polls with a lamp out
+ *  @RETURN polls that saw one
+ */
+static uint32_t run_counting_out(uint32_t us)
+{
+    uint32_t out = 0;
+
+    for (uint32_t t = 0; t < us; t += POLL_US)
+    {
+        sim_run_us(POLL_US);
+        out += (lamp_out_mask() != 0);
+    }
+
+    return out;
+}
+
+/** @RETURN ms until the lamp out bits are mask, gives up after max_ms */
+static uint32_t ms_until_mask(uint8_t mask, uint32_t max_ms)
+{
+    uint32_t start = sim_now_us();
+
+    while ((lamp_out_mask() != mask) && ((sim_now_us() - start) < (max_ms * 1000)))
+    {
+        sim_run_us(POLL_US);
+    }
+
+    return (sim_now_us() - start) / 1000;
+}
+
+/** good lamps at every running light level, then braking and flashing turn signals: no
+ *  lamp out, ever. In integrated mode the brake output runs with nothing on it
+ */
+static void good_lamps(const sCase* test)
+{
+    uint32_t out;
+
+    boot(test);
+
+    for (size_t idx = 0; idx < sizeof(arr_brightness); idx++)
+    {
+        //a brake press makes the light logic apply the new running light level
+        gs_CONFIG.brightness_low = arr_brightness[idx];
+        sim_set_input(SIM_IN_BRAKE, 1);
+        sim_run_us(20000);
+        sim_set_input(SIM_IN_BRAKE, 0);
+
+        out = run_counting_out(DWELL_US);
+        CHECK(out == 0, "lamp %u, brake %u, adc io %u, running light %u: lamp out for %u ms",
+              test->lamp_counts, test->brake_counts, test->adc_io_cycles, arr_brightness[idx], out);
+    }
+
+    //turn signals flashing full/off while braking
+    gs_CONFIG.brightness_low = BRIGHTNESS_LOW_DEFAULT_VAL;
+    sim_set_input(SIM_IN_BRAKE, 1);
+    for (int flash = 0; flash < 6; flash++)
+    {
+        sim_set_input(SIM_IN_LEFT, 1);
+        sim_set_input(SIM_IN_RIGHT, 1);
+        out = run_counting_out(330000);
+        sim_set_input(SIM_IN_LEFT, 0);
+        sim_set_input(SIM_IN_RIGHT, 0);
+        out += run_counting_out(330000);
+        CHECK(out == 0, "lamp %u, brake %u, adc io %u, flashing: lamp out for %u ms",
+              test->lamp_counts, test->brake_counts, test->adc_io_cycles, out);
+    }
+    sim_set_input(SIM_IN_BRAKE, 0);
+}
+
+/** a lamp taken out is flagged, one put back is cleared. The brake lamp in separate mode is
+ *  flagged before the topology detection moves to integrated lights, which drops the check
+ */
+static void lamp_removed(const sCase* test)
+{
+    uint32_t ms;
+    uint8_t output = test->brake_counts ? SIM_OUT_BRAKE : SIM_OUT_LEFT;
+    uint8_t bit = 1 << (test->brake_counts ? ARR_IDX_BRAKE : ARR_IDX_LEFT);
+
+    boot(test);
+    CHECK_EQ(lamp_out_mask(), 0);
+
+    sim_set_lamp(output, 0);
+    ms = ms_until_mask(bit, DETECT_MAX_MS * 2);
+    printf("adc io %3u: output %u lamp out after %u ms", test->adc_io_cycles, output, ms);
+    CHECK(ms <= DETECT_MAX_MS, "output %u: lamp out after %u ms", output, ms);
+
+    if (test->brake_counts)
+    {
+        CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_SEPARATE);
+        ms = ms_until_mask(0, SWITCH_MAX_MS);
+        printf(", integrated lights after %u ms more\n", ms);
+        CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_INTEGRATED);
+    }
+    else
+    {
+        sim_set_lamp(output, test->lamp_counts);
+        ms = ms_until_mask(0, CLEAR_MAX_MS * 2);
+        printf(", back after %u ms\n", ms);
+        CHECK(ms <= CLEAR_MAX_MS, "output %u: lamp back after %u ms", output, ms);
+    }
+}
+
+/** runs one case in a child process
+ *  @RETURN 1 if it failed
+ */
+static int run_case(void (*test_case)(const sCase*), const sCase* test)
+{
+    int status = 0;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        test_case(test);
+        CHECK_EQ(sim_wdt_expired(), 0);
+
+        fflush(stdout);
+        _exit(check_failures != 0);
+    }
+
+    waitpid(pid, &status, 0);
+    return !WIFEXITED(status) || (WEXITSTATUS(status) != 0);
+}
+
+int main(void)
+{
+    int failed = 0;
+    sCase test;
+
+    for (size_t io = 0; io < sizeof(arr_adc_io_cycles) / sizeof(arr_adc_io_cycles[0]); io++)
+    {
+        test.adc_io_cycles = arr_adc_io_cycles[io];
+        test.feedback_mode = SIM_FEEDBACK_CHOPPED;
+
+        test.lamp_counts = WEAK_LAMP_COUNTS;
+        test.brake_counts = WEAK_LAMP_COUNTS;
+        failed += run_case(good_lamps, &test);
+        test.brake_counts = 0;
+        failed += run_case(good_lamps, &test);
+
+        test.lamp_counts = LAMP_COUNTS;
+        test.brake_counts = LAMP_COUNTS;
+        failed += run_case(good_lamps, &test);
+        failed += run_case(lamp_removed, &test);
+        test.brake_counts = 0;
+        failed += run_case(lamp_removed, &test);
+    }
+
+    //a filtered sense line reads the average current
+    test.adc_io_cycles = arr_adc_io_cycles[0];
+    test.feedback_mode = SIM_FEEDBACK_AVERAGE;
+    test.lamp_counts = WEAK_LAMP_COUNTS;
+    test.brake_counts = WEAK_LAMP_COUNTS;
+    failed += run_case(good_lamps, &test);
+
+    CHECK_EQ(failed, 0);
+    return check_done("test_lamp_out");
+}
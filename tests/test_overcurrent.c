@@ -0,0 +1,145 @@
+/*
+ * test_overcurrent.c
+ * Overcurrent trip latency, from a short on an output to its pin being disconnected. The
+ * output that switched on last is the ADC priority channel, converted after every other
+ * conversion, so its trip has to land within three conversions plus the interrupt time
+ * that starts them (main.h OVERCURRENT_TRIP_WORST_US). The short goes on at random points
+ * of the scan.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+
+#define LAMP_COUNTS         400
+#define TRIALS              20
+
+//main.h OVERCURRENT_TRIP_WORST_US: 3 conversions of 13 ADC clocks at F_CPU / 64, two of
+//them started from the ADC interrupt and the trip written by the last one. The simulator
+//lands all register writes of an interrupt io_cycles after its vector
+#define CONVERSION_CYCLES   (13UL * 64)
+#define TRIP_WORST_CYCLES(io_cycles)    (3 * CONVERSION_CYCLES + 3 * (io_cycles))
+#define TRIP_MAX_US         200     /// main.h OVERCURRENT_TRIP_MAX_US
+#define ADC_ISR_CYCLES      300     /// the simulator defaults
+#define ADC_ISR_IO_CYCLES   80
+#define TRIP_POLL_CYCLES    4
+#define TRIP_TIMEOUT_US     5000
+
+typedef struct
+{
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint32_t count;
+} sLatency;
+
+/** shorts an output at a random point and waits for the trip, then takes the short away and
+ *  lets the retry bring the output back
+ *  @RETURN cycles from the short to the pin going off, 0 if it never tripped
+ */
+static uint64_t trip_once(uint8_t output)
+{
+    uint64_t start;
+    uint64_t latency = 0;
+    
+    sim_run_cycles(rand() % (4 * CONVERSION_CYCLES));
+    
+    sim_set_short(output, 1);
+    start = sim_now_cycles();
+    while ((sim_now_cycles() - start) < (TRIP_TIMEOUT_US * SIM_CYCLES_PER_US))
+    {
+        sim_run_cycles(TRIP_POLL_CYCLES);
+        if (sim_pwm_compare(output) < 0)
+        {
+            latency = sim_now_cycles() - start;
+            break;
+        }
+    }
+    sim_set_short(output, 0);
+    
+    //retry after 100ms << backoff, at most 6.4s, and the soft start after it
+    for (uint32_t ms = 0; (ms < 7000) && (sim_pwm_compare(output) < 0); ms++)
+    {
+        sim_run_us(1000);
+    }
+    sim_run_us(50000);
+    
+    return latency;
+}
+
+static void measure(const char* what, uint8_t output, sLatency* lat)
+{
+    lat->min = UINT64_MAX;
+    lat->max = 0;
+    lat->sum = 0;
+    lat->count = 0;
+    
+    for (int i = 0; i < TRIALS; i++)
+    {
+        uint64_t cycles = trip_once(output);
+        
+        CHECK(cycles != 0, "%s: trial %d never tripped", what, i);
+        if (cycles)
+        {
+            lat->min = (cycles < lat->min) ? cycles : lat->min;
+            lat->max = (cycles > lat->max) ? cycles : lat->max;
+            lat->sum += cycles;
+            lat->count++;
+        }
+    }
+    
+    if (lat->count)
+    {
+        printf("%-32s trip latency min %5.1f avg %5.1f max %5.1f us (%u trials)\n", what,
+               (double)lat->min / SIM_CYCLES_PER_US, (double)lat->sum / lat->count / SIM_CYCLES_PER_US,
+               (double)lat->max / SIM_CYCLES_PER_US, lat->count);
+    }
+}
+
+static void check_latency(const char* what, const sLatency* lat, uint64_t worst_cycles)
+{
+    CHECK(lat->max <= worst_cycles, "%s: trip took %.1f us, worst case is %.1f us", what,
+          (double)lat->max / SIM_CYCLES_PER_US, (double)worst_cycles / SIM_CYCLES_PER_US);
+}
+
+int main(void)
+{
+    sLatency lat;
+    
+    srand(7);
+    sim_set_lamp(SIM_OUT_LEFT, LAMP_COUNTS);
+    sim_set_lamp(SIM_OUT_BRAKE, LAMP_COUNTS);
+    sim_set_lamp(SIM_OUT_RIGHT, LAMP_COUNTS);
+    sim_boot();
+    
+    //separate lights, the brake running light is the priority channel
+    sim_run_us(100000);
+    CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_SEPARATE);
+    
+    measure("brake, priority", SIM_OUT_BRAKE, &lat);
+    check_latency("brake", &lat, TRIP_WORST_CYCLES(ADC_ISR_IO_CYCLES));
+    CHECK(lat.max <= TRIP_MAX_US * SIM_CYCLES_PER_US, "brake trip over OVERCURRENT_TRIP_MAX_US");
+    CHECK(gb_OVERCURRENT_TRIPPED == false, "still tripped after the retries");
+    
+    //a slower ADC interrupt starts the next conversion later, the bound moves with it
+    sim_set_isr_cycles(SIM_VEC_ADC, 2 * ADC_ISR_CYCLES, 300);
+    measure("brake, priority, slow ADC ISR", SIM_OUT_BRAKE, &lat);
+    check_latency("brake, slow ADC ISR", &lat, TRIP_WORST_CYCLES(300));
+    sim_set_isr_cycles(SIM_VEC_ADC, ADC_ISR_CYCLES, ADC_ISR_IO_CYCLES);
+    
+    //the left signal switching on last takes the priority over
+    sim_set_input(SIM_IN_RIGHT, 1);
+    sim_run_us(20000);
+    sim_set_input(SIM_IN_LEFT, 1);
+    sim_run_us(20000);
+    measure("left, priority", SIM_OUT_LEFT, &lat);
+    check_latency("left", &lat, TRIP_WORST_CYCLES(ADC_ISR_IO_CYCLES));
+    
+    //the others wait for their turn in the round robin, only reported
+    measure("right, round robin", SIM_OUT_RIGHT, &lat);
+    
+    return check_done("test_overcurrent");
+}
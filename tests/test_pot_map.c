@@ -0,0 +1,100 @@
+/*
+ * test_pot_map.c
+ * The pot readings -> flash step and brake pattern, for every 10 bit adc value, against the
+ * float formulas the firmware used to evaluate at run time. The flash step comes from the
+ * interpolated knot table and has to match exactly, the pattern from a multiply and shift.
+ *
+ */
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+
+#define ADC_VALUES          1024
+#define NUM_PATTERNS        6
+#define OVERFLOW_MS         4.096
+
+uint8_t flash_step_ms_from_adc(uint16_t value);
+void adc_flash_freq_sample(uint8_t idx, uint16_t value);
+void adc_flash_pattern_sample(uint8_t idx, uint16_t value);
+
+/** the original run time formula, 30.0 / ((adc / 146.2) + 1) timer0 overflows of 4.096ms */
+static double float_prescaler(uint16_t adc)
+{
+    return 30.0 / ((adc / 146.2) + 1);
+}
+
+static uint8_t float_step_ms(uint16_t adc)
+{
+    uint8_t prescaler = (uint8_t)float_prescaler(adc);
+    
+    return (uint8_t)((prescaler + 1) * OVERFLOW_MS);
+}
+
+static void check_flash_step(void)
+{
+    int mismatches = 0;
+    uint8_t prev = 0xFF;
+    
+    for (uint16_t adc = 0; adc < ADC_VALUES; adc++)
+    {
+        uint8_t expected = float_step_ms(adc);
+        uint8_t step = flash_step_ms_from_adc(adc);
+        
+        if (step != expected)
+        {
+            mismatches++;
+            CHECK(0, "adc %u: %u ms, the formula gives %u ms (prescaler %.4f)", adc, step, expected, float_prescaler(adc));
+        }
+        
+        //turning the pot up never slows the flashing down
+        CHECK(step <= prev, "adc %u: %u ms after %u ms", adc, step, prev);
+        prev = step;
+        
+        //and the scan engine callback stores what the mapping says
+        adc_flash_freq_sample(0, adc);
+        CHECK_EQ(gu8_FLASH_STEP_MS, step);
+    }
+    
+    CHECK(mismatches == 0, "%d adc values off the float formula", mismatches);
+    
+    CHECK_EQ(flash_step_ms_from_adc(0), 126);
+    CHECK_EQ(flash_step_ms_from_adc(ADC_VALUES - 1), 16);
+}
+
+static void check_brake_pattern(void)
+{
+    int per_pattern[NUM_PATTERNS] = { 0 };
+    
+    for (uint16_t adc = 0; adc < ADC_VALUES; adc++)
+    {
+        uint8_t expected = (uint8_t)(adc * (double)NUM_PATTERNS / ADC_VALUES);
+        
+        adc_flash_pattern_sample(1, adc);
+        CHECK(gu8_BRAKE_PATTERN == expected, "adc %u: pattern %u, expected %u", adc, gu8_BRAKE_PATTERN, expected);
+        if (gu8_BRAKE_PATTERN < NUM_PATTERNS)
+        {
+            per_pattern[gu8_BRAKE_PATTERN]++;
+        }
+    }
+    
+    //the pot range is split in equal parts
+    for (int i = 0; i < NUM_PATTERNS; i++)
+    {
+        CHECK(per_pattern[i] >= ADC_VALUES / NUM_PATTERNS && per_pattern[i] <= ADC_VALUES / NUM_PATTERNS + 1,
+              "pattern %d has %d adc values", i, per_pattern[i]);
+    }
+}
+
+int main(void)
+{
+    sim_boot();
+    
+    //the config default is FLASH_STEP_MS(512), the pot in the middle has to agree with it
+    CHECK_EQ(gs_CONFIG.flash_step_ms, flash_step_ms_from_adc(512));
+    
+    check_flash_step();
+    check_brake_pattern();
+    
+    return check_done("test_pot_map");
+}
@@ -0,0 +1,66 @@
+/*
+ * test_pwm_scale.c
+ * setPWMVal on timer1 against (val * (TOP + 1)) >> 8 in 32 bit, for every 0-255 value at
+ * the TOPs setPWMCarrier picks over the carrier frequencies and modes. Registers only, no
+ * simulator.
+ *
+ */
+
+#include "avr_timers.h"
+#include "check.h"
+
+static const ePWM_MODE arr_modes[] =
+{
+    epwm_mode_fast_8bit_default,
+    epwm_mode_phase_correct_8bit,
+    epwm_mode_fast_icr1,
+    epwm_mode_phase_correct_icr1,
+};
+
+//976Hz is the default carrier, 15625Hz gives TOP 1023 (TOP + 1 a power of two)
+static const uint16_t arr_freq_hz[] = { 31, 100, 250, 976, 1000, 2000, 3000, 7800, 15625 };
+
+static void check_carrier(ePWM_MODE mode, uint16_t freq_hz)
+{
+    uint16_t top;
+    uint16_t expected;
+    uint16_t prev = 0;
+    
+    if (setPWMCarrier(etimer_1, mode, freq_hz) == 0)
+    {
+        return;
+    }
+    top = getPWMTop(epwm_1a);
+    
+    for (uint16_t val = 0; val <= 0xFF; val++)
+    {
+        expected = (val == 0xFF) ? top : (uint16_t)(((uint32_t)val * (top + 1UL)) >> 8);
+        
+        //constant output: the inline version, run time output: _setPWMVal
+        setPWMVal(epwm_1a, (uint8_t)val);
+        setPWMVal((ePWM_OUTPUT)(val & 1), (uint8_t)val);
+        CHECK(OCR1A == expected, "mode %d, %u Hz (TOP %u): val %u gives %u, expected %u",
+              mode, freq_hz, top, val, OCR1A, expected);
+        CHECK_EQ((val & 1) ? OCR1B : OCR1A, expected);
+        CHECK(OCR1A >= prev, "mode %d, %u Hz: val %u gives %u, below %u", mode, freq_hz, val, OCR1A, prev);
+        prev = OCR1A;
+    }
+}
+
+int main(void)
+{
+    for (size_t mode = 0; mode < sizeof(arr_modes) / sizeof(arr_modes[0]); mode++)
+    {
+        for (size_t freq = 0; freq < sizeof(arr_freq_hz) / sizeof(arr_freq_hz[0]); freq++)
+        {
+            check_carrier(arr_modes[mode], arr_freq_hz[freq]);
+        }
+    }
+    
+    //timer1 back to its default keeps the 8 bit scale
+    timer1_default();
+    setPWMVal(epwm_1a, 100);
+    CHECK_EQ(OCR1A, 100);
+    
+    return check_done("test_pwm_scale");
+}
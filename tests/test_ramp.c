@@ -0,0 +1,174 @@
+/*
+ * test_ramp.c
+ * Output ramps (LIGHT_RAMP_PERIODS_LOG2): an increase goes up in steps of the 1ms light
+ * service with the first step written straight away, a decrease is written at once.
+ * Checked on the compare values the pwm timers run with.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+
+#define SAMPLE_US       100
+#define MAX_SAMPLES     200
+
+#define LAMP_COUNTS     400     /// ~0.44A at full duty
+
+//INT1 -> brake output: the ISR writes OCR2 io_cycles after its vector and moves timer2 to TOP,
+//the new value is loaded on the next timer clock (F_CPU / 64). Without that it waits for
+//BOTTOM, up to a whole carrier period of 16384 cycles
+#define INT1_IO_CYCLES          40      /// simulator default
+#define TIMER2_CLOCK_CYCLES     64
+#define BRAKE_PRESSES           20
+
+/** pwm values an output steps through from from_val to 255, LIGHT_RAMP_PERIODS_LOG2 = 2 */
+static uint8_t ramp_steps(uint8_t from_val, uint8_t* steps)
+{
+    uint8_t step = ((255 - from_val) >> 2) + 1;
+    uint8_t val = from_val;
+    uint8_t num = 0;
+    
+    while (val < 255)
+    {
+        val = ((255 - val) <= step) ? 255 : (val + step);
+        steps[num++] = val;
+    }
+    
+    return num;
+}
+
+/** samples an output every SAMPLE_US until it shows val_end or max_us is over
+ *  @RETURN number of samples taken, the distinct values seen go to seen
+ */
+static uint8_t watch_output(uint8_t output, uint8_t val_end, uint32_t max_us, uint8_t* seen, uint8_t* num_seen)
+{
+    uint8_t num = 0;
+    uint8_t val;
+    
+    *num_seen = 0;
+    
+    while (num < (max_us / SAMPLE_US))
+    {
+        sim_run_us(SAMPLE_US);
+        num++;
+        
+        val = sim_pwm_val(output);
+        if ((*num_seen == 0) || (seen[*num_seen - 1] != val))
+        {
+            seen[(*num_seen)++] = val;
+        }
+        
+        if (val == val_end)
+        {
+            break;
+        }
+    }
+    
+    return num;
+}
+
+/** the values seen must be ramp steps, in order. The timers only take a new compare value
+ *  at BOTTOM (once per ~1.02ms carrier period) and the ramp steps every 1ms, so now and
+ *  then a step is replaced before the timer took it, never more than one per ramp
+ */
+static void check_ramp(const char* what, uint8_t from_val, const uint8_t* seen, uint8_t num_seen)
+{
+    uint8_t steps[16];
+    uint8_t num_steps = ramp_steps(from_val, steps);
+    uint8_t ii;
+    uint8_t jj = 0;
+    
+    CHECK(num_seen + 1 >= num_steps, "%s: %u values seen, ramp has %u steps", what, num_seen, num_steps);
+    
+    for (ii = 0; ii < num_seen; ii++)
+    {
+        while ((jj < num_steps) && (steps[jj] != seen[ii]))
+        {
+            jj++;
+        }
+        
+        CHECK(jj < num_steps, "%s: %u is not a ramp step after the previous value", what, seen[ii]);
+    }
+    
+    CHECK((num_seen > 0) && (seen[num_seen - 1] == 255), "%s: didn't reach full", what);
+}
+
+int main(void)
+{
+    uint8_t seen[MAX_SAMPLES];
+    uint8_t num_seen;
+    uint8_t num;
+    uint64_t worst = 0;
+    uint8_t low = getPWMBrightnessVal(BRIGHTNESS_LOW_DEFAULT_VAL);
+    
+    //separate lights, all three lamps connected
+    sim_set_lamp(SIM_OUT_LEFT, LAMP_COUNTS);
+    sim_set_lamp(SIM_OUT_BRAKE, LAMP_COUNTS);
+    sim_set_lamp(SIM_OUT_RIGHT, LAMP_COUNTS);
+    sim_boot();
+    sim_run_us(100000);
+    
+    CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_SEPARATE);
+    CHECK_EQ(sim_pwm_val(SIM_OUT_BRAKE), low);
+    CHECK_EQ(sim_pwm_compare(SIM_OUT_LEFT), -1);
+    
+    //brake: running light -> full, INT1 takes the first step and OCR2 loads it on the next
+    //timer clock, so even the first sample is a ramp step. The pattern only starts a beat
+    //(>= 4ms) later
+    sim_set_input(SIM_IN_BRAKE, 1);
+    num = watch_output(SIM_OUT_BRAKE, 255, 10000, seen, &num_seen);
+    CHECK(num * SAMPLE_US <= 5000, "brake took %uus to reach full", num * SAMPLE_US);
+    check_ramp("brake", low, seen, num_seen);
+    
+    //decrease, straight to the running light, no steps in between
+    sim_set_input(SIM_IN_BRAKE, 0);
+    num = watch_output(SIM_OUT_BRAKE, low, 5000, seen, &num_seen);
+    CHECK(num * SAMPLE_US <= 1100, "brake took %uus to go back to the running light", num * SAMPLE_US);
+    CHECK(num_seen <= 2, "brake went through %u values on its way down", num_seen);
+    
+    //turn signal from off, the output is enabled and ramps up from 0
+    sim_set_input(SIM_IN_LEFT, 1);
+    num = watch_output(SIM_OUT_LEFT, 255, 10000, seen, &num_seen);
+    CHECK(num * SAMPLE_US <= 5500, "left took %uus to reach full", num * SAMPLE_US);
+    check_ramp("left", 0, &seen[1], num_seen - 1);
+    
+    //off is the output disconnected from the pin, at once
+    sim_set_input(SIM_IN_LEFT, 0);
+    sim_run_us(SAMPLE_US);
+    CHECK_EQ(sim_pwm_compare(SIM_OUT_LEFT), -1);
+    
+    //the right input is polled and debounced (4 ticks), then it ramps the same way
+    sim_set_input(SIM_IN_RIGHT, 1);
+    num = watch_output(SIM_OUT_RIGHT, 255, 15000, seen, &num_seen);
+    CHECK(num * SAMPLE_US <= 10000, "right took %uus to reach full", num * SAMPLE_US);
+    check_ramp("right", 0, &seen[1], num_seen - 1);
+    
+    sim_set_input(SIM_IN_RIGHT, 0);
+    sim_run_us(10000);
+    CHECK_EQ(sim_pwm_compare(SIM_OUT_RIGHT), -1);
+    
+    //brake presses at random points of the carrier period, each must reach the pin within a
+    //timer clock of the OCR2 write
+    srand(3);
+    for (num = 0; num < BRAKE_PRESSES; num++)
+    {
+        sim_run_cycles(rand() % (2 * 16384));
+        sim_set_input(SIM_IN_BRAKE, 1);
+        sim_run_us(2000);
+        
+        worst = (sim_int1_to_ocr2_cycles() > worst) ? sim_int1_to_ocr2_cycles() : worst;
+        CHECK(sim_int1_to_ocr2_cycles() != 0, "press %u didn't write OCR2 from INT1", num);
+        
+        sim_set_input(SIM_IN_BRAKE, 0);
+        sim_run_us(50000);
+    }
+    printf("INT1 -> OCR2 on the pin: worst %llu cycles over %u presses\n", (unsigned long long)worst, BRAKE_PRESSES);
+    CHECK(worst <= INT1_IO_CYCLES + TIMER2_CLOCK_CYCLES, "INT1 -> OCR2 took %llu cycles", (unsigned long long)worst);
+    
+    CHECK_EQ(sim_wdt_expired(), 0);
+    
+    return check_done("test_ramp");
+}
@@ -0,0 +1,125 @@
+/*
+ * test_shell.c
+ * Debug shell commands over the simulated UART, the replies are parsed from what the
+ * firmware sent (the echo of the command line comes first).
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+
+#define REPLY_MAX       512
+#define STAT_FIELDS     (4 + SW_TIMER_MAX_TIMERS)   /// after the uptime
+
+/** sends a command line and collects what comes back within wait_ms
+ *  @RETURN the reply, a pointer into a static buffer
+ */
+static const char* shell(const char* cmd, int wait_ms)
+{
+    static char reply[REPLY_MAX];
+    size_t len = 0;
+    
+    sim_uart_tx(reply, sizeof(reply));
+    
+    //typed, not back to back: at 1Mbaud a frame is shorter than the timer0 or adc ISR and
+    //the simulated UDR holds one byte
+    for (const char* c = cmd; *c; c++)
+    {
+        sim_uart_rx(c, 1);
+        sim_run_us(100);
+    }
+    sim_uart_rx_str("\r");
+    
+    for (int ms = 0; ms < wait_ms; ms++)
+    {
+        sim_run_us(1000);
+        len += sim_uart_tx(&reply[len], sizeof(reply) - 1 - len);
+    }
+    reply[len] = 0;
+    
+    return reply;
+}
+
+/** parses the "stat" reply into its decimal fields
+ *  @RETURN number of fields found after the uptime
+ */
+static int stat_fields(long* fields, int max)
+{
+    const char* reply = strstr(shell("stat", 100), "stat ");
+    char* end;
+    int num = 0;
+    
+    CHECK(reply != NULL, "no stat reply");
+    if (reply == NULL)
+    {
+        return 0;
+    }
+    
+    //uptime is 8 hex digits
+    reply += strlen("stat ") + 8;
+    while (num < max)
+    {
+        long value = strtol(reply, &end, 10);
+        
+        if (end == reply)
+        {
+            break;
+        }
+        fields[num++] = value;
+        reply = end;
+    }
+    
+    return num;
+}
+
+int main(void)
+{
+    long fields[STAT_FIELDS + 1];
+    sConfig loaded;
+    
+    sim_set_lamp(SIM_OUT_LEFT, 400);
+    sim_set_lamp(SIM_OUT_BRAKE, 400);
+    sim_set_lamp(SIM_OUT_RIGHT, 400);
+    sim_boot();
+    sim_run_us(100000);
+    
+    //stat: mode, brake, pattern, flash step, then the missed deadlines of every sw timer
+    CHECK_EQ(stat_fields(fields, STAT_FIELDS + 1), STAT_FIELDS);
+    CHECK_EQ(fields[0], eLIGHT_MODE_SEPARATE);
+    CHECK_EQ(fields[3], gu8_FLASH_STEP_MS);
+    CHECK_EQ(fields[4 + SW_TIMER_LIGHT_SERVICE], 0);
+    
+    //save writes the whole config (the EEPROM is blank) a byte per main loop pass, the
+    //answer comes once the last byte is in and the 1ms light service never waits for it
+    CHECK(strstr(shell("save", 50), "saved") == NULL, "saved before the EEPROM could be written");
+    CHECK(strstr(shell("save", 10), "busy") != NULL, "second save not refused");
+    CHECK(strstr(shell("", 1000), "saved") != NULL, "save didn't answer");
+    CHECK(config_load(&loaded, &gs_CONFIG_DEFAULTS), "no valid config in the EEPROM");
+    CHECK(memcmp(&loaded, &gs_CONFIG, sizeof(loaded)) == 0, "EEPROM config differs from the RAM copy");
+    CHECK_EQ(stat_fields(fields, STAT_FIELDS + 1), STAT_FIELDS);
+    CHECK_EQ(fields[4 + SW_TIMER_LIGHT_SERVICE], 0);
+    CHECK_EQ(sw_timer_missed(SW_TIMER_LIGHT_SERVICE), 0);
+    
+    //set: current_limit (field 0) takes CURRENT_LIMIT_MIN to CURRENT_LIMIT_MAX only, a limit
+    //under a lamp's current trips every lamp, one over the adc range never trips
+    CHECK_EQ(gs_CONFIG.current_limit, CURRENT_LIMIT_DEFAULT);
+    CHECK(strstr(shell("set 0 10", 100), "bad argument") != NULL, "set 0 10 accepted");
+    CHECK(strstr(shell("set 0 45", 100), "bad argument") != NULL, "set 0 45 accepted");
+    CHECK(strstr(shell("set 0 1024", 100), "bad argument") != NULL, "set 0 1024 accepted");
+    CHECK(strstr(shell("set 0 2000", 100), "bad argument") != NULL, "set 0 2000 accepted");
+    CHECK_EQ(gs_CONFIG.current_limit, CURRENT_LIMIT_DEFAULT);
+    CHECK(strstr(shell("set 0 46", 100), "ok") != NULL, "set 0 46 refused");
+    CHECK_EQ(gs_CONFIG.current_limit, CURRENT_LIMIT_MIN);
+    CHECK(strstr(shell("set 0 1023", 100), "ok") != NULL, "set 0 1023 refused");
+    CHECK_EQ(gs_CONFIG.current_limit, CURRENT_LIMIT_MAX);
+    CHECK(strstr(shell("set 0 500", 100), "ok") != NULL, "set 0 500 refused");
+    CHECK_EQ(gs_CONFIG.current_limit, 500);
+    
+    CHECK_EQ(sim_uart_rx_overruns(), 0);
+    
+    return check_done("test_shell");
+}
@@ -0,0 +1,208 @@
+/*
+ * test_telemetry.c
+ * Telemetry frames on the UART next to the shell and its Rx echo. Every frame that was
+ * counted as sent has to come out whole with a good CRC, and a frame that doesn't fit the
+ * Tx queue must not leave a piece of itself in there.
+ *
+ */
+
+#include <string.h>
+#include <util/crc16.h>
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+#include "avr_uart.h"
+#include "telemetry.h"
+
+#define SW_TIMER_TELEMETRY      4       /// main.h
+#define TELEMETRY_TEST_MS       2
+#define STREAM_MAX              32768
+#define FRAME_LEN               sizeof(sTelemetryFrame)
+
+void task_telemetry(void);
+
+static uint8_t stream[STREAM_MAX];
+
+/** COBS decodes one chunk between two delimiters
+ *  @RETURN decoded length, 0 if the chunk is not valid COBS
+ */
+static size_t cobs_decode(const uint8_t* src, size_t len, uint8_t* dst)
+{
+    size_t in = 0;
+    size_t out = 0;
+    
+    while (in < len)
+    {
+        uint8_t code = src[in++];
+        
+        if ((code == 0) || ((in + code - 1) > len))
+        {
+            return 0;
+        }
+        for (uint8_t ii = 1; ii < code; ii++)
+        {
+            dst[out++] = src[in++];
+        }
+        if ((code != 0xFF) && (in < len))
+        {
+            dst[out++] = 0;
+        }
+    }
+    
+    return out;
+}
+
+/** splits the stream at the delimiters and checks the frames in it. Chunks that are not
+ *  frame sized are the shell text between frames
+ *  @RETURN number of good frames
+ */
+static int check_frames(const uint8_t* data, size_t len)
+{
+    uint8_t raw[64];
+    size_t start = 0;
+    int good = 0;
+    int bad = 0;
+    int expected_seq = -1;
+    
+    for (size_t ii = 0; ii <= len; ii++)
+    {
+        if ((ii < len) && (data[ii] != 0))
+        {
+            continue;
+        }
+        
+        //a frame is the COBS code byte, payload and CRC
+        if ((ii - start) == (FRAME_LEN + 3))
+        {
+            size_t raw_len = cobs_decode(&data[start], ii - start, raw);
+            uint16_t crc = 0xFFFF;
+            
+            for (size_t jj = 0; jj < FRAME_LEN; jj++)
+            {
+                crc = _crc16_update(crc, raw[jj]);
+            }
+            
+            if ((raw_len == FRAME_LEN + 2) && (raw[FRAME_LEN] == (uint8_t)crc) && (raw[FRAME_LEN + 1] == (uint8_t)(crc >> 8)))
+            {
+                sTelemetryFrame frame;
+                
+                memcpy(&frame, raw, FRAME_LEN);
+                CHECK_EQ(frame.version, TELEMETRY_FRAME_VERSION);
+                //the sequence only counts frames that were queued, each of them must be here
+                CHECK(expected_seq < 0 || frame.sequence == (uint8_t)expected_seq,
+                      "frame %u after %d, a queued frame got lost", frame.sequence, expected_seq - 1);
+                expected_seq = (uint8_t)(frame.sequence + 1);
+                good++;
+            }
+            else
+            {
+                bad++;
+            }
+        }
+        else if ((ii - start) > 1)
+        {
+            //the echo and shell replies never contain 0, anything that is not frame sized
+            //and holds binary data is a broken frame
+            for (size_t jj = start; jj < ii; jj++)
+            {
+                if ((data[jj] < ' ') && (data[jj] != '\r') && (data[jj] != '\n'))
+                {
+                    bad++;
+                    break;
+                }
+            }
+        }
+        
+        start = ii + 1;
+    }
+    
+    CHECK(bad == 0, "%d broken frames", bad);
+    return good;
+}
+
+/** queues a block with the in place frame functions
+ *  @RETURN false if it didn't fit
+ */
+static bool fill_frame(const char* data, uint8_t len)
+{
+    if (!UART_TxFrameStart(len))
+    {
+        return false;
+    }
+    
+    while (len > 0)
+    {
+        UART_TxFramePut(*data++);
+        len--;
+    }
+    UART_TxFrameEnd();
+    
+    return true;
+}
+
+int main(void)
+{
+    char fill[64];
+    sTelemetryFrame frame;
+    size_t len = 0;
+    int good;
+    
+    //lamps on every output, a lamp out would put its log message between the frames
+    sim_set_lamp(SIM_OUT_LEFT, 400);
+    sim_set_lamp(SIM_OUT_BRAKE, 400);
+    sim_set_lamp(SIM_OUT_RIGHT, 400);
+    sim_boot();
+    sim_run_us(100000);
+    sim_uart_tx((char*)stream, sizeof(stream));
+    
+    //telemetry is off by default, run it fast while the shell is busy echoing
+    sw_timer_start(SW_TIMER_TELEMETRY, TELEMETRY_TEST_MS, TELEMETRY_TEST_MS, task_telemetry);
+    for (int ms = 0; ms < 300; ms++)
+    {
+        if ((ms % 3) == 0)
+        {
+            sim_uart_rx_str("cur\r");
+        }
+        sim_run_us(1000);
+        len += sim_uart_tx((char*)&stream[len], sizeof(stream) - len);
+    }
+    sw_timer_stop(SW_TIMER_TELEMETRY);
+    sim_run_us(5000);
+    len += sim_uart_tx((char*)&stream[len], sizeof(stream) - len);
+    
+    good = check_frames(stream, len);
+    printf("%d good frames in %zu bytes\n", good, len);
+    CHECK(good >= 50, "only %d frames made it", good);
+    
+    //all or nothing: with the Tx queue almost full a frame is refused and leaves no bytes
+    //behind. The firmware doesn't run in between, nothing drains the queue
+    memset(fill, '.', sizeof(fill));
+    memset(&frame, 0, sizeof(frame));
+    CHECK(fill_frame(fill, 50), "50 bytes didn't fit an empty queue");
+    CHECK_EQ(UART_TxFree(), 13);
+    CHECK(!fill_frame(fill, 20), "a block bigger than the free room was queued");
+    CHECK(!telemetry_send(&frame, sizeof(frame)), "a frame bigger than the free room was queued");
+    CHECK_EQ(UART_TxFree(), 13);
+    
+    sim_run_us(1000);
+    CHECK(telemetry_send(&frame, sizeof(frame)), "frame refused with the queue drained");
+    sim_run_us(1000);
+    
+    //a byte queued (the Rx echo) while a frame is written in place goes out after it
+    sim_uart_tx((char*)stream, sizeof(stream));
+    CHECK(UART_TxFrameStart(3), "3 byte frame refused");
+    CHECK(!UART_TxFrameStart(1), "second frame started while one is open");
+    CHECK(UART_TxEnqueue('x'), "echo byte refused");
+    UART_TxFramePut('a');
+    sim_run_us(100);
+    UART_TxFramePut('b');
+    UART_TxFramePut('c');
+    CHECK_EQ(sim_uart_tx((char*)stream, sizeof(stream)), 0);
+    UART_TxFrameEnd();
+    sim_run_us(100);
+    len = sim_uart_tx((char*)stream, sizeof(stream));
+    CHECK(len == 4 && memcmp(stream, "abcx", 4) == 0, "sent \"%.*s\", expected \"abcx\"", (int)len, stream);
+    
+    return check_done("test_telemetry");
+}
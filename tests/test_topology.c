@@ -0,0 +1,176 @@
+/*
+ * test_topology.c
+ * Boot into the conservative light mode and the lamp topology detection behind it. Each
+ * case boots the firmware in a child process of its own (sim_boot is once per process):
+ * how long after power up the first output lights, when the mode is decided and which
+ * mode a brake lamp of a given current ends up in. Then the brake lamp is changed without
+ * a reset, like a trailer swapped at a depot, and the time to the mode switch is taken.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "fw.h"
+#include "sim.h"
+#include "check.h"
+
+#define LAMP_COUNTS         400
+#define STEP_CYCLES         16
+#define STEP_US             10
+//init code takes no time in the simulator, only its busy waits count (the old brake lamp
+//test waited 3010ms in _delay_ms before any output came on)
+#define FIRST_LIGHT_MAX_US  1000
+//TOPO_CONFIRM_WINDOWS windows of 32 brake conversions, the brake channel gets one in 2-4
+#define DECIDED_MIN_US      15000
+#define DECIDED_MAX_US      30000
+#define NEVER_US            1000000
+#define SWAP_AT_US          1000000     /// brake lamp changed this long after boot
+#define SWAP_STEP_US        100
+#define SWAP_NEVER_US       5000000
+#define NO_SWAP             0xFFFF
+
+typedef struct
+{
+    uint16_t brake_counts;      /// brake lamp at boot, 0 - none
+    eLIGHT_MODE expected;       /// mode detected, eLIGHT_MODE_AUTO if it stays undecided
+    uint16_t swap_counts;       /// brake lamp after SWAP_AT_US, NO_SWAP - not changed
+    eLIGHT_MODE swap_expected;  /// mode after the swap
+    uint32_t swap_min_ms;       /// window the switch has to happen in, if the mode changes
+    uint32_t swap_max_ms;
+} sCase;
+
+/** @RETURN 1 if any output pin is high */
+static int any_light(void)
+{
+    return sim_pin(SIM_OUT_LEFT) || sim_pin(SIM_OUT_BRAKE) || sim_pin(SIM_OUT_RIGHT);
+}
+
+/** boots with a brake lamp of brake_counts and checks the mode it settles in */
+static void boot_case(const sCase* test)
+{
+    uint32_t first_light = 0;
+    uint32_t decided = 0;
+
+    sim_set_lamp(SIM_OUT_LEFT, LAMP_COUNTS);
+    sim_set_lamp(SIM_OUT_RIGHT, LAMP_COUNTS);
+    sim_set_lamp(SIM_OUT_BRAKE, test->brake_counts);
+    sim_boot();
+
+    while (!any_light() && (sim_now_us() < FIRST_LIGHT_MAX_US))
+    {
+        sim_run_cycles(STEP_CYCLES);
+    }
+    first_light = (uint32_t)sim_now_cycles();
+    CHECK(any_light(), "brake %u: no light %u cycles after boot", test->brake_counts, first_light);
+    CHECK_EQ(ge_LIGHT_MODE, eLIGHT_MODE_AUTO);
+    CHECK_EQ(sim_led_color(), eLED_YELLOW);
+
+    while ((ge_LIGHT_MODE == eLIGHT_MODE_AUTO) && (sim_now_us() < NEVER_US))
+    {
+        sim_run_us(STEP_US);
+    }
+    decided = sim_now_us();
+
+    printf("brake lamp %3u counts: first light %u cycles, mode %d after %u us\n",
+           test->brake_counts, first_light, ge_LIGHT_MODE, decided);
+    CHECK_EQ(ge_LIGHT_MODE, test->expected);
+    if (test->expected != eLIGHT_MODE_AUTO)
+    {
+        CHECK((decided >= DECIDED_MIN_US) && (decided <= DECIDED_MAX_US),
+              "brake %u: mode decided after %u us", test->brake_counts, decided);
+    }
+}
+
+/** changes the brake lamp SWAP_AT_US after boot and times the switch to the new mode */
+static void swap_case(const sCase* test)
+{
+    eLIGHT_MODE before;
+    uint32_t swapped_at;
+    uint32_t switched_ms;
+
+    sim_run_us(SWAP_AT_US - sim_now_us());
+    before = ge_LIGHT_MODE;
+    sim_set_lamp(SIM_OUT_BRAKE, test->swap_counts);
+    swapped_at = sim_now_us();
+
+    while ((ge_LIGHT_MODE == before) && ((sim_now_us() - swapped_at) < SWAP_NEVER_US))
+    {
+        sim_run_us(SWAP_STEP_US);
+    }
+    switched_ms = (sim_now_us() - swapped_at) / 1000;
+
+    printf("brake lamp %3u -> %3u counts: mode %d -> %d after %u ms\n",
+           test->brake_counts, test->swap_counts, before, ge_LIGHT_MODE, switched_ms);
+    CHECK_EQ(ge_LIGHT_MODE, test->swap_expected);
+    if (test->swap_expected != before)
+    {
+        CHECK((switched_ms >= test->swap_min_ms) && (switched_ms <= test->swap_max_ms),
+              "brake %u -> %u: switched after %u ms", test->brake_counts, test->swap_counts, switched_ms);
+    }
+}
+
+/** runs one case in a child process
+ *  @RETURN 1 if it failed
+ */
+static int run_case(const sCase* test)
+{
+    int status = 0;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        boot_case(test);
+        if (test->swap_counts != NO_SWAP)
+        {
+            swap_case(test);
+        }
+        CHECK_EQ(sim_wdt_expired(), 0);
+
+        fflush(stdout);
+        _exit(check_failures != 0);
+    }
+
+    waitpid(pid, &status, 0);
+    return !WIFEXITED(status) || (WEXITSTATUS(status) != 0);
+}
+
+static const sCase arr_cases[] =
+{
+    //brake lamp  , detected              , swapped to  , then                  , ms
+    //a brake lamp
+    { LAMP_COUNTS , eLIGHT_MODE_SEPARATE  , NO_SWAP     , eLIGHT_MODE_AUTO      , 0   , 0    },
+    //no brake lamp, or one drawing well under TOPO_NO_LAMP_CURRENT at full duty
+    { 0           , eLIGHT_MODE_INTEGRATED, NO_SWAP     , eLIGHT_MODE_AUTO      , 0   , 0    },
+    { 10          , eLIGHT_MODE_INTEGRATED, NO_SWAP     , eLIGHT_MODE_AUTO      , 0   , 0    },
+    //in the middle of the hysteresis band (TOPO_NO_LAMP_CURRENT up to TOPO_LAMP_CURRENT)
+    //there is no verdict, the conservative mode works with either topology so it stays.
+    //Near the edges of the band a window reads a few counts off: the brake output runs at
+    //running light duty, the chopped readings and the adc noise are scaled up by 255/duty
+    { 30          , eLIGHT_MODE_AUTO      , NO_SWAP     , eLIGHT_MODE_AUTO      , 0   , 0    },
+    //TOPO_SWITCH_WINDOWS windows. In integrated mode the brake output gets every fourth
+    //conversion, in separate mode every other one
+    { 0           , eLIGHT_MODE_INTEGRATED, LAMP_COUNTS , eLIGHT_MODE_SEPARATE  , 1500, 2500 },
+    { LAMP_COUNTS , eLIGHT_MODE_SEPARATE  , 0           , eLIGHT_MODE_INTEGRATED, 700 , 1300 },
+    //a lamp changed to one in the hysteresis band keeps the mode
+    { LAMP_COUNTS , eLIGHT_MODE_SEPARATE  , 30          , eLIGHT_MODE_SEPARATE  , 0   , 0    },
+    { LAMP_COUNTS , eLIGHT_MODE_SEPARATE  , 35          , eLIGHT_MODE_SEPARATE  , 0   , 0    },
+    { 0           , eLIGHT_MODE_INTEGRATED, 30          , eLIGHT_MODE_INTEGRATED, 0   , 0    },
+    { 0           , eLIGHT_MODE_INTEGRATED, 35          , eLIGHT_MODE_INTEGRATED, 0   , 0    },
+};
+
+int main(void)
+{
+    int failed = 0;
+
+    for (size_t idx = 0; idx < sizeof(arr_cases) / sizeof(arr_cases[0]); idx++)
+    {
+        failed += run_case(&arr_cases[idx]);
+    }
+
+    CHECK_EQ(failed, 0);
+    return check_done("test_topology");
+}
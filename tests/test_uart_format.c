@@ -0,0 +1,127 @@
+/*
+ * test_uart_format.c
+ * The subtract-and-count number formatters of avr_uart.c against the divide versions they
+ * replaced (uart_format_div.h), for every input. Raw and hex against printf. The host
+ * divides in hardware, the cycles on the AVR come from profile/bench_format under simavr.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "avr_uart.h"
+#include "uart_format_div.h"
+#include "check.h"
+
+/** compares two fixed width outputs, reports the first few mismatches */
+static int same(const char* what, long value, const char* got, const char* expected, size_t len)
+{
+    static int reported = 0;
+    
+    if (memcmp(got, expected, len) == 0)
+    {
+        return 1;
+    }
+    
+    if (reported++ < 10)
+    {
+        printf("%s(%ld): \"%.*s\", expected \"%.*s\"\n", what, value, (int)len, got, (int)len, expected);
+    }
+    return 0;
+}
+
+static void check_unsigned(void)
+{
+    char got[8];
+    char expected[8];
+    int mismatches = 0;
+    
+    for (uint32_t val = 0; val <= UINT16_MAX; val++)
+    {
+        convertUint16ToChar((uint16_t)val, got);
+        div_convertUint16ToChar((uint16_t)val, expected);
+        mismatches += !same("convertUint16ToChar", val, got, expected, STR_UINT16_LEN);
+    }
+    
+    for (uint32_t val = 0; val <= UINT8_MAX; val++)
+    {
+        convertUint8ToChar((uint8_t)val, got);
+        div_convertUint8ToChar((uint8_t)val, expected);
+        mismatches += !same("convertUint8ToChar", val, got, expected, STR_UINT8_LEN);
+    }
+    
+    CHECK_EQ(mismatches, 0);
+}
+
+/** the divide versions negated into the signed type, the minimum value overflowed there.
+ *  Those two inputs are checked against the right text instead
+ */
+static void check_signed(void)
+{
+    char got[8];
+    char expected[8];
+    int mismatches = 0;
+    
+    for (int32_t val = INT16_MIN; val <= INT16_MAX; val++)
+    {
+        convertInt16ToChar((int16_t)val, got);
+        if (val == INT16_MIN)
+        {
+            mismatches += !same("convertInt16ToChar", val, got, "-32,768", STR_INT16_LEN);
+            continue;
+        }
+        div_convertInt16ToChar((int16_t)val, expected);
+        mismatches += !same("convertInt16ToChar", val, got, expected, STR_INT16_LEN);
+    }
+    
+    for (int32_t val = INT8_MIN; val <= INT8_MAX; val++)
+    {
+        convertInt8ToChar((int8_t)val, got);
+        if (val == INT8_MIN)
+        {
+            mismatches += !same("convertInt8ToChar", val, got, "-128", STR_INT8_LEN);
+            continue;
+        }
+        div_convertInt8ToChar((int8_t)val, expected);
+        mismatches += !same("convertInt8ToChar", val, got, expected, STR_INT8_LEN);
+    }
+    
+    CHECK_EQ(mismatches, 0);
+}
+
+static void check_raw_hex(void)
+{
+    char got[8];
+    char expected[8];
+    int mismatches = 0;
+    
+    for (uint32_t val = 0; val <= UINT16_MAX; val++)
+    {
+        uint8_t len = convertUint16ToCharRaw((uint16_t)val, got);
+        
+        snprintf(expected, sizeof(expected), "%u", val);
+        mismatches += (len != strlen(expected)) || !same("convertUint16ToCharRaw", val, got, expected, len);
+        
+        convertUint16ToHex((uint16_t)val, got);
+        snprintf(expected, sizeof(expected), "%04X", val);
+        mismatches += !same("convertUint16ToHex", val, got, expected, STR_HEX16_LEN);
+        
+        if (val <= UINT8_MAX)
+        {
+            convertUint8ToHex((uint8_t)val, got);
+            snprintf(expected, sizeof(expected), "%02X", val);
+            mismatches += !same("convertUint8ToHex", val, got, expected, STR_HEX8_LEN);
+        }
+    }
+    
+    CHECK_EQ(mismatches, 0);
+}
+
+int main(void)
+{
+    check_unsigned();
+    check_signed();
+    check_raw_hex();
+    
+    return check_done("test_uart_format");
+}
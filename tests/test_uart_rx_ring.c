@@ -0,0 +1,305 @@
+/*
+ * test_uart_rx_ring.c
+ * The Rx ring of avr_uart.c with ISR(USART_RXC_vect) and the reader randomly interleaved,
+ * against a plain model of what should come out. The ISR is called directly with the byte
+ * in UDR, no simulator.
+ *
+ * The reader reads head once per call and writes tail once at its end, the ISR reads tail
+ * once. An ISR inside a reader call is the same as one right before it for the room it sees
+ * and the same as one right after it for the bytes the reader sees, so interleaving whole
+ * calls covers the orders that matter. Bursts of ISR calls with the reader slow or stopped
+ * fill the ring, wrap it and drop bytes; the lines are long enough to hit the full-ring
+ * handout too.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "avr_uart.h"
+#include "check.h"
+
+#define RING_MAX        (_UART_RX_BUFF_MAX_LEN - 1)     /// one slot stays empty
+#define STEPS           2000000UL
+
+//the vector is a plain function on the host (mock/avr/interrupt.h)
+void USART_RXC_vect(void);
+
+/** what the ring should hold, oldest byte first */
+static char model[RING_MAX];
+static int model_len = 0;
+static int model_skip_lf = 0;
+static int model_line_len = 0;      /// like rx_line_len, 0 - no line handed out
+static int model_text_len = 0;
+
+static uint32_t rand_state = 0x2545F491;
+
+//what the test got through, all must be > 0 for the test to mean something
+static unsigned long bytes_in = 0;
+static unsigned long bytes_dropped = 0;
+static unsigned long lines_read = 0;
+static unsigned long lines_wrapped = 0;
+static unsigned long full_handouts = 0;
+static unsigned long lf_merged = 0;
+static unsigned long lf_skipped = 0;
+
+static uint32_t rand_next(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static void model_pop(int count)
+{
+    memmove(model, model + count, model_len - count);
+    model_len -= count;
+}
+
+/** next byte of the stream: lines of 0 to ~150 chars ending in \r, \n or \r\n */
+static char next_byte(void)
+{
+    static int line_left = 0;
+    static int ending = 0;      /// 0 - in the text, 1 - '\r' sent and a '\n' follows
+    char data;
+
+    if (ending)
+    {
+        ending = 0;
+        return '\n';
+    }
+
+    if (line_left > 0)
+    {
+        line_left--;
+        return (char)('a' + (rand_next() % 26));
+    }
+
+    //end of the line, then pick the next one. Mostly short ones like shell commands
+    switch (rand_next() % 3)
+    {
+        case 0:     data = '\r';                    break;
+        case 1:     data = '\n';                    break;
+        default:    data = '\r';    ending = 1;     break;
+    }
+    line_left = ((rand_next() % 8) == 0) ? (int)(rand_next() % 150) : (int)(rand_next() % 20);
+
+    return data;
+}
+
+static void rx_byte(void)
+{
+    char data = next_byte();
+
+    UDR = (uint8_t)data;
+    USART_RXC_vect();
+    bytes_in++;
+
+    if (model_len < RING_MAX)
+    {
+        model[model_len++] = data;
+    }
+    else
+    {
+        bytes_dropped++;
+    }
+}
+
+/** the model of UART_PeekLine, @RETURN 1 if a line is waiting */
+static int model_peek(void)
+{
+    int idx;
+
+    if (model_line_len == 0)
+    {
+        if (model_skip_lf && model_len)
+        {
+            if (model[0] == '\n')
+            {
+                model_pop(1);
+                lf_skipped++;
+            }
+            model_skip_lf = 0;
+        }
+
+        for (idx = 0; idx < model_len; idx++)
+        {
+            if ((model[idx] == '\r') || (model[idx] == '\n'))
+            {
+                model_line_len = idx + 1;
+                model_text_len = idx;
+                break;
+            }
+        }
+
+        if ((model_line_len == 0) && (model_len == RING_MAX))
+        {
+            model_line_len = RING_MAX;
+            model_text_len = RING_MAX;
+            full_handouts++;
+        }
+    }
+
+    return (model_line_len != 0);
+}
+
+/** the model of UART_ReleaseLine, @RETURN 1 if it took the '\n' of a "\r\n" along */
+static int model_release(void)
+{
+    int merged = 0;
+
+    if (model_line_len)
+    {
+        char last = model[model_line_len - 1];
+
+        model_pop(model_line_len);
+        if (last == '\r')
+        {
+            if (model_len == 0)
+            {
+                model_skip_lf = 1;
+            }
+            else if (model[0] == '\n')
+            {
+                model_pop(1);
+                merged = 1;
+                lf_merged++;
+            }
+        }
+        model_line_len = 0;
+        model_text_len = 0;
+    }
+
+    return merged;
+}
+
+static void check_peek(unsigned long step)
+{
+    sUartLine line;
+    bool found = UART_PeekLine(&line);
+    int expected = model_peek();
+    int idx;
+
+    CHECK(found == expected, "step %lu: peek %d, expected %d", step, found, expected);
+    if (!found || !expected)
+    {
+        return;
+    }
+
+    CHECK(line.len1 + line.len2 == model_text_len, "step %lu: line of %d, expected %d",
+          step, line.len1 + line.len2, model_text_len);
+    lines_wrapped += (line.len2 != 0);
+
+    for (idx = 0; idx < model_text_len; idx++)
+    {
+        char got = (idx < line.len1) ? line.part1[idx] : line.part2[idx - line.len1];
+
+        if (got != model[idx] || UART_LineChar(&line, (uint8_t)idx) != model[idx])
+        {
+            CHECK(0, "step %lu: char %d of the line is 0x%02x, expected 0x%02x", step, idx, got, model[idx]);
+            break;
+        }
+    }
+    CHECK_EQ(UART_LineChar(&line, (uint8_t)model_text_len), 0);
+}
+
+static void check_release(void)
+{
+    UART_ReleaseLine();
+    lines_read += (model_line_len != 0);
+    model_release();
+}
+
+static void check_read_line(unsigned long step)
+{
+    char buf[_UART_RX_BUFF_MAX_LEN];
+    char expected[_UART_RX_BUFF_MAX_LEN];
+    uint8_t len;
+    int expected_len = 0;
+
+    UART_ReadLineRxBuff(buf, &len);
+
+    if (model_peek())
+    {
+        expected_len = model_line_len;
+        memcpy(expected, model, expected_len);
+        if (model_release())
+        {
+            expected[expected_len++] = '\n';
+        }
+        lines_read++;
+    }
+
+    CHECK(len == expected_len && memcmp(buf, expected, len) == 0,
+          "step %lu: read line \"%.*s\" (%u), expected \"%.*s\" (%d)",
+          step, len, buf, len, expected_len, expected, expected_len);
+}
+
+static void check_read_all(unsigned long step)
+{
+    char buf[_UART_RX_BUFF_MAX_LEN];
+    uint8_t len;
+
+    UART_ReadRxBuff(buf, &len);
+
+    CHECK(len == model_len && memcmp(buf, model, len) == 0,
+          "step %lu: read all %u bytes, expected %d", step, len, model_len);
+    model_len = 0;
+    model_skip_lf = 0;
+    model_line_len = 0;
+    model_text_len = 0;
+}
+
+int main(void)
+{
+    unsigned long step;
+    uint32_t burst_max = 4;
+
+    for (step = 0; (step < STEPS) && (check_failures < 10); step++)
+    {
+        uint32_t pick = rand_next() % 100;
+
+        //every 10000 steps the ISR gets a new burst length: a reader that keeps up or
+        //one that falls behind and lets the ring fill
+        if ((step % 10000) == 0)
+        {
+            burst_max = 1 + (rand_next() % 200);
+        }
+
+        if (pick < 50)
+        {
+            for (uint32_t n = 1 + (rand_next() % burst_max); n; n--)
+            {
+                rx_byte();
+            }
+        }
+        else if (pick < 70)
+        {
+            check_peek(step);
+        }
+        else if (pick < 85)
+        {
+            check_release();
+        }
+        else if (pick < 99)
+        {
+            check_read_line(step);
+        }
+        else
+        {
+            check_read_all(step);
+        }
+    }
+
+    printf("%lu bytes in, %lu dropped, %lu lines (%lu wrapped, %lu full ring), "
+           "\\r\\n merged %lu, \\n skipped later %lu\n",
+           bytes_in, bytes_dropped, lines_read, lines_wrapped, full_handouts, lf_merged, lf_skipped);
+    CHECK(bytes_dropped > 0, "the ring never overflowed");
+    CHECK(lines_wrapped > 0, "no line wrapped around the end of the ring");
+    CHECK(full_handouts > 0, "the full ring was never handed out");
+    CHECK(lf_merged > 0, "no \\r\\n merged by the release");
+    CHECK(lf_skipped > 0, "no \\n skipped after the release");
+
+    return check_done("test_uart_rx_ring");
+}
@@ -0,0 +1,270 @@
+/*
+ * uart_format_div.h
+ * The decimal formatters of avr_uart.c as they were before the subtract-and-count version,
+ * integer divides for every digit. Kept as the reference test_uart_format checks the new ones
+ * against, and for profile/bench_format to time both on the AVR.
+ *
+ */
+
+
+#ifndef UART_FORMAT_DIV_H_
+#define UART_FORMAT_DIV_H_
+
+#include <stdint.h>
+
+#ifndef ASCII_0
+#define ASCII_0         48
+#endif
+
+//not inlined, so the benchmark times a call like it does for avr_uart.c
+#define DIV_FORMAT      static __attribute__((noinline, unused))
+
+DIV_FORMAT void div_convertUint8ToChar(uint8_t in_val, char* output_3_chars)
+{
+    uint8_t ones;
+    uint8_t tens;
+    uint8_t hundreds;
+    uint8_t remainder;
+    
+    remainder = in_val;
+    
+    //now we integer divide, to isolate our digit of interest   
+    hundreds = remainder / 100;
+    remainder -= (hundreds * 100);
+    
+    tens = remainder / 10;
+    ones = remainder - (tens * 10);
+    
+    if (in_val >= 100)
+    {
+        output_3_chars[0] = (char)(ASCII_0 + hundreds);
+    }
+    else
+    {
+        output_3_chars[0] = ' ';
+    }
+    
+    if (in_val >= 10)
+    {
+        output_3_chars[1] = (char)(ASCII_0 + tens);
+    }
+    else
+    {
+        output_3_chars[1] = ' ';
+    }
+    
+    output_3_chars[2] = (char)(ASCII_0 + ones);
+}
+
+DIV_FORMAT void div_convertUint16ToChar(uint16_t in_val, char* output_6_chars)
+{
+    uint8_t ones;
+    uint8_t tens;
+    uint8_t hundreds;
+    uint16_t thousands;
+    uint16_t ten_thousands;
+    uint16_t remainder;
+    
+    remainder = in_val;
+    
+    //now we integer divide, to isolate our digit of interest
+    ten_thousands = remainder / 10000;
+    remainder -= (ten_thousands * 10000);
+    
+    thousands = remainder / 1000;
+    remainder -= (thousands * 1000);
+    
+    hundreds = remainder / 100;
+    remainder -= (hundreds * 100);
+    
+    tens = remainder / 10;
+    ones = remainder - (tens * 10);
+    
+    if (in_val >= 10000)
+    {
+        output_6_chars[0] = (char)(ASCII_0 + ten_thousands);
+    }
+    else
+    {
+        output_6_chars[0] = ' ';
+    }
+    
+    if (in_val >= 1000)
+    {
+        output_6_chars[1] = (char)(ASCII_0 + thousands);
+        output_6_chars[2] = ',';
+    }
+    else
+    {
+        output_6_chars[1] = ' ';
+        output_6_chars[2] = ' ';
+    }
+    
+    if (in_val >= 100)
+    {
+        output_6_chars[3] = (char)(ASCII_0 + hundreds);
+    }
+    else
+    {
+        output_6_chars[3] = ' ';
+    }
+    
+    if (in_val >= 10)
+    {
+        output_6_chars[4] = (char)(ASCII_0 + tens);
+    }
+    else
+    {
+        output_6_chars[4] = ' ';
+    }
+    
+    output_6_chars[5] = (char)(ASCII_0 + ones);
+}
+
+DIV_FORMAT void div_convertInt8ToChar(int8_t in_val, char* output_4_chars)
+{
+    uint8_t ones;
+    uint8_t tens;
+    uint8_t hundreds;
+    uint8_t remainder;
+    uint8_t is_neg;
+    
+    if (in_val < 0)
+    {
+        is_neg = 1;
+        in_val = -1 * in_val;
+    }
+    else
+    {
+        is_neg = 0;
+    }
+    
+    remainder = in_val;
+    
+    //now we integer divide, to isolate our digit of interest
+    hundreds = remainder / 100;
+    remainder -= (hundreds * 100);
+    
+    tens = remainder / 10;
+    ones = remainder - (tens * 10);
+    
+    //format
+    output_4_chars[3] = (char)(ASCII_0 + ones);
+    
+    if (in_val >= 10)
+    {
+        output_4_chars[2] = (char)(ASCII_0 + tens);
+    }
+    else
+    {
+        output_4_chars[2] = ' ';
+    }
+    
+    
+    if (in_val >= 100)
+    {
+        output_4_chars[1] = (char)(ASCII_0 + hundreds);
+    }
+    else
+    {
+        output_4_chars[1] = ' ';
+    }
+    
+    if(is_neg)
+    {
+        output_4_chars[0] = '-';
+    }
+    else
+    {
+        output_4_chars[0] = ' ';
+    }
+}
+
+DIV_FORMAT void div_convertInt16ToChar(int16_t in_val, char* output_7_chars)
+{
+    uint8_t ones;
+    uint8_t tens;
+    uint8_t hundreds;
+    uint16_t thousands;
+    uint16_t ten_thousands;
+    uint16_t remainder;
+    uint8_t is_neg;
+    
+    if (in_val < 0)
+    {
+        is_neg = 1;
+        in_val = -1 * in_val;
+    }
+    else
+    {
+        is_neg = 0;
+    }
+    
+    remainder = in_val;
+    
+    //now we integer divide, to isolate our digit of interest
+    ten_thousands = remainder / 10000;
+    remainder -= (ten_thousands * 10000);
+    
+    thousands = remainder / 1000;
+    remainder -= (thousands * 1000);
+    
+    hundreds = remainder / 100;
+    remainder -= (hundreds * 100);
+    
+    tens = remainder / 10;
+    ones = remainder - (tens * 10);
+    
+    //format
+    output_7_chars[6] = (char)(ASCII_0 + ones);
+    
+    if (in_val >= 10)
+    {
+        output_7_chars[5] = (char)(ASCII_0 + tens);
+    }
+    else
+    {
+        output_7_chars[5] = ' ';
+    }
+    
+    if (in_val >= 100)
+    {
+        output_7_chars[4] = (char)(ASCII_0 + hundreds);
+    }
+    else
+    {
+        output_7_chars[4] = ' ';
+    }
+    
+    if (in_val >= 1000)
+    {
+        output_7_chars[2] = (char)(ASCII_0 + thousands);
+        output_7_chars[3] = ',';
+    }
+    else
+    {
+        output_7_chars[2] = ' ';
+        output_7_chars[3] = ' ';
+    }
+    
+    if (in_val >= 10000)
+    {
+        output_7_chars[1] = (char)(ASCII_0 + ten_thousands);
+    }
+    else
+    {
+        output_7_chars[1] = ' ';
+    }
+    
+    if(is_neg)
+    {
+        output_7_chars[0] = '-';
+        is_neg = 0;
+    }
+    else
+    {
+        output_7_chars[0] = ' ';
+    }
+}
+
+#endif /* UART_FORMAT_DIV_H_ */
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Prints the black box record of the trunk light controller.
+
+Send "bbox" on the shell while capturing, the record saved in EEPROM comes back in
+telemetry frames (see telemetry_to_csv.py) whose payload is 0xF1, the byte offset in the
+record and the record bytes from there. The record is sBlackBox in blackbox.h: the cause
+of the save, then the event ring oldest first. Event times restart at 0 after every
+reset event.
+
+usage:
+    blackbox_decode.py capture.bin
+    blackbox_decode.py /dev/ttyUSB0     # serial port (needs pyserial), stops at the record end
+"""
+
+import argparse
+import struct
+import sys
+
+from telemetry_to_csv import crc16, frames, open_input
+
+BLACKBOX_FRAME_ID = 0xF1
+BLACKBOX_VERSION = 1
+BLACKBOX_MAGIC = 0xB10C
+NUM_EVENTS = 16
+# magic, version, cause, head, count
+HEADER = struct.Struct('<HBBBB')
+# time_ms, type, channel, value
+EVENT = struct.Struct('<IBBH')
+RECORD_LEN = HEADER.size + NUM_EVENTS * EVENT.size + 2
+
+CAUSES = ('none', 'overcurrent trip', 'watchdog reset')
+CHANNELS = ('left', 'brake', 'right')
+RESET_FLAGS = ((0x01, 'power on'), (0x02, 'external'), (0x04, 'brown out'), (0x08, 'watchdog'))
+
+
+def describe(event_type, channel, value):
+    channel_name = CHANNELS[channel] if channel < len(CHANNELS) else str(channel)
+    if event_type == 1:
+        flags = [name for bit, name in RESET_FLAGS if value & bit]
+        return 'reset (%s)' % (', '.join(flags) or 'no flags')
+    if event_type in (2, 3, 4):
+        return '%s %s' % (('brake', 'left', 'right')[event_type - 2], 'on' if value else 'off')
+    if event_type == 5:
+        return 'overcurrent trip %s reading %d' % (channel_name, value)
+    if event_type == 6:
+        return 'peak %s reading %d' % (channel_name, value)
+    if event_type == 7:
+        return 'lamp %s %s' % (channel_name, 'out' if value else 'back')
+    return 'unknown event %d channel %d value %d' % (event_type, channel, value)
+
+
+def print_record(record):
+    magic, version, cause, head, count = HEADER.unpack_from(record)
+    crc, = struct.unpack_from('<H', record, RECORD_LEN - 2)
+    if magic != BLACKBOX_MAGIC or version != BLACKBOX_VERSION:
+        print('no record saved (magic %04x version %d)' % (magic, version))
+        return False
+    if crc != crc16(record[:RECORD_LEN - 2]):
+        print('bad crc, the save was cut short')
+        return False
+
+    print('saved on %s, %d events' % (CAUSES[cause] if cause < len(CAUSES) else cause, count))
+    first = (head - count) % NUM_EVENTS
+    for idx in range(count):
+        offset = HEADER.size + ((first + idx) % NUM_EVENTS) * EVENT.size
+        time_ms, event_type, channel, value = EVENT.unpack_from(record, offset)
+        print('%10d ms  %s' % (time_ms, describe(event_type, channel, value)))
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help="capture file, serial port or - for stdin")
+    parser.add_argument('-b', '--baud', type=int, default=1000000, help="serial baud rate")
+    args = parser.parse_args()
+
+    record = bytearray(RECORD_LEN)
+    have = set()
+    try:
+        for payload in frames(open_input(args.input, args.baud)):
+            if payload is None or len(payload) < 3 or payload[0] != BLACKBOX_FRAME_ID:
+                continue
+            offset, data = payload[1], payload[2:]
+            if offset == 0:
+                have.clear()    # a new dump, or the save restarted it
+            record[offset:offset + len(data)] = data
+            have.update(range(offset, offset + len(data)))
+            if len(have) >= RECORD_LEN:
+                print_record(bytes(record[:RECORD_LEN]))
+                return
+    except KeyboardInterrupt:
+        pass
+
+    sys.stderr.write('incomplete record, %d of %d bytes\n' % (len(have), RECORD_LEN))
+    sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Formats the binary event log of the trunk light controller.
+
+Log records come in telemetry frames (see telemetry_to_csv.py) whose payload is 0xF0, a
+frame sequence number and whole records. A record is a header byte (message id in the low
+6 bits, argument length code in the top 2) followed by the raw little endian arguments.
+The text of every message is read from the .logstr section of the firmware ELF, so give
+the ELF of the firmware the unit runs.
+
+usage:
+    log_decode.py TrunkLightCircuit.elf capture.bin
+    log_decode.py TrunkLightCircuit.elf /dev/ttyUSB0     # serial port (needs pyserial)
+    log_decode.py TrunkLightCircuit.elf --modules        # module numbers for the shell "log"
+"""
+
+import argparse
+import struct
+import sys
+
+from telemetry_to_csv import frames, open_input
+
+LOG_FRAME_ID = 0xF0
+LOGSTR_VERSION = b'logstr1'
+ARG_LEN = (0, 1, 2, 4)
+ARG_FORMAT = {'NONE': '', 'U8': 'B', 'U16': 'H', 'I16': 'h', 'U16X2': 'HH'}
+
+
+def elf_section(path, wanted):
+    """returns the contents of a section of a little endian ELF32/ELF64 file"""
+    with open(path, 'rb') as elf:
+        data = elf.read()
+    if data[:4] != b'\x7fELF' or data[5] != 1:
+        raise ValueError('%s is not a little endian ELF file' % path)
+    if data[4] == 1:
+        shoff, = struct.unpack_from('<I', data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x2E)
+        section = struct.Struct('<IIIIIIIIII')
+    else:
+        shoff, = struct.unpack_from('<Q', data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x3A)
+        section = struct.Struct('<IIQQQQIIQQ')
+    headers = [section.unpack_from(data, shoff + idx * shentsize) for idx in range(shnum)]
+    names_offset = headers[shstrndx][4]
+    for header in headers:
+        name_start = names_offset + header[0]
+        name = data[name_start:data.index(b'\0', name_start)].decode()
+        if name == wanted:
+            return data[header[4]:header[4] + header[5]]
+    raise ValueError('%s has no %s section' % (path, wanted))
+
+
+def load_messages(path):
+    """@return (module names, list of (name, module, level, args, text) in id order)"""
+    strings = elf_section(path, '.logstr').split(b'\0')
+    if strings[0] != LOGSTR_VERSION:
+        raise ValueError('unknown .logstr version %r' % strings[0])
+    end = strings.index(b'', 1)
+    modules = [name.decode() for name in strings[1:end]]
+    fields = [field.decode() for field in strings[end + 1:]]
+    messages = [tuple(fields[idx:idx + 5]) for idx in range(0, len(fields) - 4, 5)]
+    return modules, messages
+
+
+def records(payload, messages):
+    """yields the formatted records of one log frame payload (sequence byte stripped)"""
+    idx = 0
+    while idx < len(payload):
+        header = payload[idx]
+        msg_id, arg_len = header & 0x3F, ARG_LEN[header >> 6]
+        raw = payload[idx + 1:idx + 1 + arg_len]
+        idx += 1 + arg_len
+        if msg_id >= len(messages):
+            yield '?', '?', 'unknown message %d args %s' % (msg_id, raw.hex())
+            continue
+        name, module, level, args, text = messages[msg_id]
+        fmt = '<' + ARG_FORMAT.get(args, '')
+        if struct.calcsize(fmt) != len(raw):
+            yield module, level, '%s args %s (ELF doesn\'t match the firmware?)' % (name, raw.hex())
+            continue
+        yield module, level, text.format(*struct.unpack(fmt, raw))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('elf', help="firmware ELF with the .logstr section")
+    parser.add_argument('input', nargs='?', help="capture file, serial port or - for stdin")
+    parser.add_argument('-b', '--baud', type=int, default=1000000, help="serial baud rate")
+    parser.add_argument('--modules', action='store_true', help="list the module numbers")
+    args = parser.parse_args()
+
+    modules, messages = load_messages(args.elf)
+    if args.modules or args.input is None:
+        for number, name in enumerate(modules):
+            print(number, name)
+        return
+
+    last_seq = None
+    lost = 0
+    try:
+        for payload in frames(open_input(args.input, args.baud)):
+            if payload is None or len(payload) < 2 or payload[0] != LOG_FRAME_ID:
+                continue    # telemetry, or a frame that didn't make it
+            seq = payload[1]
+            if last_seq is not None and seq != (last_seq + 1) & 0xFF:
+                gap = (seq - last_seq - 1) & 0xFF
+                lost += gap
+                print('-- %d log frames lost --' % gap)
+            last_seq = seq
+            for module, level, text in records(payload[2:], messages):
+                print('%3d %-6s %-5s %s' % (seq, module, level, text))
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+
+    sys.stderr.write('%d log frames lost\n' % lost)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Decodes the binary telemetry stream of the trunk light controller into CSV.
+
+Frames are COBS encoded with a 0x00 delimiter before and after, the decoded frame is the
+payload followed by a little endian CRC-16/MODBUS (avr-libc _crc16_update, init 0xFFFF).
+Anything between delimiters that doesn't decode or fails the CRC (ASCII debug output,
+a frame cut short at start up) is counted and skipped.
+
+usage:
+    telemetry_to_csv.py capture.bin -o log.csv          # raw capture file
+    telemetry_to_csv.py /dev/ttyUSB0 -o log.csv         # serial port (needs pyserial)
+    telemetry_to_csv.py - < capture.bin                 # stdin, CSV to stdout
+"""
+
+import argparse
+import struct
+import sys
+
+FRAME_VERSION = 2
+LOG_FRAME_ID = 0xF0     # event log frames share the link, log_decode.py reads them
+BLACKBOX_FRAME_ID = 0xF1    # black box dumps, blackbox_decode.py reads them
+# version, sequence, uptime_ms, current[3], pot[2], flags, lamp_out (see telemetry.h)
+FRAME = struct.Struct('<BBIHHHHHBB')
+
+FLAGS = (
+    (0x01, 'brake'),
+    (0x02, 'left'),
+    (0x04, 'right'),
+    (0x08, 'integrated'),
+    (0x10, 'fault_left'),
+    (0x20, 'fault_brake'),
+    (0x40, 'fault_right'),
+    (0x80, 'pot_lockout'),
+)
+
+# lamp_out bits, ARR_IDX_xxx
+LAMP_OUT = (
+    (0x01, 'lamp_out_left'),
+    (0x02, 'lamp_out_brake'),
+    (0x04, 'lamp_out_right'),
+)
+
+HEADER = (['uptime_ms', 'sequence', 'dropped',
+           'current_left', 'current_brake', 'current_right',
+           'pot_speed', 'pot_pattern'] + [name for _, name in FLAGS]
+          + [name for _, name in LAMP_OUT])
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    idx = 0
+    while idx < len(data):
+        code = data[idx]
+        if code == 0 or idx + code > len(data):
+            return None
+        out += data[idx + 1:idx + code]
+        idx += code
+        if code < 0xFF and idx < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def frames(stream):
+    """yields decoded, CRC checked payloads, or None for every bad frame"""
+    buff = bytearray()
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            break
+        buff += chunk
+        while True:
+            end = buff.find(b'\x00')
+            if end < 0:
+                break
+            raw = bytes(buff[:end])
+            del buff[:end + 1]
+            if not raw:
+                continue    # back to back delimiters
+            decoded = cobs_decode(raw)
+            if decoded is None or len(decoded) < 3:
+                yield None
+                continue
+            payload, crc = decoded[:-2], struct.unpack('<H', decoded[-2:])[0]
+            yield payload if crc16(payload) == crc else None
+
+
+def open_input(path, baud):
+    if path == '-':
+        return sys.stdin.buffer
+    if path.startswith('/dev/') or path.upper().startswith('COM'):
+        import serial   # pyserial, only needed for live capture
+        return serial.Serial(path, baud, timeout=1)
+    return open(path, 'rb')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help="capture file, serial port or - for stdin")
+    parser.add_argument('-o', '--output', help="CSV file, stdout if not given")
+    parser.add_argument('-b', '--baud', type=int, default=1000000, help="serial baud rate")
+    args = parser.parse_args()
+
+    out = open(args.output, 'w', newline='') if args.output else sys.stdout
+    out.write(','.join(HEADER) + '\n')
+
+    good = bad = dropped_total = 0
+    last_seq = None
+    try:
+        for payload in frames(open_input(args.input, args.baud)):
+            if payload and payload[0] in (LOG_FRAME_ID, BLACKBOX_FRAME_ID):
+                continue
+            if payload is None or len(payload) != FRAME.size or payload[0] != FRAME_VERSION:
+                bad += 1
+                continue
+            (_, seq, uptime, cur_l, cur_b, cur_r, pot_speed, pot_pattern,
+             flags, lamp_out) = FRAME.unpack(payload)
+            dropped = 0 if last_seq is None else (seq - last_seq - 1) & 0xFF
+            last_seq = seq
+            dropped_total += dropped
+            good += 1
+            row = [uptime, seq, dropped, cur_l, cur_b, cur_r, pot_speed, pot_pattern]
+            row += [1 if flags & mask else 0 for mask, _ in FLAGS]
+            row += [1 if lamp_out & mask else 0 for mask, _ in LAMP_OUT]
+            out.write(','.join(str(val) for val in row) + '\n')
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if out is not sys.stdout:
+            out.close()
+
+    sys.stderr.write('%d frames, %d bad, %d dropped by the controller\n'
+                     % (good, bad, dropped_total))
+
+
+if __name__ == '__main__':
+    main()